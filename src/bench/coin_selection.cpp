@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <bench/bench.h>
+#include <wallet/coinselection.h>
 #include <wallet/wallet.h>
 
 #include <set>
@@ -57,3 +58,56 @@ static void CoinSelection(benchmark::State& state)
 }
 
 BENCHMARK(CoinSelection, 650);
+
+static void addCoin(const CAmount& nValue, std::vector<CInputCoin>& vCoins)
+{
+    static uint32_t nextIndex = 0;
+    vCoins.emplace_back(COutPoint(uint256(), nextIndex++), CTxOut(nValue, CScript()));
+}
+
+// Worst case for the branch and bound search: the only solution is found
+// after the iteration limit, so the whole search runs and fails.
+static CAmount makeHardCase(int nPairs, std::vector<CInputCoin>& vCoins)
+{
+    vCoins.clear();
+    CAmount nTarget = 0;
+    for (int i = 0; i < nPairs; i++) {
+        nTarget += (CAmount)1 << (nPairs + i);
+        addCoin((CAmount)1 << (nPairs + i), vCoins);
+        addCoin(((CAmount)1 << (nPairs + i)) + ((CAmount)1 << (nPairs - 1 - i)), vCoins);
+    }
+    return nTarget;
+}
+
+static void BnBExhaustion(benchmark::State& state)
+{
+    std::vector<CInputCoin> vCoins;
+    std::set<CInputCoin> setCoinsRet;
+    CAmount nValueRet;
+
+    while (state.KeepRunning()) {
+        CAmount nTarget = makeHardCase(17, vCoins);
+        bool success = SelectCoinsBnB(vCoins, nTarget, 0, setCoinsRet, nValueRet, 0);
+        assert(!success);
+    }
+}
+
+// Changeless selection from a large wallet, as for a hot wallet sending
+// from 100k outputs between 0.001 and 0.1 BTC.
+static void BnBLargeWallet(benchmark::State& state)
+{
+    std::vector<CInputCoin> vCoinsInit;
+    for (int i = 0; i < 100000; i++)
+        addCoin(100000 + (i * 7919) % 9901 * 1000, vCoinsInit);
+    std::set<CInputCoin> setCoinsRet;
+    CAmount nValueRet;
+
+    while (state.KeepRunning()) {
+        std::vector<CInputCoin> vCoins(vCoinsInit);
+        bool success = SelectCoinsBnB(vCoins, COIN / 2 - 2000, 5000, setCoinsRet, nValueRet, 2000);
+        assert(success);
+    }
+}
+
+BENCHMARK(BnBExhaustion, 650);
+BENCHMARK(BnBLargeWallet, 20);
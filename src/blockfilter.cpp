@@ -0,0 +1,280 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfilter.h>
+
+#include <coins.h>
+#include <crypto/common.h>
+#include <hash.h>
+#include <primitives/block.h>
+#include <script/script.h>
+#include <streams.h>
+#include <undo.h>
+#include <version.h>
+
+#include <algorithm>
+#include <ios>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+/** Writes single bits to a byte vector, most significant bit first */
+class BitWriter
+{
+private:
+    std::vector<unsigned char>& vData;
+    unsigned char nBuffer;
+    int nBits; //!< Number of bits in nBuffer
+
+public:
+    explicit BitWriter(std::vector<unsigned char>& vDataIn) : vData(vDataIn), nBuffer(0), nBits(0) {}
+
+    /** Write the nCount low bits of nValue */
+    void Write(uint64_t nValue, int nCount)
+    {
+        while (nCount > 0) {
+            const int nTake = std::min(nCount, 8 - nBits);
+            const unsigned char bits = (nValue >> (nCount - nTake)) & ((1U << nTake) - 1);
+            nBuffer |= bits << (8 - nBits - nTake);
+            nBits += nTake;
+            nCount -= nTake;
+            if (nBits == 8)
+                Flush();
+        }
+    }
+
+    /** Write out a partially filled byte, padded with zero bits */
+    void Flush()
+    {
+        if (nBits == 0)
+            return;
+        vData.push_back(nBuffer);
+        nBuffer = 0;
+        nBits = 0;
+    }
+};
+
+/** Reads single bits from a byte range, most significant bit first */
+class BitReader
+{
+private:
+    const unsigned char* pData;
+    const unsigned char* pEnd;
+    int nBits; //!< Number of unread bits in *pData
+
+public:
+    BitReader(const unsigned char* pBegin, const unsigned char* pEndIn) : pData(pBegin), pEnd(pEndIn), nBits(8) {}
+
+    /** Read nCount bits into the low bits of nValue. Returns false if the
+     * data runs out. */
+    bool Read(int nCount, uint64_t& nValue)
+    {
+        nValue = 0;
+        while (nCount > 0) {
+            if (pData == pEnd)
+                return false;
+            const int nTake = std::min(nCount, nBits);
+            const uint64_t bits = (*pData >> (nBits - nTake)) & ((1U << nTake) - 1);
+            nValue = (nValue << nTake) | bits;
+            nBits -= nTake;
+            nCount -= nTake;
+            if (nBits == 0) {
+                pData++;
+                nBits = 8;
+            }
+        }
+        return true;
+    }
+};
+
+void GolombRiceEncode(BitWriter& writer, uint8_t P, uint64_t x)
+{
+    // Unary coded quotient followed by the P bit remainder
+    uint64_t q = x >> P;
+    while (q > 0) {
+        const int nBits = q <= 64 ? static_cast<int>(q) : 64;
+        writer.Write(~0ULL, nBits);
+        q -= nBits;
+    }
+    writer.Write(0, 1);
+    writer.Write(x, P);
+}
+
+bool GolombRiceDecode(BitReader& reader, uint8_t P, uint64_t& x)
+{
+    uint64_t q = 0;
+    uint64_t bit;
+    while (true) {
+        if (!reader.Read(1, bit))
+            return false;
+        if (!bit)
+            break;
+        q++;
+    }
+    uint64_t r;
+    if (!reader.Read(P, r))
+        return false;
+    x = (q << P) + r;
+    return true;
+}
+
+/** Map x uniformly into [0, n) with a multiply and shift instead of a
+ * division, as specified by BIP 158 */
+uint64_t MapIntoRange(uint64_t x, uint64_t n)
+{
+#ifdef __SIZEOF_INT128__
+    return static_cast<uint64_t>((static_cast<unsigned __int128>(x) * static_cast<unsigned __int128>(n)) >> 64);
+#else
+    const uint64_t x_hi = x >> 32;
+    const uint64_t x_lo = x & 0xFFFFFFFF;
+    const uint64_t n_hi = n >> 32;
+    const uint64_t n_lo = n & 0xFFFFFFFF;
+
+    const uint64_t ac = x_hi * n_hi;
+    const uint64_t ad = x_hi * n_lo;
+    const uint64_t bc = x_lo * n_hi;
+    const uint64_t bd = x_lo * n_lo;
+
+    const uint64_t mid34 = (bd >> 32) + (bc & 0xFFFFFFFF) + (ad & 0xFFFFFFFF);
+    return ac + (bc >> 32) + (ad >> 32) + (mid34 >> 32);
+#endif
+}
+
+} // namespace
+
+GCSFilter::GCSFilter(uint64_t siphash_k0, uint64_t siphash_k1)
+    : m_siphash_k0(siphash_k0), m_siphash_k1(siphash_k1), m_N(0), m_F(0), m_nDataOffset(1), m_encoded{0}
+{}
+
+GCSFilter::GCSFilter(uint64_t siphash_k0, uint64_t siphash_k1, std::vector<unsigned char> encoded_filter)
+    : m_siphash_k0(siphash_k0), m_siphash_k1(siphash_k1), m_encoded(std::move(encoded_filter))
+{
+    // The element count is a CompactSize of at most 9 bytes
+    const char* pBegin = reinterpret_cast<const char*>(m_encoded.data());
+    CDataStream ss(pBegin, pBegin + std::min<size_t>(m_encoded.size(), 9), SER_NETWORK, PROTOCOL_VERSION);
+    const uint64_t N = ReadCompactSize(ss);
+    if (N > std::numeric_limits<uint32_t>::max())
+        throw std::ios_base::failure("N must be <2^32");
+    m_N = static_cast<uint32_t>(N);
+    m_F = static_cast<uint64_t>(m_N) * BASIC_FILTER_M;
+    m_nDataOffset = GetSizeOfCompactSize(N);
+}
+
+GCSFilter::GCSFilter(uint64_t siphash_k0, uint64_t siphash_k1, const ElementSet& elements)
+    : m_siphash_k0(siphash_k0), m_siphash_k1(siphash_k1)
+{
+    const size_t N = elements.size();
+    if (N > std::numeric_limits<uint32_t>::max())
+        throw std::invalid_argument("N must be <2^32");
+    m_N = static_cast<uint32_t>(N);
+    m_F = static_cast<uint64_t>(m_N) * BASIC_FILTER_M;
+
+    CVectorWriter(SER_NETWORK, PROTOCOL_VERSION, m_encoded, 0) << COMPACTSIZE(static_cast<uint64_t>(m_N));
+    m_nDataOffset = m_encoded.size();
+
+    std::vector<uint64_t> vHash;
+    vHash.reserve(N);
+    for (const Element& element : elements)
+        vHash.push_back(HashToRange(element));
+    std::sort(vHash.begin(), vHash.end());
+
+    BitWriter writer(m_encoded);
+    uint64_t nLast = 0;
+    for (uint64_t nHash : vHash) {
+        GolombRiceEncode(writer, BASIC_FILTER_P, nHash - nLast);
+        nLast = nHash;
+    }
+    writer.Flush();
+}
+
+uint64_t GCSFilter::HashToRange(const Element& element) const
+{
+    const uint64_t hash = CSipHasher(m_siphash_k0, m_siphash_k1)
+        .Write(element.data(), element.size())
+        .Finalize();
+    return MapIntoRange(hash, m_F);
+}
+
+bool GCSFilter::MatchInternal(const uint64_t* element_hashes, size_t size) const
+{
+    BitReader reader(m_encoded.data() + m_nDataOffset, m_encoded.data() + m_encoded.size());
+
+    // Walk the sorted filter values and the sorted query values in step
+    uint64_t nValue = 0;
+    size_t nQuery = 0;
+    for (uint32_t i = 0; i < m_N && nQuery < size; i++) {
+        uint64_t nDelta;
+        if (!GolombRiceDecode(reader, BASIC_FILTER_P, nDelta))
+            return true; // Corrupt filter, don't rule anything out
+        nValue += nDelta;
+
+        while (nQuery < size && element_hashes[nQuery] < nValue)
+            nQuery++;
+        if (nQuery < size && element_hashes[nQuery] == nValue)
+            return true;
+    }
+    return false;
+}
+
+bool GCSFilter::Match(const Element& element) const
+{
+    if (m_N == 0)
+        return false;
+    const uint64_t nHash = HashToRange(element);
+    return MatchInternal(&nHash, 1);
+}
+
+bool GCSFilter::MatchAny(const ElementSet& elements) const
+{
+    if (m_N == 0 || elements.empty())
+        return false;
+
+    std::vector<uint64_t> vHash;
+    vHash.reserve(elements.size());
+    for (const Element& element : elements)
+        vHash.push_back(HashToRange(element));
+    std::sort(vHash.begin(), vHash.end());
+    return MatchInternal(vHash.data(), vHash.size());
+}
+
+static GCSFilter::ElementSet BasicFilterElements(const CBlock& block, const CBlockUndo& block_undo)
+{
+    GCSFilter::ElementSet elements;
+
+    for (const CTransactionRef& tx : block.vtx) {
+        for (const CTxOut& txout : tx->vout) {
+            const CScript& script = txout.scriptPubKey;
+            if (script.empty() || script[0] == OP_RETURN)
+                continue;
+            elements.emplace(script.begin(), script.end());
+        }
+    }
+
+    for (const CTxUndo& txundo : block_undo.vtxundo) {
+        for (const Coin& prevout : txundo.vprevout) {
+            const CScript& script = prevout.out.scriptPubKey;
+            if (script.empty())
+                continue;
+            elements.emplace(script.begin(), script.end());
+        }
+    }
+
+    return elements;
+}
+
+BlockFilter::BlockFilter(const CBlock& block, const CBlockUndo& block_undo)
+    : m_block_hash(block.GetHash()),
+      m_filter(GetSipHashKey0(), GetSipHashKey1(), BasicFilterElements(block, block_undo))
+{}
+
+uint64_t BlockFilter::GetSipHashKey0() const
+{
+    return ReadLE64(m_block_hash.begin());
+}
+
+uint64_t BlockFilter::GetSipHashKey1() const
+{
+    return ReadLE64(m_block_hash.begin() + 8);
+}
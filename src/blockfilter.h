@@ -0,0 +1,110 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILTER_H
+#define BITCOIN_BLOCKFILTER_H
+
+#include <serialize.h>
+#include <uint256.h>
+
+#include <set>
+#include <stdint.h>
+#include <vector>
+
+class CBlock;
+class CBlockUndo;
+
+//! Golomb-Rice parameter of the basic block filter (BIP 158)
+static const uint8_t BASIC_FILTER_P = 19;
+//! Inverse false positive rate of the basic block filter (BIP 158)
+static const uint32_t BASIC_FILTER_M = 784931;
+
+/**
+ * Golomb-coded set filter as defined in BIP 158.
+ *
+ * Elements are hashed with SipHash into the range [0, N * M), sorted, and the
+ * differences between successive values are Golomb-Rice coded with parameter
+ * P. The encoding is prefixed with N as a CompactSize. Membership queries
+ * have no false negatives and a false positive rate of about 1 / M.
+ */
+class GCSFilter
+{
+public:
+    typedef std::vector<unsigned char> Element;
+    typedef std::set<Element> ElementSet;
+
+    /** Construct an empty filter */
+    GCSFilter(uint64_t siphash_k0 = 0, uint64_t siphash_k1 = 0);
+
+    /** Reconstruct a filter from its encoding. Throws std::ios_base::failure
+     * if the encoding does not start with a valid element count. */
+    GCSFilter(uint64_t siphash_k0, uint64_t siphash_k1, std::vector<unsigned char> encoded_filter);
+
+    /** Build a filter containing elements */
+    GCSFilter(uint64_t siphash_k0, uint64_t siphash_k1, const ElementSet& elements);
+
+    uint32_t GetN() const { return m_N; }
+    const std::vector<unsigned char>& GetEncoded() const { return m_encoded; }
+
+    /** Whether element may be in the set. False positives are possible. */
+    bool Match(const Element& element) const;
+
+    /** Whether any of the elements may be in the set. This decodes the filter
+     * once, so it is much faster than calling Match for every element. */
+    bool MatchAny(const ElementSet& elements) const;
+
+private:
+    uint64_t m_siphash_k0;
+    uint64_t m_siphash_k1;
+    uint32_t m_N;   //!< Number of elements in the filter
+    uint64_t m_F;   //!< Range of element hashes, N * M
+    size_t m_nDataOffset; //!< Size of the element count prefix of m_encoded
+    std::vector<unsigned char> m_encoded;
+
+    /** Hash an element into the range [0, F) */
+    uint64_t HashToRange(const Element& element) const;
+
+    /** Whether any of the sorted hashed elements are in the filter */
+    bool MatchInternal(const uint64_t* element_hashes, size_t size) const;
+};
+
+/**
+ * Basic block filter (BIP 158) of a block. It contains the scriptPubKeys of
+ * all outputs of the block, except for empty and OP_RETURN scripts, and the
+ * scriptPubKeys of all coins the block spent, including loaded coins. The
+ * SipHash key is taken from the block hash.
+ */
+class BlockFilter
+{
+public:
+    BlockFilter() = default;
+    BlockFilter(const CBlock& block, const CBlockUndo& block_undo);
+
+    const uint256& GetBlockHash() const { return m_block_hash; }
+    const GCSFilter& GetFilter() const { return m_filter; }
+    const std::vector<unsigned char>& GetEncodedFilter() const { return m_filter.GetEncoded(); }
+
+    template <typename Stream>
+    void Serialize(Stream& s) const
+    {
+        s << m_block_hash << m_filter.GetEncoded();
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s)
+    {
+        std::vector<unsigned char> encoded_filter;
+        s >> m_block_hash >> encoded_filter;
+        m_filter = GCSFilter(GetSipHashKey0(), GetSipHashKey1(), std::move(encoded_filter));
+    }
+
+private:
+    uint256 m_block_hash;
+    GCSFilter m_filter;
+
+    uint64_t GetSipHashKey0() const;
+    uint64_t GetSipHashKey1() const;
+};
+
+#endif // BITCOIN_BLOCKFILTER_H
@@ -8,6 +8,9 @@
 #include <sync.h>
 
 #include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
 #include <vector>
 
 #include <boost/thread/condition_variable.hpp>
@@ -16,6 +19,9 @@
 template <typename T>
 class CCheckQueueControl;
 
+/** Maximum number of per-worker queues (including the master's) */
+static const unsigned int MAX_CHECKQUEUE_WORKERS = 64;
+
 /** 
  * Queue for verifications that have to be performed.
   * The verifications are represented by a type T, which must provide an
@@ -25,13 +31,36 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Every worker owns a deque of verifications. The master hands out the
+  * batches it is given round robin over those deques. A worker takes work
+  * from the back of its own deque, and when that is empty it steals from
+  * the front of the other workers' deques. Only the deques are locked, the
+  * completion counter and the evaluation result are atomics, and the shared
+  * mutex is only used to put idle threads to sleep and wake them up.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
-    boost::mutex mutex;
+    //! The verifications queued for a single worker
+    struct WorkerQueue
+    {
+        boost::mutex mutex;
+        std::deque<T> queue;
+    };
+
+    //! Per-worker queues, slot 0 belongs to the master
+    std::vector<std::unique_ptr<WorkerQueue>> vWorkerQueue;
+
+    //! The number of worker threads (excluding the master) that registered.
+    std::atomic<unsigned int> nWorkers;
+
+    //! Round robin position used by the master to distribute batches.
+    unsigned int nNextQueue;
+
+    //! Mutex to put idle threads to sleep, and to wake them up again
+    boost::mutex mutexIdle;
 
     //! Worker threads block on this when out of work
     boost::condition_variable condWorker;
@@ -39,87 +68,116 @@ private:
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
-
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
-
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! The number of worker threads that are (about to go) asleep.
+    std::atomic<int> nIdle;
 
-    //! The temporary evaluation result.
-    bool fAllOk;
+    //! The number of verifications sitting in the worker queues.
+    std::atomic<unsigned int> nQueued;
 
     /**
      * Number of verifications that haven't completed yet.
      * This includes elements that are no longer queued, but still in the
      * worker's own batches.
      */
-    unsigned int nTodo;
+    std::atomic<unsigned int> nTodo;
+
+    //! The temporary evaluation result.
+    std::atomic<bool> fAllOk;
 
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    /** Number of worker queues that are in use */
+    unsigned int ActiveQueues() const
+    {
+        return std::min<unsigned int>(nWorkers.load() + 1, vWorkerQueue.size());
+    }
+
+    /** Take a batch of verifications from the back of our own queue */
+    bool Pop(unsigned int nSelf, std::vector<T>& vChecks)
+    {
+        WorkerQueue& worker = *vWorkerQueue[nSelf];
+        boost::unique_lock<boost::mutex> lock(worker.mutex);
+        if (worker.queue.empty())
+            return false;
+        // Leave half of the queue behind for thieves
+        size_t nNow = std::max<size_t>(1, std::min<size_t>(nBatchSize, worker.queue.size() / 2));
+        vChecks.resize(nNow);
+        for (size_t i = 0; i < nNow; i++) {
+            vChecks[i].swap(worker.queue.back());
+            worker.queue.pop_back();
+        }
+        nQueued.fetch_sub(nNow);
+        return true;
+    }
+
+    /** Steal a batch of verifications from the front of another queue */
+    bool Steal(unsigned int nSelf, std::vector<T>& vChecks)
+    {
+        unsigned int nQueues = ActiveQueues();
+        for (unsigned int n = 1; n <= nQueues; n++) {
+            WorkerQueue& victim = *vWorkerQueue[(nSelf + n) % nQueues];
+            boost::unique_lock<boost::mutex> lock(victim.mutex);
+            if (victim.queue.empty())
+                continue;
+            size_t nNow = std::min<size_t>(nBatchSize, (victim.queue.size() + 1) / 2);
+            vChecks.resize(nNow);
+            for (size_t i = 0; i < nNow; i++) {
+                vChecks[i].swap(victim.queue.front());
+                victim.queue.pop_front();
+            }
+            nQueued.fetch_sub(nNow);
+            return true;
+        }
+        return false;
+    }
+
     /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    bool Loop(unsigned int nSelf, bool fMaster = false)
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
         do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
+            if (Pop(nSelf, vChecks) || Steal(nSelf, vChecks)) {
+                // Once a verification failed the remaining ones are only
+                // dequeued and destroyed
+                bool fOk = fAllOk.load(std::memory_order_relaxed);
+                for (T& check : vChecks)
+                    if (fOk)
+                        fOk = check();
+                if (!fOk)
+                    fAllOk.store(false, std::memory_order_relaxed);
+                // Destroy the checks before they are marked as completed
+                unsigned int nNow = vChecks.size();
+                vChecks.clear();
+                if (nTodo.fetch_sub(nNow) == nNow && !fMaster) {
+                    // We processed the last element; inform the master it can exit and return the result
+                    boost::unique_lock<boost::mutex> lock(mutexIdle);
+                    condMaster.notify_one();
                 }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if (fMaster && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
+                continue;
+            }
+
+            boost::unique_lock<boost::mutex> lock(mutexIdle);
+            if (fMaster) {
+                while (nQueued.load() == 0) {
+                    if (nTodo.load() == 0) {
+                        // return the current status, and reset it for new work later
+                        return fAllOk.exchange(true);
                     }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
+                    condMaster.wait(lock);
                 }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
+            } else {
+                nIdle++;
+                try {
+                    while (nQueued.load() == 0)
+                        condWorker.wait(lock); // wait
+                } catch (...) {
+                    nIdle--;
+                    throw;
                 }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+                nIdle--;
             }
-            // execute work
-            for (T& check : vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
         } while (true);
     }
 
@@ -128,33 +186,54 @@ public:
     boost::mutex ControlMutex;
 
     //! Create a new check queue
-    explicit CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), nBatchSize(nBatchSizeIn) {}
+    explicit CCheckQueue(unsigned int nBatchSizeIn) : nWorkers(0), nNextQueue(0), nIdle(0), nQueued(0), nTodo(0), fAllOk(true), nBatchSize(nBatchSizeIn)
+    {
+        vWorkerQueue.reserve(MAX_CHECKQUEUE_WORKERS);
+        for (unsigned int i = 0; i < MAX_CHECKQUEUE_WORKERS; i++)
+            vWorkerQueue.emplace_back(new WorkerQueue());
+    }
 
     //! Worker thread
     void Thread()
     {
-        Loop();
+        // Workers beyond MAX_CHECKQUEUE_WORKERS share a queue
+        unsigned int nSelf = 1 + nWorkers.fetch_add(1) % (MAX_CHECKQUEUE_WORKERS - 1);
+        Loop(nSelf);
     }
 
     //! Wait until execution finishes, and return whether all evaluations were successful.
     bool Wait()
     {
-        return Loop(true);
+        return Loop(0, true);
     }
 
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        for (T& check : vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
+        if (vChecks.empty())
+            return;
+
+        // Count the checks before they become visible, so that the
+        // counters never underflow when a worker grabs them right away
+        nTodo.fetch_add(vChecks.size());
+        nQueued.fetch_add(vChecks.size());
+        {
+            WorkerQueue& worker = *vWorkerQueue[nNextQueue++ % ActiveQueues()];
+            boost::unique_lock<boost::mutex> lock(worker.mutex);
+            for (T& check : vChecks) {
+                worker.queue.push_back(T());
+                check.swap(worker.queue.back());
+            }
+        }
+
+        // Only take the idle mutex when there is someone to wake up
+        if (nIdle.load() > 0) {
+            boost::unique_lock<boost::mutex> lock(mutexIdle);
+            if (vChecks.size() == 1)
+                condWorker.notify_one();
+            else
+                condWorker.notify_all();
         }
-        nTodo += vChecks.size();
-        if (vChecks.size() == 1)
-            condWorker.notify_one();
-        else if (vChecks.size() > 1)
-            condWorker.notify_all();
     }
 
     ~CCheckQueue()
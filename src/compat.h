@@ -86,8 +86,14 @@ typedef int32_t ssize_t;
 size_t strnlen( const char *start, size_t max_len);
 #endif // HAVE_DECL_STRNLEN
 
+#if defined(HAVE_SYS_EPOLL_H) && !defined(WIN32)
+// The socket handler waits with epoll and netbase with poll(), neither of
+// which limits sockets to FD_SETSIZE
+#define USE_POLL
+#endif
+
 bool static inline IsSelectableSocket(const SOCKET& s) {
-#ifdef WIN32
+#if defined(WIN32) || defined(USE_POLL)
     return true;
 #else
     return (s < FD_SETSIZE);
@@ -0,0 +1,133 @@
+// Copyright (c) 2026 The DriveNet developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <crypto/muhash.h>
+
+#include <crypto/chacha20.h>
+#include <crypto/sha256.h>
+
+#include <limits>
+
+namespace {
+
+typedef Num3072::limb_t limb_t;
+typedef Num3072::double_limb_t double_limb_t;
+
+/** 2^3072 - MAX_PRIME_DIFF is the modulus */
+constexpr limb_t MAX_PRIME_DIFF = 1103717;
+
+}
+
+Num3072::Num3072(const unsigned char (&data)[BYTE_SIZE])
+{
+    for (int i = 0; i < LIMBS; i++) {
+        limbs[i] = 0;
+        for (int j = LIMB_SIZE / 8 - 1; j >= 0; j--)
+            limbs[i] = (limbs[i] << 8) | data[i * (LIMB_SIZE / 8) + j];
+    }
+}
+
+void Num3072::SetToOne()
+{
+    limbs[0] = 1;
+    for (int i = 1; i < LIMBS; i++)
+        limbs[i] = 0;
+}
+
+bool Num3072::IsOverflow() const
+{
+    if (limbs[0] <= std::numeric_limits<limb_t>::max() - MAX_PRIME_DIFF)
+        return false;
+    for (int i = 1; i < LIMBS; i++) {
+        if (limbs[i] != std::numeric_limits<limb_t>::max())
+            return false;
+    }
+    return true;
+}
+
+void Num3072::FullReduce()
+{
+    // Subtracting the modulus is the same as adding MAX_PRIME_DIFF and
+    // dropping the 2^3072 bit.
+    double_limb_t c = MAX_PRIME_DIFF;
+    for (int i = 0; i < LIMBS; i++) {
+        c += limbs[i];
+        limbs[i] = (limb_t)c;
+        c >>= LIMB_SIZE;
+    }
+}
+
+void Num3072::Multiply(const Num3072& a)
+{
+    // Schoolbook multiplication into a 6144 bit product
+    limb_t tmp[2 * LIMBS];
+    for (int i = 0; i < 2 * LIMBS; i++)
+        tmp[i] = 0;
+    for (int i = 0; i < LIMBS; i++) {
+        double_limb_t c = 0;
+        for (int j = 0; j < LIMBS; j++) {
+            c += (double_limb_t)limbs[i] * a.limbs[j] + tmp[i + j];
+            tmp[i + j] = (limb_t)c;
+            c >>= LIMB_SIZE;
+        }
+        tmp[i + LIMBS] = (limb_t)c;
+    }
+
+    // hi * 2^3072 + lo = hi * MAX_PRIME_DIFF + lo (mod p)
+    double_limb_t c = 0;
+    for (int i = 0; i < LIMBS; i++) {
+        c += (double_limb_t)tmp[i + LIMBS] * MAX_PRIME_DIFF + tmp[i];
+        limbs[i] = (limb_t)c;
+        c >>= LIMB_SIZE;
+    }
+    // Fold the remaining carry back in until nothing is left above 2^3072
+    while (c) {
+        c *= MAX_PRIME_DIFF;
+        for (int i = 0; i < LIMBS && c; i++) {
+            c += limbs[i];
+            limbs[i] = (limb_t)c;
+            c >>= LIMB_SIZE;
+        }
+    }
+
+    if (IsOverflow())
+        FullReduce();
+}
+
+void Num3072::ToBytes(unsigned char (&out)[BYTE_SIZE])
+{
+    if (IsOverflow())
+        FullReduce();
+    for (int i = 0; i < LIMBS; i++) {
+        limb_t limb = limbs[i];
+        for (int j = 0; j < LIMB_SIZE / 8; j++) {
+            out[i * (LIMB_SIZE / 8) + j] = limb & 0xff;
+            limb >>= 8;
+        }
+    }
+}
+
+MuHash3072& MuHash3072::Insert(const unsigned char* in, size_t len)
+{
+    // Expand the element to 3072 bits with ChaCha20 keyed by its hash
+    unsigned char key[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(in, len).Finalize(key);
+    unsigned char tmp[Num3072::BYTE_SIZE];
+    ChaCha20(key, sizeof(key)).Output(tmp, sizeof(tmp));
+    data.Multiply(Num3072(tmp));
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator*=(const MuHash3072& mul)
+{
+    data.Multiply(mul.data);
+    return *this;
+}
+
+void MuHash3072::Finalize(unsigned char (&out)[32])
+{
+    unsigned char tmp[Num3072::BYTE_SIZE];
+    data.ToBytes(tmp);
+    CSHA256().Write(tmp, sizeof(tmp)).Finalize(out);
+}
@@ -0,0 +1,71 @@
+// Copyright (c) 2026 The DriveNet developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_MUHASH_H
+#define BITCOIN_CRYPTO_MUHASH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** Integer modulo 2^3072 - 1103717, the largest 3072 bit safe prime */
+class Num3072
+{
+public:
+#ifdef __SIZEOF_INT128__
+    typedef uint64_t limb_t;
+    typedef unsigned __int128 double_limb_t;
+    static const int LIMB_SIZE = 64;
+#else
+    typedef uint32_t limb_t;
+    typedef uint64_t double_limb_t;
+    static const int LIMB_SIZE = 32;
+#endif
+    static const int LIMBS = 3072 / LIMB_SIZE;
+    static const size_t BYTE_SIZE = 384;
+
+    limb_t limbs[LIMBS];
+
+    Num3072() { SetToOne(); }
+    /** Interpret 384 bytes as a little endian number */
+    explicit Num3072(const unsigned char (&data)[BYTE_SIZE]);
+
+    void SetToOne();
+    void Multiply(const Num3072& a);
+    /** Serialize the fully reduced value as 384 little endian bytes */
+    void ToBytes(unsigned char (&out)[BYTE_SIZE]);
+
+private:
+    bool IsOverflow() const;
+    void FullReduce();
+};
+
+/**
+ * Hash of a set of byte strings that doesn't depend on the order the
+ * elements are added in (MuHash). Every element is expanded into a number
+ * modulo a 3072 bit prime and the set is represented by the product of its
+ * elements, so two hashes of disjoint sets can be combined into the hash of
+ * their union. This allows a large set, such as the UTXO set, to be hashed
+ * in parallel.
+ *
+ * Removing elements is not supported.
+ */
+class MuHash3072
+{
+private:
+    Num3072 data;
+
+public:
+    /** Empty set */
+    MuHash3072() {}
+
+    /** Add an element to the set */
+    MuHash3072& Insert(const unsigned char* data, size_t len);
+
+    /** Combine with the hash of a disjoint set */
+    MuHash3072& operator*=(const MuHash3072& mul);
+
+    void Finalize(unsigned char (&out)[32]);
+};
+
+#endif // BITCOIN_CRYPTO_MUHASH_H
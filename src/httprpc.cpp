@@ -185,10 +185,44 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         if (valRequest.isObject()) {
             jreq.parse(valRequest);
 
-            UniValue result = tableRPC.execute(jreq);
-
-            // Send reply
-            strReply = JSONRPCReply(result, NullUniValue, jreq.id);
+            // Write the reply as the method produces its result. Once the
+            // output grows past the writer's buffer it is sent as a chunked
+            // reply, smaller replies are sent in one piece below.
+            bool fChunked = false;
+            JSONStreamWriter writer([req, &fChunked](const std::string& strChunk) {
+                if (!fChunked) {
+                    req->WriteHeader("Content-Type", "application/json");
+                    fChunked = true;
+                }
+                req->WriteReplyChunk(HTTP_OK, strChunk);
+            });
+            jreq.pResultWriter = &writer;
+
+            writer.BeginObject();
+            writer.Key("result");
+            try {
+                UniValue result = tableRPC.execute(jreq);
+                if (writer.IsValuePending())
+                    writer.Value(result);
+            } catch (...) {
+                if (!writer.HasFlushed())
+                    throw;
+                // Part of the result is already sent, the client will see
+                // the reply end early
+                LogPrintf("ThreadRPCServer method %s failed after starting its reply\n", SanitizeString(jreq.strMethod));
+                req->WriteReplyEnd();
+                return false;
+            }
+            writer.KeyValue("error", NullUniValue);
+            writer.KeyValue("id", jreq.id);
+            writer.EndObject();
+
+            if (writer.HasFlushed()) {
+                req->WriteReplyChunk(HTTP_OK, writer.ReleaseBuffer() + "\n");
+                req->WriteReplyEnd();
+                return true;
+            }
+            strReply = writer.ReleaseBuffer() + "\n";
 
         // array of requests
         } else if (valRequest.isArray())
@@ -20,7 +20,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <signal.h>
+#include <condition_variable>
 #include <future>
+#include <mutex>
 
 #include <event2/thread.h>
 #include <event2/buffer.h>
@@ -40,6 +42,9 @@
 /** Maximum size of http request (request line + headers) */
 static const size_t MAX_HEADERS_SIZE = 8192;
 
+/** Maximum size of the part of a chunked reply waiting to be sent */
+static const size_t MAX_REPLY_BACKLOG = 1 << 20;
+
 /** HTTP request work item */
 class HTTPWorkItem final : public HTTPClosure
 {
@@ -147,6 +152,8 @@ static WorkQueue<HTTPClosure>* workQueue = nullptr;
 std::vector<HTTPPathHandler> pathHandlers;
 //! Bound listening sockets
 std::vector<evhttp_bound_socket *> boundSockets;
+//! Seconds a chunked reply waits for the client to read before dropping it
+static int nReplyTimeout = DEFAULT_HTTP_SERVER_TIMEOUT;
 
 /** Check if a network address is allowed to access the HTTP server */
 static bool ClientAllowed(const CNetAddr& netaddr)
@@ -383,7 +390,8 @@ bool InitHTTPServer()
         return false;
     }
 
-    evhttp_set_timeout(http, gArgs.GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT));
+    nReplyTimeout = gArgs.GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT);
+    evhttp_set_timeout(http, nReplyTimeout);
     evhttp_set_max_headers_size(http, MAX_HEADERS_SIZE);
     evhttp_set_max_body_size(http, MAX_SIZE);
     evhttp_set_gencb(http, http_request_cb, nullptr);
@@ -523,7 +531,8 @@ void HTTPEvent::trigger(struct timeval* tv)
         evtimer_add(ev, tv); // trigger after timeval passed
 }
 HTTPRequest::HTTPRequest(struct evhttp_request* _req) : req(_req),
-                                                       replySent(false)
+                                                       replySent(false),
+                                                       replyStarted(false)
 {
 }
 HTTPRequest::~HTTPRequest()
@@ -531,7 +540,10 @@ HTTPRequest::~HTTPRequest()
     if (!replySent) {
         // Keep track of whether reply was sent to avoid request leaks
         LogPrintf("%s: Unhandled request\n", __func__);
-        WriteReply(HTTP_INTERNAL, "Unhandled request");
+        if (replyStarted)
+            WriteReplyEnd();
+        else
+            WriteReply(HTTP_INTERNAL, "Unhandled request");
     }
     // evhttpd cleans up the request, as long as a reply was sent.
 }
@@ -579,9 +591,23 @@ void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
  * Replies must be sent in the main loop in the main http thread,
  * this cannot be done from worker threads.
  */
+/** Re-enable reading from the socket. This is the second part of the libevent
+ * workaround in http_request_cb. */
+static void http_enable_read(evhttp_connection* conn)
+{
+    if (event_get_version_number() >= 0x02010600 && event_get_version_number() < 0x02020001) {
+        if (conn) {
+            bufferevent* bev = evhttp_connection_get_bufferevent(conn);
+            if (bev) {
+                bufferevent_enable(bev, EV_READ | EV_WRITE);
+            }
+        }
+    }
+}
+
 void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
 {
-    assert(!replySent && req);
+    assert(!replySent && !replyStarted && req);
     // Send event to main http thread to send reply message
     struct evbuffer* evb = evhttp_request_get_output_buffer(req);
     assert(evb);
@@ -589,17 +615,138 @@ void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
     auto req_copy = req;
     HTTPEvent* ev = new HTTPEvent(eventBase, true, [req_copy, nStatus]{
         evhttp_send_reply(req_copy, nStatus, nullptr, nullptr);
-        // Re-enable reading from the socket. This is the second part of the libevent
-        // workaround above.
-        if (event_get_version_number() >= 0x02010600 && event_get_version_number() < 0x02020001) {
-            evhttp_connection* conn = evhttp_request_get_connection(req_copy);
-            if (conn) {
-                bufferevent* bev = evhttp_connection_get_bufferevent(conn);
-                if (bev) {
-                    bufferevent_enable(bev, EV_READ | EV_WRITE);
-                }
+        http_enable_read(evhttp_request_get_connection(req_copy));
+    });
+    ev->trigger(nullptr);
+    replySent = true;
+    req = nullptr; // transferred back to main thread
+}
+
+/**
+ * Flow control of a chunked reply. Its worker thread waits while too many
+ * bytes are queued for the client, the main http thread counts them down as
+ * libevent empties the connection's output buffer.
+ */
+struct HTTPReplyFlow
+{
+    std::mutex mutex;
+    std::condition_variable cond;
+    //! Bytes of the reply that haven't been written to the socket yet
+    size_t nBacklog = 0;
+    //! Bytes handed to libevent since its output buffer was last empty
+    size_t nSent = 0;
+    //! The client has gone away, nothing more will be sent
+    bool fClosed = false;
+    //! The client stopped reading, the connection is dropped at the end
+    bool fTimedOut = false;
+
+    /** The connection's output buffer is empty (main http thread) */
+    void Drained()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        nBacklog -= nSent;
+        nSent = 0;
+        cond.notify_all();
+    }
+
+    void Closed()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        fClosed = true;
+        cond.notify_all();
+    }
+};
+
+static void http_reply_drained_cb(evhttp_connection* conn, void* arg)
+{
+    static_cast<HTTPReplyFlow*>(arg)->Drained();
+}
+
+static void http_reply_closed_cb(evhttp_connection* conn, void* arg)
+{
+    static_cast<HTTPReplyFlow*>(arg)->Closed();
+}
+
+void HTTPRequest::WriteReplyChunk(int nStatus, const std::string& strChunk)
+{
+    assert(!replySent && req);
+    const bool fStart = !replyStarted;
+    replyStarted = true;
+    if (fStart)
+        replyFlow = std::make_shared<HTTPReplyFlow>();
+    {
+        // Don't produce the reply faster than the client reads it, but don't
+        // wait forever on a client that stopped reading
+        std::unique_lock<std::mutex> lock(replyFlow->mutex);
+        if (!replyFlow->cond.wait_for(lock, std::chrono::seconds(nReplyTimeout), [this]{ return replyFlow->nBacklog < MAX_REPLY_BACKLOG || replyFlow->fClosed; })) {
+            LogPrint(BCLog::HTTP, "Client %s stopped reading the reply for %d seconds, disconnecting\n", GetPeer().ToString(), nReplyTimeout);
+            replyFlow->fClosed = true;
+            replyFlow->fTimedOut = true;
+        }
+        if (replyFlow->fClosed)
+            return;
+        replyFlow->nBacklog += strChunk.size();
+    }
+
+    // The chunk is handed to the main http thread in its own buffer. Events
+    // run in the order they are triggered, so chunks arrive in order.
+    struct evbuffer* evb = evbuffer_new();
+    assert(evb);
+    evbuffer_add(evb, strChunk.data(), strChunk.size());
+    auto req_copy = req;
+    auto flow = replyFlow;
+    const size_t nSize = strChunk.size();
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [req_copy, nStatus, fStart, evb, flow, nSize]{
+        // If the client has gone away libevent keeps the request until
+        // WriteReplyEnd, but it must not be started anymore
+        evhttp_connection* conn = evhttp_request_get_connection(req_copy);
+        if (conn) {
+            if (fStart) {
+                evhttp_send_reply_start(req_copy, nStatus, nullptr);
+                // Cleared again by WriteReplyEnd, which keeps flow alive
+                // until then
+                evhttp_connection_set_closecb(conn, http_reply_closed_cb, flow.get());
+            }
+            {
+                std::lock_guard<std::mutex> lock(flow->mutex);
+                flow->nSent += nSize;
             }
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+            evhttp_send_reply_chunk_with_cb(req_copy, evb, http_reply_drained_cb, flow.get());
+#else
+            evhttp_send_reply_chunk(req_copy, evb);
+            flow->Drained();
+#endif
+        } else {
+            flow->Closed();
+        }
+        evbuffer_free(evb);
+    });
+    ev->trigger(nullptr);
+}
+
+void HTTPRequest::WriteReplyEnd()
+{
+    assert(!replySent && replyStarted && req);
+    auto req_copy = req;
+    auto flow = replyFlow;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [req_copy, flow]{
+        evhttp_connection* conn = evhttp_request_get_connection(req_copy);
+        if (conn)
+            evhttp_connection_set_closecb(conn, nullptr, nullptr);
+        bool fTimedOut;
+        {
+            std::lock_guard<std::mutex> lock(flow->mutex);
+            fTimedOut = flow->fTimedOut;
+        }
+        if (conn && fTimedOut) {
+            // The rest of the reply would never be read, this frees the
+            // request along with the connection
+            evhttp_connection_free(conn);
+            return;
         }
+        evhttp_send_reply_end(req_copy);
+        http_enable_read(conn);
     });
     ev->trigger(nullptr);
     replySent = true;
@@ -8,6 +8,7 @@
 #include <string>
 #include <stdint.h>
 #include <functional>
+#include <memory>
 
 static const int DEFAULT_HTTP_THREADS=4;
 static const int DEFAULT_HTTP_WORKQUEUE=16;
@@ -17,6 +18,7 @@ struct evhttp_request;
 struct event_base;
 class CService;
 class HTTPRequest;
+struct HTTPReplyFlow;
 
 /** Initialize HTTP server.
  * Call this before RegisterHTTPHandler or EventBase().
@@ -59,6 +61,9 @@ class HTTPRequest
 private:
     struct evhttp_request* req;
     bool replySent;
+    bool replyStarted;
+    //! Tracks how much of a chunked reply hasn't been sent yet
+    std::shared_ptr<HTTPReplyFlow> replyFlow;
 
 public:
     explicit HTTPRequest(struct evhttp_request* req);
@@ -114,6 +119,26 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Write part of a chunked HTTP reply, which starts sending it right away.
+     * The first call sends the headers with status nStatus, so write the
+     * headers before. Finish the reply with WriteReplyEnd.
+     *
+     * @note Blocks while too much of the reply is waiting to be sent, until
+     * the client has read it or the connection is closed. A client that
+     * reads nothing for -rpcservertimeout seconds is disconnected, and the
+     * rest of the reply is dropped.
+     */
+    void WriteReplyChunk(int nStatus, const std::string& strChunk);
+
+    /**
+     * Finish a reply started with WriteReplyChunk.
+     *
+     * @note As with WriteReply, do not call any other HTTPRequest methods
+     * after calling this.
+     */
+    void WriteReplyEnd();
 };
 
 /** Event handler closure.
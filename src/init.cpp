@@ -333,6 +333,7 @@ void OnRPCStopped()
 {
     uiInterface.NotifyBlockTip.disconnect(&RPCNotifyBlockChange);
     RPCNotifyBlockChange(false, nullptr);
+    InterruptChainSnapshotWaiters();
     cvBlockChange.notify_all();
     LogPrint(BCLog::RPC, "RPC stopped.\n");
 }
@@ -353,6 +354,8 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
     strUsage +=HelpMessageOpt("-assumevalid=<hex>", strprintf(_("If this block is in the chain assume that it and its ancestors are valid and potentially skip their script verification (0 to verify all, default: %s, testnet: %s)"), defaultChainParams->GetConsensus().defaultAssumeValid.GetHex(), testnetChainParams->GetConsensus().defaultAssumeValid.GetHex()));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
+    strUsage += HelpMessageOpt("-blockfilterindex", strprintf(_("Maintain a compact filter index of the scripts each block creates and spends, used to speed up wallet rescans (default: %u)"), DEFAULT_BLOCKFILTERINDEX));
+    strUsage += HelpMessageOpt("-blockstatsindex", strprintf(_("Maintain a per-block fee statistics index, used by the getaveragefee rpc call (default: %u)"), DEFAULT_BLOCKSTATSINDEX));
     strUsage += HelpMessageOpt("-blockreconstructionextratxn=<n>", strprintf(_("Extra transactions to keep in memory for compact block reconstructions (default: %u)"), DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN));
     if (showDebug)
         strUsage += HelpMessageOpt("-blocksonly", strprintf(_("Whether to operate in a blocks only mode (default: %u)"), DEFAULT_BLOCKSONLY));
@@ -410,6 +413,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxconnections=<n>", strprintf(_("Maintain at most <n> connections to peers (default: %u)"), DEFAULT_MAX_PEER_CONNECTIONS));
     strUsage += HelpMessageOpt("-maxreceivebuffer=<n>", strprintf(_("Maximum per-connection receive buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXRECEIVEBUFFER));
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXSENDBUFFER));
+    strUsage += HelpMessageOpt("-msghandlerthreads=<n>", strprintf(_("Number of threads processing peer messages (1 to %d, default: %d)"), MAX_MESSAGE_HANDLER_THREADS, DEFAULT_MESSAGE_HANDLER_THREADS));
     strUsage += HelpMessageOpt("-maxtimeadjustment", strprintf(_("Maximum allowed median peer time offset adjustment. Local perspective of time may be influenced by peers forward or backward by this amount. (default: %u seconds)"), DEFAULT_MAX_TIME_ADJUSTMENT));
     strUsage += HelpMessageOpt("-maxuploadtarget=<n>", strprintf(_("Tries to keep outbound traffic under the given target (in MiB per 24h), 0 = no limit (default: %d)"), DEFAULT_MAX_UPLOAD_TARGET));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
@@ -420,6 +424,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-proxy=<ip:port>", _("Connect through SOCKS5 proxy"));
     strUsage += HelpMessageOpt("-proxyrandomize", strprintf(_("Randomize credentials for every proxy connection. This enables Tor stream isolation (default: %u)"), DEFAULT_PROXYRANDOMIZE));
     strUsage += HelpMessageOpt("-seednode=<ip>", _("Connect to a node to retrieve peer addresses, and disconnect"));
+    strUsage += HelpMessageOpt("-socketbackend=<backend>", strprintf(_("Wait for socket events with <backend> (%s, default: %s)"), GetSupportedSocketBackends(), SocketBackendToString(DEFAULT_SOCKET_BACKEND)));
     strUsage += HelpMessageOpt("-timeout=<n>", strprintf(_("Specify connection timeout in milliseconds (minimum: 1, default: %d)"), DEFAULT_CONNECT_TIMEOUT));
     strUsage += HelpMessageOpt("-torcontrol=<ip>:<port>", strprintf(_("Tor control port to use if onion listening enabled (default: %s)"), DEFAULT_TOR_CONTROL));
     strUsage += HelpMessageOpt("-torpassword=<pass>", _("Tor control port password (default: empty)"));
@@ -706,9 +711,19 @@ void ThreadImport(std::vector<fs::path> vImportFiles)
     }
     } // End scope of CImportingNow
     if (gArgs.GetArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
-        LoadMempool();
+        LoadMempool(g_rpc_task_pool);
         fDumpMempoolLater = !fRequestShutdown;
     }
+
+    // Fill in the block stats index for blocks connected before it was enabled
+    if (fBlockStatsIndex) {
+        BackfillBlockStatsIndex();
+    }
+
+    // Same for the block filter index
+    if (fBlockFilterIndex) {
+        BackfillBlockFilterIndex();
+    }
 }
 
 /** Sanity checks
@@ -940,7 +955,11 @@ bool AppInitParameterInteraction()
     nMaxConnections = std::max(nUserMaxConnections, 0);
 
     // Trim requested connection counts, to fit into system limitations
+#ifndef USE_POLL
+    // select() can't wait for sockets beyond FD_SETSIZE, with epoll only the
+    // file descriptor limit below applies
     nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS)), 0);
+#endif
     nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS + MAX_ADDNODE_CONNECTIONS);
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
         return InitError(_("Not enough file descriptors available."));
@@ -1113,6 +1132,8 @@ bool AppInitParameterInteraction()
 #endif
 
     fIsBareMultisigStd = gArgs.GetBoolArg("-permitbaremultisig", DEFAULT_PERMIT_BAREMULTISIG);
+    fBlockStatsIndex = gArgs.GetBoolArg("-blockstatsindex", DEFAULT_BLOCKSTATSINDEX);
+    fBlockFilterIndex = gArgs.GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX);
     fAcceptDatacarrier = gArgs.GetBoolArg("-datacarrier", DEFAULT_ACCEPT_DATACARRIER);
     nMaxDatacarrierBytes = gArgs.GetArg("-datacarriersize", nMaxDatacarrierBytes);
 
@@ -1258,10 +1279,18 @@ bool AppInitMain()
 
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
-        for (int i=0; i<nScriptCheckThreads-1; i++)
+        for (int i=0; i<nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadSidechainCheck);
+        }
     }
 
+    // The thread making a call to the RPC task pool works on it as well
+    int nRPCTaskThreads = std::min(std::max(GetNumCores(), 1), MAX_RPC_TASK_THREADS);
+    LogPrintf("Using %u threads for RPC tasks\n", nRPCTaskThreads);
+    for (int i = 0; i < nRPCTaskThreads - 1; i++)
+        threadGroup.create_thread(&ThreadRPCTaskPool);
+
     // Start the lightweight task scheduler thread
     CScheduler::Function serviceLoop = boost::bind(&CScheduler::serviceQueue, &scheduler);
     threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
@@ -1338,6 +1367,13 @@ bool AppInitMain()
         }
     }
 
+    SocketBackend socketBackend = DEFAULT_SOCKET_BACKEND;
+    if (gArgs.IsArgSet("-socketbackend")) {
+        std::string strBackend = gArgs.GetArg("-socketbackend", "");
+        if (!ParseSocketBackend(strBackend, socketBackend))
+            return InitError(strprintf(_("Unknown socket backend specified in -socketbackend: '%s' (available: %s)"), strBackend, GetSupportedSocketBackends()));
+    }
+
     // Check for host lookup allowed before parsing any network related parameters
     fNameLookup = gArgs.GetBoolArg("-dns", DEFAULT_NAME_LOOKUP);
 
@@ -1415,6 +1451,9 @@ bool AppInitMain()
 
     bool drivechainsEnabled = IsDrivechainEnabled(chainActive.Tip(), chainparams.GetConsensus());
 
+    // Record changes to the global SCDB for getscdbevents
+    scdb.SetRecordEvents(true);
+
     std::string strFailSCDAT;
     strFailSCDAT = "Failed to load sidechain database files!\n";
     strFailSCDAT += "They may corrupt or need to be updated.\n";
@@ -1632,6 +1671,12 @@ bool AppInitMain()
                         LogPrintf("Error reading custom vote cache.\n");
                     }
                 }
+
+                // Publish the loaded chain and SCDB state for RPC
+                {
+                    LOCK(cs_main);
+                    PublishChainSnapshot();
+                }
             } catch (const std::exception& e) {
                 LogPrintf("%s\n", e.what());
                 strLoadError = _("Error opening block database");
@@ -1853,6 +1898,8 @@ bool AppInitMain()
     connOptions.nBestHeight = chain_active_height;
     connOptions.uiInterface = &uiInterface;
     connOptions.m_msgproc = peerLogic.get();
+    connOptions.nMessageHandlerThreads = gArgs.GetArg("-msghandlerthreads", DEFAULT_MESSAGE_HANDLER_THREADS);
+    connOptions.m_socket_backend = socketBackend;
     connOptions.nSendBufferMaxSize = 1000*gArgs.GetArg("-maxsendbuffer", DEFAULT_MAXSENDBUFFER);
     connOptions.nReceiveFloodSize = 1000*gArgs.GetArg("-maxreceivebuffer", DEFAULT_MAXRECEIVEBUFFER);
     connOptions.m_added_nodes = gArgs.GetArgs("-addnode");
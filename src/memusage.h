@@ -6,6 +6,8 @@
 #define BITCOIN_MEMUSAGE_H
 
 #include <indirectmap.h>
+#include <prevector.h>
+#include <support/allocators/pool.h>
 
 #include <stdlib.h>
 
@@ -116,6 +118,32 @@ static inline size_t IncrementalDynamicUsage(const std::map<X, Y, Z>& m)
     return MallocUsage(sizeof(stl_tree_node<std::pair<const X, Y> >));
 }
 
+// Nodes of containers using pool_allocator carry no malloc overhead
+
+template<typename X, typename Y>
+static inline size_t DynamicUsage(const std::set<X, Y, pool_allocator<X> >& s)
+{
+    return PoolNodeSize(sizeof(stl_tree_node<X>)) * s.size();
+}
+
+template<typename X, typename Y>
+static inline size_t IncrementalDynamicUsage(const std::set<X, Y, pool_allocator<X> >& s)
+{
+    return PoolNodeSize(sizeof(stl_tree_node<X>));
+}
+
+template<typename X, typename Y, typename Z>
+static inline size_t DynamicUsage(const std::map<X, Y, Z, pool_allocator<std::pair<const X, Y> > >& m)
+{
+    return PoolNodeSize(sizeof(stl_tree_node<std::pair<const X, Y> >)) * m.size();
+}
+
+template<typename X, typename Y, typename Z>
+static inline size_t IncrementalDynamicUsage(const std::map<X, Y, Z, pool_allocator<std::pair<const X, Y> > >& m)
+{
+    return PoolNodeSize(sizeof(stl_tree_node<std::pair<const X, Y> >));
+}
+
 // indirectmap has underlying map with pointer as key
 
 template<typename X, typename Y>
@@ -36,6 +36,7 @@
 #endif
 
 #include <algorithm>
+#include <list>
 #include <queue>
 #include <utility>
 
@@ -223,9 +224,8 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     }
 
     int nPackagesSelected = 0;
-    int nDescendantsUpdated = 0;
     bool fNeedCriticalFeeTx = false;
-    addPackageTxs(nPackagesSelected, nDescendantsUpdated, fDrivechainEnabled, fNeedCriticalFeeTx, setSidechainsWithWTPrime);
+    addPackageTxs(nPackagesSelected, fDrivechainEnabled, fNeedCriticalFeeTx, setSidechainsWithWTPrime);
 
     int64_t nTime1 = GetTimeMicros();
 
@@ -398,6 +398,7 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
 
                 // Check if we need to generate update bytes
                 SidechainDB scdbCopy = scdb;
+                scdbCopy.SetRecordEvents(false);
                 if (!scdbCopy.UpdateSCDBMatchMT(nHeight, hashSCDB, vNewWTPrime, mapNewWTPrime)) {
                     // Get SCDB state
                     std::vector<std::vector<SidechainWTPrimeState>> vState;
@@ -547,24 +548,11 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     }
     int64_t nTime2 = GetTimeMicros();
 
-    LogPrint(BCLog::BENCH, "CreateNewBlock() packages: %.2fms (%d packages, %d updated descendants), validity: %.2fms (total %.2fms)\n", 0.001 * (nTime1 - nTimeStart), nPackagesSelected, nDescendantsUpdated, 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
+    LogPrint(BCLog::BENCH, "CreateNewBlock() packages: %.2fms (%d packages), validity: %.2fms (total %.2fms)\n", 0.001 * (nTime1 - nTimeStart), nPackagesSelected, 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
 
     return std::move(pblocktemplate);
 }
 
-void BlockAssembler::onlyUnconfirmed(CTxMemPool::setEntries& testSet)
-{
-    for (CTxMemPool::setEntries::iterator iit = testSet.begin(); iit != testSet.end(); ) {
-        // Only test txs not already in the block
-        if (inBlock.count(*iit)) {
-            testSet.erase(iit++);
-        }
-        else {
-            iit++;
-        }
-    }
-}
-
 bool BlockAssembler::TestPackage(uint64_t packageSize, int64_t packageSigOpsCost) const
 {
     // TODO: switch to weight-based accounting for packages instead of vsize-based accounting.
@@ -614,33 +602,6 @@ void BlockAssembler::AddToBlock(CTxMemPool::txiter iter)
     }
 }
 
-int BlockAssembler::UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded,
-        indexed_modified_transaction_set &mapModifiedTx)
-{
-    int nDescendantsUpdated = 0;
-    for (const CTxMemPool::txiter it : alreadyAdded) {
-        CTxMemPool::setEntries descendants;
-        mempool.CalculateDescendants(it, descendants);
-        // Insert all descendants (not yet in block) into the modified set
-        for (CTxMemPool::txiter desc : descendants) {
-            if (alreadyAdded.count(desc))
-                continue;
-            ++nDescendantsUpdated;
-            modtxiter mit = mapModifiedTx.find(desc);
-            if (mit == mapModifiedTx.end()) {
-                CTxMemPoolModifiedEntry modEntry(desc);
-                modEntry.nSizeWithAncestors -= it->GetTxSize();
-                modEntry.nModFeesWithAncestors -= it->GetModifiedFee();
-                modEntry.nSigOpCostWithAncestors -= it->GetSigOpCost();
-                mapModifiedTx.insert(modEntry);
-            } else {
-                mapModifiedTx.modify(mit, update_for_parent_inclusion(it));
-            }
-        }
-    }
-    return nDescendantsUpdated;
-}
-
 bool BlockAssembler::CreateWTPrimePayout(uint8_t nSidechain, CMutableTransaction& tx, CAmount& nFees)
 {
     // TODO log all false returns
@@ -783,56 +744,28 @@ bool BlockAssembler::CreateWTPrimePayout(uint8_t nSidechain, CMutableTransaction
     return true;
 }
 
-// Skip entries in mapTx that are already in a block or are present
-// in mapModifiedTx (which implies that the mapTx ancestor state is
-// stale due to ancestor inclusion in the block)
-// Also skip transactions that we've already failed to add. This can happen if
-// we consider a transaction in mapModifiedTx and it fails: we can then
-// potentially consider it again while walking mapTx.  It's currently
-// guaranteed to fail again, but as a belt-and-suspenders check we put it in
-// failedTx and avoid re-evaluation, since the re-evaluation would be using
-// cached size/sigops/fee values that are not actually correct.
-bool BlockAssembler::SkipMapTxEntry(CTxMemPool::txiter it, indexed_modified_transaction_set &mapModifiedTx, CTxMemPool::setEntries &failedTx)
-{
-    assert (it != mempool.mapTx.end());
-    return mapModifiedTx.count(it) || inBlock.count(it) || failedTx.count(it);
-}
-
-void BlockAssembler::SortForBlock(const CTxMemPool::setEntries& package, CTxMemPool::txiter entry, std::vector<CTxMemPool::txiter>& sortedEntries)
-{
-    // Sort package by ancestor count
-    // If a transaction A depends on transaction B, then A's ancestor count
-    // must be greater than B's.  So this is sufficient to validly order the
-    // transactions for block inclusion.
-    sortedEntries.clear();
-    sortedEntries.insert(sortedEntries.begin(), package.begin(), package.end());
-    std::sort(sortedEntries.begin(), sortedEntries.end(), CompareTxIterByAncestorCount());
-}
-
 // This transaction selection algorithm orders the mempool based
 // on feerate of a transaction including all unconfirmed ancestors.
-// Since we don't remove transactions from the mempool as we select them
-// for block inclusion, we need an alternate method of updating the feerate
-// of a transaction with its not-yet-selected ancestors as we go.
-// This is accomplished by walking the in-mempool descendants of selected
-// transactions and storing a temporary modified state in mapModifiedTxs.
-// Each time through the loop, we compare the best transaction in
-// mapModifiedTxs with the next transaction in the mempool to decide what
-// transaction package to work on next.
-void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpdated, bool fDrivechainEnabled, bool& fNeedCriticalFeeTx, const std::set<uint8_t>& setSidechainsWithWTPrime)
+// The mempool keeps its transactions split into clusters of connected
+// transactions, each linearized into packages by ancestor feerate on its
+// own (see CTxMemPool::GetMiningClusters). All that is left to do here is
+// to merge the clusters: repeatedly take the best next package of any
+// cluster and add it if it fits. The linearization assumes every package
+// makes it into the block; when one doesn't, the packages of its cluster
+// that depend on it are rebuilt with the ancestors they still need and
+// queued again by their new score.
+void BlockAssembler::addPackageTxs(int &nPackagesSelected, bool fDrivechainEnabled, bool& fNeedCriticalFeeTx, const std::set<uint8_t>& setSidechainsWithWTPrime)
 {
-    // mapModifiedTx will store sorted packages after they are modified
-    // because some of their txs are already in the block
-    indexed_modified_transaction_set mapModifiedTx;
-    // Keep track of entries that failed inclusion, to avoid duplicate work
-    CTxMemPool::setEntries failedTx;
+    const std::map<uint64_t, CTxMemPool::MiningCluster>& mapCluster = mempool.GetMiningClusters();
 
-    // Start by adding all descendants of previously added txs to mapModifiedTx
-    // and modifying them for their already included ancestors
-    UpdatePackagesForAdded(inBlock, mapModifiedTx);
+    std::priority_queue<MiningQueueEntry, std::vector<MiningQueueEntry>, CompareMiningQueueEntry> queue;
+    for (const std::pair<const uint64_t, CTxMemPool::MiningCluster>& cluster : mapCluster) {
+        if (!cluster.second.empty())
+            queue.push(MiningQueueEntry(&cluster.second, 0));
+    }
 
-    CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::iterator mi = mempool.mapTx.get<ancestor_score>().begin();
-    CTxMemPool::txiter iter;
+    // Rebuilt packages, a std::list so the queue can point into it
+    std::list<CTxMemPool::MiningPackage> listRebuilt;
 
     // Limit the number of attempts to add transactions to the block when it is
     // close to full; this is just a simple heuristic to finish quickly if the
@@ -840,74 +773,93 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
     const int64_t MAX_CONSECUTIVE_FAILURES = 1000;
     int64_t nConsecutiveFailed = 0;
 
-    while (mi != mempool.mapTx.get<ancestor_score>().end() || !mapModifiedTx.empty())
+    const uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string dummy;
+
+    while (!queue.empty())
     {
-        // Don't add deposits to the same block as a WT^ for this sidechain
-        if (mi->GetSidechainDeposit() &&
-                setSidechainsWithWTPrime.count(mi->GetSidechainNumber())) {
-            ++mi;
-            continue;
+        MiningQueueEntry entry = queue.top();
+        queue.pop();
+        if (entry.cluster && entry.nPos + 1 < entry.cluster->size())
+            queue.push(MiningQueueEntry(entry.cluster, entry.nPos + 1));
+        const CTxMemPool::MiningPackage& package = *entry.package;
+
+        // Collect the transactions the package still needs: its own that are
+        // not in the block yet, and the ancestors that were left out along
+        // with an earlier package of the same cluster.
+        std::vector<CTxMemPool::txiter> vTx;
+        bool fChanged = false;
+        for (CTxMemPool::txiter it : package.vTx) {
+            if (inBlock.count(it)) {
+                fChanged = true;
+                continue;
+            }
+            vTx.push_back(it);
+            if (!fChanged) {
+                for (CTxMemPool::txiter parent : mempool.GetMemPoolParents(it)) {
+                    if (!inBlock.count(parent) &&
+                            std::find(package.vTx.begin(), package.vTx.end(), parent) == package.vTx.end()) {
+                        fChanged = true;
+                        break;
+                    }
+                }
+            }
         }
-        // First try to find a new transaction in mapTx to evaluate.
-        if (mi != mempool.mapTx.get<ancestor_score>().end() &&
-                SkipMapTxEntry(mempool.mapTx.project<0>(mi), mapModifiedTx, failedTx)) {
-            ++mi;
+        if (vTx.empty())
             continue;
-        }
 
-        // Now that mi is not stale, determine which transaction to evaluate:
-        // the next entry from mapTx, or the best from mapModifiedTx?
-        bool fUsingModified = false;
-
-        modtxscoreiter modit = mapModifiedTx.get<ancestor_score>().begin();
-        if (mi == mempool.mapTx.get<ancestor_score>().end()) {
-            // We're out of entries in mapTx; use the entry from mapModifiedTx
-            iter = modit->iter;
-            fUsingModified = true;
-        } else {
-            // Try to compare the mapTx entry to the mapModifiedTx entry
-            iter = mempool.mapTx.project<0>(mi);
-            if (modit != mapModifiedTx.get<ancestor_score>().end() &&
-                    CompareTxMemPoolEntryByAncestorFee()(*modit, CTxMemPoolModifiedEntry(iter))) {
-                // The best entry in mapModifiedTx has higher score
-                // than the one from mapTx.
-                // Switch which transaction (package) to consider
-                iter = modit->iter;
-                fUsingModified = true;
-            } else {
-                // Either no entry in mapModifiedTx, or it's worse than mapTx.
-                // Increment mi for the next loop iteration.
-                ++mi;
+        if (fChanged) {
+            // Queue the package again with its state for the transactions it
+            // needs now, it may no longer be the best one.
+            CTxMemPool::setEntries setNeeded(vTx.begin(), vTx.end());
+            for (CTxMemPool::txiter it : vTx) {
+                CTxMemPool::setEntries setAncestors;
+                mempool.CalculateMemPoolAncestors(*it, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+                for (CTxMemPool::txiter ancestor : setAncestors) {
+                    if (!inBlock.count(ancestor))
+                        setNeeded.insert(ancestor);
+                }
             }
-        }
 
-        // We skip mapTx entries that are inBlock, and mapModifiedTx shouldn't
-        // contain anything that is inBlock.
-        assert(!inBlock.count(iter));
-
-        uint64_t packageSize = iter->GetSizeWithAncestors();
-        CAmount packageFees = iter->GetModFeesWithAncestors();
-        int64_t packageSigOpsCost = iter->GetSigOpCostWithAncestors();
-        if (fUsingModified) {
-            packageSize = modit->nSizeWithAncestors;
-            packageFees = modit->nModFeesWithAncestors;
-            packageSigOpsCost = modit->nSigOpCostWithAncestors;
+            CTxMemPool::MiningPackage rebuilt;
+            rebuilt.iter = package.iter;
+            rebuilt.vTx.assign(setNeeded.begin(), setNeeded.end());
+            std::sort(rebuilt.vTx.begin(), rebuilt.vTx.end(), CompareTxIterByAncestorCount());
+            rebuilt.nSizeWithAncestors = 0;
+            rebuilt.nModFeesWithAncestors = 0;
+            rebuilt.nSigOpCostWithAncestors = 0;
+            for (CTxMemPool::txiter it : rebuilt.vTx) {
+                rebuilt.nSizeWithAncestors += it->GetTxSize();
+                rebuilt.nModFeesWithAncestors += it->GetModifiedFee();
+                rebuilt.nSigOpCostWithAncestors += it->GetSigOpCost();
+            }
+            listRebuilt.push_back(std::move(rebuilt));
+            queue.push(MiningQueueEntry(&listRebuilt.back()));
+            continue;
         }
 
+        uint64_t packageSize = package.nSizeWithAncestors;
+        CAmount packageFees = package.nModFeesWithAncestors;
+        int64_t packageSigOpsCost = package.nSigOpCostWithAncestors;
+
         if (packageFees < blockMinFeeRate.GetFee(packageSize)) {
             // Everything else we might consider has a lower fee rate
             return;
         }
 
-        if (!TestPackage(packageSize, packageSigOpsCost)) {
-            if (fUsingModified) {
-                // Since we always look at the best entry in mapModifiedTx,
-                // we must erase failed entries so that we can consider the
-                // next best entry on the next loop iteration
-                mapModifiedTx.get<ancestor_score>().erase(modit);
-                failedTx.insert(iter);
+        // Don't add deposits to the same block as a WT^ for their sidechain
+        bool fSkip = false;
+        for (CTxMemPool::txiter it : package.vTx) {
+            if (it->GetSidechainDeposit() &&
+                    setSidechainsWithWTPrime.count(it->GetSidechainNumber())) {
+                fSkip = true;
+                break;
             }
+        }
+        if (fSkip)
+            continue;
 
+        if (!TestPackage(packageSize, packageSigOpsCost)) {
             ++nConsecutiveFailed;
 
             if (nConsecutiveFailed > MAX_CONSECUTIVE_FAILURES && nBlockWeight >
@@ -918,43 +870,23 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
             continue;
         }
 
-        CTxMemPool::setEntries ancestors;
-        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
-        std::string dummy;
-        mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
-
-        onlyUnconfirmed(ancestors);
-        ancestors.insert(iter);
-
-        if (!TestPackageTransactions(ancestors)) {
-            if (fUsingModified) {
-                mapModifiedTx.get<ancestor_score>().erase(modit);
-                failedTx.insert(iter);
-            }
+        CTxMemPool::setEntries setPackage(package.vTx.begin(), package.vTx.end());
+        if (!TestPackageTransactions(setPackage))
             continue;
-        }
 
         // This transaction will make it in; reset the failed counter.
         nConsecutiveFailed = 0;
 
-        // Package can be added. Sort the entries in a valid order.
-        std::vector<CTxMemPool::txiter> sortedEntries;
-        SortForBlock(ancestors, iter, sortedEntries);
-
-        for (size_t i=0; i<sortedEntries.size(); ++i) {
-            AddToBlock(sortedEntries[i]);
-            // Erase from the modified set, if present
-            mapModifiedTx.erase(sortedEntries[i]);
+        // The package is already sorted in a valid order.
+        for (CTxMemPool::txiter it : package.vTx) {
+            AddToBlock(it);
 
             // Set fNeedCriticalFeeTx
-            if (fDrivechainEnabled && sortedEntries[i]->HasCriticalData())
+            if (fDrivechainEnabled && it->HasCriticalData())
                 fNeedCriticalFeeTx = true;
         }
 
         ++nPackagesSelected;
-
-        // Update transactions that depend on each of these
-        nDescendantsUpdated += UpdatePackagesForAdded(ancestors, mapModifiedTx);
     }
 }
 
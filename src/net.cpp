@@ -26,6 +26,10 @@
 #include <fcntl.h>
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
 #ifdef USE_UPNP
 #include <miniupnpc/miniupnpc.h>
 #include <miniupnpc/miniwget.h>
@@ -42,6 +46,14 @@
 // We add a random period time (0 to 1 seconds) to feeler connections to prevent synchronization.
 #define FEELER_SLEEP_WINDOW 1
 
+/** Frequency to poll pnode->vSend and paused receives in the socket handler */
+static const int SELECT_TIMEOUT_MILLISECONDS = 50;
+
+#ifdef HAVE_SYS_EPOLL_H
+/** Maximum number of events handled per epoll_wait() call */
+static const int MAX_EPOLL_EVENTS = 1024;
+#endif
+
 #if !defined(HAVE_MSG_NOSIGNAL)
 #define MSG_NOSIGNAL 0
 #endif
@@ -89,6 +101,8 @@ CCriticalSection cs_vNodes;
 
 limitedmap<uint256, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
 
+static CNetMessageBufferPool recvBufferPool;
+
 void CConnman::AddOneShot(const std::string& strDest)
 {
     LOCK(cs_vOneShots);
@@ -840,6 +854,13 @@ int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
     if (hdr.nMessageSize > MAX_SIZE)
         return -1;
 
+    // receive large payloads into a pooled buffer
+    if (hdr.nMessageSize >= RECV_BUFFER_POOL_MIN_SIZE && hdr.nMessageSize <= MAX_PROTOCOL_MESSAGE_LENGTH) {
+        CSerializeData vch;
+        recvBufferPool.Get(vch, hdr.nMessageSize);
+        vRecv.swap(vch);
+    }
+
     // switch state to reading message data
     in_data = true;
 
@@ -871,6 +892,55 @@ const uint256& CNetMessage::GetMessageHash() const
     return data_hash;
 }
 
+CNetMessage::~CNetMessage()
+{
+    CSerializeData vch;
+    vRecv.swap(vch);
+    recvBufferPool.Put(vch);
+}
+
+void CNetMessageBufferPool::Get(CSerializeData& vch, unsigned int nMessageSize)
+{
+    LOCK(cs);
+    if (vBuffer.empty())
+        return;
+
+    // Use the smallest buffer that fits the whole message, otherwise the
+    // largest one so that at least part of the message avoids reallocating
+    size_t nBest = 0;
+    for (size_t i = 1; i < vBuffer.size(); i++) {
+        const size_t nCapacity = vBuffer[i].capacity();
+        const size_t nBestCapacity = vBuffer[nBest].capacity();
+        if (nBestCapacity >= nMessageSize) {
+            if (nCapacity >= nMessageSize && nCapacity < nBestCapacity)
+                nBest = i;
+        } else if (nCapacity > nBestCapacity) {
+            nBest = i;
+        }
+    }
+
+    nBytes -= vBuffer[nBest].capacity();
+    vch.swap(vBuffer[nBest]);
+    vBuffer[nBest].swap(vBuffer.back());
+    vBuffer.pop_back();
+}
+
+void CNetMessageBufferPool::Put(CSerializeData& vch)
+{
+    const size_t nCapacity = vch.capacity();
+    if (nCapacity < RECV_BUFFER_POOL_MIN_SIZE)
+        return;
+
+    LOCK(cs);
+    if (nBytes + nCapacity > RECV_BUFFER_POOL_MAX_BYTES)
+        return;
+
+    vch.clear();
+    nBytes += nCapacity;
+    vBuffer.push_back(CSerializeData());
+    vBuffer.back().swap(vch);
+}
+
 
 
 
@@ -886,7 +956,7 @@ size_t CConnman::SocketSendData(CNode *pnode) const
     size_t nSentSize = 0;
 
     while (it != pnode->vSendMsg.end()) {
-        const auto &data = *it;
+        const auto &data = it->Get();
         assert(data.size() > pnode->nSendOffset);
         int nBytes = 0;
         {
@@ -1144,166 +1214,634 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
 
     LogPrint(BCLog::NET, "connection from %s accepted\n", addr.ToString());
 
+#ifdef HAVE_SYS_EPOLL_H
+    if (m_epoll_fd != -1)
+        EpollAddNode(pnode);
+#endif
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
     }
 }
 
-void CConnman::ThreadSocketHandler()
+void CConnman::DisconnectNodes()
 {
-    unsigned int nPrevNodeCount = 0;
-    while (!interruptNet)
     {
-        //
-        // Disconnect nodes
-        //
+        LOCK(cs_vNodes);
+        // Disconnect unused nodes
+        std::vector<CNode*> vNodesCopy = vNodes;
+        for (CNode* pnode : vNodesCopy)
         {
-            LOCK(cs_vNodes);
-            // Disconnect unused nodes
-            std::vector<CNode*> vNodesCopy = vNodes;
-            for (CNode* pnode : vNodesCopy)
+            if (pnode->fDisconnect)
             {
-                if (pnode->fDisconnect)
-                {
-                    // remove from vNodes
-                    vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+                // remove from vNodes
+                vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
 
-                    // release outbound grant (if any)
-                    pnode->grantOutbound.Release();
+                // release outbound grant (if any)
+                pnode->grantOutbound.Release();
 
-                    // close socket and cleanup
-                    pnode->CloseSocketDisconnect();
+                // close socket and cleanup
+                pnode->CloseSocketDisconnect();
 
-                    // hold in disconnected pool until all refs are released
-                    pnode->Release();
-                    vNodesDisconnected.push_back(pnode);
-                }
+                // hold in disconnected pool until all refs are released
+                pnode->Release();
+                vNodesDisconnected.push_back(pnode);
             }
         }
+    }
+    {
+        // Delete disconnected nodes
+        std::list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
+        for (CNode* pnode : vNodesDisconnectedCopy)
         {
-            // Delete disconnected nodes
-            std::list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
-            for (CNode* pnode : vNodesDisconnectedCopy)
-            {
-                // wait until threads are done using it
-                if (pnode->GetRefCount() <= 0) {
-                    bool fDelete = false;
-                    {
-                        TRY_LOCK(pnode->cs_inventory, lockInv);
-                        if (lockInv) {
-                            TRY_LOCK(pnode->cs_vSend, lockSend);
-                            if (lockSend) {
-                                fDelete = true;
-                            }
+            // wait until threads are done using it
+            if (pnode->GetRefCount() <= 0) {
+                bool fDelete = false;
+                {
+                    TRY_LOCK(pnode->cs_inventory, lockInv);
+                    if (lockInv) {
+                        TRY_LOCK(pnode->cs_vSend, lockSend);
+                        if (lockSend) {
+                            fDelete = true;
                         }
                     }
-                    if (fDelete) {
-                        vNodesDisconnected.remove(pnode);
-                        DeleteNode(pnode);
-                    }
+                }
+                if (fDelete) {
+                    vNodesDisconnected.remove(pnode);
+                    DeleteNode(pnode);
                 }
             }
         }
-        size_t vNodesSize;
+    }
+}
+
+void CConnman::NotifyNumConnectionsChanged()
+{
+    size_t vNodesSize;
+    {
+        LOCK(cs_vNodes);
+        vNodesSize = vNodes.size();
+    }
+    if(vNodesSize != nPrevNodeCount) {
+        nPrevNodeCount = vNodesSize;
+        if(clientInterface)
+            clientInterface->NotifyNumConnectionsChanged(nPrevNodeCount);
+    }
+}
+
+void CConnman::InactivityCheck(CNode* pnode)
+{
+    int64_t nTime = GetSystemTimeInSeconds();
+    if (nTime - pnode->nTimeConnected > 60)
+    {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
+        {
+            LogPrint(BCLog::NET, "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->GetId());
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
         {
-            LOCK(cs_vNodes);
-            vNodesSize = vNodes.size();
+            LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
+        {
+            LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        }
+        else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
+        {
+            LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
         }
-        if(vNodesSize != nPrevNodeCount) {
-            nPrevNodeCount = vNodesSize;
-            if(clientInterface)
-                clientInterface->NotifyNumConnectionsChanged(nPrevNodeCount);
+        else if (!pnode->fSuccessfullyConnected)
+        {
+            LogPrint(BCLog::NET, "version handshake timeout from %d\n", pnode->GetId());
+            pnode->fDisconnect = true;
         }
+    }
+}
 
-        //
-        // Find which sockets have data to receive
-        //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
+void CConnman::ServiceNodeSocket(CNode* pnode, bool fRecv, bool fSend, bool fError)
+{
+    //
+    // Receive
+    //
+    if (fRecv || fError)
+    {
+        // typical socket buffer is 8K-64K
+        char pchBuf[0x10000];
+        int nBytes = 0;
+        {
+            LOCK(pnode->cs_hSocket);
+            if (pnode->hSocket == INVALID_SOCKET)
+                return;
+            nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+        }
+        if (nBytes > 0)
+        {
+            // A short read drained the socket, epoll reports new data as a new edge
+            if (nBytes < (int)sizeof(pchBuf))
+                pnode->fSocketReadable = false;
+            bool notify = false;
+            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
+                pnode->CloseSocketDisconnect();
+            RecordBytesRecv(nBytes);
+            if (notify) {
+                size_t nSizeAdded = 0;
+                auto it(pnode->vRecvMsg.begin());
+                for (; it != pnode->vRecvMsg.end(); ++it) {
+                    if (!it->complete())
+                        break;
+                    nSizeAdded += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
+                }
+                {
+                    LOCK(pnode->cs_vProcessMsg);
+                    pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), pnode->vRecvMsg, pnode->vRecvMsg.begin(), it);
+                    pnode->nProcessQueueSize += nSizeAdded;
+                    pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
+                }
+                WakeMessageHandler();
+            }
+        }
+        else if (nBytes == 0)
+        {
+            // socket closed gracefully
+            if (!pnode->fDisconnect) {
+                LogPrint(BCLog::NET, "socket closed\n");
+            }
+            pnode->CloseSocketDisconnect();
+        }
+        else if (nBytes < 0)
+        {
+            // error
+            int nErr = WSAGetLastError();
+            if (nErr == WSAEWOULDBLOCK)
+                pnode->fSocketReadable = false;
+            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
+            {
+                if (!pnode->fDisconnect)
+                    LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+                pnode->CloseSocketDisconnect();
+            }
+        }
+    }
 
-        for (const ListenSocket& hListenSocket : vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = std::max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
+    //
+    // Send
+    //
+    if (fSend)
+    {
+        LOCK(pnode->cs_vSend);
+        size_t nBytes = SocketSendData(pnode);
+        if (nBytes) {
+            RecordBytesSent(nBytes);
         }
+        // Wait for epoll to report the socket writable again
+        if (!pnode->vSendMsg.empty())
+            pnode->fSocketWritable = false;
+    }
+}
+
+void CConnman::SocketEventsSelect(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set)
+{
+    struct timeval timeout;
+    timeout.tv_sec  = 0;
+    timeout.tv_usec = SELECT_TIMEOUT_MILLISECONDS * 1000; // frequency to poll pnode->vSend
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    bool have_fds = false;
+    std::vector<SOCKET> vSockets;
 
+    for (const ListenSocket& hListenSocket : vhListenSocket) {
+        FD_SET(hListenSocket.socket, &fdsetRecv);
+        hSocketMax = std::max(hSocketMax, hListenSocket.socket);
+        have_fds = true;
+        vSockets.push_back(hListenSocket.socket);
+    }
+
+    {
+        LOCK(cs_vNodes);
+        for (CNode* pnode : vNodes)
         {
-            LOCK(cs_vNodes);
-            for (CNode* pnode : vNodes)
+            // Implement the following logic:
+            // * If there is data to send, select() for sending data. As this only
+            //   happens when optimistic write failed, we choose to first drain the
+            //   write buffer in this case before receiving more. This avoids
+            //   needlessly queueing received data, if the remote peer is not themselves
+            //   receiving data. This means properly utilizing TCP flow control signalling.
+            // * Otherwise, if there is space left in the receive buffer, select() for
+            //   receiving data.
+            // * Hand off all complete messages to the processor, to be handled without
+            //   blocking here.
+
+            bool select_recv = !pnode->fPauseRecv;
+            bool select_send;
             {
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is space left in the receive buffer, select() for
-                //   receiving data.
-                // * Hand off all complete messages to the processor, to be handled without
-                //   blocking here.
-
-                bool select_recv = !pnode->fPauseRecv;
-                bool select_send;
-                {
-                    LOCK(pnode->cs_vSend);
-                    select_send = !pnode->vSendMsg.empty();
-                }
+                LOCK(pnode->cs_vSend);
+                select_send = !pnode->vSendMsg.empty();
+            }
 
-                LOCK(pnode->cs_hSocket);
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
+            LOCK(pnode->cs_hSocket);
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
 
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = std::max(hSocketMax, pnode->hSocket);
-                have_fds = true;
+#ifndef WIN32
+            // Sockets are not limited to FD_SETSIZE when epoll is available,
+            // but this is the fallback for when setting it up failed
+            if (pnode->hSocket >= FD_SETSIZE) {
+                LogPrintf("socket %d does not fit into an fd_set, disconnecting peer=%d\n", pnode->hSocket, pnode->GetId());
+                pnode->fDisconnect = true;
+                continue;
+            }
+#endif
 
-                if (select_send) {
-                    FD_SET(pnode->hSocket, &fdsetSend);
-                    continue;
-                }
-                if (select_recv) {
-                    FD_SET(pnode->hSocket, &fdsetRecv);
-                }
+            FD_SET(pnode->hSocket, &fdsetError);
+            hSocketMax = std::max(hSocketMax, pnode->hSocket);
+            have_fds = true;
+            vSockets.push_back(pnode->hSocket);
+
+            if (select_send) {
+                FD_SET(pnode->hSocket, &fdsetSend);
+                continue;
+            }
+            if (select_recv) {
+                FD_SET(pnode->hSocket, &fdsetRecv);
             }
         }
+    }
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
-        if (interruptNet)
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+                         &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    if (interruptNet)
+        return;
+
+    if (nSelect == SOCKET_ERROR)
+    {
+        if (have_fds)
+        {
+            int nErr = WSAGetLastError();
+            LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+            for (unsigned int i = 0; i <= hSocketMax; i++)
+                FD_SET(i, &fdsetRecv);
+        }
+        FD_ZERO(&fdsetSend);
+        FD_ZERO(&fdsetError);
+        if (!interruptNet.sleep_for(std::chrono::milliseconds(timeout.tv_usec/1000)))
             return;
+    }
+
+    for (SOCKET hSocket : vSockets) {
+        if (FD_ISSET(hSocket, &fdsetRecv))
+            recv_set.insert(hSocket);
+        if (FD_ISSET(hSocket, &fdsetSend))
+            send_set.insert(hSocket);
+        if (FD_ISSET(hSocket, &fdsetError))
+            error_set.insert(hSocket);
+    }
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+void CConnman::EpollAddNode(CNode* pnode)
+{
+    LOCK(pnode->cs_hSocket);
+    if (pnode->hSocket == INVALID_SOCKET)
+        return;
+
+    // Edge-triggered, the readiness reported is remembered on the node until
+    // the socket handler has used it up
+    struct epoll_event event = {};
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = pnode;
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, pnode->hSocket, &event) == SOCKET_ERROR) {
+        LogPrintf("socket epoll_ctl error %s, disconnecting peer=%d\n", NetworkErrorString(WSAGetLastError()), pnode->GetId());
+        pnode->fDisconnect = true;
+    }
+}
+
+void CConnman::QueueReadyNode(CNode* pnode)
+{
+    if (pnode->fSocketQueued)
+        return;
+    pnode->fSocketQueued = true;
+    pnode->AddRef();
+    m_epoll_ready.push_back(pnode);
+}
+
+void CConnman::SocketEventsEpoll(int nTimeout)
+{
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    int nEvents = epoll_wait(m_epoll_fd, events, MAX_EPOLL_EVENTS, nTimeout);
+    if (interruptNet)
+        return;
+
+    if (nEvents == SOCKET_ERROR) {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEINTR) {
+            LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(nErr));
+            interruptNet.sleep_for(std::chrono::milliseconds(SELECT_TIMEOUT_MILLISECONDS));
+        }
+        return;
+    }
 
-        if (nSelect == SOCKET_ERROR)
+    for (int i = 0; i < nEvents; i++)
+    {
+        void* ptr = events[i].data.ptr;
+        if (ptr == nullptr) {
+            // Wakeup pipe, drain it and take over the nodes other threads
+            // queued for us
+            m_wakeup_pending = false;
+            char buf[128];
+            while (read(m_wakeup_pipe[0], buf, sizeof(buf)) > 0) {}
+
+            std::vector<CNode*> vPending;
+            {
+                LOCK(cs_epoll_pending);
+                vPending.swap(m_epoll_pending);
+            }
+            for (CNode* pnode : vPending) {
+                pnode->fSocketWakePending = false;
+                QueueReadyNode(pnode);
+                pnode->Release();
+            }
+            continue;
+        }
+
+        bool fListenSocket = false;
+        for (const ListenSocket& hListenSocket : vhListenSocket) {
+            if (ptr == &hListenSocket) {
+                AcceptConnection(hListenSocket);
+                fListenSocket = true;
+                break;
+            }
+        }
+        if (fListenSocket)
+            continue;
+
+        // Nodes are only deleted by this thread, and closing their socket
+        // removes it from the epoll set, so the pointer is still valid here.
+        CNode* pnode = static_cast<CNode*>(ptr);
+        // The peer shutting down its side leaves data to read before recv()
+        // returns 0, so that is only a read, held back by fPauseRecv like
+        // any other
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP))
+            pnode->fSocketReadable = true;
+        if (events[i].events & EPOLLOUT)
+            pnode->fSocketWritable = true;
+        if (events[i].events & (EPOLLERR | EPOLLHUP))
+            pnode->fSocketError = true;
+        QueueReadyNode(pnode);
+    }
+}
+
+void CConnman::ServiceReadyNodes()
+{
+    std::vector<CNode*> vReady;
+    vReady.swap(m_epoll_ready);
+    for (CNode* pnode : vReady)
+    {
+        // Same order as with select(): drain the send buffer before
+        // receiving more
+        bool fSend;
+        {
+            LOCK(pnode->cs_vSend);
+            fSend = !pnode->vSendMsg.empty();
+        }
+        bool fRecv = !fSend && pnode->fSocketReadable && !pnode->fPauseRecv;
+        // An error is reported once, recv() picks it up and closes the socket
+        const bool fError = pnode->fSocketError;
+        pnode->fSocketError = false;
+        if (!interruptNet)
+            ServiceNodeSocket(pnode, fRecv, fSend && pnode->fSocketWritable, fError);
+
+        // Keep the node on the list while it has readiness left to use.
+        // Otherwise the next epoll edge or WakeSocketHandler() brings it back.
+        bool fMore;
+        {
+            LOCK(pnode->cs_vSend);
+            if (!pnode->vSendMsg.empty())
+                fMore = pnode->fSocketWritable;
+            else
+                fMore = pnode->fSocketReadable && !pnode->fPauseRecv;
+        }
         {
-            if (have_fds)
+            LOCK(pnode->cs_hSocket);
+            if (pnode->hSocket == INVALID_SOCKET)
+                fMore = false;
+        }
+
+        if (fMore && !interruptNet) {
+            m_epoll_ready.push_back(pnode);
+        } else {
+            pnode->fSocketQueued = false;
+            pnode->Release();
+        }
+    }
+}
+
+void CConnman::ThreadSocketHandlerEpoll()
+{
+    int64_t nLastHousekeeping = 0;
+    while (!interruptNet)
+    {
+        // Disconnecting nodes and the inactivity checks walk all nodes. They
+        // run on a timer, so that a wakeup only costs as much as the number
+        // of sockets that are ready.
+        int64_t nNow = GetTimeMillis();
+        if (nNow - nLastHousekeeping >= SELECT_TIMEOUT_MILLISECONDS) {
+            nLastHousekeeping = nNow;
+            DisconnectNodes();
+            NotifyNumConnectionsChanged();
+
+            std::vector<CNode*> vNodesCopy;
             {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
+                LOCK(cs_vNodes);
+                vNodesCopy = vNodes;
+                for (CNode* pnode : vNodesCopy)
+                    pnode->AddRef();
+            }
+            for (CNode* pnode : vNodesCopy)
+                InactivityCheck(pnode);
+            {
+                LOCK(cs_vNodes);
+                for (CNode* pnode : vNodesCopy)
+                    pnode->Release();
             }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            if (!interruptNet.sleep_for(std::chrono::milliseconds(timeout.tv_usec/1000)))
-                return;
         }
 
+        // Don't sleep while readiness reported earlier has not been used up
+        int nTimeout = 0;
+        if (m_epoll_ready.empty())
+            nTimeout = std::max<int64_t>(nLastHousekeeping + SELECT_TIMEOUT_MILLISECONDS - GetTimeMillis(), 0);
+
+        SocketEventsEpoll(nTimeout);
+        if (interruptNet)
+            return;
+
+        ServiceReadyNodes();
+    }
+}
+
+bool CConnman::InitEpoll()
+{
+    m_wakeup_pending = false;
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epoll_fd == -1)
+        return false;
+
+    if (pipe(m_wakeup_pipe) != 0) {
+        m_wakeup_pipe[0] = m_wakeup_pipe[1] = -1;
+        return false;
+    }
+    for (int fd : m_wakeup_pipe) {
+        if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) == -1)
+            return false;
+    }
+
+    // The wakeup pipe and listening sockets are level-triggered, sockets of
+    // nodes are registered edge-triggered by the socket handler.
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_wakeup_pipe[0], &event) == SOCKET_ERROR)
+        return false;
+
+    for (ListenSocket& hListenSocket : vhListenSocket) {
+        event.data.ptr = &hListenSocket;
+        if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, hListenSocket.socket, &event) == SOCKET_ERROR)
+            return false;
+    }
+
+    LogPrintf("Using epoll for socket events\n");
+    return true;
+}
+
+void CConnman::CloseEpoll()
+{
+    if (m_epoll_fd != -1)
+        close(m_epoll_fd);
+    m_epoll_fd = -1;
+    for (int& fd : m_wakeup_pipe) {
+        if (fd != -1)
+            close(fd);
+        fd = -1;
+    }
+}
+#endif
+
+void CConnman::WakeSocketHandler(CNode* pnode)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    if (m_epoll_fd == -1)
+        return;
+
+    if (pnode) {
+        if (pnode->fSocketWakePending.exchange(true))
+            return;
+        pnode->AddRef();
+        LOCK(cs_epoll_pending);
+        m_epoll_pending.push_back(pnode);
+    }
+
+    if (m_wakeup_pending.exchange(true))
+        return;
+
+    char buf = 0;
+    if (write(m_wakeup_pipe[1], &buf, 1) != 1)
+        m_wakeup_pending = false;
+#endif
+}
+
+bool ParseSocketBackend(const std::string& str, SocketBackend& backendRet)
+{
+    if (str == "select") {
+        backendRet = SocketBackend::SELECT;
+        return true;
+    }
+#ifdef HAVE_SYS_EPOLL_H
+    if (str == "epoll") {
+        backendRet = SocketBackend::EPOLL;
+        return true;
+    }
+#endif
+    return false;
+}
+
+std::string SocketBackendToString(SocketBackend backend)
+{
+    switch (backend) {
+    case SocketBackend::SELECT: return "select";
+    case SocketBackend::EPOLL: return "epoll";
+    }
+    assert(false);
+}
+
+std::string GetSupportedSocketBackends()
+{
+#ifdef HAVE_SYS_EPOLL_H
+    return "epoll, select";
+#else
+    return "select";
+#endif
+}
+
+void CConnman::InitSocketEvents()
+{
+#ifdef HAVE_SYS_EPOLL_H
+    if (m_socket_backend == SocketBackend::EPOLL && !InitEpoll()) {
+        LogPrintf("Failed to set up epoll: %s, falling back to select()\n", NetworkErrorString(WSAGetLastError()));
+        CloseEpoll();
+    }
+#endif
+    if (GetSocketBackend() == SocketBackend::SELECT)
+        LogPrintf("Using select() for socket events\n");
+}
+
+SocketBackend CConnman::GetSocketBackend() const
+{
+#ifdef HAVE_SYS_EPOLL_H
+    if (m_epoll_fd != -1)
+        return SocketBackend::EPOLL;
+#endif
+    return SocketBackend::SELECT;
+}
+
+void CConnman::ThreadSocketHandler()
+{
+#ifdef HAVE_SYS_EPOLL_H
+    if (m_epoll_fd != -1) {
+        ThreadSocketHandlerEpoll();
+        return;
+    }
+#endif
+
+    while (!interruptNet)
+    {
+        DisconnectNodes();
+        NotifyNumConnectionsChanged();
+
+        //
+        // Find which sockets have data to receive
+        //
+        std::set<SOCKET> recv_set;
+        std::set<SOCKET> send_set;
+        std::set<SOCKET> error_set;
+        SocketEventsSelect(recv_set, send_set, error_set);
+        if (interruptNet)
+            return;
+
         //
         // Accept new connections
         //
         for (const ListenSocket& hListenSocket : vhListenSocket)
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            if (hListenSocket.socket != INVALID_SOCKET && recv_set.count(hListenSocket.socket) > 0)
             {
                 AcceptConnection(hListenSocket);
             }
@@ -1324,9 +1862,6 @@ void CConnman::ThreadSocketHandler()
             if (interruptNet)
                 return;
 
-            //
-            // Receive
-            //
             bool recvSet = false;
             bool sendSet = false;
             bool errorSet = false;
@@ -1334,109 +1869,12 @@ void CConnman::ThreadSocketHandler()
                 LOCK(pnode->cs_hSocket);
                 if (pnode->hSocket == INVALID_SOCKET)
                     continue;
-                recvSet = FD_ISSET(pnode->hSocket, &fdsetRecv);
-                sendSet = FD_ISSET(pnode->hSocket, &fdsetSend);
-                errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
-            }
-            if (recvSet || errorSet)
-            {
-                // typical socket buffer is 8K-64K
-                char pchBuf[0x10000];
-                int nBytes = 0;
-                {
-                    LOCK(pnode->cs_hSocket);
-                    if (pnode->hSocket == INVALID_SOCKET)
-                        continue;
-                    nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                }
-                if (nBytes > 0)
-                {
-                    bool notify = false;
-                    if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
-                        pnode->CloseSocketDisconnect();
-                    RecordBytesRecv(nBytes);
-                    if (notify) {
-                        size_t nSizeAdded = 0;
-                        auto it(pnode->vRecvMsg.begin());
-                        for (; it != pnode->vRecvMsg.end(); ++it) {
-                            if (!it->complete())
-                                break;
-                            nSizeAdded += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
-                        }
-                        {
-                            LOCK(pnode->cs_vProcessMsg);
-                            pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), pnode->vRecvMsg, pnode->vRecvMsg.begin(), it);
-                            pnode->nProcessQueueSize += nSizeAdded;
-                            pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
-                        }
-                        WakeMessageHandler();
-                    }
-                }
-                else if (nBytes == 0)
-                {
-                    // socket closed gracefully
-                    if (!pnode->fDisconnect) {
-                        LogPrint(BCLog::NET, "socket closed\n");
-                    }
-                    pnode->CloseSocketDisconnect();
-                }
-                else if (nBytes < 0)
-                {
-                    // error
-                    int nErr = WSAGetLastError();
-                    if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
-                    {
-                        if (!pnode->fDisconnect)
-                            LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
-                        pnode->CloseSocketDisconnect();
-                    }
-                }
-            }
-
-            //
-            // Send
-            //
-            if (sendSet)
-            {
-                LOCK(pnode->cs_vSend);
-                size_t nBytes = SocketSendData(pnode);
-                if (nBytes) {
-                    RecordBytesSent(nBytes);
-                }
-            }
-
-            //
-            // Inactivity checking
-            //
-            int64_t nTime = GetSystemTimeInSeconds();
-            if (nTime - pnode->nTimeConnected > 60)
-            {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
-                {
-                    LogPrint(BCLog::NET, "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->GetId());
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
-                {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
-                {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                }
-                else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
-                {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
-                }
-                else if (!pnode->fSuccessfullyConnected)
-                {
-                    LogPrint(BCLog::NET, "version handshake timeout from %d\n", pnode->GetId());
-                    pnode->fDisconnect = true;
-                }
+                recvSet = recv_set.count(pnode->hSocket) > 0;
+                sendSet = send_set.count(pnode->hSocket) > 0;
+                errorSet = error_set.count(pnode->hSocket) > 0;
             }
+            ServiceNodeSocket(pnode, recvSet, sendSet, errorSet);
+            InactivityCheck(pnode);
         }
         {
             LOCK(cs_vNodes);
@@ -1450,9 +1888,9 @@ void CConnman::WakeMessageHandler()
 {
     {
         std::lock_guard<std::mutex> lock(mutexMsgProc);
-        fMsgProcWake = true;
+        nMsgProcWake++;
     }
-    condMsgProc.notify_one();
+    condMsgProc.notify_all();
 }
 
 
@@ -1992,14 +2430,23 @@ void CConnman::OpenNetworkConnection(const CAddress& addrConnect, bool fCountFai
         pnode->m_manual_connection = true;
 
     m_msgproc->InitializeNode(pnode);
+#ifdef HAVE_SYS_EPOLL_H
+    if (m_epoll_fd != -1)
+        EpollAddNode(pnode);
+#endif
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
     }
 }
 
-void CConnman::ThreadMessageHandler()
+void CConnman::ThreadMessageHandler(int nThread)
 {
+    // All message handler threads walk the full node list, skipping nodes
+    // that another thread is already processing. This keeps every peer's
+    // messages in order while letting a slow peer (or one with a large
+    // getdata backlog) hold up only the thread that is serving it.
+    uint64_t nWakeSeen = 0;
     while (!flagInterruptMsgProc)
     {
         std::vector<CNode*> vNodesCopy;
@@ -2013,22 +2460,35 @@ void CConnman::ThreadMessageHandler()
 
         bool fMoreWork = false;
 
-        for (CNode* pnode : vNodesCopy)
+        // Start each thread at a different offset so they don't all contend
+        // for the same nodes
+        const size_t nNodes = vNodesCopy.size();
+        const size_t nOffset = nNodes * nThread / nMessageHandlerThreads;
+        for (size_t i = 0; i < nNodes; i++)
         {
+            CNode* pnode = vNodesCopy[(nOffset + i) % nNodes];
             if (pnode->fDisconnect)
                 continue;
 
+            bool fExpected = false;
+            if (!pnode->fInMessageHandler.compare_exchange_strong(fExpected, true))
+                continue;
+
             // Receive messages
+            bool fPausedRecv = pnode->fPauseRecv;
             bool fMoreNodeWork = m_msgproc->ProcessMessages(pnode, flagInterruptMsgProc);
             fMoreWork |= (fMoreNodeWork && !pnode->fPauseSend);
-            if (flagInterruptMsgProc)
-                return;
+            // The socket handler stops reading from paused nodes, tell it to resume
+            if (fPausedRecv && !pnode->fPauseRecv)
+                WakeSocketHandler(pnode);
             // Send messages
-            {
+            if (!flagInterruptMsgProc) {
                 LOCK(pnode->cs_sendProcessing);
                 m_msgproc->SendMessages(pnode, flagInterruptMsgProc);
             }
 
+            pnode->fInMessageHandler = false;
+
             if (flagInterruptMsgProc)
                 return;
         }
@@ -2041,9 +2501,9 @@ void CConnman::ThreadMessageHandler()
 
         std::unique_lock<std::mutex> lock(mutexMsgProc);
         if (!fMoreWork) {
-            condMsgProc.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [this] { return fMsgProcWake; });
+            condMsgProc.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [this, nWakeSeen] { return nMsgProcWake != nWakeSeen || flagInterruptMsgProc; });
         }
-        fMsgProcWake = false;
+        nWakeSeen = nMsgProcWake;
     }
 }
 
@@ -2209,7 +2669,16 @@ CConnman::CConnman(uint64_t nSeed0In, uint64_t nSeed1In) : nSeed0(nSeed0In), nSe
     nSendBufferMaxSize = 0;
     nReceiveFloodSize = 0;
     flagInterruptMsgProc = false;
+    nMessageHandlerThreads = 1;
+    m_socket_backend = DEFAULT_SOCKET_BACKEND;
+    nPrevNodeCount = 0;
+    nMsgProcWake = 0;
     SetTryNewOutboundPeer(false);
+#ifdef HAVE_SYS_EPOLL_H
+    m_epoll_fd = -1;
+    m_wakeup_pipe[0] = m_wakeup_pipe[1] = -1;
+    m_wakeup_pending = false;
+#endif
 
     Options connOptions;
     Init(connOptions);
@@ -2336,9 +2805,11 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
 
     {
         std::unique_lock<std::mutex> lock(mutexMsgProc);
-        fMsgProcWake = false;
+        nMsgProcWake = 0;
     }
 
+    InitSocketEvents();
+
     // Send and receive from sockets, accept connections
     threadSocketHandler = std::thread(&TraceThread<std::function<void()> >, "net", std::function<void()>(std::bind(&CConnman::ThreadSocketHandler, this)));
 
@@ -2362,7 +2833,10 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
         threadOpenConnections = std::thread(&TraceThread<std::function<void()> >, "opencon", std::function<void()>(std::bind(&CConnman::ThreadOpenConnections, this, connOptions.m_specified_outgoing)));
 
     // Process messages
-    threadMessageHandler = std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this)));
+    for (int i = 0; i < nMessageHandlerThreads; i++) {
+        vThreadMessageHandler.emplace_back(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this, i)));
+    }
+    LogPrintf("Using %d message handler threads\n", nMessageHandlerThreads);
 
     // Dump network addresses
     scheduler.scheduleEvery(std::bind(&CConnman::DumpData, this), DUMP_ADDRESSES_INTERVAL * 1000);
@@ -2394,6 +2868,7 @@ void CConnman::Interrupt()
     condMsgProc.notify_all();
 
     interruptNet();
+    WakeSocketHandler();
     InterruptSocks5(true);
 
     if (semOutbound) {
@@ -2411,8 +2886,11 @@ void CConnman::Interrupt()
 
 void CConnman::Stop()
 {
-    if (threadMessageHandler.joinable())
-        threadMessageHandler.join();
+    for (std::thread& thread : vThreadMessageHandler) {
+        if (thread.joinable())
+            thread.join();
+    }
+    vThreadMessageHandler.clear();
     if (threadOpenConnections.joinable())
         threadOpenConnections.join();
     if (threadOpenAddedConnections.joinable())
@@ -2446,6 +2924,11 @@ void CConnman::Stop()
     vNodes.clear();
     vNodesDisconnected.clear();
     vhListenSocket.clear();
+#ifdef HAVE_SYS_EPOLL_H
+    m_epoll_ready.clear();
+    m_epoll_pending.clear();
+    CloseEpoll();
+#endif
     semOutbound.reset();
     semAddnode.reset();
 }
@@ -2747,6 +3230,13 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     nextSendTimeFeeFilter = 0;
     fPauseRecv = false;
     fPauseSend = false;
+    fInMessageHandler = false;
+    fSocketQueued = false;
+    fSocketWakePending = false;
+    // Assume the socket is ready until the socket handler learns otherwise
+    fSocketReadable = true;
+    fSocketWritable = true;
+    fSocketError = false;
     nProcessQueueSize = 0;
 
     for (const std::string &msg : getAllNetMessageTypes())
@@ -2804,21 +3294,27 @@ bool CConnman::NodeFullyConnected(const CNode* pnode)
     return pnode && pnode->fSuccessfullyConnected && !pnode->fDisconnect;
 }
 
+CSharedNetPayload::CSharedNetPayload(std::vector<unsigned char>&& dataIn) :
+    data(std::move(dataIn)), hash(Hash(data.begin(), data.end()))
+{
+}
+
 void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
 {
-    size_t nMessageSize = msg.data.size();
+    size_t nMessageSize = msg.shared_data ? msg.shared_data->data.size() : msg.data.size();
     size_t nTotalSize = nMessageSize + CMessageHeader::HEADER_SIZE;
     LogPrint(BCLog::NET, "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg.command.c_str()), nMessageSize, pnode->GetId());
 
     std::vector<unsigned char> serializedHeader;
     serializedHeader.reserve(CMessageHeader::HEADER_SIZE);
-    uint256 hash = Hash(msg.data.data(), msg.data.data() + nMessageSize);
+    uint256 hash = msg.shared_data ? msg.shared_data->hash : Hash(msg.data.data(), msg.data.data() + nMessageSize);
     CMessageHeader hdr(Params().MessageStart(), msg.command.c_str(), nMessageSize);
     memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
 
     CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, serializedHeader, 0, hdr};
 
     size_t nBytesSent = 0;
+    bool fWakeSocketHandler = false;
     {
         LOCK(pnode->cs_vSend);
         bool optimisticSend(pnode->vSendMsg.empty());
@@ -2829,16 +3325,25 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
 
         if (pnode->nSendSize > nSendBufferMaxSize)
             pnode->fPauseSend = true;
-        pnode->vSendMsg.push_back(std::move(serializedHeader));
-        if (nMessageSize)
-            pnode->vSendMsg.push_back(std::move(msg.data));
+        pnode->vSendMsg.emplace_back(std::move(serializedHeader));
+        if (nMessageSize) {
+            if (msg.shared_data)
+                pnode->vSendMsg.emplace_back(std::move(msg.shared_data));
+            else
+                pnode->vSendMsg.emplace_back(std::move(msg.data));
+        }
 
         // If write queue empty, attempt "optimistic write"
-        if (optimisticSend == true)
+        if (optimisticSend == true) {
             nBytesSent = SocketSendData(pnode);
+            // The socket handler has to take over sending the rest
+            fWakeSocketHandler = !pnode->vSendMsg.empty();
+        }
     }
     if (nBytesSent)
         RecordBytesSent(nBytesSent);
+    if (fWakeSocketHandler)
+        WakeSocketHandler(pnode);
 }
 
 bool CConnman::ForNode(NodeId id, std::function<bool(CNode* pnode)> func)
@@ -24,6 +24,7 @@
 
 #include <atomic>
 #include <deque>
+#include <set>
 #include <stdint.h>
 #include <thread>
 #include <memory>
@@ -84,6 +85,23 @@ static const bool DEFAULT_FORCEDNSSEED = false;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
 
+/** -msghandlerthreads default */
+static const int DEFAULT_MESSAGE_HANDLER_THREADS = 1;
+/** Maximum number of message handler threads */
+static const int MAX_MESSAGE_HANDLER_THREADS = 16;
+
+/** How the socket handler waits for socket events */
+enum class SocketBackend {
+    SELECT,
+    EPOLL,
+};
+/** -socketbackend default */
+#ifdef HAVE_SYS_EPOLL_H
+static const SocketBackend DEFAULT_SOCKET_BACKEND = SocketBackend::EPOLL;
+#else
+static const SocketBackend DEFAULT_SOCKET_BACKEND = SocketBackend::SELECT;
+#endif
+
 // NOTE: When adjusting this, update rpcnet:setban's help ("24h")
 static const unsigned int DEFAULT_MISBEHAVING_BANTIME = 60 * 60 * 24;  // Default 24-hour ban
 
@@ -102,6 +120,19 @@ struct AddedNodeInfo
 class CNodeStats;
 class CClientUIInterface;
 
+/**
+ * A message payload that is sent to several peers without being copied, such
+ * as a cached serialized block. The checksum for the message header is
+ * computed once along with it.
+ */
+struct CSharedNetPayload
+{
+    explicit CSharedNetPayload(std::vector<unsigned char>&& dataIn);
+
+    const std::vector<unsigned char> data;
+    const uint256 hash;
+};
+
 struct CSerializedNetMsg
 {
     CSerializedNetMsg() = default;
@@ -112,9 +143,24 @@ struct CSerializedNetMsg
     CSerializedNetMsg& operator=(const CSerializedNetMsg&) = delete;
 
     std::vector<unsigned char> data;
+    //! Payload shared with other messages, sent instead of data when set
+    std::shared_ptr<const CSharedNetPayload> shared_data;
     std::string command;
 };
 
+/** Bytes queued for sending to a peer. Messages own their bytes, except for
+ * payloads shared with the send queues of other peers. */
+struct CSendBuffer
+{
+    explicit CSendBuffer(std::vector<unsigned char>&& dataIn) : data(std::move(dataIn)) {}
+    explicit CSendBuffer(std::shared_ptr<const CSharedNetPayload> sharedIn) : shared(std::move(sharedIn)) {}
+
+    const std::vector<unsigned char>& Get() const { return shared ? shared->data : data; }
+
+    std::vector<unsigned char> data;
+    std::shared_ptr<const CSharedNetPayload> shared;
+};
+
 class NetEventsInterface;
 class CConnman
 {
@@ -137,6 +183,8 @@ public:
         int nBestHeight = 0;
         CClientUIInterface* uiInterface = nullptr;
         NetEventsInterface* m_msgproc = nullptr;
+        int nMessageHandlerThreads = 1;
+        SocketBackend m_socket_backend = DEFAULT_SOCKET_BACKEND;
         unsigned int nSendBufferMaxSize = 0;
         unsigned int nReceiveFloodSize = 0;
         uint64_t nMaxOutboundTimeframe = 0;
@@ -158,6 +206,8 @@ public:
         nBestHeight = connOptions.nBestHeight;
         clientInterface = connOptions.uiInterface;
         m_msgproc = connOptions.m_msgproc;
+        nMessageHandlerThreads = std::max(1, std::min(connOptions.nMessageHandlerThreads, MAX_MESSAGE_HANDLER_THREADS));
+        m_socket_backend = connOptions.m_socket_backend;
         nSendBufferMaxSize = connOptions.nSendBufferMaxSize;
         nReceiveFloodSize = connOptions.nReceiveFloodSize;
         {
@@ -178,6 +228,8 @@ public:
     void Stop();
     void Interrupt();
     bool GetNetworkActive() const { return fNetworkActive; };
+    /** The backend the socket handler waits with, select() if epoll could not be set up */
+    SocketBackend GetSocketBackend() const;
     void SetNetworkActive(bool active);
     void OpenNetworkConnection(const CAddress& addrConnect, bool fCountFailure, CSemaphoreGrant *grantOutbound = nullptr, const char *strDest = nullptr, bool fOneShot = false, bool fFeeler = false, bool manual_connection = false);
     bool CheckIncomingNonce(uint64_t nonce);
@@ -331,8 +383,26 @@ private:
     void AddOneShot(const std::string& strDest);
     void ProcessOneShot();
     void ThreadOpenConnections(std::vector<std::string> connect);
-    void ThreadMessageHandler();
+    void ThreadMessageHandler(int nThread);
     void AcceptConnection(const ListenSocket& hListenSocket);
+    void DisconnectNodes();
+    void NotifyNumConnectionsChanged();
+    void InactivityCheck(CNode* pnode);
+    void ServiceNodeSocket(CNode* pnode, bool fRecv, bool fSend, bool fError);
+    void SocketEventsSelect(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set);
+#ifdef HAVE_SYS_EPOLL_H
+    bool InitEpoll();
+    void CloseEpoll();
+    void EpollAddNode(CNode* pnode);
+    void QueueReadyNode(CNode* pnode);
+    void SocketEventsEpoll(int nTimeout);
+    void ServiceReadyNodes();
+    void ThreadSocketHandlerEpoll();
+#endif
+    /** Set up the -socketbackend backend, falling back to select() */
+    void InitSocketEvents();
+    /** Wake up the socket handler, and with epoll have it service pnode */
+    void WakeSocketHandler(CNode* pnode = nullptr);
     void ThreadSocketHandler();
     void ThreadDNSAddressSeed();
 
@@ -390,6 +460,8 @@ private:
 
     std::vector<ListenSocket> vhListenSocket;
     std::atomic<bool> fNetworkActive;
+    /** Connection count last reported to the UI, only used by the socket handler */
+    unsigned int nPrevNodeCount;
     banmap_t setBanned;
     CCriticalSection cs_setBanned;
     bool setBannedIsDirty;
@@ -416,11 +488,18 @@ private:
     CClientUIInterface* clientInterface;
     NetEventsInterface* m_msgproc;
 
+    /** Number of threads running ThreadMessageHandler */
+    int nMessageHandlerThreads;
+
+    /** Backend requested with -socketbackend */
+    SocketBackend m_socket_backend;
+
     /** SipHasher seeds for deterministic randomness */
     const uint64_t nSeed0, nSeed1;
 
-    /** flag for waking the message processor. */
-    bool fMsgProcWake;
+    /** counter for waking the message processors, each thread waits for it
+     * to change from the value it last saw. Protected by mutexMsgProc. */
+    uint64_t nMsgProcWake;
 
     std::condition_variable condMsgProc;
     std::mutex mutexMsgProc;
@@ -428,11 +507,26 @@ private:
 
     CThreadInterrupt interruptNet;
 
+#ifdef HAVE_SYS_EPOLL_H
+    /** epoll instance used by the socket handler, -1 when falling back to select() */
+    int m_epoll_fd;
+    /** pipe used to wake up the socket handler out of epoll_wait() */
+    int m_wakeup_pipe[2];
+    std::atomic<bool> m_wakeup_pending;
+    /** Nodes with socket readiness left to use, each holding a reference.
+     * Only used by the socket handler thread. */
+    std::vector<CNode*> m_epoll_ready;
+    /** Nodes other threads want the socket handler to service, each holding
+     * a reference */
+    std::vector<CNode*> m_epoll_pending;
+    CCriticalSection cs_epoll_pending;
+#endif
+
     std::thread threadDNSAddressSeed;
     std::thread threadSocketHandler;
     std::thread threadOpenAddedConnections;
     std::thread threadOpenConnections;
-    std::thread threadMessageHandler;
+    std::vector<std::thread> vThreadMessageHandler;
 
     /** flag for deciding to connect to an extra outbound peer,
      *  in excess of nMaxOutbound
@@ -442,6 +536,12 @@ private:
     friend struct CConnmanTest;
 };
 extern std::unique_ptr<CConnman> g_connman;
+/** Parse a -socketbackend value, false if it is unknown or not available on this platform */
+bool ParseSocketBackend(const std::string& str, SocketBackend& backendRet);
+std::string SocketBackendToString(SocketBackend backend);
+/** Comma separated list of the -socketbackend values available on this platform */
+std::string GetSupportedSocketBackends();
+
 void Discover(boost::thread_group& threadGroup);
 void MapPort(bool fUseUPnP);
 unsigned short GetListenPort();
@@ -554,6 +654,31 @@ public:
 
 
 
+/** Payloads at least this large are received into pooled buffers */
+static const unsigned int RECV_BUFFER_POOL_MIN_SIZE = 256 * 1024;
+/** Maximum total capacity of idle pooled receive buffers */
+static const size_t RECV_BUFFER_POOL_MAX_BYTES = 16 * 1000 * 1000;
+
+/**
+ * Idle receive buffers kept for reuse by large messages. During IBD every
+ * peer sends a stream of multi-MB block messages; reusing their buffers
+ * avoids growing (and copying) a new one for each message as data arrives
+ * and wiping it again when the message is freed.
+ */
+class CNetMessageBufferPool
+{
+public:
+    /** Swap in the best idle buffer for a message of nMessageSize, if any */
+    void Get(CSerializeData& vch, unsigned int nMessageSize);
+    /** Keep vch for reuse if it is large enough and the pool isn't full */
+    void Put(CSerializeData& vch);
+
+private:
+    CCriticalSection cs;
+    std::vector<CSerializeData> vBuffer;
+    size_t nBytes = 0;
+};
+
 class CNetMessage {
 private:
     mutable CHash256 hasher;
@@ -578,6 +703,12 @@ public:
         nTime = 0;
     }
 
+    CNetMessage(CNetMessage&&) = default;
+    CNetMessage& operator=(CNetMessage&&) = default;
+
+    // Returns a pooled receive buffer to the pool
+    ~CNetMessage();
+
     bool complete() const
     {
         if (!in_data)
@@ -609,7 +740,7 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<std::vector<unsigned char>> vSendMsg;
+    std::deque<CSendBuffer> vSendMsg;
     CCriticalSection cs_vSend;
     CCriticalSection cs_hSocket;
     CCriticalSection cs_vRecv;
@@ -620,6 +751,10 @@ public:
 
     CCriticalSection cs_sendProcessing;
 
+    // Set while a message handler thread owns this node. A node is only ever
+    // processed by one thread at a time so its messages are handled in order.
+    std::atomic_bool fInMessageHandler;
+
     std::deque<CInv> vRecvGetData;
     uint64_t nRecvBytes;
     std::atomic<int> nRecvVersion;
@@ -661,6 +796,15 @@ public:
     const uint64_t nKeyedNetGroup;
     std::atomic_bool fPauseRecv;
     std::atomic_bool fPauseSend;
+
+    // Socket readiness reported by the (edge-triggered) epoll socket
+    // handler, only used by the socket handler thread. fSocketQueued is set
+    // while the node is on the handler's ready list.
+    bool fSocketQueued;
+    std::atomic_bool fSocketWakePending;
+    bool fSocketReadable;
+    bool fSocketWritable;
+    bool fSocketError;
 protected:
 
     mapMsgCmdSize mapSendBytesPerMsgCmd;
@@ -671,6 +815,9 @@ public:
     std::atomic<int> nStartingHeight;
 
     // flood relay
+    // vAddrToSend and addrKnown are also updated while relaying addresses
+    // received from other peers, so they are protected by cs_addrToSend.
+    CCriticalSection cs_addrToSend;
     std::vector<CAddress> vAddrToSend;
     CRollingBloomFilter addrKnown;
     bool fGetAddr;
@@ -793,6 +940,7 @@ public:
 
     void AddAddressKnown(const CAddress& _addr)
     {
+        LOCK(cs_addrToSend);
         addrKnown.insert(_addr.GetKey());
     }
 
@@ -801,6 +949,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_addrToSend);
         if (_addr.IsValid() && !addrKnown.contains(_addr.GetKey())) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand.randrange(vAddrToSend.size())] = _addr;
@@ -69,6 +69,9 @@ static const int STALE_RELAY_AGE_LIMIT = 30 * 24 * 60 * 60;
 /// limiting block relay. Set to one week, denominated in seconds.
 static const int HISTORICAL_BLOCK_AGE = 7 * 24 * 60 * 60;
 
+/// Maximum total size of the serialized blocks cached for serving getdata.
+static const size_t MAX_SERIALIZED_BLOCK_CACHE_SIZE = 64 * 1000 * 1000;
+
 // Internal stuff
 namespace {
     /** Number of nodes with fSyncStarted. */
@@ -1057,6 +1060,115 @@ static void RelayAddress(const CAddress& addr, bool fReachable, CConnman* connma
     connman->ForEachNodeThen(std::move(sortfunc), std::move(pushfunc));
 }
 
+/**
+ * LRU cache of serialized blocks sent in response to getdata. Entries are
+ * keyed by block hash and the transaction serialization flags they were
+ * serialized with, so peers downloading the same blocks during IBD share
+ * one copy of each encoding instead of every request reading, deserializing
+ * and re-serializing the block.
+ */
+class CSerializedBlockCache
+{
+public:
+    typedef std::shared_ptr<const CSharedNetPayload> Data;
+
+    Data Get(const uint256& hash, int nFlags)
+    {
+        LOCK(cs);
+        auto it = mapEntry.find(Key(hash, nFlags));
+        if (it == mapEntry.end())
+            return nullptr;
+
+        // Move to the front of the list (most recently used)
+        listEntry.splice(listEntry.begin(), listEntry, it->second);
+        return it->second->second;
+    }
+
+    void Insert(const uint256& hash, int nFlags, const Data& data)
+    {
+        if (data->data.size() > MAX_SERIALIZED_BLOCK_CACHE_SIZE)
+            return;
+
+        LOCK(cs);
+        const Key key(hash, nFlags);
+        if (mapEntry.count(key))
+            return;
+
+        listEntry.emplace_front(key, data);
+        mapEntry[key] = listEntry.begin();
+        nSize += data->data.size();
+
+        // Evict least recently used entries
+        while (nSize > MAX_SERIALIZED_BLOCK_CACHE_SIZE) {
+            nSize -= listEntry.back().second->data.size();
+            mapEntry.erase(listEntry.back().first);
+            listEntry.pop_back();
+        }
+    }
+
+private:
+    typedef std::pair<uint256, int> Key;
+    typedef std::list<std::pair<Key, Data>> EntryList;
+
+    CCriticalSection cs;
+    EntryList listEntry;
+    std::map<Key, EntryList::iterator> mapEntry;
+    size_t nSize = 0;
+};
+
+static CSerializedBlockCache serializedBlockCache;
+
+/**
+ * Return the block with the given hash stored at pos, using pblockRecent if
+ * it is the same block. Doesn't need cs_main, returns nullptr if the block
+ * can't be read, for example because it was pruned since pos was looked up.
+ */
+static std::shared_ptr<const CBlock> GetBlockForGetData(const uint256& hash, const CDiskBlockPos& pos, const std::shared_ptr<const CBlock>& pblockRecent, const Consensus::Params& consensusParams)
+{
+    if (pblockRecent && pblockRecent->GetHash() == hash)
+        return pblockRecent;
+
+    std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
+    if (!ReadBlockFromDisk(*pblockRead, pos, consensusParams) || pblockRead->GetHash() != hash)
+        return nullptr;
+    return pblockRead;
+}
+
+/**
+ * Send the block with the given hash stored at pos serialized with
+ * nSendFlags. Blocks are stored on disk with witness and drivechain data, so
+ * when the peer wants both the bytes are read from disk and sent as they
+ * are. The serialized block and its checksum are shared between the cache
+ * and the send queues of the peers it is sent to. Doesn't need cs_main,
+ * returns false if the block can't be read.
+ */
+static bool PushSerializedBlock(CNode* pfrom, CConnman* connman, const uint256& hash, const CDiskBlockPos& pos, int nSendFlags, const std::shared_ptr<const CBlock>& pblockRecent, const Consensus::Params& consensusParams)
+{
+    nSendFlags &= SERIALIZE_TRANSACTION_NO_WITNESS | SERIALIZE_TRANSACTION_NO_DRIVECHAIN;
+
+    CSerializedBlockCache::Data data = serializedBlockCache.Get(hash, nSendFlags);
+    if (!data) {
+        std::vector<unsigned char> vch;
+        if (nSendFlags == 0 && !(pblockRecent && pblockRecent->GetHash() == hash)) {
+            if (!ReadRawBlockFromDisk(vch, pos, hash, Params().MessageStart()))
+                return false;
+        } else {
+            std::shared_ptr<const CBlock> pblock = GetBlockForGetData(hash, pos, pblockRecent, consensusParams);
+            if (!pblock)
+                return false;
+            CVectorWriter(SER_NETWORK, PROTOCOL_VERSION | nSendFlags, vch, 0, *pblock);
+        }
+        data = std::make_shared<const CSharedNetPayload>(std::move(vch));
+        serializedBlockCache.Insert(hash, nSendFlags, data);
+    }
+
+    CSerializedNetMsg msg;
+    msg.command = NetMsgType::BLOCK;
+    msg.shared_data = std::move(data);
+    connman->PushMessage(pfrom, std::move(msg));
+    return true;
+}
+
 void static ProcessGetBlockData(CNode* pfrom, const Consensus::Params& consensusParams, const CInv& inv, CConnman* connman, const std::atomic<bool>& interruptMsgProc)
 {
     bool send = false;
@@ -1092,118 +1204,142 @@ void static ProcessGetBlockData(CNode* pfrom, const Consensus::Params& consensus
         ActivateBestChain(dummy, Params(), a_recent_block);
     }
 
-    LOCK(cs_main);
-    BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
-    if (mi != mapBlockIndex.end()) {
-        send = BlockRequestAllowed(mi->second, consensusParams);
-        if (!send) {
-            LogPrint(BCLog::NET, "%s: ignoring request from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
-        }
-    }
-    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
-    // disconnect node in case we have reached the outbound limit for serving historical blocks
-    // never disconnect whitelisted nodes
-    if (send && connman->OutboundTargetReached(true) && ( ((pindexBestHeader != nullptr) && (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() > HISTORICAL_BLOCK_AGE)) || inv.type == MSG_FILTERED_BLOCK) && !pfrom->fWhitelisted)
+    // Decide whether to send the block and collect what is needed to send
+    // it under cs_main. Reading, serializing and pushing it happen after
+    // releasing cs_main; the block index entry stays valid, but a pruned
+    // block may be gone by then.
+    CDiskBlockPos pos;
+    bool fCmpctDirect = false;
+    bool fPeerWantsWitness = false;
+    int nCmpctSendFlags = 0;
+    uint256 hashContinueTip;
     {
-        LogPrint(BCLog::NET, "historical block serving limit reached, disconnect peer=%d\n", pfrom->GetId());
-
-        //disconnect node
-        pfrom->fDisconnect = true;
-        send = false;
-    }
-    // Avoid leaking prune-height by never sending blocks below the NODE_NETWORK_LIMITED threshold
-    if (send && !pfrom->fWhitelisted && (
-            (((pfrom->GetLocalServices() & NODE_NETWORK_LIMITED) == NODE_NETWORK_LIMITED) && ((pfrom->GetLocalServices() & NODE_NETWORK) != NODE_NETWORK) && (chainActive.Tip()->nHeight - mi->second->nHeight > (int)NODE_NETWORK_LIMITED_MIN_BLOCKS + 2 /* add two blocks buffer extension for possible races */) )
-       )) {
-        LogPrint(BCLog::NET, "Ignore block request below NODE_NETWORK_LIMITED threshold from peer=%d\n", pfrom->GetId());
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
+        if (mi != mapBlockIndex.end()) {
+            send = BlockRequestAllowed(mi->second, consensusParams);
+            if (!send) {
+                LogPrint(BCLog::NET, "%s: ignoring request from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
+            }
+        }
+        // disconnect node in case we have reached the outbound limit for serving historical blocks
+        // never disconnect whitelisted nodes
+        if (send && connman->OutboundTargetReached(true) && ( ((pindexBestHeader != nullptr) && (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() > HISTORICAL_BLOCK_AGE)) || inv.type == MSG_FILTERED_BLOCK) && !pfrom->fWhitelisted)
+        {
+            LogPrint(BCLog::NET, "historical block serving limit reached, disconnect peer=%d\n", pfrom->GetId());
 
-        //disconnect node and prevent it from stalling (would otherwise wait for the missing block)
-        pfrom->fDisconnect = true;
-        send = false;
-    }
-    // Pruned nodes may have deleted the block, so check whether
-    // it's available before trying to send.
-    if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
-    {
-        std::shared_ptr<const CBlock> pblock;
-        if (a_recent_block && a_recent_block->GetHash() == (*mi).second->GetBlockHash()) {
-            pblock = a_recent_block;
-        } else {
-            // Send block from disk
-            std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
-            if (!ReadBlockFromDisk(*pblockRead, (*mi).second, consensusParams))
-                assert(!"cannot load block from disk");
-            pblock = pblockRead;
+            //disconnect node
+            pfrom->fDisconnect = true;
+            send = false;
         }
-        if (inv.type == MSG_BLOCK) {
-            connman->PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS | SERIALIZE_TRANSACTION_NO_DRIVECHAIN, NetMsgType::BLOCK, *pblock));
+        // Avoid leaking prune-height by never sending blocks below the NODE_NETWORK_LIMITED threshold
+        if (send && !pfrom->fWhitelisted && (
+                (((pfrom->GetLocalServices() & NODE_NETWORK_LIMITED) == NODE_NETWORK_LIMITED) && ((pfrom->GetLocalServices() & NODE_NETWORK) != NODE_NETWORK) && (chainActive.Tip()->nHeight - mi->second->nHeight > (int)NODE_NETWORK_LIMITED_MIN_BLOCKS + 2 /* add two blocks buffer extension for possible races */) )
+           )) {
+            LogPrint(BCLog::NET, "Ignore block request below NODE_NETWORK_LIMITED threshold from peer=%d\n", pfrom->GetId());
+
+            //disconnect node and prevent it from stalling (would otherwise wait for the missing block)
+            pfrom->fDisconnect = true;
+            send = false;
         }
-        else if (inv.type == MSG_WITNESS_BLOCK) {
-            connman->PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_DRIVECHAIN, NetMsgType::BLOCK, *pblock));
+        // Pruned nodes may have deleted the block, so check whether
+        // it's available before trying to send.
+        if (!send || !(mi->second->nStatus & BLOCK_HAVE_DATA))
+            return;
+
+        pos = mi->second->GetBlockPos();
+        if (inv.type == MSG_CMPCT_BLOCK) {
+            fPeerWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
+            nCmpctSendFlags = fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
+            if (!State(pfrom->GetId())->fHaveDrivechain)
+                nCmpctSendFlags |= SERIALIZE_TRANSACTION_NO_DRIVECHAIN;
+            fCmpctDirect = CanDirectFetch(consensusParams) && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH;
         }
-        else if (inv.type == MSG_DRIVECHAIN_BLOCK) {
-            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, *pblock));
+
+        // Trigger the peer node to send a getblocks request for the next batch of inventory
+        if (inv.hash == pfrom->hashContinue) {
+            hashContinueTip = chainActive.Tip()->GetBlockHash();
+            pfrom->hashContinue.SetNull();
         }
-        else if (inv.type == MSG_FILTERED_BLOCK)
-        {
-            bool sendMerkleBlock = false;
-            CMerkleBlock merkleBlock;
-            {
-                LOCK(pfrom->cs_filter);
-                if (pfrom->pfilter) {
-                    sendMerkleBlock = true;
-                    merkleBlock = CMerkleBlock(*pblock, *pfrom->pfilter);
-                }
-            }
-            if (sendMerkleBlock) {
-                connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::MERKLEBLOCK, merkleBlock));
-                // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
-                // This avoids hurting performance by pointlessly requiring a round-trip
-                // Note that there is currently no way for a node to request any single transactions we didn't send here -
-                // they must either disconnect and retry or request the full block.
-                // Thus, the protocol spec specified allows for us to provide duplicate txn here,
-                // however we MUST always provide at least what the remote peer needs
-                typedef std::pair<unsigned int, uint256> PairType;
-                for (PairType& pair : merkleBlock.vMatchedTxn)
-                    connman->PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS | SERIALIZE_TRANSACTION_NO_DRIVECHAIN, NetMsgType::TX, *pblock->vtx[pair.first]));
-            }
-            // else
-                // no response
-        }
-        else if (inv.type == MSG_CMPCT_BLOCK)
-        {
-            // If a peer is asking for old blocks, we're almost guaranteed
-            // they won't have a useful mempool to match against a compact block,
-            // and we don't feel like constructing the object for them, so
-            // instead we respond with the full, non-compact block.
-            bool fPeerWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
-            bool fPeerWantsDrivechain = State(pfrom->GetId())->fHaveDrivechain;
-            int nSendFlags = fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
-            if (!fPeerWantsDrivechain)
-                nSendFlags |= SERIALIZE_TRANSACTION_NO_DRIVECHAIN;
-            if (CanDirectFetch(consensusParams) && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
-                if ((fPeerWantsWitness || !fWitnessesPresentInARecentCompactBlock) && a_recent_compact_block && a_recent_compact_block->header.GetHash() == mi->second->GetBlockHash()) {
-                    connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *a_recent_compact_block));
-                } else {
+    } // release cs_main
+
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    bool fRead = true;
+    if (inv.type == MSG_BLOCK) {
+        fRead = PushSerializedBlock(pfrom, connman, inv.hash, pos, SERIALIZE_TRANSACTION_NO_WITNESS | SERIALIZE_TRANSACTION_NO_DRIVECHAIN, a_recent_block, consensusParams);
+    }
+    else if (inv.type == MSG_WITNESS_BLOCK) {
+        fRead = PushSerializedBlock(pfrom, connman, inv.hash, pos, SERIALIZE_TRANSACTION_NO_DRIVECHAIN, a_recent_block, consensusParams);
+    }
+    else if (inv.type == MSG_DRIVECHAIN_BLOCK) {
+        fRead = PushSerializedBlock(pfrom, connman, inv.hash, pos, 0, a_recent_block, consensusParams);
+    }
+    else if (inv.type == MSG_FILTERED_BLOCK)
+    {
+        std::shared_ptr<const CBlock> pblock = GetBlockForGetData(inv.hash, pos, a_recent_block, consensusParams);
+        fRead = pblock != nullptr;
+        bool sendMerkleBlock = false;
+        CMerkleBlock merkleBlock;
+        if (pblock) {
+            LOCK(pfrom->cs_filter);
+            if (pfrom->pfilter) {
+                sendMerkleBlock = true;
+                merkleBlock = CMerkleBlock(*pblock, *pfrom->pfilter);
+            }
+        }
+        if (sendMerkleBlock) {
+            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::MERKLEBLOCK, merkleBlock));
+            // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
+            // This avoids hurting performance by pointlessly requiring a round-trip
+            // Note that there is currently no way for a node to request any single transactions we didn't send here -
+            // they must either disconnect and retry or request the full block.
+            // Thus, the protocol spec specified allows for us to provide duplicate txn here,
+            // however we MUST always provide at least what the remote peer needs
+            typedef std::pair<unsigned int, uint256> PairType;
+            for (PairType& pair : merkleBlock.vMatchedTxn)
+                connman->PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS | SERIALIZE_TRANSACTION_NO_DRIVECHAIN, NetMsgType::TX, *pblock->vtx[pair.first]));
+        }
+        // else
+            // no response
+    }
+    else if (inv.type == MSG_CMPCT_BLOCK)
+    {
+        // If a peer is asking for old blocks, we're almost guaranteed
+        // they won't have a useful mempool to match against a compact block,
+        // and we don't feel like constructing the object for them, so
+        // instead we respond with the full, non-compact block.
+        if (fCmpctDirect) {
+            if ((fPeerWantsWitness || !fWitnessesPresentInARecentCompactBlock) && a_recent_compact_block && a_recent_compact_block->header.GetHash() == inv.hash) {
+                connman->PushMessage(pfrom, msgMaker.Make(nCmpctSendFlags, NetMsgType::CMPCTBLOCK, *a_recent_compact_block));
+            } else {
+                std::shared_ptr<const CBlock> pblock = GetBlockForGetData(inv.hash, pos, a_recent_block, consensusParams);
+                fRead = pblock != nullptr;
+                if (pblock) {
                     CBlockHeaderAndShortTxIDs cmpctblock(*pblock, fPeerWantsWitness);
-                    connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
+                    connman->PushMessage(pfrom, msgMaker.Make(nCmpctSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
                 }
-            } else {
-                connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCK, *pblock));
             }
+        } else {
+            fRead = PushSerializedBlock(pfrom, connman, inv.hash, pos, nCmpctSendFlags, a_recent_block, consensusParams);
         }
+    }
 
-        // Trigger the peer node to send a getblocks request for the next batch of inventory
-        if (inv.hash == pfrom->hashContinue)
-        {
-            // Bypass PushInventory, this must send even if redundant,
-            // and we want it right after the last block so they don't
-            // wait for other stuff first.
-            std::vector<CInv> vInv;
-            vInv.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
-            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::INV, vInv));
-            pfrom->hashContinue.SetNull();
-        }
+    if (!fRead) {
+        // Most likely pruned after we checked for it. The peer would wait
+        // for the block forever, so disconnect it.
+        LogPrint(BCLog::NET, "%s: cannot load block %s from disk, disconnect peer=%d\n", __func__, inv.hash.ToString(), pfrom->GetId());
+        pfrom->fDisconnect = true;
+        return;
+    }
+
+    if (!hashContinueTip.IsNull())
+    {
+        // Bypass PushInventory, this must send even if redundant,
+        // and we want it right after the last block so they don't
+        // wait for other stuff first.
+        std::vector<CInv> vInv;
+        vInv.push_back(CInv(MSG_BLOCK, hashContinueTip));
+        connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::INV, vInv));
     }
 }
 
@@ -1214,43 +1350,45 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
     std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
     std::vector<CInv> vNotFound;
     const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
-    {
-        LOCK(cs_main);
 
-        while (it != pfrom->vRecvGetData.end() && (it->type == MSG_TX || it->type == MSG_WITNESS_TX || it->type == MSG_DRIVECHAIN_TX)) {
-            if (interruptMsgProc)
-                return;
-            // Don't bother if send buffer is too full to respond anyway
-            if (pfrom->fPauseSend)
-                break;
+    while (it != pfrom->vRecvGetData.end() && (it->type == MSG_TX || it->type == MSG_WITNESS_TX || it->type == MSG_DRIVECHAIN_TX)) {
+        if (interruptMsgProc)
+            return;
+        // Don't bother if send buffer is too full to respond anyway
+        if (pfrom->fPauseSend)
+            break;
 
-            const CInv &inv = *it;
-            it++;
+        const CInv &inv = *it;
+        it++;
 
+        // Only the lookup needs cs_main, serialize and push without it
+        CTransactionRef tx;
+        {
+            LOCK(cs_main);
             // Send stream from relay memory
-            bool push = false;
             auto mi = mapRelay.find(inv.hash);
-            int nSendFlags = (inv.type == MSG_TX ? SERIALIZE_TRANSACTION_NO_WITNESS : 0);
-            if (inv.type != MSG_DRIVECHAIN_TX) {
-                nSendFlags |= SERIALIZE_TRANSACTION_NO_DRIVECHAIN;
-            }
             if (mi != mapRelay.end()) {
-                connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::TX, *mi->second));
-                push = true;
+                tx = mi->second;
             } else if (pfrom->timeLastMempoolReq) {
                 auto txinfo = mempool.info(inv.hash);
                 // To protect privacy, do not answer getdata using the mempool when
                 // that TX couldn't have been INVed in reply to a MEMPOOL request.
                 if (txinfo.tx && txinfo.nTime <= pfrom->timeLastMempoolReq) {
-                    connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::TX, *txinfo.tx));
-                    push = true;
+                    tx = txinfo.tx;
                 }
             }
-            if (!push) {
-                vNotFound.push_back(inv);
-            }
         }
-    } // release cs_main
+
+        int nSendFlags = (inv.type == MSG_TX ? SERIALIZE_TRANSACTION_NO_WITNESS : 0);
+        if (inv.type != MSG_DRIVECHAIN_TX) {
+            nSendFlags |= SERIALIZE_TRANSACTION_NO_DRIVECHAIN;
+        }
+        if (tx) {
+            connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::TX, *tx));
+        } else {
+            vNotFound.push_back(inv);
+        }
+    }
 
     if (it != pfrom->vRecvGetData.end()) {
         const CInv &inv = *it;
@@ -2702,7 +2840,10 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         }
         pfrom->fSentAddr = true;
 
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_addrToSend);
+            pfrom->vAddrToSend.clear();
+        }
         std::vector<CAddress> vAddr = connman->GetAddresses();
         FastRandomContext insecure_rand;
         for (const CAddress &addr : vAddr)
@@ -3249,6 +3390,7 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
         //
         if (pto->nNextAddrSend < nNow) {
             pto->nNextAddrSend = PoissonNextSend(nNow, AVG_ADDRESS_BROADCAST_INTERVAL);
+            LOCK(pto->cs_addrToSend);
             std::vector<CAddress> vAddr;
             vAddr.reserve(pto->vAddrToSend.size());
             for (const CAddress& addr : pto->vAddrToSend)
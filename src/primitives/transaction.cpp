@@ -10,6 +10,8 @@
 #include <tinyformat.h>
 #include <utilstrencodings.h>
 
+#include <memory>
+
 std::string COutPoint::ToString() const
 {
     return strprintf("COutPoint(%s, %u)", hash.ToString().substr(0,10), n);
@@ -81,47 +83,97 @@ uint256 CTransaction::GetWitnessHash() const
     }
 }
 
+const CTransaction::BlindWTPrime& CTransaction::GetBlindWTPrime() const
+{
+    const BlindWTPrime* pblind = pblindWTPrime.load(std::memory_order_acquire);
+    if (pblind)
+        return *pblind;
+
+    // Stream the serialization of the blinded transaction into the hasher
+    // instead of copying the transaction: all inputs are replaced by a
+    // single blank input with the OP_0 scriptSig the sidechain must use
+    // originally, and the sidechain change return (last output) is removed.
+    CHashWriter ss(SER_GETHASH, SERIALIZE_TRANSACTION_NO_WITNESS | SERIALIZE_TRANSACTION_NO_DRIVECHAIN);
+    ss << nVersion;
+    if (nVersion == 4) {
+        ss << TX_REPLAY_BYTES;
+    }
+
+    CTxIn blindIn;
+    blindIn.scriptSig = CScript() << OP_0;
+    WriteCompactSize(ss, 1);
+    ss << blindIn;
+
+    std::unique_ptr<BlindWTPrime> blind(new BlindWTPrime());
+    blind->amountOut = 0;
+    blind->fValid = true;
+    WriteCompactSize(ss, vout.size() - 1);
+    for (size_t i = 0; i < vout.size() - 1; i++) {
+        ss << vout[i];
+        if (!blind->fValid)
+            continue;
+        // Stop summing at the first value out of range so that the sum
+        // can't overflow
+        if (!MoneyRange(vout[i].nValue) || !MoneyRange(blind->amountOut + vout[i].nValue)) {
+            blind->fValid = false;
+            blind->amountOut = 0;
+            continue;
+        }
+        blind->amountOut += vout[i].nValue;
+    }
+    ss << nLockTime;
+    blind->hash = ss.GetHash();
+
+    // Another thread may have beaten us to it, use whichever came first
+    const BlindWTPrime* pexpected = nullptr;
+    if (pblindWTPrime.compare_exchange_strong(pexpected, blind.get()))
+        return *blind.release();
+    return *pexpected;
+}
+
 bool CTransaction::GetBWTHash(uint256& hashRet) const
 {
-    CMutableTransaction mtx(*this);
-    if (!mtx.vin.size() || !mtx.vout.size())
+    if (!vin.size() || !vout.size())
         return false;
 
-    // Remove the CTIP scriptSig (set to OP_0 as the sidechain must orignally)
-    mtx.vin.clear();
-    mtx.vin.resize(1);
-    mtx.vin[0].scriptSig = CScript() << OP_0;
-
-    // Remove the sidechain change return
-    mtx.vout.pop_back();
+    const BlindWTPrime& blind = GetBlindWTPrime();
+    if (!blind.fValid)
+        return false;
 
-    // We now have the B-WT^ hash
-    hashRet = mtx.GetHash();
+    hashRet = blind.hash;
 
     return true;
 }
 
-CAmount CTransaction::GetBlindValueOut() const
+bool CTransaction::GetBlindValueOut(CAmount& amountRet) const
 {
-    CMutableTransaction mtx(*this);
-    if (!mtx.vin.size() || !mtx.vout.size())
+    if (!vin.size() || !vout.size())
         return false;
 
-    // Remove the CTIP scriptSig (set to OP_0 as the sidechain must orignally)
-    mtx.vin.clear();
-    mtx.vin.resize(1);
-    mtx.vin[0].scriptSig = CScript() << OP_0;
+    const BlindWTPrime& blind = GetBlindWTPrime();
+    if (!blind.fValid)
+        return false;
 
-    // Remove the sidechain change return
-    mtx.vout.pop_back();
+    amountRet = blind.amountOut;
 
-    return CTransaction(mtx).GetValueOut();
+    return true;
 }
 
 /* For backward compatibility, the hash is initialized to 0. TODO: remove the need for this default constructor entirely. */
-CTransaction::CTransaction() : vin(), vout(), criticalData(), nVersion(CTransaction::CURRENT_VERSION), nLockTime(0), hash() {}
-CTransaction::CTransaction(const CMutableTransaction &tx) : vin(tx.vin), vout(tx.vout), criticalData(tx.criticalData), nVersion(tx.nVersion), nLockTime(tx.nLockTime), hash(ComputeHash()) {}
-CTransaction::CTransaction(CMutableTransaction &&tx) : vin(std::move(tx.vin)), vout(std::move(tx.vout)), criticalData(tx.criticalData), nVersion(tx.nVersion), nLockTime(tx.nLockTime), hash(ComputeHash()) {}
+CTransaction::CTransaction() : vin(), vout(), criticalData(), nVersion(CTransaction::CURRENT_VERSION), nLockTime(0), hash(), pblindWTPrime(nullptr) {}
+CTransaction::CTransaction(const CMutableTransaction &tx) : vin(tx.vin), vout(tx.vout), criticalData(tx.criticalData), nVersion(tx.nVersion), nLockTime(tx.nLockTime), hash(ComputeHash()), pblindWTPrime(nullptr) {}
+CTransaction::CTransaction(CMutableTransaction &&tx) : vin(std::move(tx.vin)), vout(std::move(tx.vout)), criticalData(tx.criticalData), nVersion(tx.nVersion), nLockTime(tx.nLockTime), hash(ComputeHash()), pblindWTPrime(nullptr) {}
+CTransaction::CTransaction(const CTransaction &tx) : vin(tx.vin), vout(tx.vout), criticalData(tx.criticalData), nVersion(tx.nVersion), nLockTime(tx.nLockTime), hash(tx.hash), pblindWTPrime(nullptr)
+{
+    const BlindWTPrime* pblind = tx.pblindWTPrime.load(std::memory_order_acquire);
+    if (pblind)
+        pblindWTPrime = new BlindWTPrime(*pblind);
+}
+
+CTransaction::~CTransaction()
+{
+    delete pblindWTPrime.load();
+}
 
 CAmount CTransaction::GetValueOut() const
 {
@@ -6,6 +6,7 @@
 #ifndef BITCOIN_PRIMITIVES_TRANSACTION_H
 #define BITCOIN_PRIMITIVES_TRANSACTION_H
 
+#include <atomic>
 #include <stdint.h>
 #include <amount.h>
 #include <script/script.h>
@@ -361,8 +362,18 @@ private:
     /** Memory only. */
     const uint256 hash;
 
+    /** Memory only. B-WT^ hash and value out, computed on first use. */
+    struct BlindWTPrime {
+        uint256 hash;
+        CAmount amountOut;
+        bool fValid; //!< False if an output value is out of range
+    };
+    mutable std::atomic<const BlindWTPrime*> pblindWTPrime;
+
     uint256 ComputeHash() const;
 
+    const BlindWTPrime& GetBlindWTPrime() const;
+
 public:
     /** Construct a CTransaction that qualifies as IsNull() */
     CTransaction();
@@ -371,6 +382,9 @@ public:
     CTransaction(const CMutableTransaction &tx);
     CTransaction(CMutableTransaction &&tx);
 
+    CTransaction(const CTransaction &tx);
+    ~CTransaction();
+
     template <typename Stream>
     inline void Serialize(Stream& s) const {
         SerializeTransaction(*this, s);
@@ -392,10 +406,13 @@ public:
     // Compute a hash that includes both transaction and witness data
     uint256 GetWitnessHash() const;
 
-    // Compute B-WT^ hash (blinded) of tx (remove inputs and sidechain change)
+    // Get B-WT^ hash (blinded) of tx (remove inputs and sidechain change).
+    // Returns false if the tx can't be a WT^ or an output value is out of range.
     bool GetBWTHash(uint256& hashRet) const;
 
-    CAmount GetBlindValueOut() const;
+    // Get sum of txouts of the blinded tx (without sidechain change).
+    // Returns false under the same conditions as GetBWTHash.
+    bool GetBlindValueOut(CAmount& amountRet) const;
 
     // Return sum of txouts.
     CAmount GetValueOut() const;
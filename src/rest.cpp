@@ -12,9 +12,13 @@
 #include <httpserver.h>
 #include <rpc/blockchain.h>
 #include <rpc/server.h>
+#include <sidechain.h>
+#include <sidechaindb.h>
 #include <streams.h>
 #include <sync.h>
+#include <txdb.h>
 #include <txmempool.h>
+#include <utilmoneystr.h>
 #include <utilstrencodings.h>
 #include <version.h>
 
@@ -23,6 +27,8 @@
 #include <univalue.h>
 
 static const size_t MAX_GETUTXOS_OUTPOINTS = 15; //allow a max of 15 outpoints to be queried at once
+static const size_t MAX_REST_DEPOSITS = 1000; //max deposits per response, clients page with the last one as cursor
+static const long MAX_REST_BMM_BLOCKS = 1000; //max blocks read from disk for one BMM request
 
 enum RetFormat {
     RF_UNDEF,
@@ -60,6 +66,25 @@ struct CCoin {
     }
 };
 
+/** BMM h* commitments in the coinbase of a block */
+struct CBMMCommitments {
+    uint256 hashBlock;
+    int32_t nHeight;
+    std::vector<uint256> vHashCritical;
+
+    ADD_SERIALIZE_METHODS;
+
+    CBMMCommitments() : nHeight(0) {}
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(hashBlock);
+        READWRITE(nHeight);
+        READWRITE(vHashCritical);
+    }
+};
+
 static bool RESTERR(HTTPRequest* req, enum HTTPStatusCode status, std::string message)
 {
     req->WriteHeader("Content-Type", "text/plain");
@@ -570,6 +595,362 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
     }
 }
 
+/*
+ * Drivechain endpoints. Sidechains sync deposits and BMM from these, so the
+ * JSON is streamed out with a JSONStreamWriter one element at a time instead
+ * of building a UniValue tree of the whole reply first.
+ */
+
+static void SidechainToJSON(JSONStreamWriter& writer, const Sidechain& s)
+{
+    writer.BeginObject();
+    writer.KeyValue("nsidechain", (int)s.nSidechain);
+    writer.KeyValue("active", s.fActive);
+    writer.KeyValue("title", s.title);
+    writer.KeyValue("description", s.description);
+    writer.KeyValue("privatekey", s.strPrivKey);
+    writer.KeyValue("keyid", s.strKeyID);
+    writer.KeyValue("nversion", s.nVersion);
+    writer.KeyValue("hashid1", s.hashID1.ToString());
+    writer.KeyValue("hashid2", s.hashID2.ToString());
+    writer.EndObject();
+}
+
+static void WTPrimeStateToJSON(JSONStreamWriter& writer, const SidechainWTPrimeState& state)
+{
+    writer.BeginObject();
+    writer.KeyValue("nsidechain", (int)state.nSidechain);
+    writer.KeyValue("hashwtprime", state.hashWTPrime.ToString());
+    writer.KeyValue("nblocksleft", (int)state.nBlocksLeft);
+    writer.KeyValue("nworkscore", (int)state.nWorkScore);
+    writer.EndObject();
+}
+
+static void CTIPToJSON(JSONStreamWriter& writer, const SidechainCTIP& ctip)
+{
+    writer.BeginObject();
+    writer.KeyValue("txid", ctip.out.hash.ToString());
+    writer.KeyValue("n", (int64_t)ctip.out.n);
+    writer.KeyValue("amount", ctip.amount);
+    writer.KeyValue("amountformatted", FormatMoney(ctip.amount));
+    writer.EndObject();
+}
+
+static void WTPrimeStatusToJSON(JSONStreamWriter& writer, const std::vector<SidechainWTPrimeState>& vState)
+{
+    writer.BeginArray();
+    for (const SidechainWTPrimeState& state : vState)
+        WTPrimeStateToJSON(writer, state);
+    writer.EndArray();
+}
+
+static void DepositsToJSON(JSONStreamWriter& writer, const std::vector<SidechainDeposit>& vDeposit)
+{
+    writer.BeginArray();
+    for (const SidechainDeposit& d : vDeposit) {
+        CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
+        ssTx << d.tx;
+
+        writer.BeginObject();
+        writer.KeyValue("nsidechain", (int)d.nSidechain);
+        writer.KeyValue("strdest", d.strDest);
+        writer.KeyValue("txid", d.tx.GetHash().ToString());
+        writer.KeyValue("txhex", HexStr(ssTx.begin(), ssTx.end()));
+        writer.KeyValue("nburnindex", (int64_t)d.nBurnIndex);
+        writer.KeyValue("ntx", (int64_t)d.nTx);
+        writer.KeyValue("hashblock", d.hashBlock.ToString());
+        writer.EndObject();
+    }
+    writer.EndArray();
+}
+
+static void BMMToJSON(JSONStreamWriter& writer, const std::vector<CBMMCommitments>& vBMM)
+{
+    writer.BeginArray();
+    for (const CBMMCommitments& bmm : vBMM) {
+        writer.BeginObject();
+        writer.KeyValue("hashblock", bmm.hashBlock.ToString());
+        writer.KeyValue("height", bmm.nHeight);
+        writer.Key("bmm");
+        writer.BeginArray();
+        for (const uint256& hashCritical : bmm.vHashCritical)
+            writer.Value(hashCritical.ToString());
+        writer.EndArray();
+        writer.EndObject();
+    }
+    writer.EndArray();
+}
+
+static void BlockDataToJSON(JSONStreamWriter& writer, const SidechainBlockData& data)
+{
+    writer.BeginObject();
+    writer.KeyValue("hashmt", data.hashMT.ToString());
+
+    writer.Key("wtprimestatus");
+    writer.BeginArray();
+    for (const std::vector<SidechainWTPrimeState>& vState : data.vWTPrimeStatus) {
+        for (const SidechainWTPrimeState& state : vState)
+            WTPrimeStateToJSON(writer, state);
+    }
+    writer.EndArray();
+
+    writer.Key("spentwtprimes");
+    writer.BeginArray();
+    for (const SidechainSpentWTPrime& spent : data.vSpentWTPrime) {
+        writer.BeginObject();
+        writer.KeyValue("nsidechain", (int)spent.nSidechain);
+        writer.KeyValue("hashwtprime", spent.hashWTPrime.ToString());
+        writer.KeyValue("hashblock", spent.hashBlock.ToString());
+        writer.EndObject();
+    }
+    writer.EndArray();
+
+    writer.Key("activationstatus");
+    writer.BeginArray();
+    for (const SidechainActivationStatus& status : data.vActivationStatus) {
+        writer.BeginObject();
+        writer.KeyValue("nage", status.nAge);
+        writer.KeyValue("nfail", status.nFail);
+        writer.Key("proposal");
+        SidechainToJSON(writer, status.proposal);
+        writer.EndObject();
+    }
+    writer.EndArray();
+
+    writer.Key("sidechains");
+    writer.BeginArray();
+    for (const Sidechain& sidechain : data.vSidechain)
+        SidechainToJSON(writer, sidechain);
+    writer.EndArray();
+    writer.EndObject();
+}
+
+/** Reply with data serialized for .bin and .hex, or written by WriteJSON */
+template <typename T>
+static bool RESTSendSidechainData(HTTPRequest* req, const RetFormat rf, const T& data, void (*WriteJSON)(JSONStreamWriter&, const T&))
+{
+    switch (rf) {
+    case RF_BINARY: {
+        CDataStream ssData(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
+        ssData << data;
+        std::string binaryData = ssData.str();
+        req->WriteHeader("Content-Type", "application/octet-stream");
+        req->WriteReply(HTTP_OK, binaryData);
+        return true;
+    }
+
+    case RF_HEX: {
+        CDataStream ssData(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
+        ssData << data;
+        std::string strHex = HexStr(ssData.begin(), ssData.end()) + "\n";
+        req->WriteHeader("Content-Type", "text/plain");
+        req->WriteReply(HTTP_OK, strHex);
+        return true;
+    }
+
+    case RF_JSON: {
+        // Large replies are sent chunked as they are written, small ones in
+        // one piece
+        bool fChunked = false;
+        JSONStreamWriter writer([req, &fChunked](const std::string& strChunk) {
+            if (!fChunked) {
+                req->WriteHeader("Content-Type", "application/json");
+                fChunked = true;
+            }
+            req->WriteReplyChunk(HTTP_OK, strChunk);
+        });
+        WriteJSON(writer, data);
+
+        if (writer.HasFlushed()) {
+            req->WriteReplyChunk(HTTP_OK, writer.ReleaseBuffer() + "\n");
+            req->WriteReplyEnd();
+            return true;
+        }
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, writer.ReleaseBuffer() + "\n");
+        return true;
+    }
+
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+}
+
+static bool ParseSidechainNumber(const std::string& str, uint8_t& nSidechain)
+{
+    int32_t n;
+    if (!ParseInt32(str, &n) || n < 0 || n > 255)
+        return false;
+
+    nSidechain = (uint8_t)n;
+    return true;
+}
+
+static bool rest_sidechain_ctip(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+
+    uint8_t nSidechain;
+    if (!ParseSidechainNumber(param, nSidechain))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid sidechain number: " + param);
+
+    std::shared_ptr<const ChainSnapshot> snapshot = GetChainSnapshot();
+    if (!snapshot->scdb->IsSidechainActive(nSidechain))
+        return RESTERR(req, HTTP_NOT_FOUND, "Sidechain not active: " + param);
+
+    SidechainCTIP ctip;
+    if (!snapshot->scdb->GetCTIP(nSidechain, ctip))
+        return RESTERR(req, HTTP_NOT_FOUND, "No CTIP found for sidechain: " + param);
+
+    return RESTSendSidechainData(req, rf, ctip, CTIPToJSON);
+}
+
+static bool rest_sidechain_wtprimestatus(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+
+    uint8_t nSidechain;
+    if (!ParseSidechainNumber(param, nSidechain))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid sidechain number: " + param);
+
+    std::shared_ptr<const ChainSnapshot> snapshot = GetChainSnapshot();
+    if (!snapshot->scdb->IsSidechainActive(nSidechain))
+        return RESTERR(req, HTTP_NOT_FOUND, "Sidechain not active: " + param);
+
+    return RESTSendSidechainData(req, rf, snapshot->scdb->GetState(nSidechain), WTPrimeStatusToJSON);
+}
+
+static bool rest_sidechain_deposits(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    std::vector<std::string> path;
+    boost::split(path, param, boost::is_any_of("/"));
+
+    if (path.size() < 1 || path.size() > 2)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid URI format. Use /rest/sidechain/deposits/<nsidechain>[/<txid>-<n>].<ext>.");
+
+    uint8_t nSidechain;
+    if (!ParseSidechainNumber(path[0], nSidechain))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid sidechain number: " + path[0]);
+
+    // The cursor is the last deposit the client has, by txid and burn output
+    COutPoint outKnown;
+    if (path.size() == 2) {
+        const std::string::size_type pos = path[1].find('-');
+        int32_t n;
+        if (pos == std::string::npos || !ParseHashStr(path[1].substr(0, pos), outKnown.hash) ||
+                !ParseInt32(path[1].substr(pos + 1), &n) || n < 0)
+            return RESTERR(req, HTTP_BAD_REQUEST, "Invalid deposit: " + path[1]);
+        outKnown.n = n;
+    }
+
+    // The deposits are not in the chain snapshot, copying all of them at
+    // every tip change would cost more than copying one page here
+    std::vector<SidechainDeposit> vDeposit;
+    {
+        LOCK(cs_main);
+        if (!scdb.IsSidechainActive(nSidechain))
+            return RESTERR(req, HTTP_NOT_FOUND, "Sidechain not active: " + path[0]);
+        if (!scdb.GetDepositsAfter(nSidechain, outKnown, MAX_REST_DEPOSITS, vDeposit))
+            return RESTERR(req, HTTP_NOT_FOUND, "Deposit not found: " + path[1]);
+    }
+
+    return RESTSendSidechainData(req, rf, vDeposit, DepositsToJSON);
+}
+
+static bool rest_sidechain_bmm(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    std::vector<std::string> path;
+    boost::split(path, param, boost::is_any_of("/"));
+
+    if (path.size() != 2)
+        return RESTERR(req, HTTP_BAD_REQUEST, "No block count specified. Use /rest/sidechain/bmm/<count>/<hash>.<ext>.");
+
+    long count = strtol(path[0].c_str(), nullptr, 10);
+    if (count < 1 || count > MAX_REST_BMM_BLOCKS)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Block count out of range: " + path[0]);
+
+    uint256 hash;
+    if (!ParseHashStr(path[1], hash))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + path[1]);
+
+    // Collect the block positions under cs_main, read the blocks without it
+    std::vector<std::pair<const CBlockIndex*, CDiskBlockPos>> vBlockPos;
+    vBlockPos.reserve(count);
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(hash);
+        const CBlockIndex* pindex = (it != mapBlockIndex.end()) ? it->second : nullptr;
+        while (pindex != nullptr && chainActive.Contains(pindex)) {
+            if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+                return RESTERR(req, HTTP_NOT_FOUND, pindex->GetBlockHash().ToString() + " not available (pruned data)");
+            vBlockPos.emplace_back(pindex, pindex->GetBlockPos());
+            if (vBlockPos.size() == (unsigned long)count)
+                break;
+            pindex = chainActive.Next(pindex);
+        }
+    }
+
+    std::vector<CBMMCommitments> vBMM;
+    vBMM.reserve(vBlockPos.size());
+    for (const auto& blockPos : vBlockPos) {
+        CBlock block;
+        if (!ReadBlockFromDisk(block, blockPos.second, Params().GetConsensus()) ||
+                block.GetHash() != blockPos.first->GetBlockHash() || block.vtx.empty())
+            return RESTERR(req, HTTP_NOT_FOUND, blockPos.first->GetBlockHash().ToString() + " not found");
+
+        CBMMCommitments bmm;
+        bmm.hashBlock = blockPos.first->GetBlockHash();
+        bmm.nHeight = blockPos.first->nHeight;
+        for (const CTxOut& out : block.vtx[0]->vout) {
+            uint256 hashCritical;
+            if (out.scriptPubKey.IsCriticalHashCommit(hashCritical))
+                bmm.vHashCritical.push_back(hashCritical);
+        }
+        vBMM.push_back(std::move(bmm));
+    }
+
+    return RESTSendSidechainData(req, rf, vBMM, BMMToJSON);
+}
+
+static bool rest_sidechain_blockdata(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string hashStr;
+    const RetFormat rf = ParseDataFormat(hashStr, strURIPart);
+
+    uint256 hash;
+    if (!ParseHashStr(hashStr, hash))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
+
+    {
+        LOCK(cs_main);
+        if (mapBlockIndex.count(hash) == 0)
+            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
+    }
+
+    SidechainBlockData data;
+    if (!psidechaintree->GetBlockData(hash, data))
+        return RESTERR(req, HTTP_NOT_FOUND, "No SCDB data for block " + hashStr);
+
+    return RESTSendSidechainData(req, rf, data, BlockDataToJSON);
+}
+
 static const struct {
     const char* prefix;
     bool (*handler)(HTTPRequest* req, const std::string& strReq);
@@ -582,6 +963,11 @@ static const struct {
       {"/rest/mempool/contents", rest_mempool_contents},
       {"/rest/headers/", rest_headers},
       {"/rest/getutxos", rest_getutxos},
+      {"/rest/sidechain/ctip/", rest_sidechain_ctip},
+      {"/rest/sidechain/wtprimestatus/", rest_sidechain_wtprimestatus},
+      {"/rest/sidechain/deposits/", rest_sidechain_deposits},
+      {"/rest/sidechain/bmm/", rest_sidechain_bmm},
+      {"/rest/sidechain/blockdata/", rest_sidechain_blockdata},
 };
 
 bool StartREST()
@@ -11,14 +11,19 @@
 #include <checkpoints.h>
 #include <coins.h>
 #include <consensus/validation.h>
+#include <crypto/muhash.h>
 #include <validation.h>
 #include <core_io.h>
+#include <init.h>
 #include <policy/feerate.h>
 #include <policy/policy.h>
 #include <primitives/transaction.h>
 #include <rpc/server.h>
+#include <sidechain.h>
+#include <sidechaindb.h>
 #include <streams.h>
 #include <sync.h>
+#include <taskpool.h>
 #include <txdb.h>
 #include <txmempool.h>
 #include <util.h>
@@ -27,6 +32,7 @@
 #include <validationinterface.h>
 #include <warnings.h>
 
+#include <atomic>
 #include <stdint.h>
 
 #include <univalue.h>
@@ -46,6 +52,9 @@ static std::mutex cs_blockchange;
 static std::condition_variable cond_blockchange;
 static CUpdatedBlock latestblock;
 
+/** Number of mempool entries described at a time by the streaming mempoolToJSON */
+static const size_t MEMPOOL_JSON_BATCH_SIZE = 1000;
+
 extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry);
 
 /* Calculate the difficulty for a given block index,
@@ -113,9 +122,9 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
     return result;
 }
 
-UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails)
+/** Fields of blockToJSON that come before the "tx" array */
+static UniValue blockToJSONHead(const CBlock& block, const CBlockIndex* blockindex)
 {
-    AssertLockHeld(cs_main);
     UniValue result(UniValue::VOBJ);
     result.push_back(Pair("hash", blockindex->GetBlockHash().GetHex()));
     int confirmations = -1;
@@ -130,19 +139,13 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
     result.push_back(Pair("version", block.nVersion));
     result.push_back(Pair("versionHex", strprintf("%08x", block.nVersion)));
     result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
-    UniValue txs(UniValue::VARR);
-    for(const auto& tx : block.vtx)
-    {
-        if(txDetails)
-        {
-            UniValue objTx(UniValue::VOBJ);
-            TxToUniv(*tx, uint256(), objTx, true, RPCSerializationFlags());
-            txs.push_back(objTx);
-        }
-        else
-            txs.push_back(tx->GetHash().GetHex());
-    }
-    result.push_back(Pair("tx", txs));
+    return result;
+}
+
+/** Fields of blockToJSON that come after the "tx" array */
+static UniValue blockToJSONTail(const CBlock& block, const CBlockIndex* blockindex)
+{
+    UniValue result(UniValue::VOBJ);
     result.push_back(Pair("time", block.GetBlockTime()));
     result.push_back(Pair("mediantime", (int64_t)blockindex->GetMedianTimePast()));
     result.push_back(Pair("nonce", (uint64_t)block.nNonce));
@@ -158,6 +161,51 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
     return result;
 }
 
+static UniValue blockTxToJSON(const CTransactionRef& tx, bool txDetails)
+{
+    if (!txDetails)
+        return tx->GetHash().GetHex();
+
+    UniValue objTx(UniValue::VOBJ);
+    TxToUniv(*tx, uint256(), objTx, true, RPCSerializationFlags());
+    return objTx;
+}
+
+UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails)
+{
+    AssertLockHeld(cs_main);
+    UniValue result = blockToJSONHead(block, blockindex);
+    UniValue txs(UniValue::VARR);
+    for(const auto& tx : block.vtx)
+        txs.push_back(blockTxToJSON(tx, txDetails));
+    result.push_back(Pair("tx", txs));
+    result.pushKVs(blockToJSONTail(block, blockindex));
+    return result;
+}
+
+void blockToJSON(JSONStreamWriter& writer, const CBlock& block, const CBlockIndex* blockindex, bool txDetails)
+{
+    // Writing blocks until the client reads the reply, so cs_main is only
+    // held for the fields that need it
+    AssertLockNotHeld(cs_main);
+    UniValue head, tail;
+    {
+        LOCK(cs_main);
+        head = blockToJSONHead(block, blockindex);
+        tail = blockToJSONTail(block, blockindex);
+    }
+
+    writer.BeginObject();
+    writer.KeyValues(head);
+    writer.Key("tx");
+    writer.BeginArray();
+    for (const auto& tx : block.vtx)
+        writer.Value(blockTxToJSON(tx, txDetails));
+    writer.EndArray();
+    writer.KeyValues(tail);
+    writer.EndObject();
+}
+
 UniValue getblockcount(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 0)
@@ -171,8 +219,8 @@ UniValue getblockcount(const JSONRPCRequest& request)
             + HelpExampleRpc("getblockcount", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Height();
+    const CBlockIndex* pindexTip = GetChainSnapshot()->pindexTip;
+    return pindexTip ? pindexTip->nHeight : -1;
 }
 
 UniValue getbestblockhash(const JSONRPCRequest& request)
@@ -188,8 +236,10 @@ UniValue getbestblockhash(const JSONRPCRequest& request)
             + HelpExampleRpc("getbestblockhash", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Tip()->GetBlockHash().GetHex();
+    const CBlockIndex* pindexTip = GetChainSnapshot()->pindexTip;
+    if (!pindexTip)
+        throw JSONRPCError(RPC_IN_WARMUP, "No block connected yet");
+    return pindexTip->GetBlockHash().GetHex();
 }
 
 void RPCNotifyBlockChange(bool ibd, const CBlockIndex * pindex)
@@ -436,6 +486,55 @@ UniValue mempoolToJSON(bool fVerbose)
     }
 }
 
+void mempoolToJSON(JSONStreamWriter& writer, bool fVerbose)
+{
+    // Writing blocks until the client reads the reply, so mempool.cs is
+    // never held while writing
+    AssertLockNotHeld(mempool.cs);
+    if (fVerbose)
+    {
+        std::vector<uint256> vtxid;
+        {
+            LOCK(mempool.cs);
+            vtxid.reserve(mempool.mapTx.size());
+            for (const CTxMemPoolEntry& e : mempool.mapTx)
+                vtxid.push_back(e.GetTx().GetHash());
+        }
+
+        // Describe the entries a batch at a time, leaving out the ones that
+        // have left the mempool in the meantime
+        writer.BeginObject();
+        std::vector<std::pair<std::string, UniValue>> vEntry;
+        for (size_t i = 0; i < vtxid.size(); i += MEMPOOL_JSON_BATCH_SIZE) {
+            vEntry.clear();
+            {
+                LOCK(mempool.cs);
+                for (size_t j = i; j < std::min(vtxid.size(), i + MEMPOOL_JSON_BATCH_SIZE); j++) {
+                    CTxMemPool::txiter it = mempool.mapTx.find(vtxid[j]);
+                    if (it == mempool.mapTx.end())
+                        continue;
+                    UniValue info(UniValue::VOBJ);
+                    entryToJSON(info, *it);
+                    vEntry.emplace_back(vtxid[j].ToString(), info);
+                }
+            }
+            for (const auto& entry : vEntry)
+                writer.KeyValue(entry.first, entry.second);
+        }
+        writer.EndObject();
+    }
+    else
+    {
+        std::vector<uint256> vtxid;
+        mempool.queryHashes(vtxid);
+
+        writer.BeginArray();
+        for (const uint256& hash : vtxid)
+            writer.Value(hash.ToString());
+        writer.EndArray();
+    }
+}
+
 UniValue getrawmempool(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() > 1)
@@ -465,6 +564,10 @@ UniValue getrawmempool(const JSONRPCRequest& request)
     if (!request.params[0].isNull())
         fVerbose = request.params[0].get_bool();
 
+    if (request.pResultWriter) {
+        mempoolToJSON(*request.pResultWriter, fVerbose);
+        return NullUniValue;
+    }
     return mempoolToJSON(fVerbose);
 }
 
@@ -688,8 +791,6 @@ UniValue getblockheader(const JSONRPCRequest& request)
             + HelpExampleRpc("getblockheader", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
         );
 
-    LOCK(cs_main);
-
     std::string strHash = request.params[0].get_str();
     uint256 hash(uint256S(strHash));
 
@@ -776,14 +877,18 @@ UniValue getblock(const JSONRPCRequest& request)
             verbosity = request.params[1].get_bool() ? 1 : 0;
     }
 
-    if (mapBlockIndex.count(hash) == 0)
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
-
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
+    const CBlockIndex* pblockindex;
+    {
+        LOCK(cs_main);
+        if (mapBlockIndex.count(hash) == 0)
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+
+        pblockindex = mapBlockIndex[hash];
 
-    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
-        throw JSONRPCError(RPC_MISC_ERROR, "Block not available (pruned data)");
+        if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+            throw JSONRPCError(RPC_MISC_ERROR, "Block not available (pruned data)");
+    }
 
     if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
         // Block not found on disk. This could be because we have the block
@@ -801,65 +906,72 @@ UniValue getblock(const JSONRPCRequest& request)
         return strHex;
     }
 
+    if (request.pResultWriter) {
+        blockToJSON(*request.pResultWriter, block, pblockindex, verbosity >= 2);
+        return NullUniValue;
+    }
+    LOCK(cs_main);
     return blockToJSON(block, pblockindex, verbosity >= 2);
 }
 
-struct CCoinsStats
-{
-    int nHeight;
-    uint256 hashBlock;
-    uint64_t nTransactions;
-    uint64_t nTransactionOutputs;
-    uint64_t nBogoSize;
-    uint256 hashSerialized;
-    uint64_t nDiskSize;
-    CAmount nTotalAmount;
-
-    CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nBogoSize(0), nDiskSize(0), nTotalAmount(0) {}
-};
-
-static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
+static void ApplyStats(CCoinsStats &stats, CHashWriter* pss, const std::map<CScript, uint8_t>& mapEscrowScript, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
 {
     assert(!outputs.empty());
-    ss << hash;
-    ss << VARINT(outputs.begin()->second.nHeight * 2 + outputs.begin()->second.fCoinBase);
+    if (pss) {
+        *pss << hash;
+        *pss << VARINT(outputs.begin()->second.nHeight * 2 + outputs.begin()->second.fCoinBase);
+    }
     stats.nTransactions++;
-    for (const auto output : outputs) {
-        ss << VARINT(output.first + 1);
-        ss << output.second.out.scriptPubKey;
-        ss << VARINT(output.second.out.nValue);
+    for (const auto& output : outputs) {
+        if (pss) {
+            *pss << VARINT(output.first + 1);
+            *pss << output.second.out.scriptPubKey;
+            *pss << VARINT(output.second.out.nValue);
+        }
         stats.nTransactionOutputs++;
         stats.nTotalAmount += output.second.out.nValue;
         stats.nBogoSize += 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
                            2 /* scriptPubKey len */ + output.second.out.scriptPubKey.size() /* scriptPubKey */;
+        if (output.second.fLoaded) {
+            stats.nLoadedOutputs++;
+            stats.nLoadedAmount += output.second.out.nValue;
+        }
+        if (!mapEscrowScript.empty()) {
+            auto it = mapEscrowScript.find(output.second.out.scriptPubKey);
+            if (it != mapEscrowScript.end()) {
+                SidechainEscrowStats& escrow = stats.mapSidechainEscrow[it->second];
+                escrow.nTransactionOutputs++;
+                escrow.nAmount += output.second.out.nValue;
+            }
+        }
     }
-    ss << VARINT(0);
+    if (pss)
+        *pss << VARINT(0);
 }
 
-//! Calculate statistics about the unspent transaction output set
-static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
+//! Calculate statistics about the coins from the cursor position up to (not including) txid phashEnd
+static bool GetUTXOStatsRange(CCoinsViewCursor* pcursor, const uint256* phashEnd, const std::map<CScript, uint8_t>& mapEscrowScript,
+                              CCoinsStats& stats, CHashWriter* pss, MuHash3072* pmuhash, std::atomic<bool>& fAbort)
 {
-    std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
-    assert(pcursor);
-
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = pcursor->GetBestBlock();
-    {
-        LOCK(cs_main);
-        stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
-    }
-    ss << stats.hashBlock;
     uint256 prevkey;
     std::map<uint32_t, Coin> outputs;
     while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
+        if (fAbort || ShutdownRequested())
+            return false;
         COutPoint key;
         Coin coin;
         if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
+            if (phashEnd && !(key.hash < *phashEnd))
+                break;
             if (!outputs.empty() && key.hash != prevkey) {
-                ApplyStats(stats, ss, prevkey, outputs);
+                ApplyStats(stats, pss, mapEscrowScript, prevkey, outputs);
                 outputs.clear();
             }
+            if (pmuhash) {
+                CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+                ss << key << coin;
+                pmuhash->Insert((const unsigned char*)ss.data(), ss.size());
+            }
             prevkey = key.hash;
             outputs[key.n] = std::move(coin);
         } else {
@@ -868,13 +980,111 @@ static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
         pcursor->Next();
     }
     if (!outputs.empty()) {
-        ApplyStats(stats, ss, prevkey, outputs);
+        ApplyStats(stats, pss, mapEscrowScript, prevkey, outputs);
+    }
+    return true;
+}
+
+bool GetUTXOStats(CCoinsViewDB *view, CCoinsStats &stats, int nRanges)
+{
+    // The legacy hash commits to the coins in database order, so it can't
+    // be split up.
+    if (stats.hashType == CoinStatsHashType::HASH_SERIALIZED_2)
+        nRanges = 1;
+    nRanges = std::min(std::max(nRanges, 1), 256);
+
+    // Split the set into ranges of txids. The cursors are created together
+    // while holding cs_main, so no flush can happen in between and they
+    // all iterate over the same database state.
+    std::vector<std::unique_ptr<CCoinsViewCursor>> vCursor;
+    std::vector<uint256> vRangeEnd;
+    std::map<CScript, uint8_t> mapEscrowScript;
+    {
+        LOCK(cs_main);
+        for (int i = 0; i < nRanges; i++) {
+            uint256 hashStart;
+            *hashStart.begin() = i * 256 / nRanges;
+            vCursor.emplace_back(view->Cursor(hashStart));
+            assert(vCursor.back());
+            if (i)
+                vRangeEnd.push_back(hashStart);
+        }
+        stats.hashBlock = vCursor[0]->GetBestBlock();
+        stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
+
+        for (const Sidechain& sidechain : scdb.GetActiveSidechains())
+            mapEscrowScript[sidechain.scriptPubKey] = sidechain.nSidechain;
+    }
+
+    std::vector<CCoinsStats> vStats(nRanges);
+    std::vector<MuHash3072> vMuHash(nRanges);
+    std::vector<char> vSuccess(nRanges, false);
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << stats.hashBlock;
+    std::atomic<bool> fAbort(false);
+
+    std::vector<CTaskPool::Task> vTask;
+    for (int i = 0; i < nRanges; i++) {
+        vTask.emplace_back([&, i] {
+            vSuccess[i] = GetUTXOStatsRange(vCursor[i].get(), i + 1 < nRanges ? &vRangeEnd[i] : nullptr, mapEscrowScript, vStats[i],
+                                            stats.hashType == CoinStatsHashType::HASH_SERIALIZED_2 ? &ss : nullptr,
+                                            stats.hashType == CoinStatsHashType::MUHASH ? &vMuHash[i] : nullptr, fAbort);
+            if (!vSuccess[i])
+                fAbort = true;
+        });
+    }
+    g_rpc_task_pool.Run(vTask);
+
+    MuHash3072 muhash;
+    for (int i = 0; i < nRanges; i++) {
+        if (!vSuccess[i])
+            return false;
+        stats.Merge(vStats[i]);
+        muhash *= vMuHash[i];
+    }
+
+    if (stats.hashType == CoinStatsHashType::HASH_SERIALIZED_2) {
+        stats.hashSerialized = ss.GetHash();
+    } else if (stats.hashType == CoinStatsHashType::MUHASH) {
+        // Commit to the block as well, like the legacy hash
+        muhash.Insert(stats.hashBlock.begin(), stats.hashBlock.size());
+        unsigned char out[32];
+        muhash.Finalize(out);
+        stats.hashSerialized = uint256(std::vector<unsigned char>(out, out + sizeof(out)));
     }
-    stats.hashSerialized = ss.GetHash();
     stats.nDiskSize = view->EstimateSize();
     return true;
 }
 
+static CCriticalSection cs_coinsstats;
+//! Result of the last GetUTXOStats call, reused until the tip changes
+static CCoinsStats coinsStatsCache;
+
+//! GetUTXOStats with one range per core, reusing the last result while the tip stays the same
+static bool GetUTXOStatsCached(CCoinsViewDB *view, CCoinsStats &stats)
+{
+    uint256 hashBlock;
+    {
+        LOCK(cs_main);
+        hashBlock = view->GetBestBlock();
+    }
+    {
+        LOCK(cs_coinsstats);
+        if (!coinsStatsCache.hashBlock.IsNull() && coinsStatsCache.hashBlock == hashBlock && coinsStatsCache.hashType == stats.hashType) {
+            stats = coinsStatsCache;
+            stats.nDiskSize = view->EstimateSize();
+            return true;
+        }
+    }
+
+    if (!GetUTXOStats(view, stats, GetNumCores()))
+        return false;
+
+    LOCK(cs_coinsstats);
+    coinsStatsCache = stats;
+    return true;
+}
+
 UniValue pruneblockchain(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 1)
@@ -926,11 +1136,14 @@ UniValue pruneblockchain(const JSONRPCRequest& request)
 
 UniValue gettxoutsetinfo(const JSONRPCRequest& request)
 {
-    if (request.fHelp || request.params.size() != 0)
+    if (request.fHelp || request.params.size() > 1)
         throw std::runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( \"hash_type\" )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "Note this call may take some time. The result is cached until the tip changes.\n"
+            "\nArguments:\n"
+            "1. \"hash_type\"    (string, optional, default=\"hash_serialized_2\") Which UTXO set hash to calculate. Options:\n"
+            "                    \"hash_serialized_2\" (single threaded), \"muhash\" (calculated in parallel), \"none\"\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
@@ -938,28 +1151,67 @@ UniValue gettxoutsetinfo(const JSONRPCRequest& request)
             "  \"transactions\": n,      (numeric) The number of transactions\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
             "  \"bogosize\": n,          (numeric) A meaningless metric for UTXO set size\n"
-            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash\n"
+            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash, only present if hash_type is \"hash_serialized_2\"\n"
+            "  \"muhash\": \"hash\",       (string) The MuHash of the set, only present if hash_type is \"muhash\"\n"
             "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
+            "  \"loaded_txouts\": n,     (numeric) The number of outputs created from loaded coins\n"
+            "  \"loaded_amount\": x.xxx, (numeric) The total amount of the loaded coins\n"
+            "  \"sidechain_escrow\": [   (array) Coins held by each active sidechain\n"
+            "    {\n"
+            "      \"nsidechain\": n,    (numeric) Sidechain number\n"
+            "      \"txouts\": n,        (numeric) The number of outputs\n"
+            "      \"amount\": x.xxx     (numeric) The total amount\n"
+            "    }\n"
+            "    ,...\n"
+            "  ]\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "\"muhash\"")
             + HelpExampleRpc("gettxoutsetinfo", "")
         );
 
     UniValue ret(UniValue::VOBJ);
 
     CCoinsStats stats;
+    if (!request.params[0].isNull()) {
+        const std::string strHashType = request.params[0].get_str();
+        if (strHashType == "muhash") {
+            stats.hashType = CoinStatsHashType::MUHASH;
+        } else if (strHashType == "hash_serialized_2") {
+            stats.hashType = CoinStatsHashType::HASH_SERIALIZED_2;
+        } else if (strHashType == "none") {
+            stats.hashType = CoinStatsHashType::NONE;
+        } else {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("%s is not a valid hash_type", strHashType));
+        }
+    }
+
     FlushStateToDisk();
-    if (GetUTXOStats(pcoinsdbview.get(), stats)) {
+    if (GetUTXOStatsCached(pcoinsdbview.get(), stats)) {
         ret.push_back(Pair("height", (int64_t)stats.nHeight));
         ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
         ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
         ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
         ret.push_back(Pair("bogosize", (int64_t)stats.nBogoSize));
-        ret.push_back(Pair("hash_serialized_2", stats.hashSerialized.GetHex()));
+        if (stats.hashType == CoinStatsHashType::HASH_SERIALIZED_2)
+            ret.push_back(Pair("hash_serialized_2", stats.hashSerialized.GetHex()));
+        else if (stats.hashType == CoinStatsHashType::MUHASH)
+            ret.push_back(Pair("muhash", stats.hashSerialized.GetHex()));
         ret.push_back(Pair("disk_size", stats.nDiskSize));
         ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
+        ret.push_back(Pair("loaded_txouts", (int64_t)stats.nLoadedOutputs));
+        ret.push_back(Pair("loaded_amount", ValueFromAmount(stats.nLoadedAmount)));
+        UniValue escrow(UniValue::VARR);
+        for (const auto& it : stats.mapSidechainEscrow) {
+            UniValue obj(UniValue::VOBJ);
+            obj.push_back(Pair("nsidechain", (int)it.first));
+            obj.push_back(Pair("txouts", (int64_t)it.second.nTransactionOutputs));
+            obj.push_back(Pair("amount", ValueFromAmount(it.second.nAmount)));
+            escrow.push_back(obj);
+        }
+        ret.push_back(Pair("sidechain_escrow", escrow));
     } else {
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
     }
@@ -1616,24 +1868,24 @@ UniValue savemempool(const JSONRPCRequest& request)
 }
 
 static const CRPCCommand commands[] =
-{ //  category              name                      actor (function)         argNames
-  //  --------------------- ------------------------  -----------------------  ----------
-    { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      {} },
-    { "blockchain",         "getchaintxstats",        &getchaintxstats,        {"nblocks", "blockhash"} },
-    { "blockchain",         "getbestblockhash",       &getbestblockhash,       {} },
-    { "blockchain",         "getblockcount",          &getblockcount,          {} },
-    { "blockchain",         "getblock",               &getblock,               {"blockhash","verbosity|verbose"} },
-    { "blockchain",         "getblockhash",           &getblockhash,           {"height"} },
-    { "blockchain",         "getblockheader",         &getblockheader,         {"blockhash","verbose"} },
-    { "blockchain",         "getchaintips",           &getchaintips,           {} },
-    { "blockchain",         "getdifficulty",          &getdifficulty,          {} },
-    { "blockchain",         "getmempoolancestors",    &getmempoolancestors,    {"txid","verbose"} },
-    { "blockchain",         "getmempooldescendants",  &getmempooldescendants,  {"txid","verbose"} },
-    { "blockchain",         "getmempoolentry",        &getmempoolentry,        {"txid"} },
-    { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         {} },
-    { "blockchain",         "getrawmempool",          &getrawmempool,          {"verbose"} },
-    { "blockchain",         "gettxout",               &gettxout,               {"txid","n","include_mempool"} },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {} },
+{ //  category              name                      actor (function)         argNames                      flags
+  //  --------------------- ------------------------  -----------------------  ----------                    -----
+    { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      {}, RPC_FLAG_READONLY },
+    { "blockchain",         "getchaintxstats",        &getchaintxstats,        {"nblocks", "blockhash"}, RPC_FLAG_READONLY },
+    { "blockchain",         "getbestblockhash",       &getbestblockhash,       {}, RPC_FLAG_READONLY | RPC_FLAG_NO_CS_MAIN },
+    { "blockchain",         "getblockcount",          &getblockcount,          {}, RPC_FLAG_READONLY | RPC_FLAG_NO_CS_MAIN },
+    { "blockchain",         "getblock",               &getblock,               {"blockhash","verbosity|verbose"}, RPC_FLAG_READONLY },
+    { "blockchain",         "getblockhash",           &getblockhash,           {"height"}, RPC_FLAG_READONLY },
+    { "blockchain",         "getblockheader",         &getblockheader,         {"blockhash","verbose"}, RPC_FLAG_READONLY },
+    { "blockchain",         "getchaintips",           &getchaintips,           {}, RPC_FLAG_READONLY },
+    { "blockchain",         "getdifficulty",          &getdifficulty,          {}, RPC_FLAG_READONLY },
+    { "blockchain",         "getmempoolancestors",    &getmempoolancestors,    {"txid","verbose"}, RPC_FLAG_READONLY },
+    { "blockchain",         "getmempooldescendants",  &getmempooldescendants,  {"txid","verbose"}, RPC_FLAG_READONLY },
+    { "blockchain",         "getmempoolentry",        &getmempoolentry,        {"txid"}, RPC_FLAG_READONLY },
+    { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         {}, RPC_FLAG_READONLY },
+    { "blockchain",         "getrawmempool",          &getrawmempool,          {"verbose"}, RPC_FLAG_READONLY },
+    { "blockchain",         "gettxout",               &gettxout,               {"txid","n","include_mempool"}, RPC_FLAG_READONLY },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {"hash_type"} },
     { "blockchain",         "pruneblockchain",        &pruneblockchain,        {"height"} },
     { "blockchain",         "savemempool",            &savemempool,            {} },
     { "blockchain",         "verifychain",            &verifychain,            {"checklevel","nblocks"} },
@@ -5,8 +5,16 @@
 #ifndef BITCOIN_RPC_BLOCKCHAIN_H
 #define BITCOIN_RPC_BLOCKCHAIN_H
 
+#include <amount.h>
+#include <uint256.h>
+
+#include <map>
+#include <stdint.h>
+
 class CBlock;
 class CBlockIndex;
+class CCoinsViewDB;
+class JSONStreamWriter;
 class UniValue;
 
 /**
@@ -24,14 +32,78 @@ void RPCNotifyBlockChange(bool ibd, const CBlockIndex *);
 /** Block description to JSON */
 UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
 
+/** Write the block description of blockToJSON, one transaction at a time */
+void blockToJSON(JSONStreamWriter& writer, const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
+
 /** Mempool information to JSON */
 UniValue mempoolInfoToJSON();
 
 /** Mempool to JSON */
 UniValue mempoolToJSON(bool fVerbose = false);
 
+/** Write the mempool of mempoolToJSON, one entry at a time */
+void mempoolToJSON(JSONStreamWriter& writer, bool fVerbose = false);
+
 /** Block header to JSON */
 UniValue blockheaderToJSON(const CBlockIndex* blockindex);
 
+/** Commitment to the UTXO set computed by GetUTXOStats */
+enum class CoinStatsHashType {
+    MUHASH,            //!< Order independent, computed in parallel
+    HASH_SERIALIZED_2, //!< Legacy serialized hash, computed on a single thread
+    NONE,
+};
+
+/** Coins held in escrow by a sidechain */
+struct SidechainEscrowStats
+{
+    uint64_t nTransactionOutputs = 0;
+    CAmount nAmount = 0;
+};
+
+struct CCoinsStats
+{
+    CoinStatsHashType hashType;
+    int nHeight;
+    uint256 hashBlock;
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    uint64_t nBogoSize;
+    uint256 hashSerialized;
+    uint64_t nDiskSize;
+    CAmount nTotalAmount;
+    //! Outputs created from loaded_coins.dat
+    uint64_t nLoadedOutputs;
+    CAmount nLoadedAmount;
+    //! Outputs paying to the deposit script of an active sidechain
+    std::map<uint8_t, SidechainEscrowStats> mapSidechainEscrow;
+
+    CCoinsStats() : hashType(CoinStatsHashType::HASH_SERIALIZED_2), nHeight(0), nTransactions(0), nTransactionOutputs(0), nBogoSize(0), nDiskSize(0), nTotalAmount(0), nLoadedOutputs(0), nLoadedAmount(0) {}
+
+    /** Add the counters of a disjoint part of the UTXO set */
+    void Merge(const CCoinsStats& other)
+    {
+        nTransactions += other.nTransactions;
+        nTransactionOutputs += other.nTransactionOutputs;
+        nBogoSize += other.nBogoSize;
+        nTotalAmount += other.nTotalAmount;
+        nLoadedOutputs += other.nLoadedOutputs;
+        nLoadedAmount += other.nLoadedAmount;
+        for (const auto& it : other.mapSidechainEscrow) {
+            SidechainEscrowStats& escrow = mapSidechainEscrow[it.first];
+            escrow.nTransactionOutputs += it.second.nTransactionOutputs;
+            escrow.nAmount += it.second.nAmount;
+        }
+    }
+};
+
+/**
+ * Calculate statistics about the unspent transaction output set of view.
+ * The set is split by the first byte of the txids into nRanges parts that
+ * are processed in parallel on g_rpc_task_pool. The legacy hash is always
+ * calculated from a single part.
+ */
+bool GetUTXOStats(CCoinsViewDB *view, CCoinsStats &stats, int nRanges);
+
 #endif
 
@@ -97,6 +97,8 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "signrawtransaction", 1, "prevtxs" },
     { "signrawtransaction", 2, "privkeys" },
     { "sendrawtransaction", 1, "allowhighfees" },
+    { "sendrawtransactions", 0, "hexstrings" },
+    { "sendrawtransactions", 1, "allowhighfees" },
     { "combinerawtransaction", 0, "txs" },
     { "fundrawtransaction", 1, "options" },
     { "fundrawtransaction", 2, "iswitness" },
@@ -149,13 +151,24 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "createsidechaindeposit", 0, "nsidechain" },
     { "createsidechaindeposit", 2, "amount" },
     { "createsidechaindeposit", 3, "fee" },
+    { "createsidechaindeposits", 0, "nsidechain" },
+    { "createsidechaindeposits", 1, "deposits" },
+    { "createsidechaindeposits", 2, "fee" },
     { "getaveragefee", 0, "blockcount" },
     { "getaveragefee", 1, "startheight" },
     { "getworkscore", 0, "nsidechain" },
+    { "getscdbevents", 0, "count" },
     { "setwtprimevote", 1, "nsidechain" },
     { "listwtprimestatus", 0, "nsidechain" },
     { "listcachedwtprimetransactions", 0, "nsidechain" },
     { "verifydeposit", 2, "nTx" },
+    { "waitforbmm", 2, "timeout" },
+    { "waitfordeposit", 0, "nsidechain" },
+    { "waitfordeposit", 2, "n" },
+    { "waitfordeposit", 3, "timeout" },
+    { "waitforwtprimestatus", 0, "nsidechain" },
+    { "waitforwtprimestatus", 2, "nworkscore" },
+    { "waitforwtprimestatus", 3, "timeout" },
     // Echo with conversion (For testing only)
     { "echojson", 0, "arg0" },
     { "echojson", 1, "arg1" },
@@ -19,6 +19,7 @@
 #include <rpc/util.h>
 #include <sidechain.h>
 #include <sidechaindb.h>
+#include <sidechainevents.h>
 #include <timedata.h>
 #include <txdb.h>
 #include <util.h>
@@ -692,13 +693,15 @@ UniValue listsidechainctip(const JSONRPCRequest& request)
             + HelpExampleRpc("listsidechainctip", "\"nsidechain\"")
             );
 
+    std::shared_ptr<const ChainSnapshot> snapshot = GetChainSnapshot();
+
     // Is nSidechain valid?
     int nSidechain = request.params[0].get_int();
-    if (!scdb.IsSidechainActive(nSidechain))
+    if (!snapshot->scdb->IsSidechainActive(nSidechain))
         throw JSONRPCError(RPC_MISC_ERROR, "Invalid sidechain number!");
 
     SidechainCTIP ctip;
-    if (!scdb.GetCTIP(nSidechain, ctip))
+    if (!snapshot->scdb->GetCTIP(nSidechain, ctip))
         throw JSONRPCError(RPC_MISC_ERROR, "No CTIP found for sidechain!");
 
     UniValue obj(UniValue::VOBJ);
@@ -794,7 +797,14 @@ UniValue listsidechaindeposits(const JSONRPCRequest& request)
         LogPrintf("%s: %s\n", __func__, strError);
         throw JSONRPCError(RPC_MISC_ERROR, strError);
     }
+#endif
+
+    // Deposit lists can be long, write them out one at a time if possible
+    JSONStreamWriter* writer = request.pResultWriter;
+    if (writer)
+        writer->BeginArray();
 
+#ifdef ENABLE_WALLET
     for (auto rit = vDeposit.crbegin(); rit != vDeposit.crend(); rit++) {
         const SidechainDeposit d = *rit;
 
@@ -845,7 +855,10 @@ UniValue listsidechaindeposits(const JSONRPCRequest& request)
         obj.push_back(Pair("ntx", (int)d.nTx));
         obj.push_back(Pair("hashblock", d.hashBlock.ToString()));
 
-        arr.push_back(obj);
+        if (writer)
+            writer->Value(obj);
+        else
+            arr.push_back(obj);
 #endif
         if (fLimit) {
             count--;
@@ -854,6 +867,10 @@ UniValue listsidechaindeposits(const JSONRPCRequest& request)
         }
     }
 
+    if (writer) {
+        writer->EndArray();
+        return NullUniValue;
+    }
     return arr;
 }
 
@@ -872,6 +889,8 @@ UniValue countsidechaindeposits(const JSONRPCRequest& request)
             + HelpExampleRpc("countsidechaindeposits", "\"nsidechain\"")
             );
 
+    LOCK(cs_main);
+
 #ifdef ENABLE_WALLET
     // Check for active wallet
     std::string strError;
@@ -909,6 +928,8 @@ UniValue receivewtprime(const JSONRPCRequest& request)
             + HelpExampleRpc("receivewtprime", "")
      );
 
+    LOCK(cs_main);
+
 #ifndef ENABLE_WALLET
     strError = "Error: Wallet disabled";
     LogPrintf("%s: %s\n", __func__, strError);
@@ -1034,6 +1055,8 @@ UniValue verifybmm(const JSONRPCRequest& request)
             + HelpExampleRpc("verifybmm", "\"blockhash\", \"bmmhash\"")
             );
 
+    LOCK(cs_main);
+
     uint256 hashBlock = uint256S(request.params[0].get_str());
     uint256 hashBMM = uint256S(request.params[1].get_str());
 
@@ -1120,6 +1143,8 @@ UniValue verifydeposit(const JSONRPCRequest& request)
             + HelpExampleRpc("verifybmm", "\"blockhash\", \"txid\"")
             );
 
+    LOCK(cs_main);
+
     uint256 hashBlock = uint256S(request.params[0].get_str());
     uint256 txid = uint256S(request.params[1].get_str());
     int nTx = request.params[2].get_int();
@@ -1194,14 +1219,15 @@ UniValue listpreviousblockhashes(const JSONRPCRequest& request)
             + HelpExampleRpc("listpreviousblockhashes", "")
             );
 
-    int nHeight = chainActive.Height();
+    const CBlockIndex* pindexTip = GetChainSnapshot()->pindexTip;
+    int nHeight = pindexTip ? pindexTip->nHeight : -1;
     int nStart = nHeight - 4;
     if (!(nHeight > 0) || !(nStart > 0))
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Insufficient blocks connected to complete request!");
 
     std::vector<uint256> vHash;
     for (int i = nStart; i <= nHeight; i++) {
-        uint256 hashBlock = chainActive[i]->GetBlockHash();
+        uint256 hashBlock = pindexTip->GetAncestor(i)->GetBlockHash();
         vHash.push_back(hashBlock);
     }
 
@@ -1227,7 +1253,9 @@ UniValue listactivesidechains(const JSONRPCRequest& request)
             + HelpExampleRpc("listactivesidechains", "")
             );
 
-    std::vector<Sidechain> vActive = scdb.GetActiveSidechains();
+    std::shared_ptr<const ChainSnapshot> snapshot = GetChainSnapshot();
+
+    std::vector<Sidechain> vActive = snapshot->scdb->GetActiveSidechains();
     UniValue ret(UniValue::VARR);
     for (const Sidechain& s : vActive) {
         UniValue obj(UniValue::VOBJ);
@@ -1257,8 +1285,10 @@ UniValue listsidechainactivationstatus(const JSONRPCRequest& request)
             + HelpExampleRpc("listsidechainactivationstatus", "")
             );
 
+    std::shared_ptr<const ChainSnapshot> snapshot = GetChainSnapshot();
+
     std::vector<SidechainActivationStatus> vStatus;
-    vStatus = scdb.GetSidechainActivationStatus();
+    vStatus = snapshot->scdb->vActivationStatus;
 
     UniValue ret(UniValue::VARR);
     for (const SidechainActivationStatus& s : vStatus) {
@@ -1288,6 +1318,8 @@ UniValue listsidechainproposals(const JSONRPCRequest& request)
             + HelpExampleRpc("listsidechainproposals", "")
             );
 
+    LOCK(cs_main);
+
     std::vector<Sidechain> vProposal = scdb.GetSidechainProposals();
     UniValue ret(UniValue::VARR);
     for (const Sidechain& s : vProposal) {
@@ -1318,9 +1350,11 @@ UniValue getsidechainactivationstatus(const JSONRPCRequest& request)
             + HelpExampleRpc("getsidechainactivationstatus", "")
             );
 
+    std::shared_ptr<const ChainSnapshot> snapshot = GetChainSnapshot();
+
     // TODO
     std::vector<SidechainActivationStatus> vStatus;
-    vStatus = scdb.GetSidechainActivationStatus();
+    vStatus = snapshot->scdb->vActivationStatus;
 
     UniValue ret(UniValue::VARR);
     for (const SidechainActivationStatus& s : vStatus) {
@@ -1363,6 +1397,8 @@ UniValue createsidechainproposal(const JSONRPCRequest& request)
             + HelpExampleRpc("createsidechainproposal", "")
             );
 
+    LOCK(cs_main);
+
     int nSidechain = request.params[0].get_int();
     if (nSidechain < 0 || nSidechain > 255)
         throw JSONRPCError(RPC_MISC_ERROR, "Invalid sidechain number!");
@@ -1466,6 +1502,8 @@ UniValue setwtprimevote(const JSONRPCRequest& request)
             + HelpExampleRpc("setwtprimevote", "")
             );
 
+    LOCK(cs_main);
+
     std::string strVote = request.params[0].get_str();
     if (strVote != "upvote" && strVote != "downvote" && strVote != "abstain")
         throw JSONRPCError(RPC_TYPE_ERROR, "Invalid vote (must be \"upvote\", \"downvote\" or \"abstain\")");
@@ -1518,6 +1556,8 @@ UniValue clearwtprimevotes(const JSONRPCRequest& request)
             + HelpExampleRpc("clearwtprimevotes", "")
             );
 
+    LOCK(cs_main);
+
     scdb.ResetWTPrimeVotes();
 
     return NullUniValue;
@@ -1534,6 +1574,8 @@ UniValue listwtprimevotes(const JSONRPCRequest& request)
             + HelpExampleRpc("listwtprimevotes", "")
             );
 
+    LOCK(cs_main);
+
     std::vector<SidechainCustomVote> vCustomVote = scdb.GetCustomVoteCache();
 
     UniValue ret(UniValue::VARR);
@@ -1570,15 +1612,23 @@ UniValue getaveragefee(const JSONRPCRequest& request)
             "\nArguments:\n"
             "1. block_count     (numeric, optional, default=6) number of blocks to scan\n"
             "2. start_height    (numeric, optional, default=current block count) block height to start from\n"
+            "\nWith -blockstatsindex the average uses the exact fees from the index, and\n"
+            "blocks the index has no entry for yet are left out. Without the index, the\n"
+            "fees of each block are estimated as its coinbase value minus the subsidy.\n"
             "\nResult:\n"
             "{\n"
-            "  \"fee\" : x.x,   (numeric) average of fees in " + CURRENCY_UNIT + "/kB\n"
+            "  \"feeaverage\" : x.x,   (numeric) average fee per transaction in " + CURRENCY_UNIT + "\n"
+            "  \"exact\" : true|false, (boolean) whether the fees came from the block stats index\n"
+            "  \"blocks\" : n,         (numeric) number of blocks included in the average\n"
+            "  \"skipped\" : n,        (numeric) number of blocks left out because they are not indexed yet\n"
             "}\n"
             "\n"
             "\nExample:\n"
             + HelpExampleCli("getaveragefee", "6 10")
             );
 
+    LOCK(cs_main);
+
     int nBlocks = 6;
     if (request.params.size() >= 1)
         nBlocks = request.params[0].get_int();
@@ -1595,16 +1645,30 @@ UniValue getaveragefee(const JSONRPCRequest& request)
     if (nBlocks > nHeight)
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Invalid number of blocks!");
 
+    // Exact fees from the index and coinbase based estimates are never mixed
+    // in one average.
+    const bool fExact = fBlockStatsIndex;
+
     int nTx = 0;
+    int nIncluded = 0;
+    int nSkipped = 0;
     CAmount nTotalFees = 0;
     for (int i = nHeight; i >= (nHeight - nBlocks); i--) {
-        uint256 hashBlock = chainActive[i]->GetBlockHash();
+        CBlockIndex* pblockindex = chainActive[i];
 
-        if (mapBlockIndex.count(hashBlock) == 0)
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        if (fExact) {
+            CBlockStats stats;
+            if (!GetBlockStats(pblockindex, stats)) {
+                nSkipped++;
+                continue;
+            }
+            nTotalFees += stats.nTotalFee;
+            nTx += stats.nTx;
+            nIncluded++;
+            continue;
+        }
 
         CBlock block;
-        CBlockIndex* pblockindex = mapBlockIndex[hashBlock];
         if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
             throw JSONRPCError(RPC_MISC_ERROR, "Block not available (pruned data)");
 
@@ -1622,10 +1686,64 @@ UniValue getaveragefee(const JSONRPCRequest& request)
         nTotalFees += nCoinbase - nSubsidy;
         // Record number of transactions
         nTx += block.vtx.size();
+        nIncluded++;
     }
 
     UniValue result(UniValue::VOBJ);
-    result.push_back(Pair("feeaverage", ValueFromAmount(nTotalFees / nTx)));
+    result.push_back(Pair("feeaverage", ValueFromAmount(nTx ? nTotalFees / nTx : 0)));
+    result.push_back(Pair("exact", fExact));
+    result.push_back(Pair("blocks", nIncluded));
+    result.push_back(Pair("skipped", nSkipped));
+    return result;
+}
+
+UniValue getblockfeestats(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            "getblockfeestats \"blockhash\"\n"
+            "Get fee statistics of a block from the block stats index (requires -blockstatsindex)\n"
+            "\nArguments:\n"
+            "1. \"blockhash\"     (string, required) The block hash\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"totalfee\" : x.x,          (numeric) Total fees in " + CURRENCY_UNIT + ", including WT^ fees\n"
+            "  \"wtprimefee\" : x.x,        (numeric) Fees paid by WT^ payouts in " + CURRENCY_UNIT + "\n"
+            "  \"txs\" : n,                 (numeric) Number of transactions, including the coinbase\n"
+            "  \"vsize\" : n,               (numeric) Total virtual size of the transactions\n"
+            "  \"feerate_percentiles\" : [  (array of numeric) 10th, 25th, 50th, 75th and 90th feerate percentiles in satoshis per virtual byte\n"
+            "    n, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExample:\n"
+            + HelpExampleCli("getblockfeestats", "\"blockhash\"")
+            );
+
+    if (!fBlockStatsIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Block stats index disabled (use -blockstatsindex)");
+
+    uint256 hashBlock = uint256S(request.params[0].get_str());
+
+    LOCK(cs_main);
+
+    BlockMap::iterator it = mapBlockIndex.find(hashBlock);
+    if (it == mapBlockIndex.end())
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+
+    CBlockStats stats;
+    if (!GetBlockStats(it->second, stats))
+        throw JSONRPCError(RPC_MISC_ERROR, "No block stats for block (not connected or not yet indexed)");
+
+    UniValue percentiles(UniValue::VARR);
+    for (const CAmount& n : stats.feeratePercentiles)
+        percentiles.push_back(n);
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("totalfee", ValueFromAmount(stats.nTotalFee)));
+    result.push_back(Pair("wtprimefee", ValueFromAmount(stats.nWTPrimeFee)));
+    result.push_back(Pair("txs", (uint64_t)stats.nTx));
+    result.push_back(Pair("vsize", (uint64_t)stats.nVSize));
+    result.push_back(Pair("feerate_percentiles", percentiles));
     return result;
 }
 
@@ -1647,10 +1765,12 @@ UniValue getworkscore(const JSONRPCRequest& request)
             + HelpExampleCli("getworkscore", "0 hashWTPrime")
             );
 
+    std::shared_ptr<const ChainSnapshot> snapshot = GetChainSnapshot();
+
     // nSidechain
     int nSidechain = request.params[0].get_int();
 
-    if (!scdb.IsSidechainActive(nSidechain))
+    if (!snapshot->scdb->IsSidechainActive(nSidechain))
         throw JSONRPCError(RPC_TYPE_ERROR, "Invalid Sidechain number");
 
     std::string strHash = request.params[1].get_str();
@@ -1661,7 +1781,7 @@ UniValue getworkscore(const JSONRPCRequest& request)
     if (hashWTPrime.IsNull())
         throw JSONRPCError(RPC_TYPE_ERROR, "Invalid WT^ hash");
 
-    std::vector<SidechainWTPrimeState> vState = scdb.GetState(nSidechain);
+    std::vector<SidechainWTPrimeState> vState = snapshot->scdb->GetState(nSidechain);
     if (vState.empty())
         throw JSONRPCError(RPC_TYPE_ERROR, "No WT^(s) in SCDB for sidechain");
 
@@ -1698,16 +1818,23 @@ UniValue listwtprimestatus(const JSONRPCRequest& request)
             + HelpExampleCli("getworkscore", "0 hashWTPrime")
             );
 
+    std::shared_ptr<const ChainSnapshot> snapshot = GetChainSnapshot();
+
     // nSidechain
     int nSidechain = request.params[0].get_int();
 
-    if (!scdb.IsSidechainActive(nSidechain))
+    if (!snapshot->scdb->IsSidechainActive(nSidechain))
         throw JSONRPCError(RPC_TYPE_ERROR, "Invalid Sidechain number");
 
-    std::vector<SidechainWTPrimeState> vState = scdb.GetState(nSidechain);
+    std::vector<SidechainWTPrimeState> vState = snapshot->scdb->GetState(nSidechain);
     if (vState.empty())
         throw JSONRPCError(RPC_TYPE_ERROR, "No WT^(s) in SCDB for sidechain");
 
+    // Write the WT^(s) out one at a time if possible
+    JSONStreamWriter* writer = request.pResultWriter;
+    if (writer)
+        writer->BeginArray();
+
     UniValue ret(UniValue::VARR);
     for (const SidechainWTPrimeState& s : vState) {
         UniValue obj(UniValue::VOBJ);
@@ -1716,9 +1843,16 @@ UniValue listwtprimestatus(const JSONRPCRequest& request)
         obj.push_back(Pair("nblocksleft", s.nBlocksLeft));
         obj.push_back(Pair("nworkscore", s.nWorkScore));
 
-        ret.push_back(obj);
+        if (writer)
+            writer->Value(obj);
+        else
+            ret.push_back(obj);
     }
 
+    if (writer) {
+        writer->EndArray();
+        return NullUniValue;
+    }
     return ret;
 }
 
@@ -1739,13 +1873,15 @@ UniValue listcachedwtprimetransactions(const JSONRPCRequest& request)
             + HelpExampleCli("listcachedwtprimetransactions", "0")
             );
 
+    std::shared_ptr<const ChainSnapshot> snapshot = GetChainSnapshot();
+
     // nSidechain
     int nSidechain = request.params[0].get_int();
 
-    if (!scdb.IsSidechainActive(nSidechain))
+    if (!snapshot->scdb->IsSidechainActive(nSidechain))
         throw JSONRPCError(RPC_TYPE_ERROR, "Invalid Sidechain number");
 
-    std::vector<SidechainWTPrimeState> vState = scdb.GetState(nSidechain);
+    std::vector<SidechainWTPrimeState> vState = snapshot->scdb->GetState(nSidechain);
     if (vState.empty())
         throw JSONRPCError(RPC_TYPE_ERROR, "No WT^(s) in SCDB for sidechain");
 
@@ -1771,6 +1907,8 @@ UniValue havespentwtprime(const JSONRPCRequest& request)
             + HelpExampleCli("havespentwtprime", "hashwtprime, nsidechain")
             );
 
+    LOCK(cs_main);
+
     std::string strHash = request.params[0].get_str();
     if (strHash.size() != 64)
         throw JSONRPCError(RPC_TYPE_ERROR, "Invalid WT^ hash length");
@@ -1800,6 +1938,8 @@ UniValue havefailedwtprime(const JSONRPCRequest& request)
             + HelpExampleCli("havefailedwtprime", "hashwtprime, nsidechain")
             );
 
+    LOCK(cs_main);
+
     std::string strHash = request.params[0].get_str();
     if (strHash.size() != 64)
         throw JSONRPCError(RPC_TYPE_ERROR, "Invalid WT^ hash length");
@@ -1818,6 +1958,289 @@ UniValue havefailedwtprime(const JSONRPCRequest& request)
     return fFailed;
 }
 
+/** The most deposits waitfordeposit returns at once */
+static const size_t MAX_WAIT_DEPOSITS = 1000;
+
+/** Parse a wait RPC timeout in milliseconds into a deadline for
+ * WaitForNextChainSnapshot */
+static int64_t ParseWaitDeadline(const UniValue& value)
+{
+    if (value.isNull())
+        return 0;
+    int nTimeout = value.get_int();
+    if (nTimeout < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative timeout");
+    return nTimeout ? GetTimeMillis() + nTimeout : 0;
+}
+
+/**
+ * Wait for a chain snapshot newer than snapshot to be published, or until
+ * nDeadline (GetTimeMillis, no limit if 0). Returns false once the deadline
+ * has passed or RPC is stopping, so callers evaluate the snapshot they hold
+ * one last time before giving up.
+ */
+static bool WaitForNextChainSnapshot(std::shared_ptr<const ChainSnapshot>& snapshot, int64_t nDeadline)
+{
+    if (!IsRPCRunning())
+        return false;
+
+    int64_t nTimeout = 0;
+    if (nDeadline) {
+        nTimeout = nDeadline - GetTimeMillis();
+        if (nTimeout <= 0)
+            return false;
+    }
+
+    snapshot = WaitForChainSnapshot(snapshot, nTimeout);
+    return true;
+}
+
+UniValue waitforbmm(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 3)
+        throw std::runtime_error(
+            "waitforbmm \"bmmhash\" ( \"blockhash\" timeout )\n"
+            "Wait for a block that commits to h* to be connected to the\n"
+            "active chain. Returns right away if one of the blocks after\n"
+            "blockhash already does.\n"
+            "\nArguments:\n"
+            "1. \"bmmhash\"        (string, required) h* to wait for\n"
+            "2. \"blockhash\"      (string, optional) Search blocks after this one (default: the current tip)\n"
+            "3. timeout          (numeric, optional, default=0) Time in milliseconds to wait. 0 indicates no timeout.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"found\" : true|false,  (boolean) Whether h* was found\n"
+            "  \"blockhash\" : \"hash\",  (string) The block with h*, or the last block searched\n"
+            "  \"height\" : n,          (numeric) Height of that block\n"
+            "  \"txid\" : \"txid\",       (string) Coinbase txid of the block with h*, if found\n"
+            "  \"time\" : n,            (numeric) Time of the block with h*, if found\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("waitforbmm", "\"bmmhash\" \"blockhash\" 1000")
+            + HelpExampleRpc("waitforbmm", "\"bmmhash\", \"blockhash\", 1000")
+            );
+
+    uint256 hashBMM = ParseHashV(request.params[0], "bmmhash");
+    int64_t nDeadline = ParseWaitDeadline(request.params[2]);
+
+    // Take the snapshot before looking at the chain, so that no tip change
+    // can happen unnoticed between the search and the wait
+    std::shared_ptr<const ChainSnapshot> snapshot = GetChainSnapshot();
+
+    const CBlockIndex* pindexLast = snapshot->pindexTip;
+    if (!request.params[1].isNull() && !request.params[1].get_str().empty()) {
+        uint256 hashBlock = ParseHashV(request.params[1], "blockhash");
+
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(hashBlock);
+        if (it == mapBlockIndex.end() || !chainActive.Contains(it->second))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found in active chain");
+        pindexLast = it->second;
+    }
+    if (!pindexLast)
+        throw JSONRPCError(RPC_IN_WARMUP, "Chain not loaded yet");
+
+    UniValue ret(UniValue::VOBJ);
+    do {
+        // Search the blocks connected since the last round. After a reorg
+        // that is everything after the fork. If the snapshot is behind the
+        // block we start from, there is nothing to search until the next one.
+        const CBlockIndex* pindexTip = snapshot->pindexTip;
+        const CBlockIndex* pindexFork = LastCommonAncestor(pindexLast, pindexTip);
+        if (pindexFork == pindexTip)
+            continue;
+
+        std::vector<std::pair<const CBlockIndex*, CDiskBlockPos>> vBlockPos;
+        {
+            LOCK(cs_main);
+            for (int nHeight = pindexFork->nHeight + 1; nHeight <= pindexTip->nHeight; nHeight++) {
+                const CBlockIndex* pindex = pindexTip->GetAncestor(nHeight);
+                if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+                    throw JSONRPCError(RPC_MISC_ERROR, "Block not available (pruned data)");
+                vBlockPos.emplace_back(pindex, pindex->GetBlockPos());
+            }
+        }
+
+        for (const auto& blockPos : vBlockPos) {
+            CBlock block;
+            if (!ReadBlockFromDisk(block, blockPos.second, Params().GetConsensus()) || block.vtx.empty())
+                throw JSONRPCError(RPC_MISC_ERROR, "Block not found on disk");
+
+            for (const CTxOut& out : block.vtx[0]->vout) {
+                uint256 hashCritical;
+                if (!out.scriptPubKey.IsCriticalHashCommit(hashCritical) || hashCritical != hashBMM)
+                    continue;
+
+                ret.push_back(Pair("found", true));
+                ret.push_back(Pair("blockhash", blockPos.first->GetBlockHash().ToString()));
+                ret.push_back(Pair("height", blockPos.first->nHeight));
+                ret.push_back(Pair("txid", block.vtx[0]->GetHash().ToString()));
+                ret.push_back(Pair("time", (int64_t)block.nTime));
+                return ret;
+            }
+        }
+
+        pindexLast = pindexTip;
+    } while (WaitForNextChainSnapshot(snapshot, nDeadline));
+
+    ret.push_back(Pair("found", false));
+    ret.push_back(Pair("blockhash", pindexLast->GetBlockHash().ToString()));
+    ret.push_back(Pair("height", pindexLast->nHeight));
+    return ret;
+}
+
+UniValue waitfordeposit(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 4)
+        throw std::runtime_error(
+            "waitfordeposit nsidechain ( \"txid\" n timeout )\n"
+            "Wait for cached deposits to nsidechain after the given deposit\n"
+            "and return them, oldest first. Returns right away if there are\n"
+            "any already. Without a txid all cached deposits are returned.\n"
+            "\nArguments:\n"
+            "1. nsidechain     (numeric, required) The sidechain number\n"
+            "2. \"txid\"         (string, optional) TXID of the last deposit known to the caller\n"
+            "3. n              (numeric, optional, required if txid is set) Output index of that deposit\n"
+            "4. timeout        (numeric, optional, default=0) Time in milliseconds to wait. 0 indicates no timeout.\n"
+            "\nResult: (array, empty on timeout)\n"
+            "[\n"
+            "  {\n"
+            "    \"nsidechain\" : n,    (numeric) The sidechain number\n"
+            "    \"strdest\" : \"dest\",  (string) Sidechain destination\n"
+            "    \"txhex\" : \"hex\",     (string) The deposit transaction\n"
+            "    \"nburnindex\" : n,    (numeric) Output index of the deposit\n"
+            "    \"ntx\" : n,           (numeric) Position of the transaction in its block\n"
+            "    \"hashblock\" : \"hash\" (string) The block the deposit is in\n"
+            "  }\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("waitfordeposit", "0 \"txid\" 1 1000")
+            + HelpExampleRpc("waitfordeposit", "0, \"txid\", 1, 1000")
+            );
+
+    int nSidechain = request.params[0].get_int();
+
+    COutPoint outKnown;
+    if (!request.params[1].isNull() && !request.params[1].get_str().empty()) {
+        if (request.params[2].isNull())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Output index 'n' is required if TXID is provided!");
+        int n = request.params[2].get_int();
+        if (n < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid output index");
+        outKnown = COutPoint(ParseHashV(request.params[1], "txid"), n);
+    }
+
+    int64_t nDeadline = ParseWaitDeadline(request.params[3]);
+
+    // Deposits are added to the cache before the snapshot of the block that
+    // has them is published
+    std::shared_ptr<const ChainSnapshot> snapshot = GetChainSnapshot();
+
+    std::vector<SidechainDeposit> vDeposit;
+    do {
+        LOCK(cs_main);
+        if (!scdb.IsSidechainActive(nSidechain))
+            throw JSONRPCError(RPC_TYPE_ERROR, "Invalid Sidechain number");
+        if (!scdb.GetDepositsAfter(nSidechain, outKnown, MAX_WAIT_DEPOSITS, vDeposit))
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Deposit not found");
+        if (!vDeposit.empty())
+            break;
+    } while (WaitForNextChainSnapshot(snapshot, nDeadline));
+
+    UniValue ret(UniValue::VARR);
+    for (const SidechainDeposit& d : vDeposit) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("nsidechain", d.nSidechain));
+        obj.push_back(Pair("strdest", d.strDest));
+        obj.push_back(Pair("txhex", EncodeHexTx(d.tx)));
+        obj.push_back(Pair("nburnindex", (int)d.nBurnIndex));
+        obj.push_back(Pair("ntx", (int)d.nTx));
+        obj.push_back(Pair("hashblock", d.hashBlock.ToString()));
+        ret.push_back(obj);
+    }
+
+    return ret;
+}
+
+/**
+ * Status of a WT^ as of snapshot: "pending" while SCDB tracks its workscore,
+ * then "spent" or "failed". "unknown" if SCDB has not seen it.
+ */
+static std::string GetWTPrimeStatus(const ChainSnapshot& snapshot, uint8_t nSidechain, const uint256& hashWTPrime, SidechainWTPrimeState& stateOut)
+{
+    for (const SidechainWTPrimeState& s : snapshot.scdb->GetState(nSidechain)) {
+        if (s.hashWTPrime == hashWTPrime) {
+            stateOut = s;
+            return "pending";
+        }
+    }
+
+    LOCK(cs_main);
+    if (scdb.HaveSpentWTPrime(hashWTPrime, nSidechain))
+        return "spent";
+    if (scdb.HaveFailedWTPrime(hashWTPrime, nSidechain))
+        return "failed";
+    return "unknown";
+}
+
+UniValue waitforwtprimestatus(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 2 || request.params.size() > 4)
+        throw std::runtime_error(
+            "waitforwtprimestatus nsidechain \"hashwtprime\" ( nworkscore timeout )\n"
+            "Wait until a WT^ is spent or failed, or is pending with a\n"
+            "workscore other than nworkscore.\n"
+            "\nArguments:\n"
+            "1. nsidechain     (numeric, required) Sidechain number of the WT^\n"
+            "2. \"hashwtprime\"  (string, required) Hash of the WT^\n"
+            "3. nworkscore     (numeric, optional) Workscore known to the caller (default: the current workscore)\n"
+            "4. timeout        (numeric, optional, default=0) Time in milliseconds to wait. 0 indicates no timeout.\n"
+            "\nResult: (the status on return, whether or not it changed)\n"
+            "{\n"
+            "  \"hashwtprime\" : \"hash\",  (string) Hash of the WT^\n"
+            "  \"status\" : \"status\",     (string) One of \"pending\", \"spent\", \"failed\" or \"unknown\"\n"
+            "  \"nblocksleft\" : x,       (numeric) Verification blocks remaining, if pending\n"
+            "  \"nworkscore\" : x,        (numeric) Workscore of the WT^, if pending\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("waitforwtprimestatus", "0 \"hashwtprime\" 10 1000")
+            + HelpExampleRpc("waitforwtprimestatus", "0, \"hashwtprime\", 10, 1000")
+            );
+
+    std::shared_ptr<const ChainSnapshot> snapshot = GetChainSnapshot();
+
+    int nSidechain = request.params[0].get_int();
+    if (!snapshot->scdb->IsSidechainActive(nSidechain))
+        throw JSONRPCError(RPC_TYPE_ERROR, "Invalid Sidechain number");
+
+    uint256 hashWTPrime = ParseHashV(request.params[1], "hashwtprime");
+
+    int64_t nDeadline = ParseWaitDeadline(request.params[3]);
+
+    SidechainWTPrimeState state;
+    std::string strStatus = GetWTPrimeStatus(*snapshot, nSidechain, hashWTPrime, state);
+
+    int nWorkScoreKnown = strStatus == "pending" ? state.nWorkScore : -1;
+    if (!request.params[2].isNull())
+        nWorkScoreKnown = request.params[2].get_int();
+
+    while (strStatus == "unknown" || (strStatus == "pending" && state.nWorkScore == nWorkScoreKnown)) {
+        if (!WaitForNextChainSnapshot(snapshot, nDeadline))
+            break;
+        strStatus = GetWTPrimeStatus(*snapshot, nSidechain, hashWTPrime, state);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("hashwtprime", hashWTPrime.ToString()));
+    ret.push_back(Pair("status", strStatus));
+    if (strStatus == "pending") {
+        ret.push_back(Pair("nblocksleft", state.nBlocksLeft));
+        ret.push_back(Pair("nworkscore", state.nWorkScore));
+    }
+
+    return ret;
+}
+
 UniValue listspentwtprimes(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size())
@@ -1835,6 +2258,8 @@ UniValue listspentwtprimes(const JSONRPCRequest& request)
             + HelpExampleCli("listspentwtprimes", "")
             );
 
+    LOCK(cs_main);
+
     std::vector<SidechainSpentWTPrime> vSpent = scdb.GetSpentWTPrimeCache();
     if (vSpent.empty())
         throw JSONRPCError(RPC_TYPE_ERROR, "No spent WT^(s) in cache!");
@@ -1869,6 +2294,8 @@ UniValue listfailedwtprimes(const JSONRPCRequest& request)
             + HelpExampleCli("listfailedwtprimes", "")
             );
 
+    LOCK(cs_main);
+
     std::vector<SidechainFailedWTPrime> vFailed = scdb.GetFailedWTPrimeCache();
     if (vFailed.empty())
         throw JSONRPCError(RPC_TYPE_ERROR, "No failed WT^(s) in cache!");
@@ -1894,8 +2321,10 @@ UniValue getscdbhash(const JSONRPCRequest& request)
             "Get SCDB hash.\n"
             );
 
+    std::shared_ptr<const ChainSnapshot> snapshot = GetChainSnapshot();
+
     UniValue ret(UniValue::VOBJ);
-    ret.push_back(Pair("hashscdb", scdb.GetSCDBHash().ToString()));
+    ret.push_back(Pair("hashscdb", snapshot->scdb->hashSCDB.ToString()));
 
     return ret;
 }
@@ -1908,6 +2337,8 @@ UniValue gettotalscdbhash(const JSONRPCRequest& request)
             "Get hash of every member of SCDB combined.\n"
             );
 
+    LOCK(cs_main);
+
     UniValue ret(UniValue::VOBJ);
     ret.push_back(Pair("hashscdbtotal", scdb.GetTotalSCDBHash().ToString()));
 
@@ -1993,6 +2424,8 @@ UniValue listfailedbmm(const JSONRPCRequest& request)
             + HelpExampleCli("listfailedbmm", "")
             );
 
+    LOCK(cs_main);
+
     std::set<uint256> setTxid = scdb.GetRemovedBMM();
 
     UniValue ret(UniValue::VARR);
@@ -2004,6 +2437,56 @@ UniValue listfailedbmm(const JSONRPCRequest& request)
 
     return ret;
 }
+
+UniValue getscdbevents(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 1)
+        throw std::runtime_error(
+            "getscdbevents ( count )\n"
+            "Print the most recent changes made to SCDB, oldest first.\n"
+            "\nArguments:\n"
+            "1. count    (numeric, optional, default=100) Maximum number of events to return (max " + std::to_string(SCDB_EVENT_LOG_SIZE) + ").\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"sequence\" : n,      (numeric) Event sequence number\n"
+            "    \"time\" : n,          (numeric) Event time\n"
+            "    \"type\" : \"type\",     (string) vote, wtprime_added, wtprime_expired, wtprime_spent, deposit or ctip\n"
+            "    \"nsidechain\" : n,    (numeric) Sidechain number\n"
+            "    \"hash\" : \"hash\",     (string) WT^ hash, or txid for deposit and ctip events\n"
+            "    \"n\" : n,             (numeric) WT^ work score, or output index for deposit and ctip events\n"
+            "    \"amount\" : x.xxx,    (numeric) Amount in " + CURRENCY_UNIT + ", for wtprime_spent, deposit and ctip events\n"
+            "  }\n"
+            "]\n"
+            "\nExample:\n"
+            + HelpExampleCli("getscdbevents", "")
+            + HelpExampleCli("getscdbevents", "10")
+            );
+
+    int nCount = 100;
+    if (!request.params[0].isNull())
+        nCount = request.params[0].get_int();
+    if (nCount < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
+
+    std::vector<SidechainEvent> vEvent = scdbEvents.GetEvents(nCount);
+
+    UniValue ret(UniValue::VARR);
+    for (const SidechainEvent& e : vEvent) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("sequence", e.nSequence));
+        obj.push_back(Pair("time", e.nTime));
+        obj.push_back(Pair("type", SidechainEventTypeToString(e.nType)));
+        obj.push_back(Pair("nsidechain", e.nSidechain));
+        obj.push_back(Pair("hash", e.hash.ToString()));
+        obj.push_back(Pair("n", (uint64_t)e.n));
+        obj.push_back(Pair("amount", ValueFromAmount(e.amount)));
+        ret.push_back(obj);
+    }
+
+    return ret;
+}
+
 UniValue echo(const JSONRPCRequest& request)
 {
     if (request.fHelp)
@@ -2030,51 +2513,56 @@ static UniValue getinfo_deprecated(const JSONRPCRequest& request)
 }
 
 static const CRPCCommand commands[] =
-{ //  category              name                      actor (function)         argNames
-  //  --------------------- ------------------------  -----------------------  ----------
-    { "control",            "getmemoryinfo",          &getmemoryinfo,          {"mode"} },
+{ //  category              name                      actor (function)         argNames                  flags
+  //  --------------------- ------------------------  -----------------------  ----------                -----
+    { "control",            "getmemoryinfo",          &getmemoryinfo,          {"mode"}, RPC_FLAG_READONLY | RPC_FLAG_NO_CS_MAIN },
     { "control",            "logging",                &logging,                {"include", "exclude"}},
     { "util",               "validateaddress",        &validateaddress,        {"address"} }, /* uses wallet if enabled */
-    { "util",               "createmultisig",         &createmultisig,         {"nrequired","keys"} },
-    { "util",               "verifymessage",          &verifymessage,          {"address","signature","message"} },
-    { "util",               "signmessagewithprivkey", &signmessagewithprivkey, {"privkey","message"} },
+    { "util",               "createmultisig",         &createmultisig,         {"nrequired","keys"}, RPC_FLAG_READONLY },
+    { "util",               "verifymessage",          &verifymessage,          {"address","signature","message"}, RPC_FLAG_READONLY },
+    { "util",               "signmessagewithprivkey", &signmessagewithprivkey, {"privkey","message"}, RPC_FLAG_READONLY | RPC_FLAG_NO_CS_MAIN },
 
     /* Not shown in help */
     { "hidden",             "setmocktime",            &setmocktime,            {"timestamp"}},
-    { "hidden",             "echo",                   &echo,                   {"arg0","arg1","arg2","arg3","arg4","arg5","arg6","arg7","arg8","arg9"}},
-    { "hidden",             "echojson",               &echo,                   {"arg0","arg1","arg2","arg3","arg4","arg5","arg6","arg7","arg8","arg9"}},
+    { "hidden",             "echo",                   &echo,                   {"arg0","arg1","arg2","arg3","arg4","arg5","arg6","arg7","arg8","arg9"}, RPC_FLAG_READONLY | RPC_FLAG_NO_CS_MAIN },
+    { "hidden",             "echojson",               &echo,                   {"arg0","arg1","arg2","arg3","arg4","arg5","arg6","arg7","arg8","arg9"}, RPC_FLAG_READONLY | RPC_FLAG_NO_CS_MAIN },
     { "hidden",             "getinfo",                &getinfo_deprecated,     {}},
 
     // TODO improve & shorten name. Sort alphabetically
     /* DriveChain rpc commands (mainly used by sidechains) */
     { "DriveChain",  "createcriticaldatatx",          &createcriticaldatatx,         {"amount", "height", "criticalhash"}},
-    { "DriveChain",  "listsidechainctip",             &listsidechainctip,            {"nsidechain"}},
-    { "DriveChain",  "listsidechaindeposits",         &listsidechaindeposits,        {"addressbytes"}},
-    { "DriveChain",  "countsidechaindeposits",        &countsidechaindeposits,       {"nsidechain"}},
+    { "DriveChain",  "listsidechainctip",             &listsidechainctip,            {"nsidechain"}, RPC_FLAG_READONLY | RPC_FLAG_NO_CS_MAIN },
+    { "DriveChain",  "listsidechaindeposits",         &listsidechaindeposits,        {"addressbytes"}, RPC_FLAG_READONLY },
+    { "DriveChain",  "countsidechaindeposits",        &countsidechaindeposits,       {"nsidechain"}, RPC_FLAG_READONLY },
+    { "DriveChain",  "waitfordeposit",                &waitfordeposit,               {"nsidechain", "txid", "n", "timeout"}},
     { "DriveChain",  "receivewtprime",                &receivewtprime,               {"nsidechain","rawtx"}},
-    { "DriveChain",  "verifybmm",                     &verifybmm,                    {"blockhash", "bmmhash"}},
-    { "DriveChain",  "verifydeposit",                 &verifydeposit,                {"blockhash", "txid", "ntx"}},
-    { "DriveChain",  "listpreviousblockhashes",       &listpreviousblockhashes,      {}},
-    { "DriveChain",  "listactivesidechains",          &listactivesidechains,         {}},
-    { "DriveChain",  "listsidechainactivationstatus", &listsidechainactivationstatus,{}},
-    { "DriveChain",  "listsidechainproposals",        &listsidechainproposals,       {}},
-    { "DriveChain",  "getsidechainactivationstatus",  &getsidechainactivationstatus, {}},
+    { "DriveChain",  "verifybmm",                     &verifybmm,                    {"blockhash", "bmmhash"}, RPC_FLAG_READONLY },
+    { "DriveChain",  "waitforbmm",                    &waitforbmm,                   {"bmmhash", "blockhash", "timeout"}},
+    { "DriveChain",  "verifydeposit",                 &verifydeposit,                {"blockhash", "txid", "ntx"}, RPC_FLAG_READONLY },
+    { "DriveChain",  "listpreviousblockhashes",       &listpreviousblockhashes,      {}, RPC_FLAG_READONLY | RPC_FLAG_NO_CS_MAIN },
+    { "DriveChain",  "listactivesidechains",          &listactivesidechains,         {}, RPC_FLAG_READONLY | RPC_FLAG_NO_CS_MAIN },
+    { "DriveChain",  "listsidechainactivationstatus", &listsidechainactivationstatus,{}, RPC_FLAG_READONLY | RPC_FLAG_NO_CS_MAIN },
+    { "DriveChain",  "listsidechainproposals",        &listsidechainproposals,       {}, RPC_FLAG_READONLY },
+    { "DriveChain",  "getsidechainactivationstatus",  &getsidechainactivationstatus, {}, RPC_FLAG_READONLY | RPC_FLAG_NO_CS_MAIN },
     { "DriveChain",  "createsidechainproposal",       &createsidechainproposal,      {"nsidechain", "title", "description", "keyhash", "nversion", "hashid1", "hashid2"}},
     { "DriveChain",  "clearwtprimevotes",             &clearwtprimevotes,            {}},
     { "DriveChain",  "setwtprimevote",                &setwtprimevote,               {"vote", "nsidechain", "hashwtprime"}},
-    { "DriveChain",  "listwtprimevotes",              &listwtprimevotes,             {}},
-    { "DriveChain",  "getaveragefee",                 &getaveragefee,                {"numblocks", "startheight"}},
-    { "DriveChain",  "getworkscore",                  &getworkscore,                 {"nsidechain", "hashwtprime"}},
-    { "DriveChain",  "havespentwtprime",              &havespentwtprime,             {"hashwtprime", "nsidechain"}},
-    { "DriveChain",  "havefailedwtprime",             &havefailedwtprime,            {"hashwtprime", "nsidechain"}},
-    { "DriveChain",  "listcachedwtprimetransactions", &listcachedwtprimetransactions,{"nsidechain"}},
-    { "DriveChain",  "listwtprimestatus",             &listwtprimestatus,            {"nsidechain"}},
-    { "DriveChain",  "listspentwtprimes",             &listspentwtprimes,            {}},
-    { "DriveChain",  "listfailedwtprimes",            &listfailedwtprimes,           {}},
-    { "DriveChain",  "getscdbhash",                   &getscdbhash,                  {}},
-    { "DriveChain",  "gettotalscdbhash",              &gettotalscdbhash,             {}},
-    { "DriveChain",  "getscdbdataforblock",           &getscdbdataforblock,          {"blockhash"}},
-    { "DriveChain",  "listfailedbmm",                 &listfailedbmm,                {}},
+    { "DriveChain",  "listwtprimevotes",              &listwtprimevotes,             {}, RPC_FLAG_READONLY },
+    { "DriveChain",  "getaveragefee",                 &getaveragefee,                {"numblocks", "startheight"}, RPC_FLAG_READONLY },
+    { "DriveChain",  "getblockfeestats",              &getblockfeestats,             {"blockhash"}, RPC_FLAG_READONLY },
+    { "DriveChain",  "getworkscore",                  &getworkscore,                 {"nsidechain", "hashwtprime"}, RPC_FLAG_READONLY | RPC_FLAG_NO_CS_MAIN },
+    { "DriveChain",  "havespentwtprime",              &havespentwtprime,             {"hashwtprime", "nsidechain"}, RPC_FLAG_READONLY },
+    { "DriveChain",  "havefailedwtprime",             &havefailedwtprime,            {"hashwtprime", "nsidechain"}, RPC_FLAG_READONLY },
+    { "DriveChain",  "listcachedwtprimetransactions", &listcachedwtprimetransactions,{"nsidechain"}, RPC_FLAG_READONLY | RPC_FLAG_NO_CS_MAIN },
+    { "DriveChain",  "listwtprimestatus",             &listwtprimestatus,            {"nsidechain"}, RPC_FLAG_READONLY | RPC_FLAG_NO_CS_MAIN },
+    { "DriveChain",  "waitforwtprimestatus",          &waitforwtprimestatus,         {"nsidechain", "hashwtprime", "nworkscore", "timeout"}},
+    { "DriveChain",  "listspentwtprimes",             &listspentwtprimes,            {}, RPC_FLAG_READONLY },
+    { "DriveChain",  "listfailedwtprimes",            &listfailedwtprimes,           {}, RPC_FLAG_READONLY },
+    { "DriveChain",  "getscdbhash",                   &getscdbhash,                  {}, RPC_FLAG_READONLY | RPC_FLAG_NO_CS_MAIN },
+    { "DriveChain",  "gettotalscdbhash",              &gettotalscdbhash,             {}, RPC_FLAG_READONLY },
+    { "DriveChain",  "getscdbdataforblock",           &getscdbdataforblock,          {"blockhash"}, RPC_FLAG_READONLY },
+    { "DriveChain",  "listfailedbmm",                 &listfailedbmm,                {}, RPC_FLAG_READONLY },
+    { "DriveChain",  "getscdbevents",                 &getscdbevents,                {"count"}, RPC_FLAG_READONLY | RPC_FLAG_NO_CS_MAIN },
 };
 
 void RegisterMiscRPCCommands(CRPCTable &t)
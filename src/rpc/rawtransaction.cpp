@@ -6,6 +6,7 @@
 #include <base58.h>
 #include <chain.h>
 #include <coins.h>
+#include <consensus/tx_verify.h>
 #include <consensus/validation.h>
 #include <core_io.h>
 #include <init.h>
@@ -23,8 +24,10 @@
 #include <script/script_error.h>
 #include <script/sign.h>
 #include <script/standard.h>
+#include <taskpool.h>
 #include <txmempool.h>
 #include <uint256.h>
+#include <util.h>
 #include <utilstrencodings.h>
 #ifdef ENABLE_WALLET
 #include <wallet/rpcwallet.h>
@@ -32,6 +35,7 @@
 #endif
 
 #include <future>
+#include <map>
 #include <stdint.h>
 
 #include <univalue.h>
@@ -1022,6 +1026,199 @@ UniValue sendrawtransaction(const JSONRPCRequest& request)
     return hashTx.GetHex();
 }
 
+/** Maximum number of transactions accepted by a single sendrawtransactions call */
+static const unsigned int MAX_RAW_TRANSACTION_BATCH = 1000;
+
+/** Decoding and context free checks of one sendrawtransactions entry */
+struct RawTransactionBatchEntry
+{
+    CTransactionRef tx;
+    std::string strError;
+};
+
+static void DecodeRawTransactionBatchEntry(const UniValue& hexstring, RawTransactionBatchEntry& entry)
+{
+    CMutableTransaction mtx;
+    if (!hexstring.isStr() || !DecodeHexTx(mtx, hexstring.get_str())) {
+        entry.strError = "TX decode failed";
+        return;
+    }
+    entry.tx = MakeTransactionRef(std::move(mtx));
+
+    CValidationState state;
+    if (!CheckTransaction(*entry.tx, state) || entry.tx->IsCoinBase()) {
+        if (state.IsValid())
+            state.DoS(100, false, REJECT_INVALID, "coinbase");
+        entry.strError = strprintf("%i: %s", state.GetRejectCode(), state.GetRejectReason());
+    }
+}
+
+UniValue sendrawtransactions(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
+        throw std::runtime_error(
+            "sendrawtransactions [\"hexstring\",...] ( allowhighfees )\n"
+            "\nSubmits a batch of raw transactions (serialized, hex-encoded) to local node and network.\n"
+            "\nThe transactions are decoded and their signatures are checked in parallel before\n"
+            "they are added to the mempool together. Transactions may spend outputs of other\n"
+            "transactions of the batch, in any order. A failed transaction does not stop the\n"
+            "rest of the batch from being submitted.\n"
+            "\nArguments:\n"
+            "1. \"hexstrings\"   (array, required) The hex strings of the raw transactions, at most " + std::to_string(MAX_RAW_TRANSACTION_BATCH) + "\n"
+            "2. allowhighfees    (boolean, optional, default=false) Allow high fees\n"
+            "\nResult:\n"
+            "[                   (array) One object per transaction, in the order given\n"
+            "  {\n"
+            "    \"txid\" : \"hex\",   (string) The transaction hash in hex, missing if the transaction could not be decoded\n"
+            "    \"accepted\" : b,   (boolean) Whether the transaction is in the mempool\n"
+            "    \"error\" : \"str\"   (string) Reason the transaction was rejected, only present if not accepted\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("sendrawtransactions", "\"[\\\"signedhex\\\",\\\"signedhex\\\"]\"") +
+            "\nAs a json rpc call\n"
+            + HelpExampleRpc("sendrawtransactions", "[\"signedhex\",\"signedhex\"]")
+        );
+
+    ObserveSafeMode();
+
+    RPCTypeCheck(request.params, {UniValue::VARR, UniValue::VBOOL});
+
+    const UniValue& hexstrings = request.params[0].get_array();
+    if (hexstrings.size() > MAX_RAW_TRANSACTION_BATCH)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Too many transactions, at most %u are allowed", MAX_RAW_TRANSACTION_BATCH));
+
+    CAmount nMaxRawTxFee = maxTxFee;
+    if (!request.params[1].isNull() && request.params[1].get_bool())
+        nMaxRawTxFee = 0;
+
+    // Decode and run the context free checks in parallel
+    std::vector<RawTransactionBatchEntry> vEntry(hexstrings.size());
+    std::vector<CTaskPool::Task> vTask;
+    vTask.reserve(vEntry.size());
+    for (size_t i = 0; i < vEntry.size(); i++) {
+        vTask.emplace_back([&hexstrings, &vEntry, i] {
+            DecodeRawTransactionBatchEntry(hexstrings[i], vEntry[i]);
+        });
+    }
+    g_rpc_task_pool.Run(vTask);
+
+    // Order the batch so that parents are submitted before their children,
+    // otherwise keep the order of the request.
+    std::map<uint256, size_t> mapBatch;
+    for (size_t i = 0; i < vEntry.size(); i++) {
+        if (vEntry[i].tx && vEntry[i].strError.empty())
+            mapBatch.emplace(vEntry[i].tx->GetHash(), i);
+    }
+    std::vector<size_t> vOrder;
+    std::vector<int> vState(vEntry.size(), 0); // 0 = new, 1 = visiting, 2 = done
+    for (size_t i = 0; i < vEntry.size(); i++) {
+        if (!vEntry[i].tx || !vEntry[i].strError.empty() || vState[i] != 0)
+            continue;
+        std::vector<std::pair<size_t, size_t>> vStack; // entry, next input
+        vStack.emplace_back(i, 0);
+        vState[i] = 1;
+        while (!vStack.empty()) {
+            const size_t nEntry = vStack.back().first;
+            const CTransaction& tx = *vEntry[nEntry].tx;
+            size_t& nIn = vStack.back().second;
+            if (nIn == tx.vin.size()) {
+                vOrder.push_back(nEntry);
+                vState[nEntry] = 2;
+                vStack.pop_back();
+                continue;
+            }
+            auto parent = mapBatch.find(tx.vin[nIn++].prevout.hash);
+            // A cycle can't be valid, leave it for AcceptToMemoryPool to reject
+            if (parent != mapBatch.end() && vState[parent->second] == 0) {
+                vState[parent->second] = 1;
+                vStack.emplace_back(parent->second, 0);
+            }
+        }
+    }
+
+    std::vector<CTransactionRef> vtxOrdered;
+    vtxOrdered.reserve(vOrder.size());
+    for (size_t nEntry : vOrder)
+        vtxOrdered.push_back(vEntry[nEntry].tx);
+
+    // Fill the signature cache before taking cs_main for the whole batch
+    PreCheckTransactionScripts(vtxOrdered, g_rpc_task_pool);
+
+    std::vector<bool> vAccepted(vEntry.size(), false);
+    std::vector<uint256> vRelay;
+    std::promise<void> promise;
+    { // cs_main scope
+    LOCK(cs_main);
+    CCoinsViewCache &view = *pcoinsTip;
+    for (size_t nEntry : vOrder) {
+        RawTransactionBatchEntry& entry = vEntry[nEntry];
+        const uint256& hashTx = entry.tx->GetHash();
+
+        bool fHaveChain = false;
+        for (size_t o = 0; !fHaveChain && o < entry.tx->vout.size(); o++) {
+            const Coin& existingCoin = view.AccessCoin(COutPoint(hashTx, o));
+            fHaveChain = !existingCoin.IsSpent();
+        }
+        if (fHaveChain) {
+            entry.strError = "transaction already in block chain";
+            continue;
+        }
+        if (mempool.exists(hashTx)) {
+            vAccepted[nEntry] = true;
+            vRelay.push_back(hashTx);
+            continue;
+        }
+
+        CValidationState state;
+        bool fMissingInputs;
+        if (AcceptToMemoryPool(mempool, state, entry.tx, &fMissingInputs,
+                               nullptr /* plTxnReplaced */, false /* bypass_limits */, nMaxRawTxFee)) {
+            vAccepted[nEntry] = true;
+            vRelay.push_back(hashTx);
+        } else if (state.IsInvalid()) {
+            entry.strError = strprintf("%i: %s", state.GetRejectCode(), state.GetRejectReason());
+        } else if (fMissingInputs) {
+            entry.strError = "Missing inputs";
+        } else {
+            entry.strError = state.GetRejectReason();
+        }
+    }
+
+    // Make sure the wallet has seen the new transactions before returning,
+    // see sendrawtransaction
+    CallFunctionInValidationInterfaceQueue([&promise] {
+        promise.set_value();
+    });
+    } // cs_main
+
+    promise.get_future().wait();
+
+    if (!vRelay.empty()) {
+        if(!g_connman)
+            throw JSONRPCError(RPC_CLIENT_P2P_DISABLED, "Error: Peer-to-peer functionality missing or disabled");
+
+        g_connman->ForEachNode([&vRelay](CNode* pnode)
+        {
+            for (const uint256& hash : vRelay)
+                pnode->PushInventory(CInv(MSG_TX, hash));
+        });
+    }
+
+    UniValue result(UniValue::VARR);
+    for (size_t i = 0; i < vEntry.size(); i++) {
+        UniValue obj(UniValue::VOBJ);
+        if (vEntry[i].tx)
+            obj.push_back(Pair("txid", vEntry[i].tx->GetHash().GetHex()));
+        obj.push_back(Pair("accepted", (bool)vAccepted[i]));
+        if (!vAccepted[i])
+            obj.push_back(Pair("error", vEntry[i].strError));
+        result.push_back(obj);
+    }
+    return result;
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         argNames
   //  --------------------- ------------------------  -----------------------  ----------
@@ -1030,6 +1227,7 @@ static const CRPCCommand commands[] =
     { "rawtransactions",    "decoderawtransaction",   &decoderawtransaction,   {"hexstring","iswitness"} },
     { "rawtransactions",    "decodescript",           &decodescript,           {"hexstring"} },
     { "rawtransactions",    "sendrawtransaction",     &sendrawtransaction,     {"hexstring","allowhighfees"} },
+    { "rawtransactions",    "sendrawtransactions",    &sendrawtransactions,    {"hexstrings","allowhighfees"} },
     { "rawtransactions",    "combinerawtransaction",  &combinerawtransaction,  {"txs"} },
     { "rawtransactions",    "signrawtransaction",     &signrawtransaction,     {"hexstring","prevtxs","privkeys","sighashtype"} }, /* uses wallet if enabled */
 
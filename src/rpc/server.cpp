@@ -10,9 +10,11 @@
 #include <init.h>
 #include <random.h>
 #include <sync.h>
+#include <taskpool.h>
 #include <ui_interface.h>
 #include <util.h>
 #include <utilstrencodings.h>
+#include <validation.h>
 
 #include <boost/bind.hpp>
 #include <boost/signals2/signal.hpp>
@@ -260,12 +262,12 @@ UniValue uptime(const JSONRPCRequest& jsonRequest)
  * Call Table
  */
 static const CRPCCommand vRPCCommands[] =
-{ //  category              name                      actor (function)         argNames
-  //  --------------------- ------------------------  -----------------------  ----------
+{ //  category              name                      actor (function)         argNames      flags
+  //  --------------------- ------------------------  -----------------------  ----------    -----
     /* Overall control/query calls */
-    { "control",            "help",                   &help,                   {"command"}  },
+    { "control",            "help",                   &help,                   {"command"},  RPC_FLAG_READONLY },
     { "control",            "stop",                   &stop,                   {}  },
-    { "control",            "uptime",                 &uptime,                 {}  },
+    { "control",            "uptime",                 &uptime,                 {},           RPC_FLAG_READONLY | RPC_FLAG_NO_CS_MAIN },
 };
 
 CRPCTable::CRPCTable()
@@ -351,6 +353,113 @@ bool RPCIsInWarmup(std::string *outStatus)
     return fRPCInWarmup;
 }
 
+JSONStreamWriter::JSONStreamWriter(const Sink& sinkIn, size_t nFlushSizeIn) :
+    sink(sinkIn), nFlushSize(nFlushSizeIn), fKeyPending(false), fFlushed(false)
+{
+}
+
+void JSONStreamWriter::Write(const std::string& str)
+{
+    strBuffer += str;
+    if (strBuffer.size() >= nFlushSize) {
+        sink(strBuffer);
+        strBuffer.clear();
+        fFlushed = true;
+    }
+}
+
+void JSONStreamWriter::BeginValue()
+{
+    if (fKeyPending) {
+        fKeyPending = false;
+        return;
+    }
+    if (!vEmpty.empty()) {
+        if (!vEmpty.back())
+            strBuffer += ',';
+        vEmpty.back() = false;
+    }
+}
+
+void JSONStreamWriter::BeginObject()
+{
+    BeginValue();
+    vEmpty.push_back(true);
+    Write("{");
+}
+
+void JSONStreamWriter::EndObject()
+{
+    assert(!vEmpty.empty() && !fKeyPending);
+    vEmpty.pop_back();
+    Write("}");
+}
+
+void JSONStreamWriter::BeginArray()
+{
+    BeginValue();
+    vEmpty.push_back(true);
+    Write("[");
+}
+
+void JSONStreamWriter::EndArray()
+{
+    assert(!vEmpty.empty() && !fKeyPending);
+    vEmpty.pop_back();
+    Write("]");
+}
+
+void JSONStreamWriter::Key(const std::string& key)
+{
+    assert(!vEmpty.empty() && !fKeyPending);
+    if (!vEmpty.back())
+        strBuffer += ',';
+    vEmpty.back() = false;
+    Write(UniValue(key).write() + ":");
+    fKeyPending = true;
+}
+
+void JSONStreamWriter::Value(const UniValue& value)
+{
+    switch (value.getType()) {
+    case UniValue::VOBJ:
+        BeginObject();
+        KeyValues(value);
+        EndObject();
+        break;
+    case UniValue::VARR:
+        BeginArray();
+        for (const UniValue& v : value.getValues())
+            Value(v);
+        EndArray();
+        break;
+    default:
+        BeginValue();
+        Write(value.write());
+    }
+}
+
+void JSONStreamWriter::KeyValue(const std::string& key, const UniValue& value)
+{
+    Key(key);
+    Value(value);
+}
+
+void JSONStreamWriter::KeyValues(const UniValue& obj)
+{
+    const std::vector<std::string>& keys = obj.getKeys();
+    const std::vector<UniValue>& values = obj.getValues();
+    for (size_t i = 0; i < keys.size(); i++)
+        KeyValue(keys[i], values[i]);
+}
+
+std::string JSONStreamWriter::ReleaseBuffer()
+{
+    std::string str;
+    str.swap(strBuffer);
+    return str;
+}
+
 void JSONRPCRequest::parse(const UniValue& valRequest)
 {
     // Parse request
@@ -410,11 +519,57 @@ static UniValue JSONRPCExecOne(JSONRPCRequest jreq, const UniValue& req)
     return rpc_result;
 }
 
+/** Whether a batch item calls a method flagged RPC_FLAG_READONLY */
+static bool IsReadOnlyRequest(const UniValue& req)
+{
+    if (!req.isObject())
+        return false;
+    const UniValue& method = find_value(req.get_obj(), "method");
+    if (!method.isStr())
+        return false;
+    const CRPCCommand* pcmd = tableRPC[method.get_str()];
+    return pcmd && (pcmd->flags & RPC_FLAG_READONLY);
+}
+
+CTaskPool g_rpc_task_pool;
+
+void ThreadRPCTaskPool() {
+    RenameThread("bitcoin-rpctask");
+    g_rpc_task_pool.Thread();
+}
+
 std::string JSONRPCExecBatch(const JSONRPCRequest& jreq, const UniValue& vReq)
 {
+    std::vector<UniValue> vResult(vReq.size());
+
+    size_t nNext = 0;
+    while (nNext < vReq.size()) {
+        // Calls that may change state run alone and in request order, so
+        // later calls see their effects. Runs of read-only calls in between
+        // are spread over the batch threads.
+        size_t nEnd = nNext;
+        while (nEnd < vReq.size() && IsReadOnlyRequest(vReq[nEnd]))
+            nEnd++;
+        if (nEnd - nNext < 2) {
+            vResult[nNext] = JSONRPCExecOne(jreq, vReq[nNext]);
+            nNext++;
+            continue;
+        }
+
+        std::vector<CTaskPool::Task> vTask;
+        vTask.reserve(nEnd - nNext);
+        for (size_t i = nNext; i < nEnd; i++) {
+            vTask.emplace_back([&jreq, &vReq, &vResult, i] {
+                vResult[i] = JSONRPCExecOne(jreq, vReq[i]);
+            });
+        }
+        g_rpc_task_pool.Run(vTask);
+
+        nNext = nEnd;
+    }
+
     UniValue ret(UniValue::VARR);
-    for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(jreq, vReq[reqIdx]));
+    ret.push_backV(vResult);
 
     return ret.write() + "\n";
 }
@@ -469,6 +624,16 @@ static inline JSONRPCRequest transformNamedArguments(const JSONRPCRequest& in, c
     return out;
 }
 
+static UniValue ExecuteCommand(const CRPCCommand& cmd, const JSONRPCRequest& request)
+{
+    // Execute, convert arguments to array if necessary
+    if (request.params.isObject()) {
+        return cmd.actor(transformNamedArguments(request, cmd.argNames));
+    } else {
+        return cmd.actor(request);
+    }
+}
+
 UniValue CRPCTable::execute(const JSONRPCRequest &request) const
 {
     // Return immediately if in warmup
@@ -487,12 +652,11 @@ UniValue CRPCTable::execute(const JSONRPCRequest &request) const
 
     try
     {
-        // Execute, convert arguments to array if necessary
-        if (request.params.isObject()) {
-            return pcmd->actor(transformNamedArguments(request, pcmd->argNames));
-        } else {
-            return pcmd->actor(request);
+        if (pcmd->flags & RPC_FLAG_NO_CS_MAIN) {
+            FORBID_LOCK(cs_main);
+            return ExecuteCommand(*pcmd, request);
         }
+        return ExecuteCommand(*pcmd, request);
     }
     catch (const std::exception& e)
     {
@@ -10,16 +10,21 @@
 #include <rpc/protocol.h>
 #include <uint256.h>
 
+#include <functional>
 #include <list>
 #include <map>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 #include <univalue.h>
 
 static const unsigned int DEFAULT_RPC_SERIALIZE_VERSION = 1;
+/** Maximum number of threads running the read-only calls of RPC batches */
+static const int MAX_RPC_TASK_THREADS = 16;
 
 class CRPCCommand;
+class CTaskPool;
 
 namespace RPCServer
 {
@@ -36,6 +41,51 @@ struct UniValueType {
     UniValue::VType type;
 };
 
+/**
+ * Writes a JSON document piece by piece, handing the output to a sink (such
+ * as a chunked HTTP reply) whenever about nFlushSize bytes have collected.
+ * Large results then need neither a complete UniValue tree nor a complete
+ * string in memory.
+ */
+class JSONStreamWriter
+{
+public:
+    typedef std::function<void(const std::string&)> Sink;
+
+    explicit JSONStreamWriter(const Sink& sinkIn, size_t nFlushSizeIn = 64 * 1024);
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+    /** Write the key of the next member of the open object */
+    void Key(const std::string& key);
+    /** Write a value. Arrays and objects are written element by element. */
+    void Value(const UniValue& value);
+    void KeyValue(const std::string& key, const UniValue& value);
+    /** Write all members of obj into the open object */
+    void KeyValues(const UniValue& obj);
+
+    /** Whether a key has been written but not its value */
+    bool IsValuePending() const { return fKeyPending; }
+    /** Whether any output has been handed to the sink */
+    bool HasFlushed() const { return fFlushed; }
+    /** Take the output that has not been handed to the sink yet */
+    std::string ReleaseBuffer();
+
+private:
+    Sink sink;
+    size_t nFlushSize;
+    std::string strBuffer;
+    //! Whether each open array or object is still empty
+    std::vector<bool> vEmpty;
+    bool fKeyPending;
+    bool fFlushed;
+
+    void BeginValue();
+    void Write(const std::string& str);
+};
+
 class JSONRPCRequest
 {
 public:
@@ -45,8 +95,11 @@ public:
     bool fHelp;
     std::string URI;
     std::string authUser;
+    //! If set, the method may write its result here instead of returning
+    //! it, and then returns NullUniValue.
+    JSONStreamWriter* pResultWriter;
 
-    JSONRPCRequest() : id(NullUniValue), params(NullUniValue), fHelp(false) {}
+    JSONRPCRequest() : id(NullUniValue), params(NullUniValue), fHelp(false), pResultWriter(nullptr) {}
     void parse(const UniValue& valRequest);
 };
 
@@ -127,13 +180,30 @@ void RPCRunLater(const std::string& name, std::function<void(void)> func, int64_
 
 typedef UniValue(*rpcfn_type)(const JSONRPCRequest& jsonRequest);
 
+/** Flags of CRPCCommand describing what a method touches */
+enum RPCCommandFlags : unsigned int {
+    //! The method changes no state. Batch requests run consecutive read-only
+    //! calls concurrently instead of one after another.
+    RPC_FLAG_READONLY = (1U << 0),
+    //! The method does not take cs_main. It reads chain and SCDB state from
+    //! the published chain snapshot, so it never waits for block validation.
+    //! Taking cs_main anyway aborts in DEBUG_LOCKORDER builds.
+    RPC_FLAG_NO_CS_MAIN = (1U << 1),
+};
+
 class CRPCCommand
 {
 public:
+    CRPCCommand(std::string categoryIn, std::string nameIn, rpcfn_type actorIn, std::vector<std::string> argNamesIn, unsigned int flagsIn = 0)
+        : category(std::move(categoryIn)), name(std::move(nameIn)), actor(actorIn), argNames(std::move(argNamesIn)), flags(flagsIn)
+    {
+    }
+
     std::string category;
     std::string name;
     rpcfn_type actor;
     std::vector<std::string> argNames;
+    unsigned int flags; //!< RPCCommandFlags
 };
 
 /**
@@ -191,8 +261,15 @@ extern std::string HelpExampleRpc(const std::string& methodname, const std::stri
 bool StartRPC();
 void InterruptRPC();
 void StopRPC();
+/** Execute a batch of requests. Consecutive calls of read-only methods are
+ * run concurrently on g_rpc_task_pool, the results are in request order. */
 std::string JSONRPCExecBatch(const JSONRPCRequest& jreq, const UniValue& vReq);
 
+/** Worker threads RPC methods spread their work over, shared by all clients */
+extern CTaskPool g_rpc_task_pool;
+/** Run a g_rpc_task_pool worker thread */
+void ThreadRPCTaskPool();
+
 // Retrieves any serialization flags requested in command line argument
 int RPCSerializationFlags();
 
@@ -9,12 +9,24 @@
 #include <primitives/transaction.h>
 #include <script/script.h>
 #include <sidechain.h>
+#include <sidechainevents.h>
 #include <streams.h>
 #include <uint256.h>
 #include <util.h>
 #include <utilstrencodings.h>
 
-SidechainDB::SidechainDB()
+#include <algorithm>
+
+// Trace points for SCDB internals that are too expensive to evaluate on every
+// block. Compiled out unless built with --enable-scdb-trace, and even then
+// only logged with -debug=scdb.
+#ifdef ENABLE_SCDB_TRACE
+#define SCDB_TRACE(...) LogPrint(BCLog::SCDB, __VA_ARGS__)
+#else
+#define SCDB_TRACE(...) do { } while (0)
+#endif
+
+SidechainDB::SidechainDB() : fRecordEvents(false)
 {
     Reset();
 }
@@ -61,8 +73,12 @@ void SidechainDB::AddDeposits(const std::vector<SidechainDeposit>& vDeposit)
     // Add the deposits to SCDB
     for (size_t x = 0; x < vDepositSplit.size(); x++) {
         for (size_t y = 0; y < vDepositSplit[x].size(); y++) {
-            vDepositCache[x].push_back(vDepositSplit[x][y]);
-            setDepositTXID.insert(vDepositSplit[x][y].tx.GetHash());
+            const SidechainDeposit& d = vDepositSplit[x][y];
+            vDepositCache[x].push_back(d);
+            setDepositTXID.insert(d.tx.GetHash());
+
+            if (d.nBurnIndex < d.tx.vout.size())
+                RecordEvent(SCDB_EVENT_DEPOSIT, d.nSidechain, d.tx.GetHash(), d.nBurnIndex, d.tx.vout[d.nBurnIndex].nValue);
         }
     }
 
@@ -118,8 +134,7 @@ bool SidechainDB::AddWTPrime(uint8_t nSidechain, const uint256& hashWTPrime, int
 
     vWT.push_back(wt);
 
-    if (fDebug)
-        LogPrintf("SCDB %s: Cached WT^: %s\n", __func__, hashWTPrime.ToString());
+    LogPrint(BCLog::SCDB, "SCDB %s: Cached WT^: %s\n", __func__, hashWTPrime.ToString());
 
     std::map<uint8_t, uint256> mapNewWTPrime;
     mapNewWTPrime[wt.nSidechain] = hashWTPrime;
@@ -394,6 +409,36 @@ std::vector<SidechainDeposit> SidechainDB::GetDeposits(uint8_t nSidechain) const
     return vDepositCache[nSidechain];
 }
 
+bool SidechainDB::GetDepositsAfter(uint8_t nSidechain, const COutPoint& outKnown, size_t nMax, std::vector<SidechainDeposit>& vDepositOut) const
+{
+    vDepositOut.clear();
+    if (!IsSidechainActive(nSidechain))
+        return outKnown.IsNull();
+
+    const std::vector<SidechainDeposit>& vDeposit = vDepositCache[nSidechain];
+
+    // Clients usually pass the last deposit they received, so search for it
+    // from the back
+    size_t nStart = 0;
+    if (!outKnown.IsNull()) {
+        size_t i = vDeposit.size();
+        while (i > 0) {
+            const SidechainDeposit& d = vDeposit[i - 1];
+            if (d.nBurnIndex == outKnown.n && d.tx.GetHash() == outKnown.hash)
+                break;
+            i--;
+        }
+        if (i == 0)
+            return false;
+        nStart = i;
+    }
+
+    size_t nEnd = std::min(vDeposit.size(), nStart + nMax);
+    vDepositOut.assign(vDeposit.begin() + nStart, vDeposit.begin() + nEnd);
+
+    return true;
+}
+
 std::vector<SidechainDeposit> SidechainDB::GetDeposits(const std::string& strPrivKey) const
 {
     // TODO refactor: only one GetDeposits function in SCDB
@@ -425,10 +470,8 @@ uint256 SidechainDB::GetHashBlockLastSeen()
 
 uint256 SidechainDB::GetTotalSCDBHash() const
 {
-    // Note: This function is used for testing only right now, and is very noisy
-    // in the log. If this function is to be used for non-testing in the future
-    // the log messages should be commented out to be re-enabled for testing if
-    // desired.
+    // Note: The intermediate hashes are only computed and logged when built
+    // with SCDB tracing enabled.
     std::vector<uint256> vLeaf;
 
     // Add mapCTIP
@@ -437,30 +480,26 @@ uint256 SidechainDB::GetTotalSCDBHash() const
         vLeaf.push_back(it->second.GetHash());
     }
 
-    uint256 hash = ComputeMerkleRoot(vLeaf);
-    LogPrintf("%s: Hash with CTIP data: %s\n", __func__, hash.ToString());
+    SCDB_TRACE("%s: Hash with CTIP data: %s\n", __func__, ComputeMerkleRoot(vLeaf).ToString());
 
     // Add hashBlockLastSeen
     vLeaf.push_back(hashBlockLastSeen);
 
-    hash = ComputeMerkleRoot(vLeaf);
-    LogPrintf("%s: Hash with hashBlockLastSeen data: %s\n", __func__, hash.ToString());
+    SCDB_TRACE("%s: Hash with hashBlockLastSeen data: %s\n", __func__, ComputeMerkleRoot(vLeaf).ToString());
 
     // Add vSidechain
     for (const Sidechain& s : vSidechain) {
         vLeaf.push_back(s.GetHash());
     }
 
-    hash = ComputeMerkleRoot(vLeaf);
-    LogPrintf("%s: Hash with vSidechain data: %s\n", __func__, hash.ToString());
+    SCDB_TRACE("%s: Hash with vSidechain data: %s\n", __func__, ComputeMerkleRoot(vLeaf).ToString());
 
     // Add vActivationStatus
     for (const SidechainActivationStatus& s : vActivationStatus) {
         vLeaf.push_back(s.GetHash());
     }
 
-    hash = ComputeMerkleRoot(vLeaf);
-    LogPrintf("%s: Hash with vActivationStatus data: %s\n", __func__, hash.ToString());
+    SCDB_TRACE("%s: Hash with vActivationStatus data: %s\n", __func__, ComputeMerkleRoot(vLeaf).ToString());
 
     // Add vDepositCache
     for (const std::vector<SidechainDeposit>& v : vDepositCache) {
@@ -469,16 +508,14 @@ uint256 SidechainDB::GetTotalSCDBHash() const
         }
     }
 
-    hash = ComputeMerkleRoot(vLeaf);
-    LogPrintf("%s: Hash with vDepositCache data: %s\n", __func__, hash.ToString());
+    SCDB_TRACE("%s: Hash with vDepositCache data: %s\n", __func__, ComputeMerkleRoot(vLeaf).ToString());
 
     // Add vWTPrimeCache
     for (const std::pair<uint8_t, CMutableTransaction>& pair : vWTPrimeCache) {
         vLeaf.push_back(pair.second.GetHash());
     }
 
-    hash = ComputeMerkleRoot(vLeaf);
-    LogPrintf("%s: Hash with vWTPrimeCache data: %s\n", __func__, hash.ToString());
+    SCDB_TRACE("%s: Hash with vWTPrimeCache data: %s\n", __func__, ComputeMerkleRoot(vLeaf).ToString());
 
     // Add vWTPrimeStatus
     for (size_t i = 0; i < SIDECHAIN_ACTIVATION_MAX_ACTIVE; i++) {
@@ -488,8 +525,7 @@ uint256 SidechainDB::GetTotalSCDBHash() const
         }
     }
 
-    hash = ComputeMerkleRoot(vLeaf);
-    LogPrintf("%s: Hash with vWTPrimeStatus data (total hash): %s\n", __func__, hash.ToString());
+    SCDB_TRACE("%s: Hash with vWTPrimeStatus data (total hash): %s\n", __func__, ComputeMerkleRoot(vLeaf).ToString());
 
     return ComputeMerkleRoot(vLeaf);
 }
@@ -512,6 +548,7 @@ uint256 SidechainDB::GetSCDBHash() const
 uint256 SidechainDB::GetSCDBHashIfUpdate(const std::vector<SidechainWTPrimeState>& vNewScores, int nHeight, const std::map<uint8_t, uint256>& mapNewWTPrime, bool fRemoveExpired) const
 {
     SidechainDB scdbCopy = (*this);
+    scdbCopy.SetRecordEvents(false);
     if (!scdbCopy.UpdateSCDBIndex(vNewScores, false /* fDebug */, mapNewWTPrime, false, fRemoveExpired))
     {
         LogPrintf("%s: SCDB failed to get updated hash at height: %i\n", __func__, nHeight);
@@ -592,6 +629,58 @@ std::vector<std::vector<SidechainWTPrimeState>> SidechainDB::GetState() const
     return vWTPrimeStatus;
 }
 
+std::shared_ptr<const SCDBSnapshot> SidechainDB::GetSnapshot() const
+{
+    std::shared_ptr<SCDBSnapshot> snapshot = std::make_shared<SCDBSnapshot>();
+    snapshot->hashBlockLastSeen = hashBlockLastSeen;
+    snapshot->hashSCDB = GetSCDBHash();
+    snapshot->vSidechain = vSidechain;
+    for (size_t i = 0; i < vSidechain.size(); i++)
+        snapshot->vActive.push_back(IsSidechainActive(i));
+    snapshot->mapCTIP = mapCTIP;
+    snapshot->vActivationStatus = vActivationStatus;
+    snapshot->vWTPrimeStatus = vWTPrimeStatus;
+    return snapshot;
+}
+
+std::vector<Sidechain> SCDBSnapshot::GetActiveSidechains() const
+{
+    std::vector<Sidechain> vActiveSidechain;
+    for (const Sidechain& s : vSidechain)  {
+        if (s.fActive)
+            vActiveSidechain.push_back(s);
+    }
+
+    return vActiveSidechain;
+}
+
+bool SCDBSnapshot::GetCTIP(uint8_t nSidechain, SidechainCTIP& out) const
+{
+    if (!IsSidechainActive(nSidechain))
+        return false;
+
+    std::map<uint8_t, SidechainCTIP>::const_iterator it = mapCTIP.find(nSidechain);
+    if (it != mapCTIP.end()) {
+        out = it->second;
+        return true;
+    }
+
+    return false;
+}
+
+std::vector<SidechainWTPrimeState> SCDBSnapshot::GetState(uint8_t nSidechain) const
+{
+    if (!IsSidechainActive(nSidechain))
+        return std::vector<SidechainWTPrimeState>();
+
+    return vWTPrimeStatus[nSidechain];
+}
+
+bool SCDBSnapshot::IsSidechainActive(uint8_t nSidechain) const
+{
+    return nSidechain < vActive.size() && vActive[nSidechain];
+}
+
 std::vector<uint256> SidechainDB::GetUncommittedWTPrimeCache(uint8_t nSidechain) const
 {
     std::vector<uint256> vHash;
@@ -805,8 +894,9 @@ void SidechainDB::RemoveExpiredWTPrimes()
                             fExpire = true;
 
                         if (fExpire) {
-                            LogPrintf("SCDB RemoveExpiredWTPrimes: Erasing expired WT^: %s\n",
+                            LogPrint(BCLog::SCDB, "SCDB RemoveExpiredWTPrimes: Erasing expired WT^: %s\n",
                                     state.ToString());
+                            RecordEvent(SCDB_EVENT_WTPRIME_EXPIRED, state.nSidechain, state.hashWTPrime, state.nWorkScore);
 
                             // Add to mapFailedWTPrimes
                             SidechainFailedWTPrime failed;
@@ -908,9 +998,13 @@ void SidechainDB::Reset()
         vSidechain[i].nSidechain = i;
 }
 
-bool SidechainDB::SpendWTPrime(uint8_t nSidechain, const uint256& hashBlock, const CTransaction& tx, const int nTx, bool fJustCheck, bool fDebug)
+void SidechainDB::SetRecordEvents(bool fRecord)
+{
+    fRecordEvents = fRecord;
+}
+
+bool SidechainDB::CheckWTPrimeSpend(uint8_t nSidechain, const CTransaction& tx, uint32_t& nBurnIndexRet, bool fDebug) const
 {
-    fDebug = true;
     if (!IsSidechainActive(nSidechain)) {
         if (fDebug) {
             LogPrintf("SCDB %s: Cannot spend WT^ (txid): %s for sidechain number: %u.\n Invalid sidechain number.\n",
@@ -1102,10 +1196,32 @@ bool SidechainDB::SpendWTPrime(uint8_t nSidechain, const uint256& hashBlock, con
     }
 
     // Get the total value out of the blind WT^
-    CAmount amountBlind = tx.GetBlindValueOut();
+    CAmount amountBlind = 0;
+    if (!tx.GetBlindValueOut(amountBlind)) {
+        if (fDebug) {
+            LogPrintf("SCDB %s: Cannot spend WT^: %s for sidechain number: %u. Output value out of range!\n",
+                __func__,
+                hashBlind.ToString(),
+                nSidechain);
+        }
+       return false;
+    }
+
+    // The blind value covers every output but the last one. Check that one
+    // here instead of letting GetValueOut() throw.
+    const CAmount amountLast = tx.vout.back().nValue;
+    if (!MoneyRange(amountLast) || !MoneyRange(amountBlind + amountLast)) {
+        if (fDebug) {
+            LogPrintf("SCDB %s: Cannot spend WT^: %s for sidechain number: %u. Output value out of range!\n",
+                __func__,
+                hashBlind.ToString(),
+                nSidechain);
+        }
+       return false;
+    }
 
     CAmount amountInput = ctip.amount;
-    CAmount amountOutput = tx.GetValueOut();
+    CAmount amountOutput = amountBlind + amountLast;
 
     // Check output amount
     if (amountBlind != amountOutput - amountChange) {
@@ -1129,9 +1245,42 @@ bool SidechainDB::SpendWTPrime(uint8_t nSidechain, const uint256& hashBlock, con
        return false;
     }
 
+    nBurnIndexRet = nBurnIndex;
+
+    return true;
+}
+
+bool SidechainDB::SpendWTPrime(uint8_t nSidechain, const uint256& hashBlock, const CTransaction& tx, const int nTx, bool fJustCheck, bool fDebug)
+{
+    uint32_t nBurnIndex = 0;
+    if (!CheckWTPrimeSpend(nSidechain, tx, nBurnIndex, fDebug))
+        return false;
+
     if (fJustCheck)
         return true;
 
+    return ApplyWTPrimeSpend(nSidechain, hashBlock, tx, nTx, nBurnIndex, fDebug);
+}
+
+bool SidechainDB::ApplyWTPrimeSpend(uint8_t nSidechain, const uint256& hashBlock, const CTransaction& tx, const int nTx, uint32_t nBurnIndex, bool fDebug)
+{
+    uint256 hashBlind;
+    if (!tx.GetBWTHash(hashBlind))
+        return false;
+
+    // The rest of the checks don't depend on SCDB state that can change
+    // between checking and spending the WT^, but the CTIP can.
+    SidechainCTIP ctip;
+    if (!GetCTIP(nSidechain, ctip) || ctip.out != tx.vin[0].prevout) {
+        if (fDebug) {
+            LogPrintf("SCDB %s: Cannot spend WT^: %s for sidechain number: %u. CTIP does not match!\n",
+                __func__,
+                hashBlind.ToString(),
+                nSidechain);
+        }
+        return false;
+    }
+
     // Create a sidechain deposit object for the return amount
     SidechainDeposit deposit;
     deposit.nSidechain = nSidechain;
@@ -1172,7 +1321,8 @@ bool SidechainDB::SpendWTPrime(uint8_t nSidechain, const uint256& hashBlock, con
     // The WT^ will be removed from SCDB when SCDB::Update() is called now that
     // it has been marked as spent.
 
-    LogPrintf("%s WT^ spent: %s for sidechain number: %u.\n", __func__, hashBlind.ToString(), nSidechain);
+    LogPrint(BCLog::SCDB, "%s WT^ spent: %s for sidechain number: %u.\n", __func__, hashBlind.ToString(), nSidechain);
+    RecordEvent(SCDB_EVENT_WTPRIME_SPENT, nSidechain, hashBlind, nTx, tx.GetValueOut());
 
     return true;
 }
@@ -1193,7 +1343,7 @@ bool SidechainDB::TxnToDeposit(const CTransaction& tx, const int nTx, const uint
         if (HasSidechainScript(std::vector<CScript>{scriptPubKey}, nSidechain)) {
             // If we already found a burn output, more make the deposit invalid
             if (fBurnFound) {
-                LogPrintf("%s: Invalid - multiple burn outputs.\ntxid: %s\n", __func__, tx.GetHash().ToString());
+                LogPrint(BCLog::SCDB, "%s: Invalid - multiple burn outputs.\ntxid: %s\n", __func__, tx.GetHash().ToString());
                 return false;
             }
 
@@ -1211,11 +1361,11 @@ bool SidechainDB::TxnToDeposit(const CTransaction& tx, const int nTx, const uint
         if (scriptPubKey.front() != OP_RETURN)
             continue;
         if (scriptPubKey.size() < 3) {
-            LogPrintf("%s: Invalid - First OP_RETURN is invalid (too small).\ntxid: %s\n", __func__, tx.GetHash().ToString());
+            LogPrint(BCLog::SCDB, "%s: Invalid - First OP_RETURN is invalid (too small).\ntxid: %s\n", __func__, tx.GetHash().ToString());
             return false;
         }
         if (scriptPubKey.size() > MAX_DEPOSIT_DESTINATION_BYTES) {
-            LogPrintf("%s: Invalid - First OP_RETURN is invalid (too large).\ntxid: %s\n", __func__, tx.GetHash().ToString());
+            LogPrint(BCLog::SCDB, "%s: Invalid - First OP_RETURN is invalid (too large).\ntxid: %s\n", __func__, tx.GetHash().ToString());
             return false;
         }
 
@@ -1223,13 +1373,13 @@ bool SidechainDB::TxnToDeposit(const CTransaction& tx, const int nTx, const uint
         opcodetype opcode;
         std::vector<unsigned char> vch;
         if (!scriptPubKey.GetOp(pDest, opcode, vch) || vch.empty()) {
-            LogPrintf("%s: Invalid - First OP_RETURN is invalid (failed GetOp).\ntxid: %s\n", __func__, tx.GetHash().ToString());
+            LogPrint(BCLog::SCDB, "%s: Invalid - First OP_RETURN is invalid (failed GetOp).\ntxid: %s\n", __func__, tx.GetHash().ToString());
             return false;
         }
 
         std::string strDest((const char*)vch.data(), vch.size());
         if (strDest.empty()) {
-            LogPrintf("%s: Invalid - empty dest.\ntxid: %s\n", __func__, tx.GetHash().ToString());
+            LogPrint(BCLog::SCDB, "%s: Invalid - empty dest.\ntxid: %s\n", __func__, tx.GetHash().ToString());
             return false;
         }
 
@@ -1301,6 +1451,7 @@ bool SidechainDB::Update(int nHeight, const uint256& hashBlock, const uint256& h
 {
     // Make a copy of SCDB to test update
     SidechainDB scdbCopy = (*this);
+    scdbCopy.SetRecordEvents(false);
     if (scdbCopy.ApplyUpdate(nHeight, hashBlock, hashPrevBlock, vout, fJustCheck, fDebug)) {
         return ApplyUpdate(nHeight, hashBlock, hashPrevBlock, vout, fJustCheck, fDebug);
     } else {
@@ -1610,8 +1761,8 @@ bool SidechainDB::ApplyUpdate(int nHeight, const uint256& hashBlock, const uint2
             if (wt.nSidechain == s.nSidechain &&
                     wt.hashWTPrime == s.hashWTPrime) {
 
-                if (fDebug && !fJustCheck) {
-                    LogPrintf("SCDB %s: Removing spent WT^: %s for nSidechain: %u in block %s.\n",
+                if (!fJustCheck) {
+                    LogPrint(BCLog::SCDB, "SCDB %s: Removing spent WT^: %s for nSidechain: %u in block %s.\n",
                             __func__,
                             wt.hashWTPrime.ToString(),
                             wt.nSidechain,
@@ -1640,8 +1791,8 @@ bool SidechainDB::ApplyUpdate(int nHeight, const uint256& hashBlock, const uint2
         }
     }
 
-    if (fDebug && !fJustCheck) {
-        LogPrintf("SCDB: %s: Updated from block %s to block %s.\n",
+    if (!fJustCheck) {
+        LogPrint(BCLog::SCDB, "SCDB: %s: Updated from block %s to block %s.\n",
                 __func__,
                 hashBlockLastSeen.ToString(),
                 hashBlock.ToString());
@@ -1670,33 +1821,33 @@ bool SidechainDB::Undo(int nHeight, const uint256& hashBlock, const uint256& has
     if (it != mapSpentWTPrime.end())
         mapSpentWTPrime.erase(it);
 
-    // TODO lookup deposits in cache with setDepositTXID, then std::remove_if
-    //
     // Undo deposits
-    // Loop through the transactions in the block being disconnected, and if
-    // they match a transaction in our deposit cache remove it.
-    bool fDepositRemoved = false;
+    // Use the deposit txid index to find which transactions in the block being
+    // disconnected are cached deposits, so that each sidechain's deposit cache
+    // only has to be walked once.
+    std::set<uint256> setRemove;
     for (const CTransactionRef& tx : vtx) {
-        for (size_t x = 0; x < vDepositCache.size(); x++) {
-            std::vector<SidechainDeposit>::iterator it;
-            for (it = vDepositCache[x].begin(); it != vDepositCache[x].end();) {
-                if (*tx == CTransaction(it->tx)) {
-                    setDepositTXID.erase(tx->GetHash());
-                    fDepositRemoved = true;
-                    it = vDepositCache[x].erase(it);
-                } else {
-                    it++;
-                }
-            }
-        }
+        if (setDepositTXID.count(tx->GetHash()))
+            setRemove.insert(tx->GetHash());
     }
 
-    // If any deposits were removed re-sort deposits and update CTIP
-    if (fDepositRemoved) {
-        // TODO check return value
-        if (!SortSCDBDeposits()) {
-            LogPrintf("SCDB %s: Failed to sort SCDB deposits!", __func__);
+    if (!setRemove.empty()) {
+        for (std::vector<SidechainDeposit>& v : vDepositCache) {
+            // Check the block hash before hashing the deposit transaction
+            v.erase(std::remove_if(v.begin(), v.end(),
+                        [this, &hashBlock, &setRemove](const SidechainDeposit& d) {
+                            if (d.hashBlock != hashBlock)
+                                return false;
+                            const uint256 txid = d.tx.GetHash();
+                            if (!setRemove.count(txid))
+                                return false;
+                            setDepositTXID.erase(txid);
+                            return true;
+                        }), v.end());
         }
+
+        // Removing deposits does not change the spend order of the deposits
+        // which remain so they do not have to be sorted again.
         // TODO check return value
         if (!UpdateCTIP()) {
             LogPrintf("SCDB %s: Failed to update CTIP!", __func__);
@@ -1706,7 +1857,7 @@ bool SidechainDB::Undo(int nHeight, const uint256& hashBlock, const uint256& has
     // Undo hashBlockLastSeen
     hashBlockLastSeen = hashPrevBlock;
 
-    LogPrintf("%s: SCDB undo for block: %s complete!\n", __func__, hashBlock.ToString());
+    LogPrint(BCLog::SCDB, "%s: SCDB undo for block: %s complete!\n", __func__, hashBlock.ToString());
 
     return true;
 }
@@ -1824,6 +1975,9 @@ bool SidechainDB::UpdateSCDBIndex(const std::vector<SidechainWTPrimeState>& vNew
                         //            state.hashWTPrime.ToString(),
                         //            vWTPrimeStatus[x][y].nWorkScore,
                         //            s.nWorkScore);
+                        if (s.nWorkScore != state.nWorkScore)
+                            RecordEvent(SCDB_EVENT_VOTE, s.nSidechain, s.hashWTPrime, s.nWorkScore);
+
                         vWTPrimeStatus[x][y].nWorkScore = s.nWorkScore;
                     }
                 }
@@ -1872,10 +2026,11 @@ bool SidechainDB::UpdateSCDBIndex(const std::vector<SidechainWTPrimeState>& vNew
 
             vWTPrimeStatus[x].push_back(s);
 
-            if (fDebug)
-                LogPrintf("SCDB %s: Cached new WT^: %s\n",
-                        __func__,
-                        s.hashWTPrime.ToString());
+            RecordEvent(SCDB_EVENT_WTPRIME_ADDED, s.nSidechain, s.hashWTPrime, s.nWorkScore);
+
+            LogPrint(BCLog::SCDB, "SCDB %s: Cached new WT^: %s\n",
+                    __func__,
+                    s.hashWTPrime.ToString());
         }
     }
 
@@ -2065,6 +2220,12 @@ void SidechainDB::UpdateActivationStatus(const std::vector<uint256>& vHash)
     }
 }
 
+void SidechainDB::RecordEvent(uint8_t nType, uint8_t nSidechain, const uint256& hash, uint32_t n, CAmount amount) const
+{
+    if (fRecordEvents)
+        scdbEvents.Record(nType, nSidechain, hash, n, amount);
+}
+
 bool SidechainDB::SortSCDBDeposits()
 {
     std::vector<std::vector<SidechainDeposit>> vDepositSorted;
@@ -2097,14 +2258,22 @@ bool SidechainDB::UpdateCTIP()
             const COutPoint out(d.tx.GetHash(), d.nBurnIndex);
             const CAmount amount = d.tx.vout[d.nBurnIndex].nValue;
 
+            // Nothing to do if the CTIP didn't move
+            std::map<uint8_t, SidechainCTIP>::const_iterator it;
+            it = mapCTIP.find(d.nSidechain);
+            if (it != mapCTIP.end() && it->second.out == out && it->second.amount == amount)
+                continue;
+
             SidechainCTIP ctip;
             ctip.out = out;
             ctip.amount = amount;
 
             mapCTIP[d.nSidechain] = ctip;
 
+            RecordEvent(SCDB_EVENT_CTIP, d.nSidechain, out.hash, out.n, amount);
+
             // Log the update
-            LogPrintf("SCDB %s: Updated sidechain CTIP for nSidechain: %u. CTIP output: %s CTIP amount: %i.\n",
+            LogPrint(BCLog::SCDB, "SCDB %s: Updated sidechain CTIP for nSidechain: %u. CTIP output: %s CTIP amount: %i.\n",
                 __func__,
                 d.nSidechain,
                 out.ToString(),
@@ -2116,7 +2285,10 @@ bool SidechainDB::UpdateCTIP()
 
             if (it != mapCTIP.end()) {
                 mapCTIP.erase(it);
-                LogPrintf("SCDB %s: Removed sidechain CTIP.\n",
+
+                RecordEvent(SCDB_EVENT_CTIP, x, uint256());
+
+                LogPrint(BCLog::SCDB, "SCDB %s: Removed sidechain CTIP.\n",
                     __func__);
             }
 
@@ -31,6 +31,7 @@ struct SidechainDeposit;
 struct SidechainWTPrimeState;
 struct SidechainSpentWTPrime;
 struct SidechainFailedWTPrime;
+struct SCDBSnapshot;
 
 class SidechainDB
 {
@@ -120,6 +121,12 @@ public:
     /** Return vector of cached deposits for nSidechain. */
     std::vector<SidechainDeposit> GetDeposits(const std::string& sidechainPriv) const;
 
+    /** Return up to nMax cached deposits of nSidechain that follow the
+     * deposit with burn output outKnown, oldest first. A null outKnown
+     * starts at the first cached deposit. Returns false if outKnown is not
+     * a cached deposit (for example after a reorg). */
+    bool GetDepositsAfter(uint8_t nSidechain, const COutPoint& outKnown, size_t nMax, std::vector<SidechainDeposit>& vDepositOut) const;
+
     /** Return the hash of the last block SCDB processed */
     uint256 GetHashBlockLastSeen();
 
@@ -157,6 +164,9 @@ public:
     /** Get a list of WT^(s) spent in a given block */
     std::vector<SidechainSpentWTPrime> GetSpentWTPrimesForBlock(const uint256& hashBlock) const;
 
+    /** Copy the state that follows from the active chain into a snapshot */
+    std::shared_ptr<const SCDBSnapshot> GetSnapshot() const;
+
     /** Get status of nSidechain's WT^(s) (public for unit tests) */
     std::vector<SidechainWTPrimeState> GetState(uint8_t nSidechain) const;
 
@@ -224,9 +234,21 @@ public:
     /** Reset everything */
     void Reset();
 
+    /** Record changes to this SCDB in the scdbEvents log. Only enabled for
+     * the global SCDB, copies made for trial updates must not record. */
+    void SetRecordEvents(bool fRecord);
+
     /** Spend a WT^ (if we can) */
     bool SpendWTPrime(uint8_t nSidechain, const uint256& hashBlock, const CTransaction& tx, const int nTx, bool fJustCheck = false,  bool fDebug = false);
 
+    /** Check that a WT^ can be spent, returns the output index of the
+     * sidechain change return */
+    bool CheckWTPrimeSpend(uint8_t nSidechain, const CTransaction& tx, uint32_t& nBurnIndexRet, bool fDebug = false) const;
+
+    /** Spend a WT^ that has already passed CheckWTPrimeSpend(), only the
+     * CTIP is checked again */
+    bool ApplyWTPrimeSpend(uint8_t nSidechain, const uint256& hashBlock, const CTransaction& tx, const int nTx, uint32_t nBurnIndex, bool fDebug = false);
+
     /** Get SidechainDeposit from deposit CTransaction. Part of SCDB because
      * we need the list of active sidechains to find deposit outputs. */
     bool TxnToDeposit(const CTransaction& tx, const int nTx, const uint256& hashBlock, SidechainDeposit& deposit);
@@ -266,6 +288,12 @@ private:
     /** Calls SortDeposits for all of SCDB's deposit cache */
     bool SortSCDBDeposits();
 
+    /** Add an event to scdbEvents if fRecordEvents is set */
+    void RecordEvent(uint8_t nType, uint8_t nSidechain, const uint256& hash, uint32_t n = 0, CAmount amount = 0) const;
+
+    /** Whether changes to this SCDB are recorded in scdbEvents */
+    bool fRecordEvents;
+
     /** All sidechain slots, their activation status, and params if active */
     std::vector<Sidechain> vSidechain;
 
@@ -328,6 +356,30 @@ private:
 
 };
 
+/**
+ * Copy of the parts of SCDB that follow from the active chain alone: the
+ * sidechains, their CTIPs, activation status and WT^ workscores. Validation
+ * publishes one at every tip change (see GetChainSnapshot), so that RPC can
+ * read them without cs_main. Deposits, spent and failed WT^(s) and the
+ * node's own caches are left out as they grow without bound.
+ */
+struct SCDBSnapshot
+{
+    uint256 hashBlockLastSeen;
+    uint256 hashSCDB;
+    std::vector<Sidechain> vSidechain;
+    std::vector<bool> vActive; //!< Result of IsSidechainActive by sidechain number
+    std::map<uint8_t, SidechainCTIP> mapCTIP;
+    std::vector<SidechainActivationStatus> vActivationStatus;
+    std::vector<std::vector<SidechainWTPrimeState>> vWTPrimeStatus;
+
+    /** Same as the SidechainDB functions of the same name */
+    std::vector<Sidechain> GetActiveSidechains() const;
+    bool GetCTIP(uint8_t nSidechain, SidechainCTIP& out) const;
+    std::vector<SidechainWTPrimeState> GetState(uint8_t nSidechain) const;
+    bool IsSidechainActive(uint8_t nSidechain) const;
+};
+
 /** Read encoded sum of WT fees from WT^ output script */
 bool DecodeWTFees(const CScript& script, CAmount& amount);
 
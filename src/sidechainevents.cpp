@@ -0,0 +1,103 @@
+// Copyright (c) 2026 The DriveNet developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <sidechainevents.h>
+
+#include <utiltime.h>
+
+#include <string.h>
+
+SidechainEventLog scdbEvents;
+
+std::string SidechainEventTypeToString(uint8_t nType)
+{
+    switch (nType) {
+    case SCDB_EVENT_VOTE:
+        return "vote";
+    case SCDB_EVENT_WTPRIME_ADDED:
+        return "wtprime_added";
+    case SCDB_EVENT_WTPRIME_EXPIRED:
+        return "wtprime_expired";
+    case SCDB_EVENT_WTPRIME_SPENT:
+        return "wtprime_spent";
+    case SCDB_EVENT_DEPOSIT:
+        return "deposit";
+    case SCDB_EVENT_CTIP:
+        return "ctip";
+    default:
+        return "unknown";
+    }
+}
+
+SidechainEventLog::SidechainEventLog() : nNext(0)
+{
+    for (Slot& slot : slots) {
+        slot.nSeq.store(0, std::memory_order_relaxed);
+        for (std::atomic<uint64_t>& word : slot.data)
+            word.store(0, std::memory_order_relaxed);
+    }
+}
+
+void SidechainEventLog::Record(uint8_t nType, uint8_t nSidechain, const uint256& hash, uint32_t n, CAmount amount)
+{
+    const uint64_t nSequence = nNext.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = slots[nSequence % SCDB_EVENT_LOG_SIZE];
+
+    uint64_t vWord[SLOT_WORDS];
+    memcpy(vWord, hash.begin(), 32);
+    vWord[4] = GetTime();
+    vWord[5] = amount;
+    vWord[6] = ((uint64_t)nType << 40) | ((uint64_t)nSidechain << 32) | n;
+
+    // The sequence stored in the slot is 2 * (nSequence + 1) once the write is
+    // complete and odd while it is in progress.
+    slot.nSeq.store(2 * nSequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < SLOT_WORDS; i++)
+        slot.data[i].store(vWord[i], std::memory_order_relaxed);
+    slot.nSeq.store(2 * nSequence + 2, std::memory_order_release);
+}
+
+std::vector<SidechainEvent> SidechainEventLog::GetEvents(size_t nMax) const
+{
+    std::vector<SidechainEvent> vEvent;
+
+    const uint64_t nEnd = nNext.load(std::memory_order_acquire);
+    if (nMax > SCDB_EVENT_LOG_SIZE)
+        nMax = SCDB_EVENT_LOG_SIZE;
+    const uint64_t nBegin = nEnd > nMax ? nEnd - nMax : 0;
+
+    vEvent.reserve(nEnd - nBegin);
+    for (uint64_t nSequence = nBegin; nSequence < nEnd; nSequence++) {
+        const Slot& slot = slots[nSequence % SCDB_EVENT_LOG_SIZE];
+
+        const uint64_t nSeqBefore = slot.nSeq.load(std::memory_order_acquire);
+        if (nSeqBefore != 2 * nSequence + 2)
+            continue; // Still being written or already overwritten
+
+        uint64_t vWord[SLOT_WORDS];
+        for (size_t i = 0; i < SLOT_WORDS; i++)
+            vWord[i] = slot.data[i].load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.nSeq.load(std::memory_order_relaxed) != nSeqBefore)
+            continue;
+
+        SidechainEvent event;
+        event.nSequence = nSequence;
+        memcpy(event.hash.begin(), vWord, 32);
+        event.nTime = vWord[4];
+        event.amount = vWord[5];
+        event.nType = vWord[6] >> 40;
+        event.nSidechain = vWord[6] >> 32;
+        event.n = vWord[6];
+        vEvent.push_back(event);
+    }
+    return vEvent;
+}
+
+uint64_t SidechainEventLog::GetCount() const
+{
+    return nNext.load(std::memory_order_relaxed);
+}
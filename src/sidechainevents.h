@@ -0,0 +1,88 @@
+// Copyright (c) 2026 The DriveNet developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SIDECHAINEVENTS_H
+#define BITCOIN_SIDECHAINEVENTS_H
+
+#include <amount.h>
+#include <uint256.h>
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/** Number of SCDB events kept in memory, older events are overwritten */
+static const size_t SCDB_EVENT_LOG_SIZE = 1024;
+
+enum SidechainEventType : uint8_t {
+    SCDB_EVENT_VOTE = 0,        // Work score of a WT^ changed
+    SCDB_EVENT_WTPRIME_ADDED,   // New WT^ added to SCDB
+    SCDB_EVENT_WTPRIME_EXPIRED, // WT^ removed from SCDB without being spent
+    SCDB_EVENT_WTPRIME_SPENT,   // WT^ payout connected
+    SCDB_EVENT_DEPOSIT,         // Deposit appended to the deposit cache
+    SCDB_EVENT_CTIP,            // CTIP of a sidechain moved or was removed
+};
+
+std::string SidechainEventTypeToString(uint8_t nType);
+
+/**
+ * Structured record of a change made to SCDB. What hash, n and amount refer
+ * to depends on the event type:
+ *
+ * VOTE / WTPRIME_*: hash = WT^ hash, n = work score
+ * DEPOSIT / CTIP:   hash = txid, n = output index, amount = output value
+ *
+ * A removed CTIP is recorded with a null hash.
+ */
+struct SidechainEvent {
+    uint64_t nSequence;
+    int64_t nTime;
+    uint8_t nType;
+    uint8_t nSidechain;
+    uint32_t n;
+    uint256 hash;
+    CAmount amount;
+};
+
+/**
+ * Fixed size ring buffer of SCDB events. Recording an event never blocks
+ * and never formats a string, so it is cheap enough to leave enabled on the
+ * block connection path.
+ *
+ * Each slot is protected by a sequence counter (seqlock): the counter is odd
+ * while a write is in progress and readers discard slots that changed while
+ * they were being copied. Writers are expected to be serialized (SCDB is only
+ * modified while holding cs_main) but readers can run concurrently with them.
+ */
+class SidechainEventLog
+{
+public:
+    SidechainEventLog();
+
+    void Record(uint8_t nType, uint8_t nSidechain, const uint256& hash, uint32_t n = 0, CAmount amount = 0);
+
+    /** Return up to nMax of the most recent events, oldest first */
+    std::vector<SidechainEvent> GetEvents(size_t nMax = SCDB_EVENT_LOG_SIZE) const;
+
+    /** Total number of events recorded, including overwritten ones */
+    uint64_t GetCount() const;
+
+private:
+    // Event data is stored as atomic words so that concurrent readers never
+    // race with the writer, even when they end up discarding the slot.
+    static const size_t SLOT_WORDS = 7;
+
+    struct Slot {
+        std::atomic<uint64_t> nSeq;
+        std::atomic<uint64_t> data[SLOT_WORDS];
+    };
+
+    std::atomic<uint64_t> nNext;
+    Slot slots[SCDB_EVENT_LOG_SIZE];
+};
+
+extern SidechainEventLog scdbEvents;
+
+#endif // BITCOIN_SIDECHAINEVENTS_H
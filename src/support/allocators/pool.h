@@ -0,0 +1,287 @@
+// Copyright (c) 2026 The DriveNet developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/** Alignment and size granularity of nodes handed out by a FixedSizePool */
+static const size_t POOL_NODE_ALIGN = 8;
+
+/** Maximum number of bytes requested from the system at once by a FixedSizePool */
+static const size_t POOL_CHUNK_SIZE = 256 * 1024;
+
+/** Size of a pool node able to hold an object of nSize bytes */
+static constexpr size_t PoolNodeSize(size_t nSize)
+{
+    return nSize < sizeof(void*) ? sizeof(void*) : (nSize + POOL_NODE_ALIGN - 1) & ~(POOL_NODE_ALIGN - 1);
+}
+
+/**
+ * Free list allocator for nodes of a single size.
+ *
+ * Memory is taken from the system in chunks and carved into nodes without
+ * any per-allocation header. Every new chunk holds half as many nodes as the
+ * chunks held so far, up to POOL_CHUNK_SIZE, so a small pool doesn't strand
+ * its free nodes in a chunk that is still in use. Released nodes go back on
+ * the free list and are handed out again before a new chunk is requested.
+ * ReleaseUnused() returns the chunks none of whose nodes are in use.
+ *
+ * Not thread safe, the owner serializes access.
+ */
+class FixedSizePool
+{
+public:
+    explicit FixedSizePool(size_t nNodeSizeIn) :
+        nNodeSize(PoolNodeSize(nNodeSizeIn)),
+        nMaxNodesPerChunk(nNodeSize > POOL_CHUNK_SIZE ? 1 : POOL_CHUNK_SIZE / nNodeSize),
+        pFree(nullptr), nChunkNext(0), nNodesReserved(0), nNodesInUse(0), nNodesFree(0) {}
+
+    ~FixedSizePool()
+    {
+        for (const auto& chunk : vChunk)
+            ::operator delete(chunk.first);
+    }
+
+    FixedSizePool(const FixedSizePool&) = delete;
+    FixedSizePool& operator=(const FixedSizePool&) = delete;
+
+    void* Allocate()
+    {
+        nNodesInUse++;
+        if (pFree) {
+            FreeNode* pNode = pFree;
+            pFree = pNode->pNext;
+            nNodesFree--;
+            return pNode;
+        }
+        if (vChunk.empty() || nChunkNext == vChunk.back().second) {
+            const size_t nNodes = std::max<size_t>(1, std::min(nMaxNodesPerChunk, nNodesReserved / 2));
+            vChunk.emplace_back(static_cast<char*>(::operator new(nNodes * nNodeSize)), nNodes);
+            nNodesReserved += nNodes;
+            nChunkNext = 0;
+        }
+        return vChunk.back().first + nNodeSize * nChunkNext++;
+    }
+
+    void Deallocate(void* p)
+    {
+        nNodesInUse--;
+        nNodesFree++;
+        FreeNode* pNode = static_cast<FreeNode*>(p);
+        pNode->pNext = pFree;
+        pFree = pNode;
+    }
+
+    /** Return the chunks none of whose nodes are in use to the system */
+    void ReleaseUnused()
+    {
+        if (!pFree)
+            return;
+
+        // Count the nodes of every chunk that are still in use. Nodes past
+        // nChunkNext in the last chunk were never handed out.
+        std::vector<std::pair<char*, size_t>> vChunkUsed;
+        vChunkUsed.reserve(vChunk.size());
+        for (const auto& chunk : vChunk)
+            vChunkUsed.emplace_back(chunk.first, chunk.first == vChunk.back().first ? nChunkNext : chunk.second);
+        std::sort(vChunkUsed.begin(), vChunkUsed.end());
+        auto FindChunk = [&vChunkUsed](const void* p) {
+            auto it = std::upper_bound(vChunkUsed.begin(), vChunkUsed.end(), std::make_pair(static_cast<char*>(const_cast<void*>(p)), (size_t)-1));
+            return --it;
+        };
+        for (FreeNode* pNode = pFree; pNode; pNode = pNode->pNext)
+            FindChunk(pNode)->second--;
+
+        bool fRelease = false;
+        for (const auto& chunk : vChunkUsed)
+            fRelease |= chunk.second == 0;
+        if (!fRelease)
+            return;
+
+        // Unlink the free nodes of released chunks
+        FreeNode** ppNode = &pFree;
+        while (*ppNode) {
+            if (FindChunk(*ppNode)->second == 0) {
+                *ppNode = (*ppNode)->pNext;
+                nNodesFree--;
+            } else {
+                ppNode = &(*ppNode)->pNext;
+            }
+        }
+
+        std::vector<std::pair<char*, size_t>> vChunkKeep;
+        bool fReleaseLast = false;
+        for (const auto& chunk : vChunk) {
+            if (FindChunk(chunk.first)->second != 0) {
+                vChunkKeep.push_back(chunk);
+                continue;
+            }
+            fReleaseLast |= chunk.first == vChunk.back().first;
+            nNodesReserved -= chunk.second;
+            ::operator delete(chunk.first);
+        }
+        vChunk.swap(vChunkKeep);
+        // All remaining chunks are carved completely
+        if (fReleaseLast && !vChunk.empty())
+            nChunkNext = vChunk.back().second;
+    }
+
+    size_t NodeSize() const { return nNodeSize; }
+    size_t NodesInUse() const { return nNodesInUse; }
+
+    /** Bytes held from the system, including free nodes */
+    size_t ReservedBytes() const { return nNodesReserved * nNodeSize; }
+
+    /**
+     * Bytes of released nodes waiting to be reused. The never used tail of
+     * the last chunk isn't included, as it was never touched.
+     */
+    size_t FreeBytes() const { return nNodesFree * nNodeSize; }
+
+private:
+    struct FreeNode {
+        FreeNode* pNext;
+    };
+
+    const size_t nNodeSize;
+    const size_t nMaxNodesPerChunk;
+
+    std::vector<std::pair<char*, size_t>> vChunk; //!< Chunks and their number of nodes
+    FreeNode* pFree;
+    size_t nChunkNext; //!< Index of the next never used node in vChunk.back()
+    size_t nNodesReserved;
+    size_t nNodesInUse;
+    size_t nNodesFree;
+};
+
+/**
+ * The FixedSizePools of one owner, one for each node size its containers
+ * need. Like FixedSizePool it is not thread safe: CTxMemPool only touches
+ * its containers, and so their pools, while holding its cs.
+ */
+class PoolResource
+{
+public:
+    PoolResource() {}
+    PoolResource(const PoolResource&) = delete;
+    PoolResource& operator=(const PoolResource&) = delete;
+
+    void* Allocate(size_t nNodeSize) { return GetPool(nNodeSize).Allocate(); }
+    void Deallocate(void* p, size_t nNodeSize) { GetPool(nNodeSize).Deallocate(p); }
+
+    void ReleaseUnused()
+    {
+        for (const auto& pool : vPool)
+            pool->ReleaseUnused();
+    }
+
+    size_t ReservedBytes() const
+    {
+        size_t nBytes = 0;
+        for (const auto& pool : vPool)
+            nBytes += pool->ReservedBytes();
+        return nBytes;
+    }
+
+    size_t FreeBytes() const
+    {
+        size_t nBytes = 0;
+        for (const auto& pool : vPool)
+            nBytes += pool->FreeBytes();
+        return nBytes;
+    }
+
+private:
+    FixedSizePool& GetPool(size_t nNodeSize)
+    {
+        // There are only a few node sizes
+        for (const auto& pool : vPool) {
+            if (pool->NodeSize() == nNodeSize)
+                return *pool;
+        }
+        vPool.emplace_back(new FixedSizePool(nNodeSize));
+        return *vPool.back();
+    }
+
+    std::vector<std::unique_ptr<FixedSizePool>> vPool;
+};
+
+/**
+ * Allocator for node based containers (std::set, std::map,
+ * boost::multi_index_container). Single object allocations, which is what
+ * these containers use for their nodes, come from the PoolResource the
+ * allocator was constructed with. Array allocations such as hash table
+ * buckets, and all allocations of a default constructed allocator, fall back
+ * to operator new, so temporary containers don't share the owner's pools.
+ */
+template <typename T>
+struct pool_allocator {
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    // Nodes are always released through the allocator that allocated them
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    template <typename U>
+    struct rebind {
+        typedef pool_allocator<U> other;
+    };
+
+    pool_allocator() noexcept : resource(nullptr) {}
+    explicit pool_allocator(PoolResource* resourceIn) noexcept : resource(resourceIn) {}
+    template <typename U>
+    pool_allocator(const pool_allocator<U>& other) noexcept : resource(other.resource) {}
+
+    /** Copies of a container are allocated with operator new */
+    pool_allocator select_on_container_copy_construction() const { return pool_allocator(); }
+
+    T* allocate(std::size_t n, const void* hint = nullptr)
+    {
+        static_assert(alignof(T) <= POOL_NODE_ALIGN, "pool_allocator does not support over-aligned types");
+        if (n == 1 && resource)
+            return static_cast<T*>(resource->Allocate(PoolNodeSize(sizeof(T))));
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n)
+    {
+        if (n == 1 && resource)
+            resource->Deallocate(p, PoolNodeSize(sizeof(T)));
+        else
+            ::operator delete(p);
+    }
+
+    std::size_t max_size() const noexcept { return std::size_t(-1) / sizeof(T); }
+
+    T* address(T& x) const { return &x; }
+    const T* address(const T& x) const { return &x; }
+
+    template <typename U, typename... Args>
+    void construct(U* p, Args&&... args) { ::new ((void*)p) U(std::forward<Args>(args)...); }
+    template <typename U>
+    void destroy(U* p) { p->~U(); }
+
+    PoolResource* resource;
+};
+
+template <typename T, typename U>
+bool operator==(const pool_allocator<T>& a, const pool_allocator<U>& b) { return a.resource == b.resource; }
+template <typename T, typename U>
+bool operator!=(const pool_allocator<T>& a, const pool_allocator<U>& b) { return a.resource != b.resource; }
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_POOL_H
@@ -73,6 +73,8 @@ struct LockData {
 } static lockdata;
 
 static thread_local std::unique_ptr<LockStack> lockstack;
+//! Mutexes the current thread must not lock, see FORBID_LOCK
+static thread_local std::unique_ptr<std::map<void*, std::string>> lockforbidden;
 
 static void potential_deadlock_detected(const std::pair<void*, void*>& mismatch, const LockStack& s1, const LockStack& s2)
 {
@@ -105,6 +107,11 @@ static void push_lock(void* c, const CLockLocation& locklocation)
     if (!lockstack)
         lockstack.reset(new LockStack);
 
+    if (lockforbidden && lockforbidden->count(c)) {
+        fprintf(stderr, "Assertion failed: lock %s is forbidden here: %s\n", (*lockforbidden)[c].c_str(), locklocation.ToString().c_str());
+        abort();
+    }
+
     std::lock_guard<std::mutex> lock(lockdata.dd_mutex);
 
     lockstack->push_back(std::make_pair(c, locklocation));
@@ -167,6 +174,21 @@ void AssertLockNotHeldInternal(const char* pszName, const char* pszFile, int nLi
     }
 }
 
+void ForbidLockInternal(const char* pszName, const char* pszFile, int nLine, void* cs)
+{
+    if (!lockstack)
+        lockstack.reset(new LockStack);
+    if (!lockforbidden)
+        lockforbidden.reset(new std::map<void*, std::string>);
+    AssertLockNotHeldInternal(pszName, pszFile, nLine, cs);
+    lockforbidden->emplace(cs, strprintf("%s (%s:%d)", pszName, pszFile, nLine));
+}
+
+void AllowLockInternal(void* cs)
+{
+    lockforbidden->erase(cs);
+}
+
 void DeleteLock(void* cs)
 {
     if (!lockdata.available) {
@@ -76,12 +76,16 @@ void LeaveCritical();
 std::string LocksHeld();
 void AssertLockHeldInternal(const char* pszName, const char* pszFile, int nLine, void* cs);
 void AssertLockNotHeldInternal(const char* pszName, const char* pszFile, int nLine, void* cs);
+void ForbidLockInternal(const char* pszName, const char* pszFile, int nLine, void* cs);
+void AllowLockInternal(void* cs);
 void DeleteLock(void* cs);
 #else
 void static inline EnterCritical(const char* pszName, const char* pszFile, int nLine, void* cs, bool fTry = false) {}
 void static inline LeaveCritical() {}
 void static inline AssertLockHeldInternal(const char* pszName, const char* pszFile, int nLine, void* cs) {}
 void static inline AssertLockNotHeldInternal(const char* pszName, const char* pszFile, int nLine, void* cs) {}
+void static inline ForbidLockInternal(const char* pszName, const char* pszFile, int nLine, void* cs) {}
+void static inline AllowLockInternal(void* cs) {}
 void static inline DeleteLock(void* cs) {}
 #endif
 #define AssertLockHeld(cs) AssertLockHeldInternal(#cs, __FILE__, __LINE__, &cs)
@@ -175,9 +179,27 @@ public:
 #define PASTE(x, y) x ## y
 #define PASTE2(x, y) PASTE(x, y)
 
+/** Abort if the current thread locks a mutex while this is in scope. Only checked with DEBUG_LOCKORDER. */
+class CForbiddenLock
+{
+private:
+    void* cs;
+
+public:
+    CForbiddenLock(void* csIn, const char* pszName, const char* pszFile, int nLine) : cs(csIn)
+    {
+        ForbidLockInternal(pszName, pszFile, nLine, cs);
+    }
+    ~CForbiddenLock()
+    {
+        AllowLockInternal(cs);
+    }
+};
+
 #define LOCK(cs) CCriticalBlock PASTE2(criticalblock, __COUNTER__)(cs, #cs, __FILE__, __LINE__)
 #define LOCK2(cs1, cs2) CCriticalBlock criticalblock1(cs1, #cs1, __FILE__, __LINE__), criticalblock2(cs2, #cs2, __FILE__, __LINE__)
 #define TRY_LOCK(cs, name) CCriticalBlock name(cs, #cs, __FILE__, __LINE__, true)
+#define FORBID_LOCK(cs) CForbiddenLock PASTE2(forbiddenlock, __COUNTER__)((void*)(&cs), #cs, __FILE__, __LINE__)
 
 #define ENTER_CRITICAL_SECTION(cs)                            \
     {                                                         \
@@ -0,0 +1,69 @@
+// Copyright (c) 2026 The DriveNet developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <taskpool.h>
+
+#include <utility>
+
+CTaskPool::Task CTaskPool::PopTask(TaskGroup& group)
+{
+    Task task = std::move(group.queue.front());
+    group.queue.pop_front();
+    group.nRunning++;
+    return task;
+}
+
+void CTaskPool::Thread()
+{
+    while (true) {
+        std::shared_ptr<TaskGroup> group;
+        Task task;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            // Callers take their own tasks too, drop the groups they emptied
+            while (!queueGroup.empty() && queueGroup.front()->queue.empty())
+                queueGroup.pop_front();
+            if (queueGroup.empty()) {
+                condWorker.wait(lock);
+                continue;
+            }
+            group = queueGroup.front();
+            queueGroup.pop_front();
+            task = PopTask(*group);
+            if (!group->queue.empty())
+                queueGroup.push_back(group);
+        }
+
+        task();
+
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (--group->nRunning == 0 && group->queue.empty())
+            group->condDone.notify_one();
+    }
+}
+
+void CTaskPool::Run(std::vector<Task>& vTask)
+{
+    if (vTask.empty())
+        return;
+
+    std::shared_ptr<TaskGroup> group = std::make_shared<TaskGroup>();
+    boost::unique_lock<boost::mutex> lock(mutex);
+    for (Task& task : vTask)
+        group->queue.push_back(std::move(task));
+    vTask.clear();
+    queueGroup.push_back(group);
+    if (group->queue.size() > 1)
+        condWorker.notify_all();
+
+    while (!group->queue.empty()) {
+        Task task = PopTask(*group);
+        lock.unlock();
+        task();
+        lock.lock();
+        group->nRunning--;
+    }
+    while (group->nRunning)
+        group->condDone.wait(lock);
+}
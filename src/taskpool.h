@@ -0,0 +1,58 @@
+// Copyright (c) 2026 The DriveNet developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TASKPOOL_H
+#define BITCOIN_TASKPOOL_H
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+/**
+ * Pool of worker threads shared by independent callers.
+ *
+ * Unlike CCheckQueue, which has a single master at a time, any number of
+ * threads can call Run() concurrently. Each call is a group of its own:
+ * the workers take tasks from the waiting groups round robin, and the
+ * caller works on the tasks of its own group until they are all done, so
+ * a call also completes when no worker thread was started.
+ */
+class CTaskPool
+{
+public:
+    typedef std::function<void()> Task;
+
+    CTaskPool() {}
+    CTaskPool(const CTaskPool&) = delete;
+    CTaskPool& operator=(const CTaskPool&) = delete;
+
+    //! Worker thread loop, stopped by interrupting the thread
+    void Thread();
+
+    //! Run the tasks on the pool and the calling thread, return once all are done
+    void Run(std::vector<Task>& vTask);
+
+private:
+    //! The tasks of one Run() call
+    struct TaskGroup
+    {
+        std::deque<Task> queue;
+        size_t nRunning = 0;
+        boost::condition_variable condDone;
+    };
+
+    boost::mutex mutex;
+    boost::condition_variable condWorker;
+    //! Groups with tasks waiting, in the order the workers serve them
+    std::deque<std::shared_ptr<TaskGroup>> queueGroup;
+
+    //! Take the next task of group. Requires mutex.
+    Task PopTask(TaskGroup& group);
+};
+
+#endif // BITCOIN_TASKPOOL_H
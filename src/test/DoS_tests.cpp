@@ -8,14 +8,17 @@
 #include <keystore.h>
 #include <net.h>
 #include <net_processing.h>
+#include <netmessagemaker.h>
 #include <pow.h>
 #include <script/sign.h>
 #include <serialize.h>
 #include <util.h>
 #include <validation.h>
+#include <versionbits.h>
 
 #include <test/test_drivenet.h>
 
+#include <set>
 #include <stdint.h>
 
 #include <boost/test/unit_test.hpp>
@@ -382,4 +385,212 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
     BOOST_CHECK(mapOrphanTransactions.empty());
 }
 
+// Frame a message the way PushMessage() does and queue it for processing as
+// if the socket handler had read it from the peer.
+static void ReceiveTestMessage(CNode& node, const CSerializedNetMsg& msg)
+{
+    CMessageHeader hdr(Params().MessageStart(), msg.command.c_str(), msg.data.size());
+    uint256 hash = Hash(msg.data.data(), msg.data.data() + msg.data.size());
+    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+
+    std::vector<unsigned char> vHeader;
+    CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, vHeader, 0, hdr};
+
+    CNetMessage netmsg(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
+    BOOST_CHECK_EQUAL(netmsg.readHeader((const char*)vHeader.data(), vHeader.size()), (int)vHeader.size());
+    BOOST_CHECK_EQUAL(netmsg.readData((const char*)msg.data.data(), msg.data.size()), (int)msg.data.size());
+    BOOST_CHECK(netmsg.complete());
+    netmsg.nTime = GetTimeMicros();
+
+    LOCK(node.cs_vProcessMsg);
+    node.nProcessQueueSize += netmsg.vRecv.size() + CMessageHeader::HEADER_SIZE;
+    node.vProcessMsg.push_back(std::move(netmsg));
+}
+
+// Wait until the message handler threads have drained every node's queue
+static bool WaitForMessageHandlers(const std::vector<CNode*>& vNodes)
+{
+    for (int i = 0; i < 1000; i++) {
+        bool fDone = true;
+        for (CNode* pnode : vNodes) {
+            LOCK(pnode->cs_vProcessMsg);
+            if (!pnode->vProcessMsg.empty() || pnode->fInMessageHandler) {
+                fDone = false;
+            }
+        }
+        if (fDone) {
+            return true;
+        }
+        MilliSleep(10);
+    }
+    return false;
+}
+
+static void InitMessageHandlerConnman(CConnman* connman, PeerLogicValidation* peerLogic, int nThreads)
+{
+    CConnman::Options options;
+    options.nMaxConnections = 125;
+    options.nMaxOutbound = 8;
+    options.m_msgproc = peerLogic;
+    options.nMessageHandlerThreads = nThreads;
+    // The test peers have no socket, so everything sent to them stays
+    // queued. Don't let that pause them.
+    options.nSendBufferMaxSize = 1000 * DEFAULT_MAXSENDBUFFER;
+    options.nReceiveFloodSize = 1000 * DEFAULT_MAXRECEIVEBUFFER;
+    connman->Init(options);
+}
+
+BOOST_AUTO_TEST_CASE(msghandler_concurrent_orphans)
+{
+    constexpr int nThreads = 4;
+    constexpr int nPeers = 8;
+    constexpr int nOrphansPerPeer = 10;
+    static_assert(nPeers * nOrphansPerPeer <= DEFAULT_MAX_ORPHAN_TRANSACTIONS, "orphans must not be evicted");
+
+    InitMessageHandlerConnman(connman, peerLogic.get(), nThreads);
+    {
+        LOCK(cs_main);
+        LimitOrphanTxSize(0);
+    }
+
+    std::vector<CNode*> vNodes;
+    for (int i = 0; i < nPeers; i++) {
+        AddRandomOutboundPeer(vNodes, *peerLogic);
+    }
+
+    CKey key;
+    key.MakeNewKey(true);
+    std::map<uint256, NodeId> mapExpected;
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    for (CNode* pnode : vNodes) {
+        for (int i = 0; i < nOrphansPerPeer; i++) {
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            tx.vin[0].prevout.n = 0;
+            tx.vin[0].prevout.hash = InsecureRand256();
+            tx.vin[0].scriptSig << OP_1;
+            tx.vout.resize(1);
+            tx.vout[0].nValue = 1*CENT;
+            tx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+            CTransactionRef ptx = MakeTransactionRef(tx);
+            mapExpected[ptx->GetHash()] = pnode->GetId();
+            ReceiveTestMessage(*pnode, msgMaker.Make(NetMsgType::TX, *ptx));
+        }
+    }
+
+    // All peers feed the shared orphan pool at the same time
+    CConnmanTest::StartMessageHandlers(nThreads);
+    connman->WakeMessageHandler();
+    BOOST_CHECK(WaitForMessageHandlers(vNodes));
+    CConnmanTest::StopMessageHandlers();
+
+    {
+        LOCK(cs_main);
+        BOOST_CHECK_EQUAL(mapOrphanTransactions.size(), mapExpected.size());
+        for (const auto& expected : mapExpected) {
+            auto it = mapOrphanTransactions.find(expected.first);
+            BOOST_REQUIRE(it != mapOrphanTransactions.end());
+            BOOST_CHECK_EQUAL(it->second.fromPeer, expected.second);
+        }
+    }
+
+    bool dummy;
+    for (const CNode* pnode : vNodes) {
+        BOOST_CHECK(!pnode->fDisconnect);
+        peerLogic->FinalizeNode(pnode->GetId(), dummy);
+    }
+    CConnmanTest::ClearNodes();
+    for (CNode* pnode : vNodes) {
+        delete pnode;
+    }
+
+    // Finalizing the peers erased the orphans they announced
+    LOCK(cs_main);
+    BOOST_CHECK(mapOrphanTransactions.empty());
+}
+
+// Regtest proof of work keeps mining the test headers cheap
+struct RegtestingSetup : public TestingSetup {
+    RegtestingSetup() : TestingSetup(CBaseChainParams::REGTEST) {}
+};
+
+BOOST_FIXTURE_TEST_CASE(msghandler_concurrent_block_requests, RegtestingSetup)
+{
+    constexpr int nThreads = 4;
+    constexpr int nPeers = 8;
+    constexpr int nHeaders = 20;
+
+    InitMessageHandlerConnman(connman, peerLogic.get(), nThreads);
+
+    // A chain of headers on top of genesis that every peer announces
+    std::vector<CBlock> vHeaders;
+    {
+        LOCK(cs_main);
+        const CBlockIndex* pindexGenesis = chainActive.Tip();
+        uint256 hashPrev = pindexGenesis->GetBlockHash();
+        for (int i = 0; i < nHeaders; i++) {
+            CBlock block;
+            block.nVersion = VERSIONBITS_TOP_BITS;
+            block.hashPrevBlock = hashPrev;
+            block.hashMerkleRoot = InsecureRand256();
+            block.nTime = pindexGenesis->nTime + (i + 1) * Params().GetConsensus().nPowTargetSpacing;
+            block.nBits = pindexGenesis->nBits;
+            block.nNonce = 0;
+            while (!CheckProofOfWork(block.GetPoWHash(), block.nBits, Params().GetConsensus())) {
+                ++block.nNonce;
+            }
+            hashPrev = block.GetHash();
+            vHeaders.push_back(block);
+        }
+    }
+
+    // Segwit is active, so blocks are only fetched from peers that completed
+    // a handshake announcing the services we expect.
+    std::vector<CNode*> vNodes;
+    const ServiceFlags nServices = ServiceFlags(NODE_NETWORK | NODE_WITNESS | NODE_DRIVECHAIN);
+    for (int i = 0; i < nPeers; i++) {
+        CAddress addr(ip(GetRandInt(0xffffffff)), NODE_NONE);
+        vNodes.push_back(new CNode(id++, nServices, 0, INVALID_SOCKET, addr, 0, 0, CAddress(), "", /*fInboundIn=*/ false));
+        CNode& node = *vNodes.back();
+        peerLogic->InitializeNode(&node);
+        CConnmanTest::AddNode(node);
+
+        ReceiveTestMessage(node, CNetMsgMaker(INIT_PROTO_VERSION).Make(NetMsgType::VERSION, PROTOCOL_VERSION, (uint64_t)nServices, GetTime(),
+                CAddress(CService(), NODE_NONE), CAddress(CService(), nServices), GetRand(std::numeric_limits<uint64_t>::max()), std::string("/test/"), 0, true));
+        ReceiveTestMessage(node, CNetMsgMaker(INIT_PROTO_VERSION).Make(NetMsgType::VERACK));
+        ReceiveTestMessage(node, CNetMsgMaker(PROTOCOL_VERSION).Make(NetMsgType::HEADERS, vHeaders));
+    }
+
+    // Every peer can serve every block, but each one must only be requested
+    // from a single peer.
+    CConnmanTest::StartMessageHandlers(nThreads);
+    connman->WakeMessageHandler();
+    BOOST_CHECK(WaitForMessageHandlers(vNodes));
+    CConnmanTest::StopMessageHandlers();
+
+    std::set<int> setHeightInFlight;
+    size_t nInFlight = 0;
+    for (const CNode* pnode : vNodes) {
+        BOOST_CHECK(pnode->fSuccessfullyConnected);
+        BOOST_CHECK(!pnode->fDisconnect);
+        CNodeStateStats stats;
+        BOOST_REQUIRE(GetNodeStateStats(pnode->GetId(), stats));
+        BOOST_CHECK(stats.vHeightInFlight.size() <= (size_t)MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+        setHeightInFlight.insert(stats.vHeightInFlight.begin(), stats.vHeightInFlight.end());
+        nInFlight += stats.vHeightInFlight.size();
+    }
+    BOOST_CHECK_EQUAL(nInFlight, setHeightInFlight.size());
+    BOOST_CHECK_EQUAL(setHeightInFlight.size(), (size_t)nHeaders);
+
+    bool dummy;
+    for (const CNode* pnode : vNodes) {
+        peerLogic->FinalizeNode(pnode->GetId(), dummy);
+    }
+    CConnmanTest::ClearNodes();
+    for (CNode* pnode : vNodes) {
+        delete pnode;
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -4,6 +4,8 @@
 
 #include <util.h>
 
+#include <memusage.h>
+#include <support/allocators/pool.h>
 #include <support/allocators/secure.h>
 #include <test/test_drivenet.h>
 
@@ -204,6 +206,105 @@ BOOST_AUTO_TEST_CASE(lockedpool_tests_mock)
     BOOST_CHECK(pool.stats().used == 0);
 }
 
+BOOST_AUTO_TEST_CASE(fixed_size_pool_tests)
+{
+    FixedSizePool pool(20);
+    BOOST_CHECK_EQUAL(pool.NodeSize(), 24U);
+    const size_t nMaxNodesPerChunk = POOL_CHUNK_SIZE / 24;
+
+    // Each new chunk holds half as many nodes as the chunks held so far
+    std::vector<void*> vNode;
+    const size_t vReserved[] = {1, 2, 3, 4, 6, 6, 9, 9};
+    for (size_t nReserved : vReserved) {
+        vNode.push_back(pool.Allocate());
+        BOOST_CHECK_EQUAL(pool.ReservedBytes(), nReserved * 24);
+    }
+    BOOST_CHECK_EQUAL(pool.NodesInUse(), 8U);
+    BOOST_CHECK_EQUAL(pool.FreeBytes(), 0U);
+
+    // Released nodes are reused before any new chunk is requested
+    void* pLast = vNode.back();
+    pool.Deallocate(pLast);
+    BOOST_CHECK_EQUAL(pool.FreeBytes(), 24U);
+    BOOST_CHECK(pool.Allocate() == pLast);
+    BOOST_CHECK_EQUAL(pool.FreeBytes(), 0U);
+
+    // Free the first two chunks completely and one of the two nodes of the fifth
+    for (size_t i : {0, 1, 4}) {
+        pool.Deallocate(vNode[i]);
+        vNode[i] = nullptr;
+    }
+    BOOST_CHECK_EQUAL(pool.FreeBytes(), 3 * 24U);
+    BOOST_CHECK_EQUAL(pool.ReservedBytes(), 9 * 24U);
+
+    // Only the completely free chunks are returned
+    pool.ReleaseUnused();
+    BOOST_CHECK_EQUAL(pool.ReservedBytes(), 7 * 24U);
+    BOOST_CHECK_EQUAL(pool.FreeBytes(), 24U);
+    BOOST_CHECK_EQUAL(pool.NodesInUse(), 5U);
+
+    // The remaining free node is handed out before a new chunk is requested,
+    // and chunks never grow past POOL_CHUNK_SIZE
+    vNode[4] = pool.Allocate();
+    BOOST_CHECK_EQUAL(pool.FreeBytes(), 0U);
+    BOOST_CHECK_EQUAL(pool.ReservedBytes(), 7 * 24U);
+    size_t nReserved = pool.ReservedBytes();
+    while (pool.NodesInUse() < 3 * nMaxNodesPerChunk) {
+        vNode.push_back(pool.Allocate());
+        BOOST_CHECK(pool.ReservedBytes() - nReserved <= nMaxNodesPerChunk * 24);
+        nReserved = pool.ReservedBytes();
+    }
+    BOOST_CHECK(pool.ReservedBytes() < 4 * nMaxNodesPerChunk * 24);
+
+    // Freeing everything returns every chunk
+    for (void* p : vNode) {
+        if (p)
+            pool.Deallocate(p);
+    }
+    BOOST_CHECK_EQUAL(pool.NodesInUse(), 0U);
+    pool.ReleaseUnused();
+    BOOST_CHECK_EQUAL(pool.ReservedBytes(), 0U);
+    BOOST_CHECK_EQUAL(pool.FreeBytes(), 0U);
+
+    // and the pool starts small again afterwards
+    void* p = pool.Allocate();
+    BOOST_CHECK_EQUAL(pool.ReservedBytes(), 24U);
+    pool.Deallocate(p);
+}
+
+BOOST_AUTO_TEST_CASE(pool_allocator_tests)
+{
+    typedef std::set<uint64_t, std::less<uint64_t>, pool_allocator<uint64_t> > pooled_set;
+    const size_t nNodeSize = PoolNodeSize(sizeof(memusage::stl_tree_node<uint64_t>));
+    PoolResource resource;
+    {
+        pooled_set s{std::less<uint64_t>(), pooled_set::allocator_type(&resource)};
+        for (uint64_t i = 0; i < 100; i++)
+            s.insert(i);
+        BOOST_CHECK_EQUAL(s.size(), 100U);
+        BOOST_CHECK_EQUAL(*s.begin(), 0U);
+        BOOST_CHECK_EQUAL(*s.rbegin(), 99U);
+        BOOST_CHECK_EQUAL(memusage::DynamicUsage(s), 100 * nNodeSize);
+        BOOST_CHECK_EQUAL(resource.FreeBytes(), 0U);
+        BOOST_CHECK(resource.ReservedBytes() >= 100 * nNodeSize);
+
+        // Copies and default constructed sets don't use the resource
+        pooled_set copy(s);
+        pooled_set temp;
+        temp.insert(1);
+        BOOST_CHECK(copy == s);
+        BOOST_CHECK(copy.get_allocator() != s.get_allocator());
+        BOOST_CHECK(temp.get_allocator() == pooled_set::allocator_type());
+        BOOST_CHECK_EQUAL(resource.FreeBytes(), 0U);
+
+        s.erase(0);
+        BOOST_CHECK_EQUAL(resource.FreeBytes(), nNodeSize);
+    }
+    BOOST_CHECK_EQUAL(resource.FreeBytes(), 100 * nNodeSize);
+    resource.ReleaseUnused();
+    BOOST_CHECK_EQUAL(resource.ReservedBytes(), 0U);
+}
+
 // These tests used the live LockedPoolManager object, this is also used
 // by other tests so the conditions are somewhat less controllable and thus the
 // tests are somewhat more error-prone.
@@ -0,0 +1,136 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfilter.h>
+
+#include <clientversion.h>
+#include <coins.h>
+#include <crypto/common.h>
+#include <primitives/block.h>
+#include <script/script.h>
+#include <streams.h>
+#include <uint256.h>
+#include <undo.h>
+#include <utilstrencodings.h>
+#include <version.h>
+#include <test/test_drivenet.h>
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilter_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(gcsfilter_test)
+{
+    GCSFilter::ElementSet included_elements, excluded_elements;
+    for (int i = 0; i < 100; ++i) {
+        GCSFilter::Element element1(32);
+        element1[0] = i;
+        included_elements.insert(std::move(element1));
+
+        GCSFilter::Element element2(32);
+        element2[1] = i;
+        excluded_elements.insert(std::move(element2));
+    }
+
+    GCSFilter filter(0, 0, included_elements);
+    BOOST_CHECK_EQUAL(filter.GetN(), 100U);
+    for (const auto& element : included_elements) {
+        BOOST_CHECK(filter.Match(element));
+
+        auto insertion = excluded_elements.insert(element);
+        BOOST_CHECK(filter.MatchAny(excluded_elements));
+        excluded_elements.erase(insertion.first);
+    }
+    BOOST_CHECK(!filter.MatchAny(excluded_elements));
+
+    // A filter decoded from the encoding matches the same elements
+    GCSFilter decoded(0, 0, filter.GetEncoded());
+    BOOST_CHECK_EQUAL(decoded.GetN(), 100U);
+    BOOST_CHECK(decoded.GetEncoded() == filter.GetEncoded());
+    BOOST_CHECK(decoded.MatchAny(included_elements));
+    BOOST_CHECK(!decoded.MatchAny(excluded_elements));
+
+    // Empty filters match nothing
+    GCSFilter empty(0, 0, GCSFilter::ElementSet());
+    BOOST_CHECK_EQUAL(empty.GetN(), 0U);
+    BOOST_CHECK(empty.GetEncoded() == std::vector<unsigned char>(1, 0));
+    BOOST_CHECK(!empty.MatchAny(included_elements));
+
+    // The encoding must at least contain the element count
+    BOOST_CHECK_THROW(GCSFilter(0, 0, std::vector<unsigned char>()), std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(gcsfilter_bip158_vector)
+{
+    // Basic filter of the testnet3 genesis block from the BIP 158 test vectors
+    const uint256 hashBlock = uint256S("000000000933ea01ad0ee984209779baaec3ced90fa3f408719526f8d77f4943");
+    const std::vector<unsigned char> script = ParseHex("4104678afdb0fe5548271967f1a67130b7105cd6a828e03909a67962e0ea1f61deb649f6bc3f4cef38c4f35504e51ec112de5c384df7ba0b8d578a4c702b6bf11d5fac");
+
+    GCSFilter filter(ReadLE64(hashBlock.begin()), ReadLE64(hashBlock.begin() + 8), GCSFilter::ElementSet{script});
+    BOOST_CHECK_EQUAL(HexStr(filter.GetEncoded()), "019dfca8");
+    BOOST_CHECK(filter.Match(script));
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_basic_test)
+{
+    CScript included_scripts[5], excluded_scripts[3];
+
+    // First two are outputs on a single transaction
+    included_scripts[0] << std::vector<unsigned char>(0, 65) << OP_CHECKSIG;
+    included_scripts[1] << OP_DUP << OP_HASH160 << std::vector<unsigned char>(1, 20) << OP_EQUALVERIFY << OP_CHECKSIG;
+
+    // Third is an output of a second transaction
+    included_scripts[2] << OP_1 << std::vector<unsigned char>(2, 33) << OP_1 << OP_CHECKMULTISIG;
+
+    // Last two are spent by a single transaction, one of them a loaded coin
+    included_scripts[3] << OP_0 << std::vector<unsigned char>(3, 32);
+    included_scripts[4] << OP_4 << OP_ADD << OP_8 << OP_EQUAL;
+
+    // OP_RETURN outputs and empty scripts are left out
+    excluded_scripts[0] << OP_RETURN << std::vector<unsigned char>(4, 40);
+    excluded_scripts[1] << std::vector<unsigned char>(5, 33) << OP_CHECKSIG;
+
+    CMutableTransaction tx_1;
+    tx_1.vout.emplace_back(100, included_scripts[0]);
+    tx_1.vout.emplace_back(200, included_scripts[1]);
+    tx_1.vout.emplace_back(0, excluded_scripts[0]);
+    tx_1.vout.emplace_back(300, CScript());
+
+    CMutableTransaction tx_2;
+    tx_2.vout.emplace_back(300, included_scripts[2]);
+
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(tx_1));
+    block.vtx.push_back(MakeTransactionRef(tx_2));
+
+    CBlockUndo block_undo;
+    block_undo.vtxundo.emplace_back();
+    block_undo.vtxundo.back().vprevout.emplace_back(CTxOut(500, included_scripts[3]), 1000, true, false /* fCriticalData */, false /* fLoaded */);
+    block_undo.vtxundo.back().vprevout.emplace_back(CTxOut(600, included_scripts[4]), 0, false, false /* fCriticalData */, true /* fLoaded */);
+    block_undo.vtxundo.back().vprevout.emplace_back(CTxOut(700, CScript()), 10000, false, false /* fCriticalData */, false /* fLoaded */);
+
+    BlockFilter block_filter(block, block_undo);
+    BOOST_CHECK(block_filter.GetBlockHash() == block.GetHash());
+
+    const GCSFilter& filter = block_filter.GetFilter();
+    BOOST_CHECK_EQUAL(filter.GetN(), 5U);
+    for (const CScript& script : included_scripts)
+        BOOST_CHECK(filter.Match(GCSFilter::Element(script.begin(), script.end())));
+    for (const CScript& script : excluded_scripts)
+        BOOST_CHECK(!filter.Match(GCSFilter::Element(script.begin(), script.end())));
+
+    // Serialization round trip, as done by the block filter index
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << block_filter;
+    BlockFilter block_filter2;
+    ss >> block_filter2;
+    BOOST_CHECK(block_filter2.GetBlockHash() == block_filter.GetBlockHash());
+    BOOST_CHECK(block_filter2.GetEncodedFilter() == block_filter.GetEncodedFilter());
+    for (const CScript& script : included_scripts)
+        BOOST_CHECK(block_filter2.GetFilter().Match(GCSFilter::Element(script.begin(), script.end())));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
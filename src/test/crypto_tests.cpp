@@ -10,6 +10,7 @@
 #include <crypto/sha512.h>
 #include <crypto/hmac_sha256.h>
 #include <crypto/hmac_sha512.h>
+#include <crypto/muhash.h>
 #include <random.h>
 #include <utilstrencodings.h>
 #include <test/test_drivenet.h>
@@ -524,6 +525,69 @@ BOOST_AUTO_TEST_CASE(chacha20_testvector)
                  "fab78c9");
 }
 
+BOOST_AUTO_TEST_CASE(muhash_tests)
+{
+    // (p - 1)^2 = 1 mod p
+    unsigned char minus_one[Num3072::BYTE_SIZE];
+    memset(minus_one, 0xff, sizeof(minus_one));
+    minus_one[0] = 0xff - 1103717 % 256;
+    minus_one[1] = 0xff - (1103717 >> 8) % 256;
+    minus_one[2] = 0xff - (1103717 >> 16);
+    Num3072 num(minus_one);
+    num.Multiply(Num3072(minus_one));
+    unsigned char out[Num3072::BYTE_SIZE];
+    num.ToBytes(out);
+    BOOST_CHECK_EQUAL(out[0], 1);
+    for (size_t i = 1; i < sizeof(out); i++)
+        BOOST_CHECK_EQUAL(out[i], 0);
+
+    // Independent of insertion order and of how the set is split up
+    unsigned char elements[4][32];
+    for (int i = 0; i < 4; i++)
+        GetRandBytes(elements[i], 32);
+    MuHash3072 acc1, acc2, acc3, acc4;
+    for (int i = 0; i < 4; i++)
+        acc1.Insert(elements[i], 32);
+    for (int i = 3; i >= 0; i--)
+        acc2.Insert(elements[i], 32);
+    acc3.Insert(elements[2], 32).Insert(elements[0], 32);
+    acc4.Insert(elements[3], 32).Insert(elements[1], 32);
+    acc3 *= acc4;
+
+    unsigned char hash1[32], hash2[32], hash3[32];
+    acc1.Finalize(hash1);
+    acc2.Finalize(hash2);
+    acc3.Finalize(hash3);
+    BOOST_CHECK(memcmp(hash1, hash2, 32) == 0);
+    BOOST_CHECK(memcmp(hash1, hash3, 32) == 0);
+
+    // Different sets hash differently
+    MuHash3072 acc5;
+    for (int i = 0; i < 3; i++)
+        acc5.Insert(elements[i], 32);
+    acc5.Finalize(hash2);
+    BOOST_CHECK(memcmp(hash1, hash2, 32) != 0);
+
+    // Known answer for the elements 0, 1 and 2 as 32 byte little endian
+    // numbers. Expansion and finalization are those of Bitcoin Core's MuHash.
+    MuHash3072 acc6;
+    for (int i = 0; i < 3; i++) {
+        unsigned char element[32] = {(unsigned char)i};
+        acc6.Insert(element, sizeof(element));
+    }
+    acc6.Finalize(hash1);
+    BOOST_CHECK_EQUAL(HexStr(hash1, hash1 + 32), "6b5eeda63604270b7bfd81ea3d7c0ce1fae1e83e61e9ef5b7fa5d6721545d470");
+
+    // The empty set commits to one
+    MuHash3072 empty;
+    empty.Finalize(hash1);
+    Num3072 one;
+    one.ToBytes(out);
+    CSHA256().Write(out, sizeof(out)).Finalize(hash2);
+    BOOST_CHECK(memcmp(hash1, hash2, 32) == 0);
+    BOOST_CHECK_EQUAL(HexStr(hash1, hash1 + 32), "c85525462fdcf30a2c18d6f4b92923000974355c2477f59594d2c205a1d25add");
+}
+
 BOOST_AUTO_TEST_CASE(countbits_tests)
 {
     FastRandomContext ctx;
@@ -5,6 +5,11 @@
 #include <chainparams.h>
 #include <validation.h>
 #include <net.h>
+#include <policy/policy.h>
+#include <sidechain.h>
+#include <sidechaindb.h>
+#include <txdb.h>
+#include <undo.h>
 
 #include <test/test_drivenet.h>
 
@@ -58,6 +63,87 @@ BOOST_AUTO_TEST_CASE(subsidy_limit_test)
     BOOST_CHECK_EQUAL(nSum, 2099999997690000ULL);
 }
 
+BOOST_AUTO_TEST_CASE(block_stats_test)
+{
+    CBlock block;
+
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = 50 * COIN;
+    coinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+
+    CBlockUndo blockundo;
+    CAmount nTotalFee = 0;
+    // Transactions paying increasing fees. The payout differs so that each
+    // has its own blind WT^ hash, which leaves out the last output.
+    for (int i = 1; i <= 10; i++) {
+        CMutableTransaction mtx;
+        mtx.vin.resize(1);
+        mtx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        mtx.vout.resize(2);
+        mtx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        mtx.vout[0].nValue = COIN / 2 - (i * 1000);
+        mtx.vout[1].scriptPubKey = CScript() << OP_TRUE;
+        mtx.vout[1].nValue = COIN / 2;
+        block.vtx.push_back(MakeTransactionRef(mtx));
+        nTotalFee += i * 1000;
+
+        CTxUndo txundo;
+        txundo.vprevout.emplace_back(CTxOut(COIN, CScript() << OP_TRUE), 1, false, false, false);
+        blockundo.vtxundo.push_back(txundo);
+    }
+
+    CBlockStats stats;
+    {
+        LOCK(cs_main);
+        ComputeBlockStats(block, blockundo, stats);
+    }
+
+    BOOST_CHECK_EQUAL(stats.nTotalFee, nTotalFee);
+    BOOST_CHECK_EQUAL(stats.nWTPrimeFee, 0);
+    BOOST_CHECK_EQUAL(stats.nTx, block.vtx.size());
+
+    uint32_t nVSize = 0;
+    for (const CTransactionRef& tx : block.vtx)
+        nVSize += GetVirtualTransactionSize(*tx);
+    BOOST_CHECK_EQUAL(stats.nVSize, nVSize);
+
+    // The transactions all have the same size, so percentiles are increasing
+    // and bounded by the lowest and highest feerate.
+    int64_t nTxVSize = GetVirtualTransactionSize(*block.vtx[1]);
+    BOOST_CHECK_EQUAL(stats.feeratePercentiles[0], 1000 / nTxVSize);
+    for (int i = 1; i < BLOCK_STATS_NUM_PERCENTILES; i++)
+        BOOST_CHECK(stats.feeratePercentiles[i] >= stats.feeratePercentiles[i - 1]);
+    BOOST_CHECK(stats.feeratePercentiles[BLOCK_STATS_NUM_PERCENTILES - 1] <= 10000 / nTxVSize);
+
+    // Round trip serialization
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << stats;
+    CBlockStats statsRead;
+    ss >> statsRead;
+    BOOST_CHECK_EQUAL(statsRead.nTotalFee, stats.nTotalFee);
+    BOOST_CHECK_EQUAL(statsRead.nTx, stats.nTx);
+    BOOST_CHECK(statsRead.feeratePercentiles == stats.feeratePercentiles);
+
+    // A transaction counts as a WT^ payout if SCDB recorded it as a WT^
+    // spent in this block, whatever the sidechain scripts are today.
+    SidechainSpentWTPrime spent;
+    spent.nSidechain = 0;
+    BOOST_CHECK(block.vtx[3]->GetBWTHash(spent.hashWTPrime));
+    spent.hashBlock = block.GetHash();
+    scdb.AddSpentWTPrimes(std::vector<SidechainSpentWTPrime>{spent});
+    {
+        LOCK(cs_main);
+        ComputeBlockStats(block, blockundo, stats);
+    }
+    BOOST_CHECK_EQUAL(stats.nTotalFee, nTotalFee);
+    BOOST_CHECK_EQUAL(stats.nWTPrimeFee, 3000);
+    scdb.Reset();
+}
+
 bool ReturnFalse() { return false; }
 bool ReturnTrue() { return true; }
 
@@ -74,4 +160,67 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     Test.disconnect(&ReturnTrue);
     BOOST_CHECK(Test());
 }
+
+BOOST_FIXTURE_TEST_CASE(read_raw_block_from_disk, TestChain100Setup)
+{
+    // The raw bytes on disk must match the full serialization of the block
+    // since they are served to peers as they are
+    for (int nHeight : {0, 1, 50, 100}) {
+        const CBlockIndex* pindex = chainActive[nHeight];
+
+        CBlock block;
+        BOOST_CHECK(ReadBlockFromDisk(block, pindex, Params().GetConsensus()));
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << block;
+
+        std::vector<unsigned char> vch;
+        BOOST_CHECK(ReadRawBlockFromDisk(vch, pindex, Params().MessageStart()));
+        BOOST_CHECK_EQUAL(vch.size(), ss.size());
+        BOOST_CHECK(std::equal(vch.begin(), vch.end(), (const unsigned char*)ss.data()));
+    }
+
+    // Reading with the wrong message start fails
+    std::vector<unsigned char> vch;
+    CMessageHeader::MessageStartChars messageStart;
+    memset(messageStart, 0, sizeof(messageStart));
+    BOOST_CHECK(!ReadRawBlockFromDisk(vch, chainActive.Tip(), messageStart));
+
+    // Reading through an index that points at another block's data fails
+    CBlockIndex indexWrong(*chainActive[1]);
+    indexWrong.phashBlock = chainActive[2]->phashBlock;
+    BOOST_CHECK(!ReadRawBlockFromDisk(vch, &indexWrong, Params().MessageStart()));
+}
+
+BOOST_FIXTURE_TEST_CASE(block_stats_backfill, TestChain100Setup)
+{
+    // The chain was built without the index
+    fBlockStatsIndex = true;
+    CBlockStats stats;
+    BOOST_CHECK(!GetBlockStats(chainActive[50], stats));
+
+    BackfillBlockStatsIndex();
+    BOOST_CHECK(GetBlockStats(chainActive[50], stats));
+    BOOST_CHECK(GetBlockStats(chainActive.Tip(), stats));
+    uint256 hashBackfilled;
+    BOOST_CHECK(pblocktree->ReadBlockStatsBackfilled(hashBackfilled));
+    BOOST_CHECK(hashBackfilled == chainActive.Tip()->GetBlockHash());
+
+    // Blocks up to the marker aren't looked at again
+    BOOST_CHECK(pblocktree->EraseBlockStats(chainActive[50]->GetBlockHash()));
+    BackfillBlockStatsIndex();
+    BOOST_CHECK(!GetBlockStats(chainActive[50], stats));
+
+    // Blocks connected while the index was disabled are filled in
+    fBlockStatsIndex = false;
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CreateAndProcessBlock({}, scriptPubKey);
+    fBlockStatsIndex = true;
+    BOOST_CHECK(!GetBlockStats(chainActive.Tip(), stats));
+    BackfillBlockStatsIndex();
+    BOOST_CHECK(GetBlockStats(chainActive.Tip(), stats));
+    BOOST_CHECK(pblocktree->ReadBlockStatsBackfilled(hashBackfilled));
+    BOOST_CHECK(hashBackfilled == chainActive.Tip()->GetBlockHash());
+
+    fBlockStatsIndex = false;
+}
 BOOST_AUTO_TEST_SUITE_END()
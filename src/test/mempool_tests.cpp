@@ -418,6 +418,136 @@ BOOST_AUTO_TEST_CASE(MempoolAncestorIndexingTest)
 }
 
 
+BOOST_AUTO_TEST_CASE(MempoolMiningClusterTest)
+{
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+
+    /* Zero fee parent with a high fee child */
+    CMutableTransaction txParent = CMutableTransaction();
+    txParent.vout.resize(1);
+    txParent.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txParent.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(txParent.GetHash(), entry.Fee(0LL).FromTx(txParent));
+
+    CMutableTransaction txChild = CMutableTransaction();
+    txChild.vin.resize(1);
+    txChild.vin[0].prevout = COutPoint(txParent.GetHash(), 0);
+    txChild.vin[0].scriptSig = CScript() << OP_11;
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txChild.vout[0].nValue = 9 * COIN;
+    pool.addUnchecked(txChild.GetHash(), entry.Fee(20000LL).FromTx(txChild));
+
+    /* Unrelated transaction */
+    CMutableTransaction txSingle = CMutableTransaction();
+    txSingle.vout.resize(1);
+    txSingle.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txSingle.vout[0].nValue = 5 * COIN;
+    pool.addUnchecked(txSingle.GetHash(), entry.Fee(10000LL).FromTx(txSingle));
+
+    LOCK(pool.cs);
+    std::map<uint64_t, CTxMemPool::MiningCluster> mapCluster = pool.GetMiningClusters();
+    BOOST_CHECK_EQUAL(mapCluster.size(), 2U);
+    for (const std::pair<const uint64_t, CTxMemPool::MiningCluster>& cluster : mapCluster) {
+        // Each cluster is mined as a single package
+        BOOST_CHECK_EQUAL(cluster.second.size(), 1U);
+        const CTxMemPool::MiningPackage& package = cluster.second[0];
+        if (package.vTx.size() == 2) {
+            // The child pays for its parent, which comes first
+            BOOST_CHECK(package.iter->GetTx().GetHash() == txChild.GetHash());
+            BOOST_CHECK(package.vTx[0]->GetTx().GetHash() == txParent.GetHash());
+            BOOST_CHECK(package.vTx[1]->GetTx().GetHash() == txChild.GetHash());
+            BOOST_CHECK_EQUAL(package.nModFeesWithAncestors, 20000);
+            BOOST_CHECK_EQUAL(package.nSizeWithAncestors, GetVirtualTransactionSize(txParent) + GetVirtualTransactionSize(txChild));
+        } else {
+            BOOST_CHECK_EQUAL(package.vTx.size(), 1U);
+            BOOST_CHECK(package.iter->GetTx().GetHash() == txSingle.GetHash());
+        }
+    }
+
+    /* A zero fee child of the unrelated transaction is mined after it */
+    CMutableTransaction txLowChild = CMutableTransaction();
+    txLowChild.vin.resize(1);
+    txLowChild.vin[0].prevout = COutPoint(txSingle.GetHash(), 0);
+    txLowChild.vin[0].scriptSig = CScript() << OP_11;
+    txLowChild.vout.resize(1);
+    txLowChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txLowChild.vout[0].nValue = 4 * COIN;
+    pool.addUnchecked(txLowChild.GetHash(), entry.Fee(0LL).FromTx(txLowChild));
+
+    mapCluster = pool.GetMiningClusters();
+    BOOST_CHECK_EQUAL(mapCluster.size(), 2U);
+    for (const std::pair<const uint64_t, CTxMemPool::MiningCluster>& cluster : mapCluster) {
+        if (cluster.second[0].iter->GetTx().GetHash() != txSingle.GetHash())
+            continue;
+        BOOST_CHECK_EQUAL(cluster.second.size(), 2U);
+        BOOST_CHECK_EQUAL(cluster.second[1].vTx.size(), 1U);
+        BOOST_CHECK(cluster.second[1].iter->GetTx().GetHash() == txLowChild.GetHash());
+        BOOST_CHECK_EQUAL(cluster.second[1].nModFeesWithAncestors, 0);
+    }
+
+    /* Removing the child leaves the parent in a cluster of its own */
+    pool.removeRecursive(txChild);
+    mapCluster = pool.GetMiningClusters();
+    BOOST_CHECK_EQUAL(mapCluster.size(), 2U);
+    size_t nTx = 0;
+    for (const std::pair<const uint64_t, CTxMemPool::MiningCluster>& cluster : mapCluster) {
+        for (const CTxMemPool::MiningPackage& package : cluster.second)
+            nTx += package.vTx.size();
+        if (cluster.second[0].iter->GetTx().GetHash() == txParent.GetHash()) {
+            BOOST_CHECK_EQUAL(cluster.second.size(), 1U);
+            BOOST_CHECK_EQUAL(cluster.second[0].vTx.size(), 1U);
+        }
+    }
+    BOOST_CHECK_EQUAL(nTx, pool.size());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolLargeMiningClusterTest)
+{
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+
+    /* A zero fee parent with more children than a cluster is linearized in full for */
+    CMutableTransaction txParent = CMutableTransaction();
+    txParent.vout.resize(MAX_MINING_CLUSTER_SIZE);
+    for (unsigned int i = 0; i < MAX_MINING_CLUSTER_SIZE; i++) {
+        txParent.vout[i].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txParent.vout[i].nValue = COIN;
+    }
+    pool.addUnchecked(txParent.GetHash(), entry.Fee(0LL).FromTx(txParent));
+
+    std::map<uint256, CAmount> mapChildFee;
+    for (unsigned int i = 0; i < MAX_MINING_CLUSTER_SIZE; i++) {
+        CMutableTransaction txChild = CMutableTransaction();
+        txChild.vin.resize(1);
+        txChild.vin[0].prevout = COutPoint(txParent.GetHash(), i);
+        txChild.vin[0].scriptSig = CScript() << OP_11;
+        txChild.vout.resize(1);
+        txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txChild.vout[0].nValue = COIN - 1000 * (i + 1);
+        pool.addUnchecked(txChild.GetHash(), entry.Fee(1000 * (i + 1)).FromTx(txChild));
+        mapChildFee[txChild.GetHash()] = 1000 * (i + 1);
+    }
+
+    LOCK(pool.cs);
+    std::map<uint64_t, CTxMemPool::MiningCluster> mapCluster = pool.GetMiningClusters();
+    BOOST_CHECK_EQUAL(mapCluster.size(), 1U);
+    const CTxMemPool::MiningCluster& cluster = mapCluster.begin()->second;
+    BOOST_CHECK_EQUAL(cluster.size(), MAX_MINING_CLUSTER_SIZE);
+
+    // The best child pays for the parent, the others follow on their own
+    BOOST_CHECK_EQUAL(cluster[0].vTx.size(), 2U);
+    BOOST_CHECK(cluster[0].vTx[0]->GetTx().GetHash() == txParent.GetHash());
+    BOOST_CHECK_EQUAL(cluster[0].nModFeesWithAncestors, (CAmount)1000 * MAX_MINING_CLUSTER_SIZE);
+    for (size_t i = 1; i < cluster.size(); i++) {
+        BOOST_CHECK_EQUAL(cluster[i].vTx.size(), 1U);
+        BOOST_CHECK_EQUAL(cluster[i].nModFeesWithAncestors, mapChildFee[cluster[i].iter->GetTx().GetHash()]);
+        BOOST_CHECK_EQUAL(cluster[i].nSizeWithAncestors, cluster[i].iter->GetTxSize());
+        BOOST_CHECK(cluster[i].nModFeesWithAncestors < cluster[i - 1].nModFeesWithAncestors);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
 {
     CTxMemPool pool;
@@ -571,4 +701,40 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolNodePoolUsageTest)
+{
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+
+    // Enough transactions to fill several chunks of pool nodes
+    std::vector<CTransactionRef> vtx;
+    for (int i = 0; i < 3000; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].scriptSig = CScript() << i;
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        tx.vout[0].nValue = COIN;
+        pool.addUnchecked(tx.GetHash(), entry.Fee(1000LL).FromTx(tx));
+        vtx.push_back(MakeTransactionRef(tx));
+    }
+    const size_t nNodeBytes = vtx.size() * PoolNodeSize(sizeof(CTxMemPoolEntry));
+    BOOST_CHECK(pool.DynamicMemoryUsage() > nNodeBytes);
+
+    // The nodes of transactions removed by a block stay in the pool for the
+    // next transactions and still count towards its usage
+    pool.removeForBlock(vtx, 1);
+    BOOST_CHECK_EQUAL(pool.size(), 0U);
+    const size_t nUsageRemoved = pool.DynamicMemoryUsage();
+    BOOST_CHECK(nUsageRemoved > nNodeBytes);
+
+    // Trimming counts the free nodes as well and returns the chunks that
+    // are completely free
+    pool.addUnchecked(vtx[0]->GetHash(), entry.Fee(1000LL).FromTx(*vtx[0]));
+    const size_t nLimit = nUsageRemoved / 2;
+    BOOST_CHECK(pool.DynamicMemoryUsage() > nLimit);
+    pool.TrimToSize(nLimit);
+    BOOST_CHECK(pool.DynamicMemoryUsage() <= nLimit);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -9,9 +9,16 @@
 #include <serialize.h>
 #include <streams.h>
 #include <net.h>
+#include <net_processing.h>
 #include <netbase.h>
+#include <netmessagemaker.h>
 #include <chainparams.h>
 #include <util.h>
+#include <utiltime.h>
+
+#ifndef WIN32
+#include <poll.h>
+#endif
 
 class CAddrManSerializationMock : public CAddrMan
 {
@@ -185,4 +192,219 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+BOOST_AUTO_TEST_CASE(cnetmessage_pooled_buffer)
+{
+    // Receive several large messages in a row so that later ones reuse the
+    // pooled buffers of earlier ones, including a smaller and a larger one
+    const std::vector<unsigned int> vSize = {1000 * 1000, 300 * 1000, 2 * 1000 * 1000, 1000};
+    for (size_t n = 0; n < vSize.size(); n++) {
+        std::vector<unsigned char> vPayload(vSize[n]);
+        for (size_t i = 0; i < vPayload.size(); i++)
+            vPayload[i] = (i * 7 + n) & 0xff;
+
+        CMessageHeader hdr(Params().MessageStart(), "block", vPayload.size());
+        CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+        ssHeader << hdr;
+        BOOST_CHECK_EQUAL(ssHeader.size(), (size_t)CMessageHeader::HEADER_SIZE);
+
+        CNetMessage msg(Params().MessageStart(), SER_NETWORK, PROTOCOL_VERSION);
+        BOOST_CHECK_EQUAL(msg.readHeader(ssHeader.data(), ssHeader.size()), (int)CMessageHeader::HEADER_SIZE);
+
+        const char* pch = (const char*)vPayload.data();
+        unsigned int nRemaining = vPayload.size();
+        while (nRemaining > 0) {
+            int nRead = msg.readData(pch, std::min(nRemaining, 65536u));
+            BOOST_CHECK(nRead > 0);
+            pch += nRead;
+            nRemaining -= nRead;
+        }
+
+        BOOST_CHECK(msg.complete());
+        BOOST_CHECK_EQUAL(msg.vRecv.size(), vPayload.size());
+        BOOST_CHECK(memcmp(msg.vRecv.data(), vPayload.data(), vPayload.size()) == 0);
+        BOOST_CHECK(msg.GetMessageHash() == Hash(vPayload.begin(), vPayload.end()));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(cconnman_push_shared_payload)
+{
+    CConnman connman(0x1337, 0x1337);
+    in_addr ipv4Addr;
+    ipv4Addr.s_addr = 0xa0b0c001;
+    CAddress addr = CAddress(CService(ipv4Addr, 7777), NODE_NETWORK);
+    CNode node(0, NODE_NETWORK, 0, INVALID_SOCKET, addr, 0, 0, CAddress(), "", false);
+
+    // Both messages queue the payload itself, not a copy of it
+    auto payload = std::make_shared<const CSharedNetPayload>(std::vector<unsigned char>(1000, 0x42));
+    for (int i = 0; i < 2; i++) {
+        CSerializedNetMsg msg;
+        msg.command = NetMsgType::BLOCK;
+        msg.shared_data = payload;
+        connman.PushMessage(&node, std::move(msg));
+    }
+    BOOST_REQUIRE_EQUAL(node.vSendMsg.size(), 4U);
+    BOOST_CHECK(node.vSendMsg[1].shared == payload);
+    BOOST_CHECK(node.vSendMsg[3].shared == payload);
+    BOOST_CHECK_EQUAL(payload.use_count(), 3);
+    BOOST_CHECK_EQUAL(node.nSendSize, 2 * (payload->data.size() + CMessageHeader::HEADER_SIZE));
+
+    // Headers and messages that aren't shared own their bytes
+    BOOST_CHECK(!node.vSendMsg[0].shared);
+    BOOST_CHECK(!node.vSendMsg[2].shared);
+    connman.PushMessage(&node, CNetMsgMaker(INIT_PROTO_VERSION).Make(NetMsgType::PING, (uint64_t)0x1337));
+    BOOST_REQUIRE_EQUAL(node.vSendMsg.size(), 6U);
+    BOOST_CHECK(!node.vSendMsg[5].shared);
+    BOOST_CHECK_EQUAL(node.vSendMsg[5].Get().size(), sizeof(uint64_t));
+
+    // The header describes the shared payload
+    CDataStream ssHeader(node.vSendMsg[0].Get(), SER_NETWORK, INIT_PROTO_VERSION);
+    CMessageHeader hdr(Params().MessageStart());
+    ssHeader >> hdr;
+    BOOST_CHECK(hdr.IsValid(Params().MessageStart()));
+    BOOST_CHECK_EQUAL(hdr.GetCommand(), NetMsgType::BLOCK);
+    BOOST_CHECK_EQUAL(hdr.nMessageSize, payload->data.size());
+    uint256 hash = Hash(payload->data.begin(), payload->data.end());
+    BOOST_CHECK(payload->hash == hash);
+    BOOST_CHECK(memcmp(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(socketbackend_parse)
+{
+    SocketBackend backend = SocketBackend::EPOLL;
+    BOOST_CHECK(ParseSocketBackend("select", backend));
+    BOOST_CHECK(backend == SocketBackend::SELECT);
+    BOOST_CHECK_EQUAL(SocketBackendToString(backend), "select");
+#ifdef HAVE_SYS_EPOLL_H
+    BOOST_CHECK(ParseSocketBackend("epoll", backend));
+    BOOST_CHECK(backend == SocketBackend::EPOLL);
+    BOOST_CHECK(DEFAULT_SOCKET_BACKEND == SocketBackend::EPOLL);
+    BOOST_CHECK_EQUAL(GetSupportedSocketBackends(), "epoll, select");
+#else
+    BOOST_CHECK(!ParseSocketBackend("epoll", backend));
+    BOOST_CHECK(DEFAULT_SOCKET_BACKEND == SocketBackend::SELECT);
+    BOOST_CHECK_EQUAL(GetSupportedSocketBackends(), "select");
+#endif
+    BOOST_CHECK(!ParseSocketBackend("poll", backend));
+    BOOST_CHECK(!ParseSocketBackend("", backend));
+    BOOST_CHECK(!ParseSocketBackend("SELECT", backend));
+}
+
+#ifndef WIN32
+template <typename Predicate>
+static bool WaitFor(Predicate pred)
+{
+    for (int i = 0; i < 1000; i++) {
+        if (pred())
+            return true;
+        MilliSleep(10);
+    }
+    return false;
+}
+
+// Read exactly nBytes from a blocking socket, giving up after 10 seconds
+// without progress
+static bool ReadFromSocket(int fd, std::vector<unsigned char>& vData, size_t nBytes)
+{
+    vData.clear();
+    while (vData.size() < nBytes) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, 10 * 1000) != 1)
+            return false;
+        unsigned char buf[65536];
+        ssize_t nRead = recv(fd, buf, std::min(sizeof(buf), nBytes - vData.size()), 0);
+        if (nRead <= 0)
+            return false;
+        vData.insert(vData.end(), buf, buf + nRead);
+    }
+    return true;
+}
+
+// Run the socket handler with backend against a peer connected through a
+// socketpair: it must read a message from the peer, finish a send that does
+// not fit into the socket buffer, and disconnect the peer once it hangs up.
+static void TestSocketHandler(CConnman* connman, PeerLogicValidation* peerLogic, SocketBackend backend)
+{
+    CConnman::Options options;
+    options.nMaxConnections = 125;
+    options.m_msgproc = peerLogic;
+    options.m_socket_backend = backend;
+    options.nSendBufferMaxSize = 1000 * DEFAULT_MAXSENDBUFFER;
+    options.nReceiveFloodSize = 1000 * DEFAULT_MAXRECEIVEBUFFER;
+    connman->Init(options);
+
+    int fds[2];
+    BOOST_REQUIRE_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    BOOST_REQUIRE(SetSocketNonBlocking(fds[0], true));
+
+    CConnmanTest::StartSocketHandler();
+    BOOST_CHECK(connman->GetSocketBackend() == backend);
+
+    in_addr ipv4Addr;
+    ipv4Addr.s_addr = 0xa0b0c001;
+    CAddress addr = CAddress(CService(ipv4Addr, 7777), NODE_NETWORK);
+    CNode* pnode = new CNode(0, NODE_NETWORK, 0, fds[0], addr, 0, 0, CAddress(), "", true);
+    pnode->AddRef();
+    peerLogic->InitializeNode(pnode);
+    CConnmanTest::AddNode(*pnode);
+
+    // A message written by the peer is queued for processing
+    CSerializedNetMsg ping = CNetMsgMaker(INIT_PROTO_VERSION).Make(NetMsgType::PING, (uint64_t)0x1337);
+    CMessageHeader hdr(Params().MessageStart(), ping.command.c_str(), ping.data.size());
+    uint256 hash = Hash(ping.data.begin(), ping.data.end());
+    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    std::vector<unsigned char> vWrite;
+    CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, vWrite, 0, hdr};
+    vWrite.insert(vWrite.end(), ping.data.begin(), ping.data.end());
+    BOOST_REQUIRE_EQUAL(send(fds[1], vWrite.data(), vWrite.size(), 0), (ssize_t)vWrite.size());
+
+    BOOST_CHECK(WaitFor([pnode] {
+        LOCK(pnode->cs_vProcessMsg);
+        return !pnode->vProcessMsg.empty();
+    }));
+    {
+        LOCK(pnode->cs_vProcessMsg);
+        BOOST_REQUIRE_EQUAL(pnode->vProcessMsg.size(), 1U);
+        BOOST_CHECK_EQUAL(pnode->vProcessMsg.front().hdr.GetCommand(), NetMsgType::PING);
+        BOOST_CHECK_EQUAL(pnode->vProcessMsg.front().vRecv.size(), ping.data.size());
+    }
+
+    // The optimistic send only gets part of a large message into the socket
+    // buffer, the socket handler has to send the rest
+    CSerializedNetMsg block;
+    block.command = NetMsgType::BLOCK;
+    block.data.resize(4 * 1000 * 1000);
+    for (size_t i = 0; i < block.data.size(); i++)
+        block.data[i] = i & 0xff;
+    std::vector<unsigned char> vExpected = block.data;
+    connman->PushMessage(pnode, std::move(block));
+
+    std::vector<unsigned char> vRead;
+    BOOST_REQUIRE(ReadFromSocket(fds[1], vRead, CMessageHeader::HEADER_SIZE + vExpected.size()));
+    BOOST_CHECK(std::equal(vExpected.begin(), vExpected.end(), vRead.begin() + CMessageHeader::HEADER_SIZE));
+    BOOST_CHECK(WaitFor([pnode] {
+        LOCK(pnode->cs_vSend);
+        return pnode->vSendMsg.empty();
+    }));
+
+    // The peer hanging up gets the node disconnected and deleted
+    close(fds[1]);
+    BOOST_CHECK(WaitFor([connman] { return connman->GetNodeCount(CConnman::CONNECTIONS_ALL) == 0; }));
+
+    CConnmanTest::StopSocketHandler();
+    BOOST_CHECK(connman->GetSocketBackend() == SocketBackend::SELECT);
+}
+
+BOOST_FIXTURE_TEST_CASE(sockethandler_select, TestingSetup)
+{
+    TestSocketHandler(connman, peerLogic.get(), SocketBackend::SELECT);
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+BOOST_FIXTURE_TEST_CASE(sockethandler_epoll, TestingSetup)
+{
+    TestSocketHandler(connman, peerLogic.get(), SocketBackend::EPOLL);
+}
+#endif
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
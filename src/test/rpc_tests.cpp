@@ -4,13 +4,21 @@
 
 #include <rpc/server.h>
 #include <rpc/client.h>
+#include <rpc/blockchain.h>
 
 #include <base58.h>
 #include <core_io.h>
 #include <netbase.h>
+#include <random.h>
+#include <script/interpreter.h>
+#include <sidechaindb.h>
+#include <txdb.h>
+#include <validation.h>
 
 #include <test/test_drivenet.h>
 
+#include <thread>
+
 #include <boost/algorithm/string.hpp>
 #include <boost/test/unit_test.hpp>
 
@@ -82,6 +90,121 @@ BOOST_AUTO_TEST_CASE(rpc_rawparams)
     BOOST_CHECK_THROW(CallRPC("sendrawtransaction null"), std::runtime_error);
     BOOST_CHECK_THROW(CallRPC("sendrawtransaction DEADBEEF"), std::runtime_error);
     BOOST_CHECK_THROW(CallRPC(std::string("sendrawtransaction ")+rawtx+" extra"), std::runtime_error);
+
+    BOOST_CHECK_THROW(CallRPC("sendrawtransactions"), std::runtime_error);
+    BOOST_CHECK_THROW(CallRPC("sendrawtransactions null"), std::runtime_error);
+    BOOST_CHECK_THROW(CallRPC(std::string("sendrawtransactions ")+rawtx), std::runtime_error);
+    BOOST_CHECK_NO_THROW(r = CallRPC("sendrawtransactions []"));
+    BOOST_CHECK_EQUAL(r.size(), 0U);
+    BOOST_CHECK_NO_THROW(r = CallRPC(std::string("sendrawtransactions [\"DEADBEEF\",\"")+rawtx+"\"]"));
+    BOOST_CHECK_EQUAL(r.size(), 2U);
+    BOOST_CHECK(find_value(r[0].get_obj(), "txid").isNull());
+    BOOST_CHECK_EQUAL(find_value(r[0].get_obj(), "error").get_str(), "TX decode failed");
+    BOOST_CHECK_EQUAL(find_value(r[1].get_obj(), "txid").get_str(), "a6eab3c14ab5272a58a5ba91505ba1a4b6d7a3a9fcbd187b6cd99a7b6d548cb7");
+    BOOST_CHECK_EQUAL(find_value(r[1].get_obj(), "accepted").get_bool(), false);
+    BOOST_CHECK_EQUAL(find_value(r[1].get_obj(), "error").get_str(), "Missing inputs");
+}
+
+static void SignTestInput(CMutableTransaction& mtx, unsigned int nIn, const CKey& key, const CScript& scriptCode, bool fPushPubKey)
+{
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptCode, mtx, nIn, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    mtx.vin[nIn].scriptSig = CScript() << vchSig;
+    if (fPushPubKey)
+        mtx.vin[nIn].scriptSig << ToByteVector(key.GetPubKey());
+}
+
+BOOST_FIXTURE_TEST_CASE(rpc_sendrawtransactions_chains, TestChain100Setup)
+{
+    // Children given before their parents, and a deposit spending the CTIP
+    // of an earlier deposit of the batch, are all accepted
+    CKey keySidechain;
+    keySidechain.MakeNewKey(true);
+    Sidechain proposal;
+    proposal.nSidechain = 0;
+    proposal.title = "Test";
+    proposal.description = "Description";
+    proposal.strKeyID = HexStr(keySidechain.GetPubKey().GetID());
+    proposal.scriptPubKey = GetScriptForDestination(keySidechain.GetPubKey().GetID());
+    BOOST_CHECK(ActivateSidechain(scdb, proposal, 0));
+
+    const CScript scriptCoinbase = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    const std::string strDest = "sidechaindestination";
+    const CScript scriptDest = CScript() << OP_RETURN << std::vector<unsigned char>(strDest.begin(), strDest.end());
+    const CAmount nFee = CENT / 10;
+
+    // Only the first coinbase is mature, the parent funds everything else
+    CMutableTransaction parent;
+    parent.vin.emplace_back(COutPoint(coinbaseTxns[0].GetHash(), 0));
+    for (int i = 0; i < 3; i++)
+        parent.vout.emplace_back(10 * COIN, scriptCoinbase);
+    parent.vout.emplace_back(coinbaseTxns[0].vout[0].nValue - 30 * COIN - nFee, scriptCoinbase);
+    SignTestInput(parent, 0, coinbaseKey, scriptCoinbase, false);
+
+    CMutableTransaction child;
+    child.vin.emplace_back(COutPoint(parent.GetHash(), 0));
+    child.vout.emplace_back(10 * COIN - nFee, scriptCoinbase);
+    SignTestInput(child, 0, coinbaseKey, scriptCoinbase, false);
+
+    CMutableTransaction deposit1;
+    deposit1.vin.emplace_back(COutPoint(parent.GetHash(), 1));
+    deposit1.vout.emplace_back(COIN, proposal.scriptPubKey);
+    deposit1.vout.emplace_back(0, scriptDest);
+    deposit1.vout.emplace_back(9 * COIN - nFee, scriptCoinbase);
+    SignTestInput(deposit1, 0, coinbaseKey, scriptCoinbase, false);
+
+    CMutableTransaction deposit2;
+    deposit2.vin.emplace_back(COutPoint(deposit1.GetHash(), 0));
+    deposit2.vin.emplace_back(COutPoint(parent.GetHash(), 2));
+    deposit2.vout.emplace_back(2 * COIN, proposal.scriptPubKey);
+    deposit2.vout.emplace_back(0, scriptDest);
+    deposit2.vout.emplace_back(9 * COIN - nFee, scriptCoinbase);
+    SignTestInput(deposit2, 0, keySidechain, proposal.scriptPubKey, true);
+    SignTestInput(deposit2, 1, coinbaseKey, scriptCoinbase, false);
+
+    const std::vector<CMutableTransaction> vtx{child, deposit2, parent, deposit1};
+    std::string strHex;
+    for (const CMutableTransaction& mtx : vtx)
+        strHex += std::string(strHex.empty() ? "" : ",") + "\"" + EncodeHexTx(mtx) + "\"";
+
+    UniValue r;
+    BOOST_CHECK_NO_THROW(r = CallRPC("sendrawtransactions [" + strHex + "]"));
+    BOOST_CHECK_EQUAL(r.size(), vtx.size());
+    for (size_t i = 0; i < vtx.size() && i < r.size(); i++) {
+        BOOST_CHECK_EQUAL(find_value(r[i].get_obj(), "txid").get_str(), vtx[i].GetHash().GetHex());
+        BOOST_CHECK(find_value(r[i].get_obj(), "accepted").get_bool());
+        BOOST_CHECK(find_value(r[i].get_obj(), "error").isNull());
+    }
+    BOOST_CHECK_EQUAL(mempool.size(), vtx.size());
+
+    mempool.clear();
+    mempool.UpdateCTIPFromMempool(std::map<uint8_t, SidechainCTIP>());
+    scdb.Reset();
+}
+
+BOOST_FIXTURE_TEST_CASE(rpc_utxostats_ranges, TestChain100Setup)
+{
+    // Splitting the UTXO set into ranges gives the same stats as one range
+    FlushStateToDisk();
+    for (CoinStatsHashType hashType : {CoinStatsHashType::MUHASH, CoinStatsHashType::NONE}) {
+        CCoinsStats stats1;
+        stats1.hashType = hashType;
+        BOOST_CHECK(GetUTXOStats(pcoinsdbview.get(), stats1, 1));
+        BOOST_CHECK(stats1.nTransactionOutputs >= 100U);
+        for (int nRanges : {2, 7, 256}) {
+            CCoinsStats stats;
+            stats.hashType = hashType;
+            BOOST_CHECK(GetUTXOStats(pcoinsdbview.get(), stats, nRanges));
+            BOOST_CHECK(stats.hashBlock == stats1.hashBlock);
+            BOOST_CHECK(stats.hashSerialized == stats1.hashSerialized);
+            BOOST_CHECK_EQUAL(stats.nTransactions, stats1.nTransactions);
+            BOOST_CHECK_EQUAL(stats.nTransactionOutputs, stats1.nTransactionOutputs);
+            BOOST_CHECK_EQUAL(stats.nBogoSize, stats1.nBogoSize);
+            BOOST_CHECK_EQUAL(stats.nTotalAmount, stats1.nTotalAmount);
+        }
+    }
 }
 
 BOOST_AUTO_TEST_CASE(rpc_togglenetwork)
@@ -345,4 +468,197 @@ BOOST_AUTO_TEST_CASE(rpc_convert_values_generatetoaddress)
     BOOST_CHECK_EQUAL(result[2].get_int(), 9);
 }
 
+BOOST_AUTO_TEST_CASE(rpc_batch_order)
+{
+    // Runs of read-only calls are executed concurrently, the replies must
+    // still come back in request order
+    SetRPCWarmupFinished();
+
+    UniValue vReq(UniValue::VARR);
+    for (int i = 0; i < 20; i++) {
+        UniValue req(UniValue::VOBJ);
+        req.pushKV("id", i);
+        if (i == 7) {
+            req.pushKV("method", "nosuchmethod");
+        } else if (i == 13) {
+            req.pushKV("method", "getblockcount");
+        } else {
+            req.pushKV("method", "echo");
+            UniValue params(UniValue::VARR);
+            params.push_back(i);
+            req.pushKV("params", params);
+        }
+        vReq.push_back(req);
+    }
+
+    JSONRPCRequest jreq;
+    UniValue ret;
+    BOOST_CHECK(ret.read(JSONRPCExecBatch(jreq, vReq)));
+    BOOST_CHECK(ret.isArray());
+    BOOST_CHECK_EQUAL(ret.size(), vReq.size());
+    for (int i = 0; i < 20; i++) {
+        const UniValue& reply = ret[i];
+        BOOST_CHECK_EQUAL(find_value(reply, "id").get_int(), i);
+        if (i == 7) {
+            BOOST_CHECK_EQUAL(find_value(find_value(reply, "error"), "code").get_int(), RPC_METHOD_NOT_FOUND);
+        } else if (i == 13) {
+            BOOST_CHECK_EQUAL(find_value(reply, "result").get_int(), 0);
+        } else {
+            BOOST_CHECK_EQUAL(find_value(reply, "result")[0].get_int(), i);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(rpc_stream_writer)
+{
+    UniValue value;
+    BOOST_CHECK(value.read("{\"a\":[1,2,{\"b\":null,\"c\":\"x\\\"y\"}],\"d\":{},\"e\":[],\"f\":[[true],false]}"));
+
+    // A small flush size hands out many chunks, together they are the value
+    std::string strOut;
+    int nChunks = 0;
+    JSONStreamWriter writer([&](const std::string& strChunk) {
+        strOut += strChunk;
+        nChunks++;
+    }, 4);
+    writer.Value(value);
+    BOOST_CHECK(writer.HasFlushed());
+    BOOST_CHECK(nChunks > 1);
+    strOut += writer.ReleaseBuffer();
+    BOOST_CHECK_EQUAL(strOut, value.write());
+
+    // Results written by methods match the returned ones
+    for (const std::string& strMethod : {"getblock", "getrawmempool"}) {
+        JSONRPCRequest request;
+        request.strMethod = strMethod;
+        request.params = UniValue(UniValue::VARR);
+        if (strMethod == "getblock") {
+            request.params.push_back(chainActive.Tip()->GetBlockHash().GetHex());
+            request.params.push_back(2);
+        } else {
+            request.params.push_back(UniValue(true));
+        }
+        UniValue result = tableRPC[strMethod]->actor(request);
+
+        std::string strStreamed;
+        JSONStreamWriter resultWriter([&](const std::string& strChunk) {
+            strStreamed += strChunk;
+        }, 16);
+        request.pResultWriter = &resultWriter;
+        BOOST_CHECK(tableRPC[strMethod]->actor(request).isNull());
+        strStreamed += resultWriter.ReleaseBuffer();
+        BOOST_CHECK_EQUAL(strStreamed, result.write());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(rpc_stream_listwtprimestatus)
+{
+    Sidechain proposal;
+    proposal.nSidechain = 0;
+    proposal.title = "Test";
+    proposal.description = "Description";
+    BOOST_CHECK(ActivateSidechain(scdb, proposal, 0, true));
+    for (int i = 0; i < 3; i++) {
+        SidechainWTPrimeState wt;
+        wt.hashWTPrime = GetRandHash();
+        wt.nBlocksLeft = SIDECHAIN_VERIFICATION_PERIOD - 1;
+        wt.nSidechain = 0;
+        wt.nWorkScore = 1;
+        BOOST_CHECK(scdb.UpdateSCDBIndex(std::vector<SidechainWTPrimeState>{wt}));
+    }
+    {
+        LOCK(cs_main);
+        PublishChainSnapshot();
+    }
+
+    JSONRPCRequest request;
+    request.strMethod = "listwtprimestatus";
+    request.params = UniValue(UniValue::VARR);
+    request.params.push_back(0);
+    UniValue result = tableRPC[request.strMethod]->actor(request);
+    BOOST_CHECK_EQUAL(result.size(), 3U);
+
+    std::string strStreamed;
+    JSONStreamWriter resultWriter([&](const std::string& strChunk) {
+        strStreamed += strChunk;
+    }, 16);
+    request.pResultWriter = &resultWriter;
+    BOOST_CHECK(tableRPC[request.strMethod]->actor(request).isNull());
+    strStreamed += resultWriter.ReleaseBuffer();
+    BOOST_CHECK_EQUAL(strStreamed, result.write());
+
+    scdb.Reset();
+    {
+        LOCK(cs_main);
+        PublishChainSnapshot();
+    }
+}
+
+BOOST_AUTO_TEST_CASE(rpc_wait_sidechain)
+{
+    // Wait RPCs report the state they stopped at when nothing happens in time
+    UniValue r;
+    std::string strTip = chainActive.Tip()->GetBlockHash().GetHex();
+    BOOST_CHECK_NO_THROW(r = CallRPC("waitforbmm " + GetRandHash().GetHex() + " " + strTip + " 10"));
+    BOOST_CHECK_EQUAL(find_value(r.get_obj(), "found").get_bool(), false);
+    BOOST_CHECK_EQUAL(find_value(r.get_obj(), "blockhash").get_str(), strTip);
+    BOOST_CHECK_EQUAL(find_value(r.get_obj(), "height").get_int(), chainActive.Height());
+
+    BOOST_CHECK_THROW(CallRPC("waitforbmm " + GetRandHash().GetHex() + " " + GetRandHash().GetHex() + " 10"), std::runtime_error);
+    BOOST_CHECK_THROW(CallRPC("waitforbmm " + GetRandHash().GetHex() + " " + strTip + " -1"), std::runtime_error);
+    BOOST_CHECK_THROW(CallRPC("waitfordeposit 200"), std::runtime_error);
+    BOOST_CHECK_THROW(CallRPC("waitforwtprimestatus 200 " + GetRandHash().GetHex()), std::runtime_error);
+}
+
+BOOST_FIXTURE_TEST_CASE(rpc_invalidateblock_blockcount, TestChain100Setup)
+{
+    // RPCs reading the chain snapshot see the tip move back and forth
+    const int nHeight = chainActive.Height();
+    const std::string strTip = chainActive.Tip()->GetBlockHash().GetHex();
+    BOOST_CHECK_NO_THROW(CallRPC("invalidateblock " + strTip));
+    BOOST_CHECK_EQUAL(CallRPC("getblockcount").get_int(), nHeight - 1);
+    BOOST_CHECK_EQUAL(CallRPC("getbestblockhash").get_str(), chainActive.Tip()->GetBlockHash().GetHex());
+
+    BOOST_CHECK_NO_THROW(CallRPC("reconsiderblock " + strTip));
+    BOOST_CHECK_EQUAL(CallRPC("getblockcount").get_int(), nHeight);
+    BOOST_CHECK_EQUAL(CallRPC("getbestblockhash").get_str(), strTip);
+}
+
+BOOST_FIXTURE_TEST_CASE(rpc_wait_sidechain_found, TestChain100Setup)
+{
+    // A waiting waitforbmm returns the block committing to h* once it is
+    // connected. Waits only block while RPC is running.
+    StartRPC();
+    const uint256 hashBMM = GetRandHash();
+    const std::string strStart = chainActive.Tip()->GetBlockHash().GetHex();
+    UniValue r;
+    std::thread waiter([&] {
+        r = CallRPC("waitforbmm " + hashBMM.GetHex() + " " + strStart + " 60000");
+    });
+
+    CScript scriptCommit;
+    scriptCommit.resize(37);
+    scriptCommit[0] = OP_RETURN;
+    scriptCommit[1] = 0xD1;
+    scriptCommit[2] = 0x61;
+    scriptCommit[3] = 0x73;
+    scriptCommit[4] = 0x68;
+    memcpy(&scriptCommit[5], hashBMM.begin(), 32);
+    CBlock block = CreateAndProcessBlock({}, scriptCommit);
+    waiter.join();
+
+    BOOST_CHECK_EQUAL(find_value(r.get_obj(), "found").get_bool(), true);
+    BOOST_CHECK_EQUAL(find_value(r.get_obj(), "blockhash").get_str(), block.GetHash().GetHex());
+    BOOST_CHECK_EQUAL(find_value(r.get_obj(), "height").get_int(), chainActive.Height());
+    BOOST_CHECK_EQUAL(find_value(r.get_obj(), "txid").get_str(), block.vtx[0]->GetHash().GetHex());
+    BOOST_CHECK_EQUAL(find_value(r.get_obj(), "time").get_int64(), block.GetBlockTime());
+
+    // Once the block is invalidated h* is not in the active chain anymore
+    BOOST_CHECK_NO_THROW(CallRPC("invalidateblock " + block.GetHash().GetHex()));
+    BOOST_CHECK_NO_THROW(r = CallRPC("waitforbmm " + hashBMM.GetHex() + " " + strStart + " 10"));
+    BOOST_CHECK_EQUAL(find_value(r.get_obj(), "found").get_bool(), false);
+    BOOST_CHECK_EQUAL(find_value(r.get_obj(), "blockhash").get_str(), strStart);
+    InterruptRPC();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
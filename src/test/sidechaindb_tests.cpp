@@ -2,6 +2,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "arith_uint256.h"
 #include "chainparams.h"
 #include "consensus/validation.h"
 #include "core_io.h"
@@ -12,12 +13,15 @@
 #include "script/sigcache.h"
 #include "sidechain.h"
 #include "sidechaindb.h"
+#include "sidechainevents.h"
 #include "uint256.h"
 #include "utilstrencodings.h"
 #include "validation.h"
 
 #include "test/test_drivenet.h"
 
+#include <thread>
+
 #include <boost/test/unit_test.hpp>
 
 CScript EncodeWTFees(const CAmount& amount)
@@ -80,6 +84,59 @@ BOOST_AUTO_TEST_CASE(sidechaindb_wtprime)
     BOOST_CHECK(scdbTest.CheckWorkScore(0, hashWTTest));
 }
 
+BOOST_AUTO_TEST_CASE(sidechaindb_snapshot)
+{
+    // A snapshot keeps the state it was taken from after SCDB moves on
+    SidechainDB scdbTest;
+
+    BOOST_CHECK(ActivateTestSidechain(scdbTest));
+
+    uint256 hashWTTest = GetRandHash();
+
+    SidechainWTPrimeState wtTest;
+    wtTest.hashWTPrime = hashWTTest;
+    wtTest.nBlocksLeft = SIDECHAIN_VERIFICATION_PERIOD - 1;
+    wtTest.nSidechain = 0;
+    wtTest.nWorkScore = 1;
+    BOOST_CHECK(scdbTest.UpdateSCDBIndex(std::vector<SidechainWTPrimeState>{wtTest}));
+
+    std::shared_ptr<const SCDBSnapshot> snapshot = scdbTest.GetSnapshot();
+    BOOST_CHECK(snapshot->hashSCDB == scdbTest.GetSCDBHash());
+    BOOST_CHECK(snapshot->IsSidechainActive(0));
+    BOOST_CHECK(!snapshot->IsSidechainActive(1));
+    BOOST_CHECK_EQUAL(snapshot->GetActiveSidechains().size(), 1);
+    BOOST_CHECK_EQUAL(snapshot->GetState(0).size(), 1);
+
+    wtTest.nWorkScore = 2;
+    BOOST_CHECK(scdbTest.UpdateSCDBIndex(std::vector<SidechainWTPrimeState>{wtTest}));
+
+    BOOST_CHECK(snapshot->hashSCDB != scdbTest.GetSCDBHash());
+    BOOST_CHECK_EQUAL(snapshot->GetState(0).front().nWorkScore, 1);
+    BOOST_CHECK_EQUAL(scdbTest.GetSnapshot()->GetState(0).front().nWorkScore, 2);
+}
+
+BOOST_AUTO_TEST_CASE(sidechaindb_snapshot_wait)
+{
+    // Waiting for a new chain snapshot times out without one and wakes up
+    // when one is published
+    std::shared_ptr<const ChainSnapshot> snapshot = GetChainSnapshot();
+    BOOST_CHECK(WaitForChainSnapshot(snapshot, 1) == snapshot);
+
+    std::shared_ptr<const ChainSnapshot> snapshotNew;
+    std::thread waiter([&snapshot, &snapshotNew] {
+        snapshotNew = WaitForChainSnapshot(snapshot, 0);
+    });
+    {
+        LOCK(cs_main);
+        PublishChainSnapshot();
+    }
+    waiter.join();
+
+    BOOST_CHECK(snapshotNew != snapshot);
+    BOOST_CHECK(snapshotNew == GetChainSnapshot());
+    BOOST_CHECK(snapshotNew->pindexTip == snapshot->pindexTip);
+}
+
 BOOST_AUTO_TEST_CASE(sidechaindb_MultipleWTPrimes_one_expires)
 {
     // Test multiple verification periods, approve multiple WT^s on the
@@ -408,6 +465,104 @@ BOOST_AUTO_TEST_CASE(sidechaindb_wallet_ctip_multi_deposits)
     BOOST_CHECK(scdbTest.GetCTIP(0, ctip2));
     BOOST_CHECK(ctip2.out.hash == mtx2.GetHash());
     BOOST_CHECK(ctip2.out.n == 1);
+
+    // Page through the deposits with the last known deposit as cursor
+    BOOST_CHECK(scdbTest.GetDepositsAfter(0, COutPoint(), 1, vDeposit));
+    BOOST_CHECK(vDeposit.size() == 1 && vDeposit.front().tx == mtx);
+    BOOST_CHECK(scdbTest.GetDepositsAfter(0, COutPoint(mtx.GetHash(), 1), 10, vDeposit));
+    BOOST_CHECK(vDeposit.size() == 1 && vDeposit.front().tx == mtx2);
+    BOOST_CHECK(scdbTest.GetDepositsAfter(0, COutPoint(mtx2.GetHash(), 1), 10, vDeposit));
+    BOOST_CHECK(vDeposit.empty());
+
+    // Unknown cursor
+    BOOST_CHECK(!scdbTest.GetDepositsAfter(0, COutPoint(mtx2.GetHash(), 0), 10, vDeposit));
+}
+
+BOOST_AUTO_TEST_CASE(sidechaindb_undo_deposits)
+{
+    // Undo the deposits of the last block and check that the deposits which
+    // remain are still in CTIP spend order without sorting them again, and
+    // match SCDB state that never saw the disconnected block.
+    SidechainDB scdbTest;
+    SidechainDB scdbExpected;
+
+    BOOST_CHECK(ActivateTestSidechain(scdbTest));
+    BOOST_CHECK(ActivateTestSidechain(scdbExpected));
+
+    CScript sidechainScript;
+    BOOST_CHECK(scdbTest.GetSidechainScript(0, sidechainScript));
+
+    // A chain of deposits where each one spends the CTIP of the one before,
+    // the first two in block A and the last two in block B.
+    const uint256 hashBlockA = GetRandHash();
+    const uint256 hashBlockB = GetRandHash();
+    std::vector<SidechainDeposit> vDeposit;
+    COutPoint prevCTIP;
+    for (int i = 0; i < 4; i++) {
+        CMutableTransaction mtx;
+        mtx.vin.resize(1);
+        if (i == 0)
+            mtx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        else
+            mtx.vin[0].prevout = prevCTIP;
+        mtx.vout.push_back(CTxOut(CAmount(0), CScript() << OP_RETURN << ParseHex("ff")));
+        mtx.vout.push_back(CTxOut((i + 1) * CENT, sidechainScript));
+
+        SidechainDeposit deposit;
+        deposit.nSidechain = 0;
+        deposit.strDest = "ff";
+        deposit.tx = mtx;
+        deposit.nBurnIndex = 1;
+        deposit.nTx = 1 + (i % 2);
+        deposit.hashBlock = i < 2 ? hashBlockA : hashBlockB;
+        vDeposit.push_back(deposit);
+
+        prevCTIP = COutPoint(mtx.GetHash(), 1);
+    }
+
+    // Add block A then block B, giving each block's deposits out of order
+    scdbTest.AddDeposits(std::vector<SidechainDeposit>{ vDeposit[1], vDeposit[0] });
+    scdbTest.AddDeposits(std::vector<SidechainDeposit>{ vDeposit[3], vDeposit[2] });
+    scdbExpected.AddDeposits(std::vector<SidechainDeposit>{ vDeposit[1], vDeposit[0] });
+
+    std::vector<CTransactionRef> vtxB;
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vout.push_back(CTxOut(50 * CENT, CScript() << OP_TRUE));
+    vtxB.push_back(MakeTransactionRef(coinbase));
+    vtxB.push_back(MakeTransactionRef(vDeposit[2].tx));
+    vtxB.push_back(MakeTransactionRef(vDeposit[3].tx));
+
+    BOOST_CHECK(scdbTest.Undo(1, hashBlockB, hashBlockA, vtxB));
+
+    std::vector<SidechainDeposit> vRemaining = scdbTest.GetDeposits(0);
+    BOOST_CHECK(vRemaining.size() == 2);
+    BOOST_CHECK(vRemaining[0].tx == vDeposit[0].tx);
+    BOOST_CHECK(vRemaining[1].tx == vDeposit[1].tx);
+
+    std::vector<SidechainDeposit> vSorted;
+    BOOST_CHECK(SortDeposits(vRemaining, vSorted));
+    BOOST_CHECK(vSorted.size() == vRemaining.size());
+    for (size_t i = 0; i < vSorted.size() && i < vRemaining.size(); i++)
+        BOOST_CHECK(vSorted[i].tx == vRemaining[i].tx);
+
+    std::vector<SidechainDeposit> vExpected = scdbExpected.GetDeposits(0);
+    BOOST_CHECK(vExpected.size() == vRemaining.size());
+    for (size_t i = 0; i < vExpected.size() && i < vRemaining.size(); i++)
+        BOOST_CHECK(vExpected[i].tx == vRemaining[i].tx);
+
+    SidechainCTIP ctip;
+    SidechainCTIP ctipExpected;
+    BOOST_CHECK(scdbTest.GetCTIP(0, ctip));
+    BOOST_CHECK(scdbExpected.GetCTIP(0, ctipExpected));
+    BOOST_CHECK(ctip.out == ctipExpected.out);
+    BOOST_CHECK(ctip.out == COutPoint(vDeposit[1].tx.GetHash(), 1));
+    BOOST_CHECK(ctip.amount == ctipExpected.amount);
+
+    BOOST_CHECK(!scdbTest.HaveDepositCached(vDeposit[2].tx.GetHash()));
+    BOOST_CHECK(!scdbTest.HaveDepositCached(vDeposit[3].tx.GetHash()));
+    BOOST_CHECK(scdbTest.HaveDepositCached(vDeposit[1].tx.GetHash()));
+    BOOST_CHECK(scdbTest.GetHashBlockLastSeen() == hashBlockA);
 }
 
 BOOST_AUTO_TEST_CASE(sidechaindb_wallet_ctip_multi_deposits_multi_sidechain)
@@ -1678,4 +1833,192 @@ BOOST_AUTO_TEST_CASE(txn_to_deposit)
     BOOST_CHECK(scdbTest.TxnToDeposit(mtx, 0, {}, deposit));
 }
 
+BOOST_AUTO_TEST_CASE(sidechaindb_bwt_hash)
+{
+    // The cached B-WT^ hash and blind value out must match the original
+    // definition: inputs replaced by a single OP_0 input and the sidechain
+    // change output removed.
+    CMutableTransaction wmtx;
+    wmtx.vin.push_back(CTxIn(GetRandHash(), 1));
+    wmtx.vin.push_back(CTxIn(GetRandHash(), 0));
+    wmtx.vin[0].scriptSig = CScript() << OP_TRUE;
+    wmtx.vout.push_back(CTxOut(CAmount(0), CScript() << OP_RETURN << ParseHex(HexStr(SIDECHAIN_WTPRIME_RETURN_DEST) )));
+    wmtx.vout.push_back(CTxOut(CAmount(0), EncodeWTFees(1 * CENT)));
+    for (int i = 0; i < 10; i++)
+        wmtx.vout.push_back(CTxOut((i + 1) * CENT, CScript() << OP_TRUE));
+    wmtx.vout.push_back(CTxOut(24 * CENT, CScript() << OP_DROP));
+
+    for (int32_t nVersion : {2, 3, 4}) {
+        wmtx.nVersion = nVersion;
+        CTransaction tx(wmtx);
+
+        CMutableTransaction blind(wmtx);
+        blind.vin.clear();
+        blind.vin.resize(1);
+        blind.vin[0].scriptSig = CScript() << OP_0;
+        blind.vout.pop_back();
+
+        uint256 hashBlind;
+        BOOST_CHECK(tx.GetBWTHash(hashBlind));
+        BOOST_CHECK(hashBlind == blind.GetHash());
+        CAmount amountBlind = 0;
+        BOOST_CHECK(tx.GetBlindValueOut(amountBlind));
+        BOOST_CHECK(amountBlind == CTransaction(blind).GetValueOut());
+
+        // Cached values are returned again and survive a copy
+        CTransaction txCopy(tx);
+        uint256 hashCopy;
+        BOOST_CHECK(txCopy.GetBWTHash(hashCopy));
+        BOOST_CHECK(hashCopy == hashBlind);
+        BOOST_CHECK(tx.GetBWTHash(hashCopy));
+        BOOST_CHECK(hashCopy == hashBlind);
+        CAmount amountCopy = 0;
+        BOOST_CHECK(txCopy.GetBlindValueOut(amountCopy));
+        BOOST_CHECK(amountCopy == amountBlind);
+    }
+
+    // Not a WT^
+    uint256 hashBlind;
+    BOOST_CHECK(!CTransaction().GetBWTHash(hashBlind));
+
+    // Output values out of range are reported instead of thrown
+    CMutableTransaction wmtxBad(wmtx);
+    wmtxBad.vout[2].nValue = MAX_MONEY;
+    wmtxBad.vout[3].nValue = MAX_MONEY;
+    CTransaction txBad(wmtxBad);
+    CAmount amountBad = 0;
+    BOOST_CHECK(!txBad.GetBWTHash(hashBlind));
+    BOOST_CHECK(!txBad.GetBlindValueOut(amountBad));
+}
+
+BOOST_AUTO_TEST_CASE(scdb_event_log)
+{
+    // Test the event log ring buffer, including wrapping around
+    SidechainEventLog eventLog;
+    BOOST_CHECK(eventLog.GetEvents().empty());
+
+    const size_t nEvents = SCDB_EVENT_LOG_SIZE + 10;
+    for (size_t i = 0; i < nEvents; i++)
+        eventLog.Record(SCDB_EVENT_VOTE, i % 256, ArithToUint256(arith_uint256(i)), i, i * COIN);
+
+    BOOST_CHECK(eventLog.GetCount() == nEvents);
+
+    std::vector<SidechainEvent> vEvent = eventLog.GetEvents();
+    BOOST_CHECK(vEvent.size() == SCDB_EVENT_LOG_SIZE);
+    for (size_t i = 0; i < vEvent.size(); i++) {
+        const size_t nSequence = nEvents - SCDB_EVENT_LOG_SIZE + i;
+        BOOST_CHECK(vEvent[i].nSequence == nSequence);
+        BOOST_CHECK(vEvent[i].nType == SCDB_EVENT_VOTE);
+        BOOST_CHECK(vEvent[i].nSidechain == nSequence % 256);
+        BOOST_CHECK(vEvent[i].hash == ArithToUint256(arith_uint256(nSequence)));
+        BOOST_CHECK(vEvent[i].n == nSequence);
+        BOOST_CHECK(vEvent[i].amount == (CAmount)nSequence * COIN);
+    }
+
+    vEvent = eventLog.GetEvents(3);
+    BOOST_CHECK(vEvent.size() == 3);
+    BOOST_CHECK(vEvent.back().nSequence == nEvents - 1);
+
+    // Test that SCDB records a deposit and the CTIP moving only when enabled
+    SidechainDB scdbTest;
+    BOOST_CHECK(ActivateTestSidechain(scdbTest, 0));
+
+    CMutableTransaction mtx;
+    mtx.nVersion = 2;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout.SetNull();
+    mtx.vout.push_back(CTxOut(50 * CENT, CScript() << OP_RETURN << ParseHex("ff")));
+    Sidechain sidechain;
+    BOOST_CHECK(scdbTest.GetSidechain(0, sidechain));
+    mtx.vout.push_back(CTxOut(50 * CENT, sidechain.scriptPubKey));
+
+    SidechainDeposit deposit;
+    deposit.nSidechain = 0;
+    deposit.strDest = "ff";
+    deposit.tx = mtx;
+    deposit.nBurnIndex = 1;
+    deposit.nTx = 1;
+
+    const uint64_t nCount = scdbEvents.GetCount();
+    SidechainDB scdbCopy = scdbTest;
+    scdbCopy.AddDeposits(std::vector<SidechainDeposit>{ deposit });
+    BOOST_CHECK(scdbEvents.GetCount() == nCount);
+
+    scdbTest.SetRecordEvents(true);
+    scdbTest.AddDeposits(std::vector<SidechainDeposit>{ deposit });
+    vEvent = scdbEvents.GetEvents(scdbEvents.GetCount() - nCount);
+    BOOST_CHECK(vEvent.size() == 2);
+    BOOST_CHECK(vEvent.front().nType == SCDB_EVENT_DEPOSIT);
+    BOOST_CHECK(vEvent.back().nType == SCDB_EVENT_CTIP);
+    BOOST_CHECK(vEvent.back().hash == mtx.GetHash());
+    BOOST_CHECK(vEvent.back().n == 1);
+    BOOST_CHECK(vEvent.back().amount == 50 * CENT);
+}
+
+BOOST_FIXTURE_TEST_CASE(sidechaindb_resync_after_disconnect, TestChain100Setup)
+{
+    // Disconnecting several blocks at once resyncs SCDB a single time after
+    // the last block is disconnected. The result must match the SCDB state
+    // we had when the chain was last at that height, and a full resync.
+
+    // Propose and ACK a sidechain so that SCDB changes with every block
+    Sidechain proposal;
+    proposal.nSidechain = 0;
+    proposal.nVersion = 0;
+    proposal.title = "Test";
+    proposal.description = "Description";
+    proposal.strKeyID = "58c63096724814c3dcdf088b9bb0dc48e6e1a89c";
+    proposal.strPrivKey = "91jbRcYNm4RpdJy4u99g8KyFTUsWxvXcJcYXYbQp9MU7mX1vg3K";
+    std::vector<unsigned char> vch = ParseHex("76a91458c63096724814c3dcdf088b9bb0dc48e6e1a89c88ac");
+    proposal.scriptPubKey = CScript(vch.begin(), vch.end());
+
+    scdb.CacheSidechainProposals(std::vector<Sidechain>{ proposal });
+    scdb.CacheSidechainHashToAck(proposal.GetHash());
+
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    std::map<int, uint256> mapTotalHash;
+    for (int i = 0; i < 10; i++) {
+        CreateAndProcessBlock(std::vector<CMutableTransaction>{}, scriptPubKey);
+        LOCK(cs_main);
+        mapTotalHash[chainActive.Height()] = scdb.GetTotalSCDBHash();
+    }
+    BOOST_CHECK(!scdb.GetSidechainActivationStatus().empty());
+
+    int nTip;
+    CBlockIndex* pindexInvalid;
+    {
+        LOCK(cs_main);
+        nTip = chainActive.Height();
+        pindexInvalid = chainActive[nTip - 4];
+    }
+
+    // Disconnect the last five blocks
+    CValidationState state;
+    BOOST_CHECK(InvalidateBlock(state, Params(), pindexInvalid));
+    BOOST_CHECK(ActivateBestChain(state, Params()));
+    {
+        LOCK(cs_main);
+        BOOST_CHECK_EQUAL(chainActive.Height(), nTip - 5);
+        BOOST_CHECK(scdb.GetHashBlockLastSeen() == chainActive.Tip()->GetBlockHash());
+        BOOST_CHECK(scdb.GetTotalSCDBHash() == mapTotalHash[nTip - 5]);
+
+        // Same result as a full resync from the sidechain tree
+        BOOST_CHECK(ResyncSCDB(chainActive.Tip()));
+        BOOST_CHECK(scdb.GetTotalSCDBHash() == mapTotalHash[nTip - 5]);
+    }
+
+    // Reconnect them
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(ResetBlockFailureFlags(pindexInvalid));
+    }
+    BOOST_CHECK(ActivateBestChain(state, Params()));
+    {
+        LOCK(cs_main);
+        BOOST_CHECK_EQUAL(chainActive.Height(), nTip);
+        BOOST_CHECK(scdb.GetHashBlockLastSeen() == chainActive.Tip()->GetBlockHash());
+        BOOST_CHECK(scdb.GetTotalSCDBHash() == mapTotalHash[nTip]);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
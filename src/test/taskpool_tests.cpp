@@ -0,0 +1,62 @@
+// Copyright (c) 2026 The DriveNet developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <taskpool.h>
+
+#include <test/test_drivenet.h>
+
+#include <atomic>
+
+#include <boost/thread.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(taskpool_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(taskpool_no_workers)
+{
+    // Without worker threads the caller runs all of its tasks
+    CTaskPool pool;
+    std::vector<int> vResult(100, 0);
+    std::vector<CTaskPool::Task> vTask;
+    for (size_t i = 0; i < vResult.size(); i++)
+        vTask.emplace_back([&vResult, i] { vResult[i] = i + 1; });
+    pool.Run(vTask);
+    BOOST_CHECK(vTask.empty());
+    for (size_t i = 0; i < vResult.size(); i++)
+        BOOST_CHECK_EQUAL(vResult[i], (int)i + 1);
+}
+
+BOOST_AUTO_TEST_CASE(taskpool_concurrent_callers)
+{
+    // Several callers share the workers, each returns once its own tasks are done
+    CTaskPool pool;
+    boost::thread_group workers;
+    for (int i = 0; i < 3; i++)
+        workers.create_thread([&pool] { pool.Thread(); });
+
+    std::atomic<int> nFailed{0};
+    boost::thread_group callers;
+    for (int c = 0; c < 4; c++) {
+        callers.create_thread([&pool, &nFailed] {
+            for (int nRound = 0; nRound < 50; nRound++) {
+                std::vector<std::atomic<int>> vCount(20);
+                std::vector<CTaskPool::Task> vTask;
+                for (size_t i = 0; i < vCount.size(); i++)
+                    vTask.emplace_back([&vCount, i] { vCount[i]++; });
+                pool.Run(vTask);
+                for (const std::atomic<int>& count : vCount) {
+                    if (count != 1)
+                        nFailed++;
+                }
+            }
+        });
+    }
+    callers.join_all();
+    workers.interrupt_all();
+    workers.join_all();
+
+    BOOST_CHECK_EQUAL(nFailed, 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -26,6 +26,10 @@
 
 void CConnmanTest::AddNode(CNode& node)
 {
+#ifdef HAVE_SYS_EPOLL_H
+    if (g_connman->m_epoll_fd != -1 && node.hSocket != INVALID_SOCKET)
+        g_connman->EpollAddNode(&node);
+#endif
     LOCK(cs_vNodes);
     g_connman->vNodes.push_back(&node);
 }
@@ -36,6 +40,46 @@ void CConnmanTest::ClearNodes()
     g_connman->vNodes.clear();
 }
 
+void CConnmanTest::StartMessageHandlers(int nThreads)
+{
+    g_connman->flagInterruptMsgProc = false;
+    g_connman->nMessageHandlerThreads = nThreads;
+    for (int i = 0; i < nThreads; i++) {
+        g_connman->vThreadMessageHandler.emplace_back(&CConnman::ThreadMessageHandler, g_connman.get(), i);
+    }
+}
+
+void CConnmanTest::StopMessageHandlers()
+{
+    {
+        std::lock_guard<std::mutex> lock(g_connman->mutexMsgProc);
+        g_connman->flagInterruptMsgProc = true;
+    }
+    g_connman->condMsgProc.notify_all();
+    for (std::thread& thread : g_connman->vThreadMessageHandler) {
+        thread.join();
+    }
+    g_connman->vThreadMessageHandler.clear();
+    g_connman->flagInterruptMsgProc = false;
+}
+
+void CConnmanTest::StartSocketHandler()
+{
+    g_connman->interruptNet.reset();
+    g_connman->InitSocketEvents();
+    g_connman->threadSocketHandler = std::thread(&CConnman::ThreadSocketHandler, g_connman.get());
+}
+
+void CConnmanTest::StopSocketHandler()
+{
+    g_connman->interruptNet();
+    g_connman->WakeSocketHandler();
+    g_connman->threadSocketHandler.join();
+#ifdef HAVE_SYS_EPOLL_H
+    g_connman->CloseEpoll();
+#endif
+}
+
 uint256 insecure_rand_seed = GetRandHash();
 FastRandomContext insecure_rand_ctx(insecure_rand_seed);
 
@@ -94,8 +138,10 @@ TestingSetup::TestingSetup(const std::string& chainName) : BasicTestingSetup(cha
             }
         }
         nScriptCheckThreads = 3;
-        for (int i=0; i < nScriptCheckThreads-1; i++)
+        for (int i=0; i < nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadSidechainCheck);
+        }
         g_connman = std::unique_ptr<CConnman>(new CConnman(0x1337, 0x1337)); // Deterministic randomness for tests.
         connman = g_connman.get();
         peerLogic.reset(new PeerLogicValidation(connman, scheduler));
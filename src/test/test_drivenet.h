@@ -53,6 +53,11 @@ class CNode;
 struct CConnmanTest {
     static void AddNode(CNode& node);
     static void ClearNodes();
+    static void StartMessageHandlers(int nThreads);
+    static void StopMessageHandlers();
+    /** Run the socket handler with the backend g_connman was initialized with */
+    static void StartSocketHandler();
+    static void StopSocketHandler();
 };
 
 class PeerLogicValidation;
@@ -6,9 +6,11 @@
 #include "chainparams.h"
 #include "consensus/validation.h"
 #include "core_io.h"
+#include "keystore.h"
 #include "miner.h"
 #include "random.h"
 #include "script/sigcache.h"
+#include "script/sign.h"
 #include "script/standard.h"
 #include "uint256.h"
 #include "utilstrencodings.h"
@@ -190,4 +192,63 @@ BOOST_AUTO_TEST_CASE(criticaldata_invalid_no_commit)
     */
 }
 
+BOOST_AUTO_TEST_CASE(criticaldata_replace_expired)
+{
+    CBasicKeyStore tempKeystore;
+    tempKeystore.AddKey(coinbaseKey);
+
+    // Create a signed critical data transaction for the block after
+    // nLockTime spending the coinbase output of coinbaseTxns[nCoinbase]
+    auto CreateCriticalDataTx = [&](int nCoinbase, const CAmount& nFee, uint32_t nLockTime) {
+        CMutableTransaction mtx;
+        mtx.nVersion = 3;
+        mtx.nLockTime = nLockTime;
+        mtx.criticalData.hashCritical = GetRandHash();
+        mtx.vin.resize(1);
+        mtx.vin[0].prevout = COutPoint(coinbaseTxns[nCoinbase].GetHash(), 0);
+        mtx.vout.resize(1);
+        mtx.vout[0].scriptPubKey = GetScriptForRawPubKey(coinbaseKey.GetPubKey());
+        mtx.vout[0].nValue = coinbaseTxns[nCoinbase].vout[0].nValue - nFee;
+
+        const CTransaction txToSign(mtx);
+        TransactionSignatureCreator creator(&tempKeystore, &txToSign, 0, coinbaseTxns[nCoinbase].vout[0].nValue);
+        SignatureData sigdata;
+        BOOST_CHECK(ProduceSignature(creator, coinbaseTxns[nCoinbase].vout[0].scriptPubKey, sigdata));
+        mtx.vin[0].scriptSig = sigdata.scriptSig;
+        return MakeTransactionRef(mtx);
+    };
+
+    auto Accept = [](const CTransactionRef& tx, CValidationState& state) {
+        LOCK(cs_main);
+        return AcceptToMemoryPool(mempool, state, tx,
+                    nullptr /* pfMissingInputs */, nullptr /* plTxnReplaced */,
+                    false /* bypass_limits */, 0 /* nAbsurdFee */);
+    };
+
+    // Mature another coinbase
+    CreateAndProcessBlock({}, GetScriptForRawPubKey(coinbaseKey.GetPubKey()));
+    const int nHeight = chainActive.Height();
+
+    // The transactions don't signal BIP 125, a conflicting transaction for
+    // the same block is rejected even though it pays more
+    CTransactionRef tx = CreateCriticalDataTx(0, CENT, nHeight);
+    CValidationState state;
+    BOOST_CHECK(Accept(tx, state));
+    BOOST_CHECK(!Accept(CreateCriticalDataTx(0, 2 * CENT, nHeight), state));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "txn-mempool-conflict");
+
+    // A transaction for a block that has already been connected can't be
+    // mined anymore and is replaced without having to pay more
+    CTransactionRef txExpired = CreateCriticalDataTx(1, CENT, nHeight - 1);
+    CValidationState state2;
+    BOOST_CHECK(Accept(txExpired, state2));
+    CTransactionRef txReplacement = CreateCriticalDataTx(1, CENT / 2, nHeight);
+    BOOST_CHECK(Accept(txReplacement, state2));
+    BOOST_CHECK(!mempool.exists(txExpired->GetHash()));
+    BOOST_CHECK(mempool.exists(txReplacement->GetHash()));
+    BOOST_CHECK(mempool.exists(tx->GetHash()));
+
+    mempool.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -11,7 +11,9 @@
 #include <random.h>
 #include <script/standard.h>
 #include <script/sign.h>
+#include <taskpool.h>
 #include <test/test_drivenet.h>
+#include <util.h>
 #include <utiltime.h>
 #include <core_io.h>
 #include <keystore.h>
@@ -368,4 +370,90 @@ BOOST_FIXTURE_TEST_CASE(checkinputs_test, TestChain100Setup)
     }
 }
 
+BOOST_FIXTURE_TEST_CASE(mempool_dump_load, TestChain100Setup)
+{
+    // No worker threads, the checks run on this thread
+    CTaskPool pool;
+    CScript scriptPubKey = CScript() <<  ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    // A spend of a mature coinbase and a child spending it
+    std::vector<CMutableTransaction> spends;
+    spends.resize(2);
+    for (int i = 0; i < 2; i++)
+    {
+        spends[i].nVersion = 1;
+        spends[i].vin.resize(1);
+        spends[i].vin[0].prevout.hash = i == 0 ? coinbaseTxns[0].GetHash() : spends[0].GetHash();
+        spends[i].vin[0].prevout.n = 0;
+        spends[i].vout.resize(1);
+        spends[i].vout[0].nValue = (11 - i) * CENT;
+        spends[i].vout[0].scriptPubKey = scriptPubKey;
+
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, spends[i], 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        spends[i].vin[0].scriptSig << vchSig;
+        BOOST_CHECK(ToMemPool(spends[i]));
+    }
+    BOOST_CHECK_EQUAL(mempool.size(), 2U);
+
+    // Same tip: entries are added back without AcceptToMemoryPool
+    int64_t nFastPath = -1;
+    BOOST_CHECK(DumpMempool());
+    mempool.clear();
+    BOOST_CHECK(LoadMempool(pool, &nFastPath));
+    BOOST_CHECK_EQUAL(nFastPath, 2);
+    BOOST_CHECK_EQUAL(mempool.size(), 2U);
+    BOOST_CHECK(mempool.exists(spends[0].GetHash()));
+    BOOST_CHECK(mempool.exists(spends[1].GetHash()));
+    {
+        LOCK(mempool.cs);
+        CTxMemPool::txiter it = mempool.mapTx.find(spends[1].GetHash());
+        BOOST_CHECK_EQUAL(it->GetCountWithAncestors(), 2U);
+        BOOST_CHECK_EQUAL(it->GetFee(), spends[0].vout[0].nValue - spends[1].vout[0].nValue);
+    }
+
+    // New tip: entries go through full validation again
+    BOOST_CHECK(DumpMempool());
+    mempool.clear();
+    CreateAndProcessBlock({}, scriptPubKey);
+    BOOST_CHECK(LoadMempool(pool, &nFastPath));
+    BOOST_CHECK_EQUAL(nFastPath, 0);
+    BOOST_CHECK_EQUAL(mempool.size(), 2U);
+
+    // A dump in the format without cached results is still loaded
+    {
+        CAutoFile file(fsbridge::fopen(GetDataDir() / "mempool.dat", "wb"), SER_DISK, CLIENT_VERSION);
+        file << (uint64_t)1;
+        file << (uint64_t)spends.size();
+        for (const CMutableTransaction& spend : spends) {
+            file << MakeTransactionRef(spend);
+            file << GetTime();
+            file << (int64_t)0;
+        }
+        file << std::map<uint256, CAmount>();
+    }
+    mempool.clear();
+    BOOST_CHECK(LoadMempool(pool, &nFastPath));
+    BOOST_CHECK_EQUAL(nFastPath, 0);
+    BOOST_CHECK_EQUAL(mempool.size(), 2U);
+    BOOST_CHECK(mempool.exists(spends[0].GetHash()));
+    BOOST_CHECK(mempool.exists(spends[1].GetHash()));
+
+    // A corrupted dump is rejected
+    BOOST_CHECK(DumpMempool());
+    mempool.clear();
+    fs::path path = GetDataDir() / "mempool.dat";
+    std::vector<char> vch(fs::file_size(path));
+    FILE* file = fsbridge::fopen(path, "rb+");
+    BOOST_CHECK_EQUAL(fread(vch.data(), 1, vch.size(), file), vch.size());
+    vch[vch.size() / 2] ^= 1;
+    rewind(file);
+    BOOST_CHECK_EQUAL(fwrite(vch.data(), 1, vch.size(), file), vch.size());
+    fclose(file);
+    BOOST_CHECK(!LoadMempool(pool));
+    BOOST_CHECK_EQUAL(mempool.size(), 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
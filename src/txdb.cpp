@@ -4,6 +4,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <txdb.h>
+#include <blockfilter.h>
 
 #include <chainparams.h>
 #include <hash.h>
@@ -27,6 +28,9 @@ static const char DB_COIN = 'C';
 static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
+static const char DB_BLOCK_STATS = 's';
+static const char DB_BLOCK_STATS_BACKFILLED = 'S';
+static const char DB_BLOCK_FILTER = 'g';
 static const char DB_BLOCK_INDEX = 'b';
 
 static const char DB_BEST_BLOCK = 'B';
@@ -357,12 +361,18 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
 }
 
 CCoinsViewCursor *CCoinsViewDB::Cursor() const
+{
+    return Cursor(uint256());
+}
+
+CCoinsViewCursor *CCoinsViewDB::Cursor(const uint256& hashStart) const
 {
     CCoinsViewDBCursor *i = new CCoinsViewDBCursor(const_cast<CDBWrapper&>(db).NewIterator(), GetBestBlock());
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
-    i->pcursor->Seek(DB_COIN);
+    const COutPoint outpointStart(hashStart, 0);
+    i->pcursor->Seek(CoinEntry(&outpointStart));
     // Cache key of first record
     if (i->pcursor->Valid()) {
         CoinEntry entry(&i->keyTmp.second);
@@ -460,6 +470,44 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::ReadBlockStats(const uint256 &hashBlock, CBlockStats &stats) {
+    return Read(std::make_pair(DB_BLOCK_STATS, hashBlock), stats);
+}
+
+bool CBlockTreeDB::WriteBlockStats(const std::vector<std::pair<uint256, CBlockStats> >&vect) {
+    CDBBatch batch(*this);
+    for (std::vector<std::pair<uint256,CBlockStats> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        batch.Write(std::make_pair(DB_BLOCK_STATS, it->first), it->second);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::EraseBlockStats(const uint256 &hashBlock) {
+    return Erase(std::make_pair(DB_BLOCK_STATS, hashBlock));
+}
+
+bool CBlockTreeDB::ReadBlockStatsBackfilled(uint256 &hashBlock) {
+    return Read(DB_BLOCK_STATS_BACKFILLED, hashBlock);
+}
+
+bool CBlockTreeDB::WriteBlockStatsBackfilled(const uint256 &hashBlock) {
+    return Write(DB_BLOCK_STATS_BACKFILLED, hashBlock);
+}
+
+bool CBlockTreeDB::ReadBlockFilter(const uint256 &hashBlock, BlockFilter &filter) {
+    return Read(std::make_pair(DB_BLOCK_FILTER, hashBlock), filter);
+}
+
+bool CBlockTreeDB::WriteBlockFilters(const std::vector<BlockFilter> &vFilter) {
+    CDBBatch batch(*this);
+    for (const BlockFilter& filter : vFilter)
+        batch.Write(std::make_pair(DB_BLOCK_FILTER, filter.GetBlockHash()), filter);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::EraseBlockFilter(const uint256 &hashBlock) {
+    return Erase(std::make_pair(DB_BLOCK_FILTER, hashBlock));
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
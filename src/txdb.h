@@ -10,11 +10,13 @@
 #include <dbwrapper.h>
 #include <chain.h>
 
+#include <array>
 #include <map>
 #include <string>
 #include <utility>
 #include <vector>
 
+class BlockFilter;
 class CBlockIndex;
 class CCoinsViewDBCursor;
 class CCoinsViewLoadedDBCursor;
@@ -64,6 +66,44 @@ struct CDiskTxPos : public CDiskBlockPos
     }
 };
 
+//! Number of feerate percentiles tracked by the block stats index
+static const int BLOCK_STATS_NUM_PERCENTILES = 5;
+
+/** Fee statistics of a connected block, kept by the -blockstatsindex */
+struct CBlockStats
+{
+    CAmount nTotalFee; // Sum of all transaction fees, including WT^ fees
+    CAmount nWTPrimeFee; // Fees paid by WT^ payout transactions
+    uint32_t nTx; // Number of transactions, including the coinbase
+    uint32_t nVSize; // Sum of transaction virtual sizes
+    // 10th, 25th, 50th, 75th & 90th weight percentile feerates (sat / vbyte)
+    std::array<CAmount, BLOCK_STATS_NUM_PERCENTILES> feeratePercentiles;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(VARINT(nTotalFee));
+        READWRITE(VARINT(nWTPrimeFee));
+        READWRITE(VARINT(nTx));
+        READWRITE(VARINT(nVSize));
+        for (CAmount& n : feeratePercentiles)
+            READWRITE(VARINT(n));
+    }
+
+    CBlockStats() {
+        SetNull();
+    }
+
+    void SetNull() {
+        nTotalFee = 0;
+        nWTPrimeFee = 0;
+        nTx = 0;
+        nVSize = 0;
+        feeratePercentiles.fill(0);
+    }
+};
+
 /** CCoinsView backed by the coin database (chainstate/) */
 class CCoinsViewDB final : public CCoinsView
 {
@@ -79,6 +119,8 @@ public:
     std::vector<uint256> GetHeadBlocks() const override;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
     CCoinsViewCursor *Cursor() const override;
+    //! Cursor positioned at the first coin whose txid is not below hashStart
+    CCoinsViewCursor *Cursor(const uint256& hashStart) const;
     CCoinsViewLoadedCursor *LoadedCursor() const;
 
     //! Attempt to update from an older database format. Returns whether an error occurred.
@@ -158,6 +200,15 @@ public:
     bool ReadReindexing(bool &fReindexing);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &vect);
+    bool ReadBlockStats(const uint256 &hashBlock, CBlockStats &stats);
+    bool WriteBlockStats(const std::vector<std::pair<uint256, CBlockStats> > &vect);
+    bool EraseBlockStats(const uint256 &hashBlock);
+    /** Block up to which BackfillBlockStatsIndex has filled in the active chain */
+    bool ReadBlockStatsBackfilled(uint256 &hashBlock);
+    bool WriteBlockStatsBackfilled(const uint256 &hashBlock);
+    bool ReadBlockFilter(const uint256 &hashBlock, BlockFilter &filter);
+    bool WriteBlockFilters(const std::vector<BlockFilter> &vFilter);
+    bool EraseBlockFilter(const uint256 &hashBlock);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex);
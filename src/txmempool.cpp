@@ -22,11 +22,13 @@
 #include "utilmoneystr.h"
 #include "utiltime.h"
 
+#include <type_traits>
+
 CTxMemPoolEntry::CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFee,
                                  int64_t _nTime, unsigned int _entryHeight,
                                  bool _spendsCoinbase, bool _spendsCriticalData, bool _fSidechainDeposit, uint8_t _nSidechain, int64_t _sigOpsCost, LockPoints lp):
-    tx(_tx), nFee(_nFee), nTime(_nTime), entryHeight(_entryHeight),
-    spendsCoinbase(_spendsCoinbase), spendsCriticalData(_spendsCriticalData), fSidechainDeposit(_fSidechainDeposit), nSidechain(_nSidechain), sigOpCost(_sigOpsCost), lockPoints(lp)
+    tx(_tx), nFee(_nFee), nTime(_nTime), lockPoints(lp), entryHeight(_entryHeight), sigOpCost(_sigOpsCost),
+    spendsCoinbase(_spendsCoinbase), spendsCriticalData(_spendsCriticalData), fSidechainDeposit(_fSidechainDeposit), nSidechain(_nSidechain)
 {
     nTxWeight = GetTransactionWeight(*tx);
     nUsageSize = RecursiveDynamicUsage(tx);
@@ -41,6 +43,8 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFe
     nSizeWithAncestors = GetTxSize();
     nModFeesWithAncestors = nFee;
     nSigOpCostWithAncestors = sigOpCost;
+
+    nMiningCluster = 0;
 }
 
 void CTxMemPoolEntry::UpdateFeeDelta(int64_t newFeeDelta)
@@ -334,7 +338,11 @@ void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee,
 
 CTxMemPool::CTxMemPool(CBlockPolicyEstimator* estimator) :
     nTransactionsUpdated(0), fCriticalTxnAddedSinceBlock(false),
-    minerPolicyEstimator(estimator)
+    minerPolicyEstimator(estimator),
+    mapTx(indexed_transaction_set::ctor_args_list(), indexed_transaction_set::allocator_type(&nodePool)),
+    mapLinks(CompareIteratorByHash(), txlinksMap::allocator_type(&nodePool)),
+    fMiningClusters(false), nNextMiningCluster(1),
+    setMiningDirty(CompareIteratorByHash(), setEntries::allocator_type(&nodePool))
 {
     _clear(); //lock free clear
 
@@ -376,7 +384,8 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     // all the appropriate checks.
     LOCK(cs);
     indexed_transaction_set::iterator newit = mapTx.insert(entry).first;
-    mapLinks.insert(make_pair(newit, TxLinks()));
+    mapLinks.insert(std::make_pair(newit, TxLinks(setEntries::allocator_type(&nodePool))));
+    InvalidateMiningCluster(newit);
 
     // Update transaction for any feeDelta created by PrioritiseTransaction
     // TODO: refactor so that the fee delta is calculated before inserting
@@ -450,6 +459,8 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
     totalTxSize -= it->GetTxSize();
     cachedInnerUsage -= it->DynamicMemoryUsage();
     cachedInnerUsage -= memusage::DynamicUsage(mapLinks[it].parents) + memusage::DynamicUsage(mapLinks[it].children);
+    InvalidateMiningCluster(it);
+    setMiningDirty.erase(it);
     mapLinks.erase(it);
     mapTx.erase(it);
     nTransactionsUpdated++;
@@ -627,6 +638,9 @@ void CTxMemPool::removeForBlock(const std::vector<CTransactionRef>& vtx, unsigne
 
 void CTxMemPool::_clear()
 {
+    mapMiningCluster.clear();
+    setMiningDirty.clear();
+    cachedMiningUsage = 0;
     mapLinks.clear();
     mapTx.clear();
     mapNextTx.clear();
@@ -637,6 +651,7 @@ void CTxMemPool::_clear()
     rollingMinimumFeeRate = 0;
     ++nTransactionsUpdated;
     fCriticalTxnAddedSinceBlock = false;
+    nodePool.ReleaseUnused();
 }
 
 void CTxMemPool::clear()
@@ -879,6 +894,7 @@ void CTxMemPool::PrioritiseTransaction(const uint256& hash, const CAmount& nFeeD
         txiter it = mapTx.find(hash);
         if (it != mapTx.end()) {
             mapTx.modify(it, update_fee_delta(delta));
+            InvalidateMiningCluster(it);
             // Now update all ancestors' modified fees with descendants
             setEntries setAncestors;
             uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
@@ -948,8 +964,15 @@ bool CCoinsViewMemPool::GetCoin(const COutPoint &outpoint, Coin &coin) const {
 
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
-    // Estimate the overhead of mapTx to be 12 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
-    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 12 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
+    return LiveMemoryUsage() + nodePool.FreeBytes();
+}
+
+size_t CTxMemPool::LiveMemoryUsage() const {
+    AssertLockHeld(cs);
+    // mapTx nodes (the entry plus the links of all four indices) come from a
+    // pool without per-allocation overhead.
+    typedef std::remove_pointer<decltype(mapTx.begin().get_node())>::type mapTxNode;
+    return PoolNodeSize(sizeof(mapTxNode)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage + memusage::DynamicUsage(mapMiningCluster) + memusage::DynamicUsage(setMiningDirty) + cachedMiningUsage;
 }
 
 void CTxMemPool::RemoveStaged(setEntries &stage, bool updateDescendants, MemPoolRemovalReason reason) {
@@ -988,6 +1011,8 @@ bool CTxMemPool::addUnchecked(const uint256&hash, const CTxMemPoolEntry &entry,
 
 void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add)
 {
+    InvalidateMiningCluster(entry);
+    InvalidateMiningCluster(child);
     setEntries s;
     if (add && mapLinks[entry].children.insert(child).second) {
         cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
@@ -998,6 +1023,8 @@ void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add)
 
 void CTxMemPool::UpdateParent(txiter entry, txiter parent, bool add)
 {
+    InvalidateMiningCluster(entry);
+    InvalidateMiningCluster(parent);
     setEntries s;
     if (add && mapLinks[entry].parents.insert(parent).second) {
         cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
@@ -1022,6 +1049,173 @@ const CTxMemPool::setEntries & CTxMemPool::GetMemPoolChildren(txiter entry) cons
     return it->second.children;
 }
 
+void CTxMemPool::InvalidateMiningCluster(txiter it)
+{
+    if (!fMiningClusters)
+        return;
+
+    setMiningDirty.insert(it);
+    if (it->nMiningCluster == 0)
+        return;
+
+    std::map<uint64_t, MiningCluster>::iterator mit = mapMiningCluster.find(it->nMiningCluster);
+    if (mit != mapMiningCluster.end()) {
+        for (const MiningPackage& package : mit->second) {
+            cachedMiningUsage -= memusage::DynamicUsage(package.vTx);
+            for (txiter member : package.vTx) {
+                member->nMiningCluster = 0;
+                setMiningDirty.insert(member);
+            }
+        }
+        cachedMiningUsage -= memusage::DynamicUsage(mit->second);
+        mapMiningCluster.erase(mit);
+    }
+    it->nMiningCluster = 0;
+}
+
+// Greedy ancestor feerate selection restricted to one cluster: repeatedly
+// take the entry with the best ancestor score together with its ancestors
+// that have not been taken yet, then update the ancestor state of the
+// remaining descendants as if the package was already in the block. Each
+// step walks the ancestors and descendants of the package, so the whole
+// cluster costs O(n^2), which is why large clusters take the cheaper path of
+// going through their entries by the ancestor score the mempool keeps.
+void CTxMemPool::LinearizeMiningCluster(const setEntries& cluster, MiningCluster& vPackage)
+{
+    if (cluster.size() > MAX_MINING_CLUSTER_SIZE) {
+        LinearizeMiningClusterByAncestorScore(cluster, vPackage);
+        return;
+    }
+
+    std::map<txiter, MiningPackage, CompareIteratorByHash> mapState;
+    std::set<MiningPackage, CompareTxMemPoolEntryByAncestorFee> setQueue;
+    for (txiter it : cluster) {
+        MiningPackage& state = mapState[it];
+        state.iter = it;
+        state.nSizeWithAncestors = it->GetSizeWithAncestors();
+        state.nModFeesWithAncestors = it->GetModFeesWithAncestors();
+        state.nSigOpCostWithAncestors = it->GetSigOpCostWithAncestors();
+        setQueue.insert(state);
+    }
+
+    setEntries setSelected;
+    const uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string dummy;
+    while (!setQueue.empty()) {
+        MiningPackage package = *setQueue.begin();
+
+        setEntries setAncestors;
+        CalculateMemPoolAncestors(*package.iter, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+        package.vTx.push_back(package.iter);
+        for (txiter ancestor : setAncestors) {
+            if (!setSelected.count(ancestor))
+                package.vTx.push_back(ancestor);
+        }
+        std::sort(package.vTx.begin(), package.vTx.end(), CompareTxIterByAncestorCount());
+
+        for (txiter it : package.vTx) {
+            setSelected.insert(it);
+            setQueue.erase(mapState[it]);
+        }
+        for (txiter it : package.vTx) {
+            setEntries setDescendants;
+            CalculateDescendants(it, setDescendants);
+            for (txiter desc : setDescendants) {
+                if (setSelected.count(desc))
+                    continue;
+                MiningPackage& state = mapState[desc];
+                setQueue.erase(state);
+                state.nSizeWithAncestors -= it->GetTxSize();
+                state.nModFeesWithAncestors -= it->GetModifiedFee();
+                state.nSigOpCostWithAncestors -= it->GetSigOpCost();
+                setQueue.insert(state);
+            }
+        }
+        vPackage.push_back(std::move(package));
+    }
+}
+
+// The ancestor feerate selection without updating the scores of the
+// remaining entries: go through the cluster by the mempool's ancestor score
+// and make a package of each entry not taken yet and its ancestors that are
+// not taken yet either. The package state is summed over its own members, so
+// it is exact, but the packages need not come in the best order.
+void CTxMemPool::LinearizeMiningClusterByAncestorScore(const setEntries& cluster, MiningCluster& vPackage)
+{
+    std::vector<txiter> vSorted(cluster.begin(), cluster.end());
+    std::sort(vSorted.begin(), vSorted.end(), [](const txiter& a, const txiter& b) {
+        return CompareTxMemPoolEntryByAncestorFee()(*a, *b);
+    });
+
+    setEntries setSelected;
+    const uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string dummy;
+    for (txiter it : vSorted) {
+        if (setSelected.count(it))
+            continue;
+
+        MiningPackage package;
+        package.iter = it;
+        package.nSizeWithAncestors = 0;
+        package.nModFeesWithAncestors = 0;
+        package.nSigOpCostWithAncestors = 0;
+
+        setEntries setAncestors;
+        CalculateMemPoolAncestors(*it, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+        setAncestors.insert(it);
+        for (txiter member : setAncestors) {
+            if (!setSelected.insert(member).second)
+                continue;
+            package.vTx.push_back(member);
+            package.nSizeWithAncestors += member->GetTxSize();
+            package.nModFeesWithAncestors += member->GetModifiedFee();
+            package.nSigOpCostWithAncestors += member->GetSigOpCost();
+        }
+        std::sort(package.vTx.begin(), package.vTx.end(), CompareTxIterByAncestorCount());
+        vPackage.push_back(std::move(package));
+    }
+}
+
+const std::map<uint64_t, CTxMemPool::MiningCluster>& CTxMemPool::GetMiningClusters()
+{
+    AssertLockHeld(cs);
+    if (!fMiningClusters) {
+        fMiningClusters = true;
+        for (txiter it = mapTx.begin(); it != mapTx.end(); it++)
+            setMiningDirty.insert(it);
+    }
+
+    while (!setMiningDirty.empty()) {
+        // Collect every transaction connected to the first dirty entry
+        setEntries cluster;
+        std::vector<txiter> vStage(1, *setMiningDirty.begin());
+        while (!vStage.empty()) {
+            txiter it = vStage.back();
+            vStage.pop_back();
+            if (!cluster.insert(it).second)
+                continue;
+            InvalidateMiningCluster(it);
+            for (txiter parent : GetMemPoolParents(it))
+                vStage.push_back(parent);
+            for (txiter child : GetMemPoolChildren(it))
+                vStage.push_back(child);
+        }
+        for (txiter it : cluster)
+            setMiningDirty.erase(it);
+
+        const uint64_t nCluster = nNextMiningCluster++;
+        MiningCluster& vPackage = mapMiningCluster[nCluster];
+        LinearizeMiningCluster(cluster, vPackage);
+        for (const MiningPackage& package : vPackage) {
+            cachedMiningUsage += memusage::DynamicUsage(package.vTx);
+            for (txiter it : package.vTx)
+                it->nMiningCluster = nCluster;
+        }
+        cachedMiningUsage += memusage::DynamicUsage(vPackage);
+    }
+    return mapMiningCluster;
+}
+
 void CTxMemPool::RemoveExpiredCriticalRequests(std::vector<uint256>& vHashRemoved)
 {
     setEntries txToRemove;
@@ -1327,7 +1521,18 @@ void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<COutPoint>* pvNoSpends
 
     unsigned nTxnRemoved = 0;
     CFeeRate maxFeeRateRemoved(0);
+    // Removing transactions only puts their nodes on the free lists of
+    // nodePool, where the next transactions pick them up again, and the
+    // free nodes count towards DynamicMemoryUsage. Once the remaining
+    // transactions fit, return the chunks that became completely free, and
+    // only keep removing transactions if that wasn't enough.
     while (!mapTx.empty() && DynamicMemoryUsage() > sizelimit) {
+        if (LiveMemoryUsage() <= sizelimit) {
+            nodePool.ReleaseUnused();
+            if (DynamicMemoryUsage() <= sizelimit)
+                break;
+        }
+
         indexed_transaction_set::index<descendant_score>::type::iterator it = mapTx.get<descendant_score>().begin();
 
         // We set the new mempool min fee to the feerate of the removed set, plus the
@@ -1360,6 +1565,9 @@ void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<COutPoint>* pvNoSpends
         }
     }
 
+    if (nTxnRemoved)
+        nodePool.ReleaseUnused();
+
     if (maxFeeRateRemoved > CFeeRate(0)) {
         LogPrint(BCLog::MEMPOOL, "Removed %u txn, rolling minimum fee bumped to %s\n", nTxnRemoved, maxFeeRateRemoved.ToString());
     }
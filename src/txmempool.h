@@ -19,6 +19,7 @@
 #include <policy/feerate.h>
 #include <primitives/transaction.h>
 #include <sidechain.h>
+#include <support/allocators/pool.h>
 #include <sync.h>
 #include <random.h>
 
@@ -33,6 +34,9 @@ class CBlockIndex;
 /** Fake height value used in Coin to signify they are only in the memory pool (since 0.8) */
 static const uint32_t MEMPOOL_HEIGHT = 0x7FFFFFFF;
 
+/** Larger mining clusters are split into packages by the ancestor scores kept by the mempool */
+static const unsigned int MAX_MINING_CLUSTER_SIZE = 100;
+
 struct LockPoints
 {
     // Will be set to the blockchain height and median time past
@@ -65,20 +69,11 @@ class CTxMemPool;
 class CTxMemPoolEntry
 {
 private:
+    // Members are ordered by size to avoid padding: entries are the bulk of
+    // the mempool's memory usage.
     CTransactionRef tx;
     CAmount nFee;              //!< Cached to avoid expensive parent-transaction lookups
-    size_t nTxWeight;          //!< ... and avoid recomputing tx weight (also used for GetTxSize())
-    size_t nUsageSize;         //!< ... and total memory usage
     int64_t nTime;             //!< Local time when entering the mempool
-    unsigned int entryHeight;  //!< Chain height when entering the mempool
-    bool spendsCoinbase;       //!< keep track of transactions that spend a coinbase
-    bool spendsCriticalData;   //!< keep track of transactions that spend a critical data request
-
-    // Sidechain deposit info
-    bool fSidechainDeposit;
-    uint8_t nSidechain;
-
-    int64_t sigOpCost;         //!< Total sigop cost
     int64_t feeDelta;          //!< Used for determining the priority of the transaction for mining in a block
     LockPoints lockPoints;     //!< Track the height and time at which tx was final
 
@@ -95,6 +90,17 @@ private:
     CAmount nModFeesWithAncestors;
     int64_t nSigOpCostWithAncestors;
 
+    uint32_t nTxWeight;        //!< ... and avoid recomputing tx weight (also used for GetTxSize())
+    uint32_t nUsageSize;       //!< ... and total memory usage
+    uint32_t entryHeight;      //!< Chain height when entering the mempool
+    int32_t sigOpCost;         //!< Total sigop cost, bounded by MAX_BLOCK_SIGOPS_COST
+
+    bool spendsCoinbase;       //!< keep track of transactions that spend a coinbase
+    bool spendsCriticalData;   //!< keep track of transactions that spend a critical data request
+
+    // Sidechain deposit info
+    bool fSidechainDeposit;
+    uint8_t nSidechain;
 
 public:
     CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFee,
@@ -143,7 +149,8 @@ public:
     CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
     int64_t GetSigOpCostWithAncestors() const { return nSigOpCostWithAncestors; }
 
-    mutable size_t vTxHashesIdx; //!< Index in mempool's vTxHashes
+    mutable uint32_t vTxHashesIdx; //!< Index in mempool's vTxHashes
+    mutable uint64_t nMiningCluster; //!< Id of the mempool mining cluster containing this entry, 0 if none
 };
 
 // Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
@@ -468,7 +475,11 @@ private:
     mutable bool blockSinceLastRollingFeeBump;
     mutable double rollingMinimumFeeRate; //!< minimum fee to get into the pool, decreases exponentially
 
+    PoolResource nodePool; //!< Nodes of mapTx, mapLinks and the link sets, only used while holding cs
+
     void trackPackageRemoved(const CFeeRate& rate);
+    /** Memory used by the transactions in the pool, without free pool nodes */
+    size_t LiveMemoryUsage() const;
 
 public:
 
@@ -497,7 +508,8 @@ public:
                 boost::multi_index::identity<CTxMemPoolEntry>,
                 CompareTxMemPoolEntryByAncestorFee
             >
-        >
+        >,
+        pool_allocator<CTxMemPoolEntry>
     > indexed_transaction_set;
 
     mutable CCriticalSection cs;
@@ -511,11 +523,51 @@ public:
             return a->GetTx().GetHash() < b->GetTx().GetHash();
         }
     };
-    typedef std::set<txiter, CompareIteratorByHash> setEntries;
+    typedef std::set<txiter, CompareIteratorByHash, pool_allocator<txiter> > setEntries;
 
     const setEntries & GetMemPoolParents(txiter entry) const;
     const setEntries & GetMemPoolChildren(txiter entry) const;
 
+    /**
+     * A set of transactions to be added to a block together: iter and its
+     * ancestors that are not part of an earlier package of the same cluster.
+     * The ancestor state is that of iter with those earlier packages
+     * excluded, so packages sort with CompareTxMemPoolEntryByAncestorFee.
+     */
+    struct MiningPackage {
+        txiter iter;
+        std::vector<txiter> vTx; //!< Transactions of the package in a valid block order
+        uint64_t nSizeWithAncestors;
+        CAmount nModFeesWithAncestors;
+        int64_t nSigOpCostWithAncestors;
+
+        int64_t GetModifiedFee() const { return iter->GetModifiedFee(); }
+        uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
+        CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
+        size_t GetTxSize() const { return iter->GetTxSize(); }
+        const CTransaction& GetTx() const { return iter->GetTx(); }
+    };
+
+    /** Packages of a cluster in the order they are selected by ancestor feerate */
+    typedef std::vector<MiningPackage> MiningCluster;
+
+    /**
+     * Return the mining packages of every cluster (set of connected
+     * transactions) in the mempool. Clusters changed since the previous call
+     * are linearized again first, from scratch, at a cost quadratic in the
+     * size of the cluster. Clusters of more than MAX_MINING_CLUSTER_SIZE
+     * transactions are instead split in the order of the ancestor scores the
+     * mempool keeps, without updating them for the packages taken before.
+     *
+     * Taking a package never changes the scores in another cluster, so for
+     * clusters linearized in full, merging them by the score of their next
+     * package gives the ancestor feerate order over the whole mempool. The
+     * linearization does
+     * assume that every package is taken, though: once the block assembler
+     * leaves one out, the packages of that cluster after it still need it.
+     */
+    const std::map<uint64_t, MiningCluster>& GetMiningClusters();
+
     void RemoveExpiredCriticalRequests(std::vector<uint256>& vHashRemoved);
 
     void SelectBMMRequests(std::vector<uint256>& vHashRemoved);
@@ -534,16 +586,35 @@ private:
     typedef std::map<txiter, setEntries, CompareIteratorByHash> cacheMap;
 
     struct TxLinks {
+        TxLinks() {}
+        explicit TxLinks(const setEntries::allocator_type& alloc) : parents(alloc), children(alloc) {}
+
         setEntries parents;
         setEntries children;
     };
 
-    typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
+    typedef std::map<txiter, TxLinks, CompareIteratorByHash, pool_allocator<std::pair<const txiter, TxLinks> > > txlinksMap;
     txlinksMap mapLinks;
 
     void UpdateParent(txiter entry, txiter parent, bool add);
     void UpdateChild(txiter entry, txiter child, bool add);
 
+    // Mining cluster index used by block assembly. It is only maintained
+    // once GetMiningClusters() has been called, so that nodes which never
+    // create block templates don't pay for it.
+    bool fMiningClusters;
+    uint64_t nNextMiningCluster;
+    std::map<uint64_t, MiningCluster> mapMiningCluster;
+    setEntries setMiningDirty; //!< Entries whose cluster must be linearized again
+    uint64_t cachedMiningUsage; //!< Dynamic memory usage of the MiningCluster vectors
+
+    /** Drop the cluster containing it and mark its entries for relinearization */
+    void InvalidateMiningCluster(txiter it);
+    /** Split a cluster into mining packages */
+    void LinearizeMiningCluster(const setEntries& cluster, MiningCluster& vPackage);
+    /** Split a cluster into mining packages without updating ancestor scores, for large clusters */
+    void LinearizeMiningClusterByAncestorScore(const setEntries& cluster, MiningCluster& vPackage);
+
     std::vector<indexed_transaction_set::const_iterator> GetSortedDepthAndScore() const;
 
 public:
@@ -681,6 +752,7 @@ public:
     TxMempoolInfo info(const uint256& hash) const;
     std::vector<TxMempoolInfo> infoAll() const;
 
+    /** Memory used by the pool, including nodes of removed transactions kept for reuse */
     size_t DynamicMemoryUsage() const;
 
     boost::signals2::signal<void (CTransactionRef)> NotifyEntryAdded;
@@ -725,6 +797,19 @@ private:
     void removeUnchecked(txiter entry, MemPoolRemovalReason reason = MemPoolRemovalReason::UNKNOWN);
 };
 
+/**
+ * Sort transactions by ancestor count, which is a valid order to appear in a
+ * block: a transaction always has more ancestors than any of its parents.
+ */
+struct CompareTxIterByAncestorCount {
+    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
+    {
+        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        return CTxMemPool::CompareIteratorByHash()(a, b);
+    }
+};
+
 /**
  * CCoinsView that brings transactions from a memorypool into view.
  * It does not check for spendings by memory pool transactions.
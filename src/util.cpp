@@ -249,6 +249,7 @@ const CLogCategoryDesc LogCategories[] =
     {BCLog::COINDB, "coindb"},
     {BCLog::QT, "qt"},
     {BCLog::LEVELDB, "leveldb"},
+    {BCLog::SCDB, "scdb"},
     {BCLog::ALL, "1"},
     {BCLog::ALL, "all"},
 };
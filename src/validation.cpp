@@ -6,6 +6,7 @@
 #include <validation.h>
 
 #include <arith_uint256.h>
+#include <blockfilter.h>
 #include <chain.h>
 #include <chainparams.h>
 #include <checkpoints.h>
@@ -31,6 +32,7 @@
 #include <script/standard.h>
 #include <sidechain.h>
 #include <sidechaindb.h>
+#include <taskpool.h>
 #include <timedata.h>
 #include <tinyformat.h>
 #include <txdb.h>
@@ -44,7 +46,9 @@
 #include <versionbits.h>
 #include <warnings.h>
 
+#include <condition_variable>
 #include <future>
+#include <mutex>
 #include <sstream>
 #include <tuple>
 
@@ -163,12 +167,12 @@ public:
     bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested,  const CDiskBlockPos* dbp, bool* fNewBlock, bool fFromDisk = false);
 
     // Block (dis)connection on a given view:
-    DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view);
+    DisconnectResult DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view, bool fResyncSCDB = true);
     bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
                     CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck = false);
 
     // Block disconnection on our pcoinsTip:
-    bool DisconnectTip(CValidationState& state, const CChainParams& chainparams, DisconnectedBlockTransactions *disconnectpool);
+    bool DisconnectTip(CValidationState& state, const CChainParams& chainparams, DisconnectedBlockTransactions *disconnectpool, bool fResyncSCDB = true);
 
     // Manual block validity manipulation:
     bool PreciousBlock(CValidationState& state, const CChainParams& params, CBlockIndex *pindex);
@@ -213,6 +217,8 @@ int nScriptCheckThreads = 0;
 std::atomic_bool fImporting(false);
 std::atomic_bool fReindex(false);
 bool fTxIndex = false;
+bool fBlockStatsIndex = false;
+bool fBlockFilterIndex = false;
 bool fHavePruned = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
@@ -235,6 +241,11 @@ CTxMemPool mempool(&feeEstimator);
 
 SidechainDB scdb;
 
+static std::mutex g_chain_snapshot_mutex;
+static std::condition_variable g_chain_snapshot_cv;
+static std::shared_ptr<const ChainSnapshot> g_chain_snapshot;
+static bool g_chain_snapshot_interrupted = false;
+
 /** Constant stuff for coinbase transactions we create: */
 CScript COINBASE_FLAGS;
 
@@ -552,7 +563,7 @@ void GetSidechainValues(const CCoinsView& coins, const CTransaction &tx, CAmount
                         CAmount& amtReturning, CAmount& amtWithdrawn)
 {
     // Collect coins from inputs
-    std::vector<Coin> vCoin;
+    std::vector<CTxOut> vSpent;
     for (const CTxIn& in : tx.vin) {
         Coin coin;
 
@@ -560,15 +571,19 @@ void GetSidechainValues(const CCoinsView& coins, const CTransaction &tx, CAmount
         if (!coins.GetCoin(in.prevout, coin)) {
             return;
         }
-        vCoin.push_back(coin);
+        vSpent.push_back(coin.out);
     }
 
+    GetSidechainValues(vSpent, tx, amtSidechainUTXO, amtUserInput, amtReturning, amtWithdrawn);
+}
+
+void GetSidechainValues(const std::vector<CTxOut>& vSpent, const CTransaction &tx, CAmount& amtSidechainUTXO, CAmount& amtUserInput,
+                        CAmount& amtReturning, CAmount& amtWithdrawn)
+{
     // Count value of inputs
     uint8_t nSidechain;
-    for (const Coin& c : vCoin) {
-        const CTxOut& out = c.out;
-        CScript scriptPubKey = out.scriptPubKey;
-        if (scdb.HasSidechainScript(std::vector<CScript>{scriptPubKey}, nSidechain)) {
+    for (const CTxOut& out : vSpent) {
+        if (scdb.HasSidechainScript(std::vector<CScript>{out.scriptPubKey}, nSidechain)) {
             amtSidechainUTXO += out.nValue;
         } else {
             amtUserInput += out.nValue;
@@ -577,8 +592,7 @@ void GetSidechainValues(const CCoinsView& coins, const CTransaction &tx, CAmount
 
     // Count outputs
     for (const CTxOut& out : tx.vout) {
-        CScript scriptPubKey = out.scriptPubKey;
-        if (scdb.HasSidechainScript(std::vector<CScript>{scriptPubKey}, nSidechain)) {
+        if (scdb.HasSidechainScript(std::vector<CScript>{out.scriptPubKey}, nSidechain)) {
             amtReturning += out.nValue;
         } else {
             amtWithdrawn += out.nValue;
@@ -781,6 +795,8 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
 
     // Check for conflicts with in-memory transactions
     std::set<uint256> setConflicts;
+    // Conflicting critical data transactions that can't be mined anymore
+    std::set<uint256> setExpiredConflicts;
     for (const CTxIn &txin : tx.vin)
     {
         auto itConflicting = pool.mapNextTx.find(txin.prevout);
@@ -789,6 +805,16 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
             const CTransaction *ptxConflicting = itConflicting->second;
             if (!setConflicts.count(ptxConflicting->GetHash()))
             {
+                // Critical data (BMM requests) is only valid in the block
+                // following nLockTime. Once the tip has moved past it the
+                // transaction is dead weight in the mempool, so it can always
+                // be replaced and its fees aren't taken into account below.
+                if (!ptxConflicting->criticalData.IsNull() && (int64_t)ptxConflicting->nLockTime < chainActive.Height()) {
+                    setConflicts.insert(ptxConflicting->GetHash());
+                    setExpiredConflicts.insert(ptxConflicting->GetHash());
+                    continue;
+                }
+
                 // Allow opt-out of transaction replacement by setting
                 // nSequence > MAX_BIP125_RBF_SEQUENCE (SEQUENCE_FINAL-2) on all inputs.
                 //
@@ -981,6 +1007,7 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
             std::set<uint256> setConflictsParents;
             const int maxDescendantsToVisit = 100;
             CTxMemPool::setEntries setIterConflicting;
+            CTxMemPool::setEntries setIterExpired;
             for (const uint256 &hashConflicting : setConflicts)
             {
                 CTxMemPool::txiter mi = pool.mapTx.find(hashConflicting);
@@ -990,6 +1017,14 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
                 // Save these to avoid repeated lookups
                 setIterConflicting.insert(mi);
 
+                if (setExpiredConflicts.count(hashConflicting)) {
+                    setIterExpired.insert(mi);
+                    for (const CTxIn &txin : mi->GetTx().vin)
+                        setConflictsParents.insert(txin.prevout.hash);
+                    nConflictingCount += mi->GetCountWithDescendants();
+                    continue;
+                }
+
                 // Don't allow the replacement to reduce the feerate of the
                 // mempool.
                 //
@@ -1030,11 +1065,16 @@ static bool AcceptToMemoryPoolWorker(const CChainParams& chainparams, CTxMemPool
             if (nConflictingCount <= maxDescendantsToVisit) {
                 // If not too many to replace, then calculate the set of
                 // transactions that would have to be evicted
+                CTxMemPool::setEntries allExpired;
                 for (CTxMemPool::txiter it : setIterConflicting) {
                     pool.CalculateDescendants(it, allConflicting);
                 }
+                for (CTxMemPool::txiter it : setIterExpired) {
+                    pool.CalculateDescendants(it, allExpired);
+                }
                 for (CTxMemPool::txiter it : allConflicting) {
-                    nConflictingFees += it->GetModifiedFee();
+                    if (!allExpired.count(it))
+                        nConflictingFees += it->GetModifiedFee();
                     nConflictingSize += it->GetTxSize();
                 }
             } else {
@@ -1344,6 +1384,66 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vch, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+{
+    vch.clear();
+
+    // Blocks are stored after their message start and size (see WriteBlockToDisk)
+    if (pos.nPos < CMessageHeader::MESSAGE_START_SIZE + sizeof(unsigned int))
+        return error("%s: Invalid block position %s", __func__, pos.ToString());
+    CDiskBlockPos hpos = pos;
+    hpos.nPos -= CMessageHeader::MESSAGE_START_SIZE + sizeof(unsigned int);
+
+    // Open history file to read
+    CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+
+    try {
+        CMessageHeader::MessageStartChars blockStart;
+        unsigned int nSize;
+        filein >> FLATDATA(blockStart) >> nSize;
+
+        if (memcmp(blockStart, messageStart, CMessageHeader::MESSAGE_START_SIZE))
+            return error("%s: Block magic mismatch at %s", __func__, pos.ToString());
+
+        if (nSize > MAX_SIZE)
+            return error("%s: Block size %u too large at %s", __func__, nSize, pos.ToString());
+
+        vch.resize(nSize);
+        filein.read((char*)vch.data(), nSize);
+    }
+    catch (const std::exception& e) {
+        return error("%s: I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+
+    return true;
+}
+
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vch, const CDiskBlockPos& pos, const uint256& hash, const CMessageHeader::MessageStartChars& messageStart)
+{
+    if (!ReadRawBlockFromDisk(vch, pos, messageStart))
+        return false;
+
+    // The bytes are sent to peers without being deserialized, so at least
+    // make sure they start with the header of the block we were asked for
+    static const size_t nHeaderSize = ::GetSerializeSize(CBlockHeader(), SER_NETWORK, PROTOCOL_VERSION);
+    if (vch.size() < nHeaderSize || Hash(vch.data(), vch.data() + nHeaderSize) != hash)
+        return error("%s: block hash doesn't match %s at %s", __func__, hash.ToString(), pos.ToString());
+    return true;
+}
+
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vch, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart)
+{
+    CDiskBlockPos blockPos;
+    {
+        LOCK(cs_main);
+        blockPos = pindex->GetBlockPos();
+    }
+
+    return ReadRawBlockFromDisk(vch, blockPos, pindex->GetBlockHash(), messageStart);
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     int halvings = nHeight / consensusParams.nSubsidyHalvingInterval;
@@ -1784,8 +1884,10 @@ int ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out)
 }
 
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
- *  When FAILED is returned, view is left in an indeterminate state. */
-DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view)
+ *  When FAILED is returned, view is left in an indeterminate state.
+ *  If fResyncSCDB is false the caller is disconnecting multiple blocks and
+ *  must call ResyncSCDBAfterDisconnect() once it is done. */
+DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view, bool fResyncSCDB)
 {
     bool fClean = true;
 
@@ -1836,26 +1938,23 @@ DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockI
         }
     }
 
-    // Load SCDB undo data from disk
-    if (!ResyncSCDB(pindex->pprev)) {
-        error("%s: Failed to re-sync SCDB for disconnected block: %s!", __func__, block.GetHash().ToString());
+    // Apply undo to SCDB (deposits & spent WT^(s) of this block)
+    if (!scdb.Undo(pindex->nHeight, block.GetHash(), block.GetPrevHash(), block.vtx, LogAcceptCategory(BCLog::SCDB) /* fDebug */)) {
+        error("%s: Failed to undo SCDB data for block: %s!", __func__, block.GetHash().ToString());
         return DISCONNECT_FAILED;
     }
 
-    // Apply undo to SCDB
-    if (!scdb.Undo(pindex->nHeight, block.GetHash(), block.GetPrevHash(), block.vtx, true /* fDebug */)) {
-        error("%s: Failed to undo SCDB data for block: %s!", __func__, block.GetHash().ToString());
+    // Load SCDB undo data from disk & update mempool CTIP
+    if (fResyncSCDB && !ResyncSCDBAfterDisconnect(pindex->pprev)) {
+        error("%s: Failed to re-sync SCDB for disconnected block: %s!", __func__, block.GetHash().ToString());
         return DISCONNECT_FAILED;
     }
 
-    // Update mempool CTIP
-    mempool.UpdateCTIPFromBlock(scdb.GetCTIP(), true /* fDisconnect */);
-
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev->GetBlockHash());
 
     // Log that we have disconnected a block
-    LogPrintf("%s: Block disconnected:\n%s\n", __func__, block.ToString());
+    LogPrintf("%s: Block disconnected: %s\n", __func__, block.GetHash().ToString());
 
     return fClean ? DISCONNECT_OK : DISCONNECT_UNCLEAN;
 }
@@ -1924,13 +2023,201 @@ static bool WriteTxIndexDataForBlock(const CBlock& block, CValidationState& stat
     return true;
 }
 
+static bool WriteBlockStatsForBlock(const CBlock& block, const CBlockUndo& blockundo, CValidationState& state, CBlockIndex* pindex)
+{
+    if (!fBlockStatsIndex) return true;
+
+    CBlockStats stats;
+    ComputeBlockStats(block, blockundo, stats);
+
+    if (!pblocktree->WriteBlockStats({std::make_pair(pindex->GetBlockHash(), stats)})) {
+        return AbortNode(state, "Failed to write block stats index");
+    }
+
+    return true;
+}
+
+static bool WriteBlockFilterForBlock(const CBlock& block, const CBlockUndo& blockundo, CValidationState& state, CBlockIndex* pindex)
+{
+    if (!fBlockFilterIndex) return true;
+
+    if (!pblocktree->WriteBlockFilters({BlockFilter(block, blockundo)})) {
+        return AbortNode(state, "Failed to write block filter index");
+    }
+
+    return true;
+}
+
 static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
 
+/** Number of script checks PreCheckTransactionScripts and the mempool load run per pool task */
+static const size_t SCRIPT_PRECHECKS_PER_TASK = 16;
+
 void ThreadScriptCheck() {
     RenameThread("bitcoin-scriptch");
     scriptcheckqueue.Thread();
 }
 
+void PreCheckTransactionScripts(const std::vector<CTransactionRef>& vtx, CTaskPool& pool)
+{
+    CCoinsView viewDummy;
+    CCoinsViewCache view(&viewDummy);
+    {
+        LOCK2(cs_main, mempool.cs);
+        CCoinsViewMemPool viewMemPool(pcoinsTip.get(), mempool);
+        for (const CTransactionRef& tx : vtx) {
+            for (const CTxIn& txin : tx->vin) {
+                Coin coin;
+                if (!view.HaveCoinInCache(txin.prevout) && viewMemPool.GetCoin(txin.prevout, coin))
+                    view.AddCoin(txin.prevout, std::move(coin), false);
+            }
+        }
+    }
+
+    // CScriptCheck keeps a pointer to the precomputed data of its
+    // transaction, so don't let the vector reallocate.
+    std::vector<PrecomputedTransactionData> vTxData;
+    vTxData.reserve(vtx.size());
+
+    // The script execution cache needs cs_main, so build the checks here
+    // instead of going through CheckInputs. Only the signature cache, which
+    // has its own lock, is filled.
+    std::vector<CScriptCheck> vChecks;
+    for (const CTransactionRef& tx : vtx) {
+        if (tx->IsCoinBase() || !view.HaveInputs(*tx))
+            continue;
+
+        vTxData.emplace_back(*tx);
+        for (unsigned int i = 0; i < tx->vin.size(); i++) {
+            const Coin& coin = view.AccessCoin(tx->vin[i].prevout);
+            vChecks.emplace_back(coin.out, *tx, i, STANDARD_SCRIPT_VERIFY_FLAGS, true, &vTxData.back());
+        }
+
+        // Make the outputs available to descendants later in the batch
+        AddCoins(view, *tx, MEMPOOL_HEIGHT, true);
+    }
+
+    // Run the checks on the given pool rather than scriptcheckqueue, whose
+    // single master would make block validation wait for the batch.
+    std::vector<CTaskPool::Task> vTask;
+    for (size_t nBegin = 0; nBegin < vChecks.size(); nBegin += SCRIPT_PRECHECKS_PER_TASK) {
+        const size_t nEnd = std::min(nBegin + SCRIPT_PRECHECKS_PER_TASK, vChecks.size());
+        vTask.emplace_back([&vChecks, nBegin, nEnd] {
+            for (size_t i = nBegin; i < nEnd; i++)
+                vChecks[i]();
+        });
+    }
+    pool.Run(vTask);
+}
+
+/** Result of the Drivechain checks of a single block transaction */
+struct SidechainTxCheckResult
+{
+    //! Spends a sidechain CTIP
+    bool fSidechainInputs = false;
+    uint8_t nSidechain = 0;
+    //! B-WT^ hash could not be calculated
+    bool fInvalidFormat = false;
+    uint256 hashBWT;
+    //! Withdraws coins from the sidechain (M6)
+    bool fWTPrime = false;
+    bool fWTPrimeValid = false;
+    uint32_t nWTPrimeBurnIndex = 0;
+    //! Pays to a sidechain script (M5)
+    bool fDeposit = false;
+    bool fDepositValid = false;
+    SidechainDeposit deposit;
+};
+
+/**
+ * Closure representing the Drivechain (M5 / M6) checks of one transaction.
+ * SCDB is only read here (cs_main is held by ConnectBlock for the lifetime of
+ * the check) and the results are merged into SCDB in transaction order after
+ * all checks have finished.
+ */
+class CSidechainCheck
+{
+private:
+    const CTransaction *ptx;
+    std::vector<CTxOut> vSpent;
+    int nTx;
+    uint256 hashBlock;
+    bool fCheckDeposit;
+    SidechainTxCheckResult *result;
+
+public:
+    CSidechainCheck(): ptx(nullptr), nTx(0), fCheckDeposit(false), result(nullptr) {}
+    CSidechainCheck(const CTransaction& txIn, std::vector<CTxOut>& vSpentIn, int nTxIn, const uint256& hashBlockIn, bool fCheckDepositIn, SidechainTxCheckResult* resultIn) :
+        ptx(&txIn), nTx(nTxIn), hashBlock(hashBlockIn), fCheckDeposit(fCheckDepositIn), result(resultIn) { vSpent.swap(vSpentIn); }
+
+    bool operator()();
+
+    void swap(CSidechainCheck &check) {
+        std::swap(ptx, check.ptx);
+        vSpent.swap(check.vSpent);
+        std::swap(nTx, check.nTx);
+        std::swap(hashBlock, check.hashBlock);
+        std::swap(fCheckDeposit, check.fCheckDeposit);
+        std::swap(result, check.result);
+    }
+};
+
+bool CSidechainCheck::operator()() {
+    const CTransaction& tx = *ptx;
+
+    std::vector<CScript> vScript;
+    vScript.reserve(vSpent.size());
+    for (const CTxOut& out : vSpent)
+        vScript.push_back(out.scriptPubKey);
+
+    result->fSidechainInputs = scdb.HasSidechainScript(vScript, result->nSidechain);
+    if (result->fSidechainInputs) {
+        // We must get the B-WT^ hash as work is applied to
+        // WT^ before inputs and the change output are known.
+        if (!tx.GetBWTHash(result->hashBWT)) {
+            result->fInvalidFormat = true;
+        } else {
+            // Get values to and from sidechain
+            CAmount amtSidechainUTXO = CAmount(0);
+            CAmount amtUserInput = CAmount(0);
+            CAmount amtReturning = CAmount(0);
+            CAmount amtWithdrawn = CAmount(0);
+            GetSidechainValues(vSpent, tx, amtSidechainUTXO, amtUserInput, amtReturning, amtWithdrawn);
+
+            if (amtSidechainUTXO > amtReturning) {
+                // Note that we are just checking that the WT^ can be spent,
+                // it will be spent after all of the checks have finished
+                result->fWTPrime = true;
+                result->fWTPrimeValid = scdb.CheckWTPrimeSpend(result->nSidechain, tx, result->nWTPrimeBurnIndex, LogAcceptCategory(BCLog::SCDB) /* fDebug */);
+            }
+        }
+    }
+
+    if (fCheckDeposit) {
+        // Check for possible sidechain deposits
+        uint8_t nSidechain;
+        for (const CTxOut& out : tx.vout) {
+            if (scdb.HasSidechainScript(std::vector<CScript>{out.scriptPubKey}, nSidechain)) {
+                result->fDeposit = true;
+                break;
+            }
+        }
+        if (result->fDeposit)
+            result->fDepositValid = scdb.TxnToDeposit(tx, nTx, hashBlock, result->deposit);
+    }
+
+    // Failures are reported by ConnectBlock in transaction order, so never
+    // stop the queue early.
+    return true;
+}
+
+static CCheckQueue<CSidechainCheck> sidechaincheckqueue(128);
+
+void ThreadSidechainCheck() {
+    RenameThread("bitcoin-sidechainch");
+    sidechaincheckqueue.Thread();
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
@@ -2156,16 +2443,17 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
     std::vector<PrecomputedTransactionData> txdata;
     txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
-    std::vector<std::tuple<CTransaction, int, uint256>> vDepositTx;
-    std::vector<std::tuple<uint8_t, CTransaction, int>> vWTPrimeToSpend;
+
+    // Drivechain checks run on their own queue, results are indexed by tx
+    const uint256 hashBlock = block.GetHash();
+    std::vector<SidechainTxCheckResult> vSidechainResult(drivechainsEnabled ? block.vtx.size() : 0);
+    CCheckQueueControl<CSidechainCheck> sidechainControl(drivechainsEnabled && nScriptCheckThreads ? &sidechaincheckqueue : nullptr);
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
         const CTransaction &tx = *(block.vtx[i]);
 
         nInputs += tx.vin.size();
 
-        bool fSidechainInputs = false;
-        uint8_t nSidechain = 0;
         if (!tx.IsCoinBase())
         {
             CAmount txfee = 0;
@@ -2183,16 +2471,6 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
                                  REJECT_INVALID, "bad-txns-inputs-missingorspent");
 
 
-            // Set fSidechainInputs & nSidechain
-            if (drivechainsEnabled) {
-                std::vector<CScript> vScript;
-                for (const CTxIn& in : tx.vin) {
-                    Coin coin = view.AccessCoin(in.prevout);
-                    vScript.push_back(coin.out.scriptPubKey);
-                }
-                fSidechainInputs = scdb.HasSidechainScript(vScript, nSidechain);
-            }
-
             // Check that transaction is BIP68 final
             // BIP68 lock checks (as opposed to nLockTime checks) must
             // be in ConnectBlock because they require the UTXO set
@@ -2244,44 +2522,21 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
          * coins held in the CTIP output of the sidechain.
          */
 
-        if (drivechainsEnabled && fSidechainInputs) {
-            // We must get the B-WT^ hash as work is applied to
-            // WT^ before inputs and the change output are known.
-            uint256 hashBWT;
-            if (!tx.GetBWTHash(hashBWT))
-                return error("ConnectBlock(): WT^ (full id): %s has invalid format", tx.GetHash().ToString());
-
-            // Get values to and from sidechain
-            CAmount amtSidechainUTXO = CAmount(0);
-            CAmount amtUserInput = CAmount(0);
-            CAmount amtReturning = CAmount(0);
-            CAmount amtWithdrawn = CAmount(0);
-            GetSidechainValues(view, tx, amtSidechainUTXO, amtUserInput, amtReturning, amtWithdrawn);
-
-            if (amtSidechainUTXO > amtReturning) {
-                // Note that we are just checking that the WT^ can be spent,
-                // and then tracking it to spend later in the function
-                if (scdb.SpendWTPrime(nSidechain, block.GetHash(), tx, i, true /* fJustCheck */, true /* fDebug */)) {
-                    vWTPrimeToSpend.push_back(std::make_tuple(nSidechain, tx, i));
-                } else {
-                    return error("ConnectBlock(): Spend WT^ failed (blind WT^ hash : txid): %s : %s", hashBWT.ToString(), tx.GetHash().ToString());
-                }
-            }
-        }
-
-        if (drivechainsEnabled && !tx.IsCoinBase() && !fJustCheck) {
-            // Check for possible sidechain deposits
-            bool fSidechainOutput = false;
-            uint8_t nSidechain;
-            for (const CTxOut out : tx.vout) {
-                const CScript& scriptPubKey = out.scriptPubKey;
-                if (scdb.HasSidechainScript(std::vector<CScript>{scriptPubKey}, nSidechain)) {
-                    fSidechainOutput = true;
-                    break;
-                }
+        if (drivechainsEnabled) {
+            // The spent coins are gone from the view after UpdateCoins, so
+            // hand copies of their outputs to the check.
+            std::vector<CTxOut> vSpent;
+            if (!tx.IsCoinBase()) {
+                vSpent.reserve(tx.vin.size());
+                for (const CTxIn& in : tx.vin)
+                    vSpent.push_back(view.AccessCoin(in.prevout).out);
             }
-            if (fSidechainOutput)
-                vDepositTx.push_back(std::make_tuple(tx, i, block.GetHash()));
+            std::vector<CSidechainCheck> vSidechainChecks;
+            vSidechainChecks.emplace_back(tx, vSpent, i, hashBlock, !tx.IsCoinBase() && !fJustCheck, &vSidechainResult[i]);
+            if (nScriptCheckThreads)
+                sidechainControl.Add(vSidechainChecks);
+            else
+                vSidechainChecks.back()();
         }
 
         CTxUndo undoDummy;
@@ -2305,43 +2560,51 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     int64_t nTime4 = GetTimeMicros(); nTimeVerify += nTime4 - nTime2;
     LogPrint(BCLog::BENCH, "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs (%.2fms/blk)]\n", nInputs - 1, MILLI * (nTime4 - nTime2), nInputs <= 1 ? 0 : MILLI * (nTime4 - nTime2) / (nInputs-1), nTimeVerify * MICRO, nTimeVerify * MILLI / nBlocksTotal);
 
-    if (drivechainsEnabled && !fJustCheck && vDepositTx.size()) {
-        // Convert deposit transactions into SidechainDeposit objects
-        std::vector<SidechainDeposit> vDeposit;
-        for (size_t i = 0; i <  vDepositTx.size(); i++) {
-            const CTransaction tx = std::get<0>(vDepositTx[i]);
-            int nTx = std::get<1>(vDepositTx[i]);
-            uint256 hashBlock = std::get<2>(vDepositTx[i]);
-            SidechainDeposit deposit;
-            if (!scdb.TxnToDeposit(tx, nTx, hashBlock, deposit)) {
+    sidechainControl.Wait();
+
+    // Merge the results of the Drivechain checks in transaction order
+    std::vector<SidechainDeposit> vDeposit;
+    std::vector<size_t> vWTPrimeToSpend;
+    for (size_t i = 0; i < vSidechainResult.size(); i++) {
+        const CTransaction& tx = *(block.vtx[i]);
+        SidechainTxCheckResult& result = vSidechainResult[i];
+
+        if (result.fInvalidFormat)
+            return error("ConnectBlock(): WT^ (full id): %s has invalid format", tx.GetHash().ToString());
+
+        if (result.fWTPrime) {
+            if (!result.fWTPrimeValid)
+                return error("ConnectBlock(): Spend WT^ failed (blind WT^ hash : txid): %s : %s", result.hashBWT.ToString(), tx.GetHash().ToString());
+            vWTPrimeToSpend.push_back(i);
+        }
+
+        if (result.fDeposit) {
+            if (!result.fDepositValid) {
                 LogPrintf("%s: Deposits invalid from block: %s\n", __func__, block.GetHash().ToString());
                 return error("%s: Deposits invalid from block: %s", __func__, block.GetHash().ToString());
             }
             // Skip WT^ change return deposit, handled by SCDB::SpendWTPrime
-            if (deposit.strDest == SIDECHAIN_WTPRIME_RETURN_DEST)
-                continue;
-            vDeposit.push_back(deposit);
+            if (result.deposit.strDest != SIDECHAIN_WTPRIME_RETURN_DEST)
+                vDeposit.push_back(std::move(result.deposit));
         }
-        scdb.AddDeposits(vDeposit);
     }
 
-    if (drivechainsEnabled && vWTPrimeToSpend.size()) {
-        for (size_t i = 0; i < vWTPrimeToSpend.size(); i++) {
-            uint8_t nSidechain = std::get<0>(vWTPrimeToSpend[i]);
-            const CTransaction tx = std::get<1>(vWTPrimeToSpend[i]);
-            int nTx = std::get<2>(vWTPrimeToSpend[i]);
+    if (drivechainsEnabled && !fJustCheck && vDeposit.size())
+        scdb.AddDeposits(vDeposit);
 
-            uint256 hashBWT;
-            tx.GetBWTHash(hashBWT);
-            if (!scdb.SpendWTPrime(nSidechain, block.GetHash(), tx, nTx, fJustCheck, true /* fDebug */)) {
-                return error("ConnectBlock(): Final spend WT^ failed (blind WT^ hash : txid): %s : %s.\n nSidechain: %u\n", hashBWT.ToString(), tx.GetHash().ToString(), nSidechain);
+    // The WT^(s) were verified by the checks above, spend them now
+    if (drivechainsEnabled && !fJustCheck) {
+        for (size_t i : vWTPrimeToSpend) {
+            const SidechainTxCheckResult& result = vSidechainResult[i];
+            if (!scdb.ApplyWTPrimeSpend(result.nSidechain, hashBlock, *(block.vtx[i]), i, result.nWTPrimeBurnIndex, LogAcceptCategory(BCLog::SCDB) /* fDebug */)) {
+                return error("ConnectBlock(): Final spend WT^ failed (blind WT^ hash : txid): %s : %s.\n nSidechain: %u\n", result.hashBWT.ToString(), block.vtx[i]->GetHash().ToString(), result.nSidechain);
             }
         }
     }
 
     if (drivechainsEnabled) {
         // Update / synchronize SCDB
-        if (!scdb.Update(pindex->nHeight, block.GetHash(), block.GetPrevHash(), block.vtx[0]->vout, fJustCheck, true /* fDebug */)) {
+        if (!scdb.Update(pindex->nHeight, block.GetHash(), block.GetPrevHash(), block.vtx[0]->vout, fJustCheck, LogAcceptCategory(BCLog::SCDB) /* fDebug */)) {
             LogPrintf("%s: SCDB failed to update with block: %s\n", __func__, block.GetHash().ToString());
             return error("%s: SCDB update failed for block: %s", __func__, block.GetHash().ToString());
         }
@@ -2364,6 +2627,12 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     if (!WriteTxIndexDataForBlock(block, state, pindex))
         return false;
 
+    if (!WriteBlockStatsForBlock(block, blockundo, state, pindex))
+        return false;
+
+    if (!WriteBlockFilterForBlock(block, blockundo, state, pindex))
+        return false;
+
     // TODO
     // Instead of writing the entire vector of sidechains with each block for
     // undo purposes, store the sidechain only once with LDB and then maintain
@@ -2600,7 +2869,7 @@ void static UpdateTip(const CBlockIndex *pindexNew, const CChainParams& chainPar
   * disconnectpool (note that the caller is responsible for mempool consistency
   * in any case).
   */
-bool CChainState::DisconnectTip(CValidationState& state, const CChainParams& chainparams, DisconnectedBlockTransactions *disconnectpool)
+bool CChainState::DisconnectTip(CValidationState& state, const CChainParams& chainparams, DisconnectedBlockTransactions *disconnectpool, bool fResyncSCDB)
 {
     CBlockIndex *pindexDelete = chainActive.Tip();
     assert(pindexDelete);
@@ -2614,11 +2883,17 @@ bool CChainState::DisconnectTip(CValidationState& state, const CChainParams& cha
     {
         CCoinsViewCache view(pcoinsTip.get());
         assert(view.GetBestBlock() == pindexDelete->GetBlockHash());
-        if (DisconnectBlock(block, pindexDelete, view) != DISCONNECT_OK)
+        if (DisconnectBlock(block, pindexDelete, view, fResyncSCDB) != DISCONNECT_OK)
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         bool flushed = view.Flush();
         assert(flushed);
     }
+    // Remove the block stats index entry here instead of in DisconnectBlock,
+    // which VerifyDB also uses on blocks that stay connected.
+    if (fBlockStatsIndex && !pblocktree->EraseBlockStats(pindexDelete->GetBlockHash()))
+        return AbortNode(state, "Failed to erase block stats index entry");
+    if (fBlockFilterIndex && !pblocktree->EraseBlockFilter(pindexDelete->GetBlockHash()))
+        return AbortNode(state, "Failed to erase block filter index entry");
     LogPrint(BCLog::BENCH, "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * MILLI);
     // Write the chain state to disk, if necessary.
     if (!FlushStateToDisk(chainparams, state, FLUSH_STATE_IF_NEEDED))
@@ -2640,6 +2915,10 @@ bool CChainState::DisconnectTip(CValidationState& state, const CChainParams& cha
     chainActive.SetTip(pindexDelete->pprev);
 
     UpdateTip(pindexDelete->pprev, chainparams);
+    // When disconnecting several blocks SCDB is only valid again after the
+    // caller resyncs it, which publishes the snapshot then
+    if (fResyncSCDB)
+        PublishChainSnapshot();
     // Let wallets know transactions went from 1-confirmed to
     // 0-confirmed or conflicted:
     GetMainSignals().BlockDisconnected(pblock);
@@ -2776,6 +3055,7 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
     // Update chainActive & related variables.
     chainActive.SetTip(pindexNew);
     UpdateTip(pindexNew, chainparams);
+    PublishChainSnapshot();
 
     int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
     LogPrint(BCLog::BENCH, "  - Connect postprocess: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime6 - nTime5) * MILLI, nTimePostConnect * MICRO, nTimePostConnect * MILLI / nBlocksTotal);
@@ -2866,18 +3146,32 @@ bool CChainState::ActivateBestChainStep(CValidationState& state, const CChainPar
     const CBlockIndex *pindexFork = chainActive.FindFork(pindexMostWork);
 
     // Disconnect active blocks which are no longer in the best chain.
+    // SCDB is resynced once from the fork point's data rather than after each
+    // disconnected block.
     bool fBlocksDisconnected = false;
     DisconnectedBlockTransactions disconnectpool;
     while (chainActive.Tip() && chainActive.Tip() != pindexFork) {
-        if (!DisconnectTip(state, chainparams, &disconnectpool)) {
+        if (!DisconnectTip(state, chainparams, &disconnectpool, false /* fResyncSCDB */)) {
             // This is likely a fatal error, but keep the mempool consistent,
             // just in case. Only remove from the mempool in this case.
+            if (fBlocksDisconnected) {
+                ResyncSCDBAfterDisconnect(chainActive.Tip());
+                PublishChainSnapshot();
+            }
             UpdateMempoolForReorg(disconnectpool, false);
             return false;
         }
         fBlocksDisconnected = true;
     }
 
+    if (fBlocksDisconnected && !ResyncSCDBAfterDisconnect(chainActive.Tip())) {
+        PublishChainSnapshot();
+        UpdateMempoolForReorg(disconnectpool, false);
+        return error("%s: Failed to re-sync SCDB after disconnecting to block: %s", __func__, chainActive.Tip()->GetBlockHash().ToString());
+    }
+    if (fBlocksDisconnected)
+        PublishChainSnapshot();
+
     // Build list of new blocks to connect.
     std::vector<CBlockIndex*> vpindexToConnect;
     bool fContinue = true;
@@ -3103,14 +3397,26 @@ bool CChainState::InvalidateBlock(CValidationState& state, const CChainParams& c
         pindex_was_in_chain = true;
         // ActivateBestChain considers blocks already in chainActive
         // unconditionally valid already, so force disconnect away from it.
-        if (!DisconnectTip(state, chainparams, &disconnectpool)) {
+        if (!DisconnectTip(state, chainparams, &disconnectpool, false /* fResyncSCDB */)) {
             // It's probably hopeless to try to make the mempool consistent
             // here if DisconnectTip failed, but we can try.
+            if (pindex_was_in_chain) {
+                ResyncSCDBAfterDisconnect(chainActive.Tip());
+                PublishChainSnapshot();
+            }
             UpdateMempoolForReorg(disconnectpool, false);
             return false;
         }
     }
 
+    if (pindex_was_in_chain && !ResyncSCDBAfterDisconnect(chainActive.Tip())) {
+        PublishChainSnapshot();
+        UpdateMempoolForReorg(disconnectpool, false);
+        return error("%s: Failed to re-sync SCDB after disconnecting to block: %s", __func__, chainActive.Tip()->GetBlockHash().ToString());
+    }
+    if (pindex_was_in_chain)
+        PublishChainSnapshot();
+
     // Now mark the blocks we just disconnected as descendants invalid
     // (note this may not be all descendants).
     while (pindex_was_in_chain && invalid_walk_tip != pindex) {
@@ -4868,6 +5174,10 @@ void UnloadBlockIndex()
 {
     LOCK(cs_main);
     chainActive.SetTip(nullptr);
+    {
+        std::lock_guard<std::mutex> lock(g_chain_snapshot_mutex);
+        g_chain_snapshot.reset();
+    }
     pindexBestInvalid = nullptr;
     pindexBestHeader = nullptr;
     mempool.clear();
@@ -5278,9 +5588,327 @@ int VersionBitsTipStateSinceHeight(const Consensus::Params& params, Consensus::D
     return VersionBitsStateSinceHeight(chainActive.Tip(), params, pos, versionbitscache);
 }
 
-static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+static const uint64_t MEMPOOL_DUMP_VERSION_LEGACY = 1;
+static const uint64_t MEMPOOL_DUMP_VERSION = 2;
+
+/** Number of transactions whose scripts are checked together while loading the mempool */
+static const size_t MEMPOOL_LOAD_BATCH_SIZE = 1000;
+
+namespace {
+/**
+ * A mempool.dat entry. Besides the transaction it stores what mempool
+ * acceptance computed for it, which is compared with the values computed
+ * again when the entry is added back without AcceptToMemoryPool, and the
+ * positions in the dump of its in-mempool parents. Entries are written
+ * parents first.
+ */
+struct MempoolDumpEntry
+{
+    CTransactionRef tx;
+    int64_t nTime;
+    int64_t nFeeDelta;
+    CAmount nFee;
+    int64_t nSigOpCost;
+    bool fSpendsCoinbase;
+    bool fSpendsCriticalData;
+    bool fSidechainDeposit;
+    uint8_t nSidechain;
+    std::vector<uint32_t> vParent;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(tx);
+        READWRITE(nTime);
+        READWRITE(nFeeDelta);
+        READWRITE(nFee);
+        READWRITE(nSigOpCost);
+        READWRITE(fSpendsCoinbase);
+        READWRITE(fSpendsCriticalData);
+        READWRITE(fSidechainDeposit);
+        READWRITE(nSidechain);
+        READWRITE(vParent);
+    }
+};
+} // namespace
 
-bool LoadMempool(void)
+/**
+ * Add a mempool.dat entry back to the mempool without going through
+ * AcceptToMemoryPool. Only valid while the chain tip is the one the mempool
+ * was dumped at and once the scripts of the transaction passed
+ * CheckMempoolDumpScripts. Everything else mempool acceptance checks is
+ * computed again here and compared with the results stored in the dump.
+ * Returns false if anything differs or needs the sidechain state of the
+ * mempool, in which case the caller falls back to full validation.
+ */
+static bool AddMempoolDumpEntry(CTxMemPool& pool, const MempoolDumpEntry& dumped)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(pool.cs);
+
+    const CChainParams& chainparams = Params();
+    const CTransaction& tx = *dumped.tx;
+    const uint256& hash = tx.GetHash();
+
+    // Deposits update the sidechain CTIP tracked by the mempool and critical
+    // data depends on the tip, leave them to AcceptToMemoryPool.
+    if (dumped.fSidechainDeposit || !tx.criticalData.IsNull())
+        return false;
+
+    CValidationState state;
+    if (!CheckTransaction(tx, state) || tx.IsCoinBase())
+        return false;
+
+    const bool fWitnessEnabled = IsWitnessEnabled(chainActive.Tip(), chainparams.GetConsensus());
+    if (tx.HasWitness() && !fWitnessEnabled)
+        return false;
+
+    std::string reason;
+    if (fRequireStandard && !IsStandardTx(tx, reason, fWitnessEnabled))
+        return false;
+
+    if (!CheckFinalTx(tx, STANDARD_LOCKTIME_VERIFY_FLAGS))
+        return false;
+
+    for (const CTxIn& txin : tx.vin) {
+        if (pool.mapNextTx.count(txin.prevout))
+            return false;
+    }
+
+    CCoinsViewMemPool viewMemPool(pcoinsTip.get(), pool);
+    CCoinsViewCache view(&viewMemPool);
+    if (!view.HaveInputs(tx))
+        return false;
+
+    const bool fDrivechainsEnabled = IsDrivechainEnabled(chainActive.Tip(), chainparams.GetConsensus());
+    if (fDrivechainsEnabled) {
+        CAmount amtSidechainUTXO = 0;
+        CAmount amtUserInput = 0;
+        CAmount amtReturning = 0;
+        CAmount amtWithdrawn = 0;
+        GetSidechainValues(view, tx, amtSidechainUTXO, amtUserInput, amtReturning, amtWithdrawn);
+        if (amtSidechainUTXO || amtReturning)
+            return false;
+    }
+
+    LockPoints lp;
+    if (!CheckSequenceLocks(tx, STANDARD_LOCKTIME_VERIFY_FLAGS, &lp))
+        return false;
+
+    CAmount nFees = 0;
+    if (!Consensus::CheckTxInputs(tx, state, view, GetSpendHeight(view), nFees))
+        return false;
+
+    if (fRequireStandard && !AreInputsStandard(tx, view))
+        return false;
+    if (tx.HasWitness() && fRequireStandard && !IsWitnessStandard(tx, view))
+        return false;
+
+    const int64_t nSigOpsCost = GetTransactionSigOpCost(tx, view, STANDARD_SCRIPT_VERIFY_FLAGS);
+    if (nSigOpsCost > MAX_STANDARD_TX_SIGOPS_COST)
+        return false;
+
+    bool fSpendsCoinbase = false;
+    bool fSpendsCriticalData = false;
+    for (const CTxIn& txin : tx.vin) {
+        const Coin& coin = view.AccessCoin(txin.prevout);
+        if (coin.IsCoinBase())
+            fSpendsCoinbase = true;
+        if (fDrivechainsEnabled && coin.IsCriticalData())
+            fSpendsCriticalData = true;
+    }
+
+    // The spent coins are the same as at the time of the dump, so should be
+    // everything computed from them
+    if (nFees != dumped.nFee || nSigOpsCost != dumped.nSigOpCost ||
+            fSpendsCoinbase != dumped.fSpendsCoinbase || fSpendsCriticalData != dumped.fSpendsCriticalData)
+        return false;
+
+    CTxMemPoolEntry entry(dumped.tx, nFees, dumped.nTime, chainActive.Height(),
+                          fSpendsCoinbase, fSpendsCriticalData,
+                          false /* fSidechainDeposit */, 0 /* nSidechain */, nSigOpsCost, lp);
+
+    // Fee policy may have changed since the dump
+    CAmount nModifiedFees = nFees;
+    pool.ApplyDelta(hash, nModifiedFees);
+    const size_t nSize = entry.GetTxSize();
+    if (nModifiedFees < pool.GetMinFee(gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize))
+        return false;
+    if (nModifiedFees < ::minRelayTxFee.GetFee(nSize))
+        return false;
+
+    CTxMemPool::setEntries setAncestors;
+    size_t nLimitAncestors = gArgs.GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+    size_t nLimitAncestorSize = gArgs.GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT)*1000;
+    size_t nLimitDescendants = gArgs.GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+    size_t nLimitDescendantSize = gArgs.GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT)*1000;
+    std::string errString;
+    if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString))
+        return false;
+
+    pool.addUnchecked(hash, entry, setAncestors, false /* validFeeEstimate */);
+    GetMainSignals().TransactionAddedToMempool(dumped.tx);
+    return true;
+}
+
+/**
+ * Run the script checks of a batch of dumped transactions on pool.
+ * Transactions are checked against the mempool and the
+ * outputs of their parents earlier in the batch; vChecked tells which ones
+ * had all their inputs available. Returns whether all of their checks
+ * passed. Either way the signatures end up in the signature cache, so that
+ * AcceptToMemoryPool, which validates one transaction at a time, doesn't
+ * have to verify them itself.
+ *
+ * The checks are collected under cs_main and mempool.cs, but run after
+ * both are released.
+ */
+static bool CheckMempoolDumpScripts(const std::vector<MempoolDumpEntry>& vBatch, unsigned int flags, std::vector<bool>& vChecked, CTaskPool& pool)
+{
+    vChecked.assign(vBatch.size(), false);
+
+    // CScriptCheck keeps a pointer to the precomputed data of its
+    // transaction, so don't let the vector reallocate.
+    std::vector<PrecomputedTransactionData> vTxData;
+    vTxData.reserve(vBatch.size());
+    std::vector<CScriptCheck> vChecks;
+    {
+        LOCK2(cs_main, mempool.cs);
+        CCoinsViewMemPool viewMemPool(pcoinsTip.get(), mempool);
+        CCoinsViewCache view(&viewMemPool);
+        for (size_t i = 0; i < vBatch.size(); i++) {
+            const CTransaction& tx = *vBatch[i].tx;
+            if (tx.IsCoinBase() || mempool.exists(tx.GetHash()) || !view.HaveInputs(tx))
+                continue;
+
+            vTxData.emplace_back(tx);
+            CValidationState state;
+            if (!CheckInputs(tx, state, view, true, flags, true, false, vTxData.back(), &vChecks))
+                return false;
+            vChecked[i] = true;
+
+            // Let children later in the batch find their inputs
+            UpdateCoins(tx, view, MEMPOOL_HEIGHT);
+        }
+    }
+
+    // Like PreCheckTransactionScripts, stay off scriptcheckqueue so that
+    // block validation doesn't wait for the batch
+    std::atomic<bool> fValid(true);
+    std::vector<CTaskPool::Task> vTask;
+    for (size_t nBegin = 0; nBegin < vChecks.size(); nBegin += SCRIPT_PRECHECKS_PER_TASK) {
+        const size_t nEnd = std::min(nBegin + SCRIPT_PRECHECKS_PER_TASK, vChecks.size());
+        vTask.emplace_back([&vChecks, &fValid, nBegin, nEnd] {
+            for (size_t i = nBegin; i < nEnd && fValid; i++) {
+                if (!vChecks[i]())
+                    fValid = false;
+            }
+        });
+    }
+    pool.Run(vTask);
+    return fValid;
+}
+
+/**
+ * Check the hash at the end of a mempool.dat, hashing the file in chunks
+ * rather than reading it into memory at once. The file is left positioned
+ * just after the version.
+ */
+static bool CheckMempoolDumpChecksum(FILE* file)
+{
+    const size_t nHeaderSize = sizeof(uint64_t);
+    if (fseek(file, 0, SEEK_END) != 0)
+        return false;
+    const long nFileSize = ftell(file);
+    if (nFileSize < 0 || (size_t)nFileSize < nHeaderSize + 32) {
+        LogPrintf("Mempool file from disk is truncated. Continuing anyway.\n");
+        return false;
+    }
+
+    rewind(file);
+    CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+    char buf[65536];
+    size_t nLeft = nFileSize - 32;
+    while (nLeft > 0) {
+        const size_t nRead = fread(buf, 1, std::min(nLeft, sizeof(buf)), file);
+        if (nRead == 0)
+            return false;
+        hasher.write(buf, nRead);
+        nLeft -= nRead;
+    }
+    uint256 hashChecksum;
+    if (fread(hashChecksum.begin(), 1, 32, file) != 32)
+        return false;
+    if (hasher.GetHash() != hashChecksum) {
+        LogPrintf("Mempool file from disk has a bad checksum. Continuing anyway.\n");
+        return false;
+    }
+
+    return fseek(file, nHeaderSize, SEEK_SET) == 0;
+}
+
+static bool LoadMempoolLegacy(CAutoFile& file)
+{
+    const CChainParams& chainparams = Params();
+    int64_t nExpiryTimeout = gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+
+    int64_t count = 0;
+    int64_t expired = 0;
+    int64_t failed = 0;
+    int64_t already_there = 0;
+    int64_t nNow = GetTime();
+
+    uint64_t num;
+    file >> num;
+    while (num--) {
+        CTransactionRef tx;
+        int64_t nTime;
+        int64_t nFeeDelta;
+        file >> tx;
+        file >> nTime;
+        file >> nFeeDelta;
+
+        CAmount amountdelta = nFeeDelta;
+        if (amountdelta) {
+            mempool.PrioritiseTransaction(tx->GetHash(), amountdelta);
+        }
+        CValidationState state;
+        if (nTime + nExpiryTimeout > nNow) {
+            LOCK(cs_main);
+            AcceptToMemoryPoolWithTime(chainparams, mempool, state, tx, nullptr /* pfMissingInputs */, nTime,
+                                       nullptr /* plTxnReplaced */, false /* bypass_limits */, 0 /* nAbsurdFee */);
+            if (state.IsValid()) {
+                ++count;
+            } else {
+                // mempool may contain the transaction already, e.g. from
+                // wallet(s) having loaded it while we were processing
+                // mempool transactions; consider these as valid, instead of
+                // failed, but mark them as 'already there'
+                if (mempool.exists(tx->GetHash())) {
+                    ++already_there;
+                } else {
+                    ++failed;
+                }
+            }
+        } else {
+            ++expired;
+        }
+        if (ShutdownRequested())
+            return false;
+    }
+    std::map<uint256, CAmount> mapDeltas;
+    file >> mapDeltas;
+
+    for (const auto& i : mapDeltas) {
+        mempool.PrioritiseTransaction(i.first, i.second);
+    }
+
+    LogPrintf("Imported mempool transactions from disk: %i succeeded, %i failed, %i expired, %i already there\n", count, failed, expired, already_there);
+    return true;
+}
+
+bool LoadMempool(CTaskPool& pool, int64_t* pnFastPath)
 {
     const CChainParams& chainparams = Params();
     int64_t nExpiryTimeout = gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
@@ -5291,59 +5919,134 @@ bool LoadMempool(void)
         return false;
     }
 
+    int64_t nStart = GetTimeMicros();
+    if (pnFastPath)
+        *pnFastPath = 0;
+
     int64_t count = 0;
+    int64_t unchanged = 0;
     int64_t expired = 0;
     int64_t failed = 0;
     int64_t already_there = 0;
     int64_t nNow = GetTime();
 
+    // The script flags AcceptToMemoryPool checks with
+    unsigned int scriptVerifyFlags = STANDARD_SCRIPT_VERIFY_FLAGS;
+    if (!chainparams.RequireStandard()) {
+        scriptVerifyFlags = gArgs.GetArg("-promiscuousmempoolflags", scriptVerifyFlags);
+    }
+
     try {
         uint64_t version;
         file >> version;
+        if (version == MEMPOOL_DUMP_VERSION_LEGACY) {
+            return LoadMempoolLegacy(file);
+        }
         if (version != MEMPOOL_DUMP_VERSION) {
             return false;
         }
-        uint64_t num;
-        file >> num;
-        while (num--) {
-            CTransactionRef tx;
-            int64_t nTime;
-            int64_t nFeeDelta;
-            file >> tx;
-            file >> nTime;
-            file >> nFeeDelta;
-
-            CAmount amountdelta = nFeeDelta;
-            if (amountdelta) {
-                mempool.PrioritiseTransaction(tx->GetHash(), amountdelta);
+
+        // The dump ends with the hash of everything before it
+        if (!CheckMempoolDumpChecksum(file.Get()))
+            return false;
+
+        uint256 hashTip;
+        file >> hashTip;
+        const uint64_t nEntry = ReadCompactSize(file);
+
+        // Whether each entry made it (back) into the mempool
+        std::vector<bool> vLoaded;
+
+        std::vector<MempoolDumpEntry> vBatch;
+        std::vector<bool> vChecked;
+        for (uint64_t nBatch = 0; nBatch < nEntry; nBatch += MEMPOOL_LOAD_BATCH_SIZE) {
+            vBatch.clear();
+            for (uint64_t i = nBatch; i < nEntry && i < nBatch + MEMPOOL_LOAD_BATCH_SIZE; i++) {
+                vBatch.emplace_back();
+                file >> vBatch.back();
             }
-            CValidationState state;
-            if (nTime + nExpiryTimeout > nNow) {
+
+            bool fTipChanged;
+            {
                 LOCK(cs_main);
-                AcceptToMemoryPoolWithTime(chainparams, mempool, state, tx, nullptr /* pfMissingInputs */, nTime,
+                fTipChanged = chainActive.Tip() == nullptr || chainActive.Tip()->GetBlockHash() != hashTip;
+            }
+            // While the tip is the one of the dump, entries whose scripts
+            // pass here skip AcceptToMemoryPool. Otherwise this only fills
+            // the signature cache ahead of it.
+            const bool fScriptsValid = CheckMempoolDumpScripts(vBatch, scriptVerifyFlags, vChecked, pool) && !fTipChanged;
+
+            for (size_t j = 0; j < vBatch.size(); j++) {
+                const MempoolDumpEntry& dumped = vBatch[j];
+                const uint64_t i = vLoaded.size();
+                vLoaded.push_back(false);
+
+                if (dumped.nFeeDelta) {
+                    mempool.PrioritiseTransaction(dumped.tx->GetHash(), dumped.nFeeDelta);
+                }
+                if (dumped.nTime + nExpiryTimeout <= nNow) {
+                    ++expired;
+                    continue;
+                }
+
+                // Children of transactions that didn't make it can't either
+                bool fMissingParent = false;
+                for (uint32_t nParent : dumped.vParent) {
+                    if (nParent >= i || !vLoaded[nParent])
+                        fMissingParent = true;
+                }
+                if (fMissingParent) {
+                    ++failed;
+                    continue;
+                }
+
+                LOCK(cs_main);
+                {
+                    LOCK(mempool.cs);
+                    if (mempool.exists(dumped.tx->GetHash())) {
+                        vLoaded[i] = true;
+                        ++already_there;
+                        continue;
+                    }
+                    if (fScriptsValid && vChecked[j] && chainActive.Tip()->GetBlockHash() == hashTip &&
+                            AddMempoolDumpEntry(mempool, dumped)) {
+                        vLoaded[i] = true;
+                        ++unchanged;
+                        ++count;
+                        continue;
+                    }
+                }
+
+                CValidationState state;
+                AcceptToMemoryPoolWithTime(chainparams, mempool, state, dumped.tx, nullptr /* pfMissingInputs */, dumped.nTime,
                                            nullptr /* plTxnReplaced */, false /* bypass_limits */, 0 /* nAbsurdFee */);
                 if (state.IsValid()) {
+                    vLoaded[i] = true;
                     ++count;
-                } else {
+                } else if (mempool.exists(dumped.tx->GetHash())) {
                     // mempool may contain the transaction already, e.g. from
                     // wallet(s) having loaded it while we were processing
                     // mempool transactions; consider these as valid, instead of
                     // failed, but mark them as 'already there'
-                    if (mempool.exists(tx->GetHash())) {
-                        ++already_there;
-                    } else {
-                        ++failed;
-                    }
+                    vLoaded[i] = true;
+                    ++already_there;
+                } else {
+                    ++failed;
                 }
-            } else {
-                ++expired;
             }
             if (ShutdownRequested())
                 return false;
         }
+
         std::map<uint256, CAmount> mapDeltas;
         file >> mapDeltas;
 
+        {
+            // Entries added without AcceptToMemoryPool skip the size limit
+            LOCK(cs_main);
+            LimitMempoolSize(mempool, gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, gArgs.GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+        }
+
         for (const auto& i : mapDeltas) {
             mempool.PrioritiseTransaction(i.first, i.second);
         }
@@ -5352,7 +6055,10 @@ bool LoadMempool(void)
         return false;
     }
 
-    LogPrintf("Imported mempool transactions from disk: %i succeeded, %i failed, %i expired, %i already there\n", count, failed, expired, already_there);
+    if (pnFastPath)
+        *pnFastPath = unchanged;
+
+    LogPrintf("Imported mempool transactions from disk: %i succeeded (%i without AcceptToMemoryPool), %i failed, %i expired, %i already there in %.2fs\n", count, unchanged, failed, expired, already_there, (GetTimeMicros() - nStart) * MICRO);
     return true;
 }
 
@@ -5361,38 +6067,62 @@ bool DumpMempool(void)
     int64_t start = GetTimeMicros();
 
     std::map<uint256, CAmount> mapDeltas;
-    std::vector<TxMempoolInfo> vinfo;
+    std::vector<MempoolDumpEntry> vEntry;
+    uint256 hashTip;
 
     {
-        LOCK(mempool.cs);
+        LOCK2(cs_main, mempool.cs);
+        if (chainActive.Tip())
+            hashTip = chainActive.Tip()->GetBlockHash();
         for (const auto &i : mempool.mapDeltas) {
             mapDeltas[i.first] = i.second;
         }
-        vinfo = mempool.infoAll();
+
+        // infoAll() returns entries sorted by ancestor count, so parents
+        // always come before their children.
+        std::vector<TxMempoolInfo> vinfo = mempool.infoAll();
+        std::map<uint256, uint32_t> mapPosition;
+        vEntry.reserve(vinfo.size());
+        for (const auto& i : vinfo) {
+            CTxMemPool::txiter it = mempool.mapTx.find(i.tx->GetHash());
+            MempoolDumpEntry dumped;
+            dumped.tx = i.tx;
+            dumped.nTime = i.nTime;
+            dumped.nFeeDelta = i.nFeeDelta;
+            dumped.nFee = it->GetFee();
+            dumped.nSigOpCost = it->GetSigOpCost();
+            dumped.fSpendsCoinbase = it->GetSpendsCoinbase();
+            dumped.fSpendsCriticalData = it->GetSpendsCriticalData();
+            dumped.fSidechainDeposit = it->GetSidechainDeposit();
+            dumped.nSidechain = it->GetSidechainNumber();
+            for (CTxMemPool::txiter parent : mempool.GetMemPoolParents(it)) {
+                auto pos = mapPosition.find(parent->GetTx().GetHash());
+                assert(pos != mapPosition.end());
+                dumped.vParent.push_back(pos->second);
+            }
+            mapPosition.emplace(i.tx->GetHash(), vEntry.size());
+            vEntry.push_back(std::move(dumped));
+            mapDeltas.erase(i.tx->GetHash());
+        }
     }
 
     int64_t mid = GetTimeMicros();
 
     try {
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ss << MEMPOOL_DUMP_VERSION;
+        ss << hashTip;
+        ss << vEntry;
+        ss << mapDeltas;
+        ss << Hash(ss.begin(), ss.end());
+
         FILE* filestr = fsbridge::fopen(GetDataDir() / "mempool.dat.new", "wb");
         if (!filestr) {
             return false;
         }
 
         CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
-
-        uint64_t version = MEMPOOL_DUMP_VERSION;
-        file << version;
-
-        file << (uint64_t)vinfo.size();
-        for (const auto& i : vinfo) {
-            file << *(i.tx);
-            file << (int64_t)i.nTime;
-            file << (int64_t)i.nFeeDelta;
-            mapDeltas.erase(i.tx->GetHash());
-        }
-
-        file << mapDeltas;
+        file.write(ss.data(), ss.size());
         FileCommit(file.Get());
         file.fclose();
         RenameOver(GetDataDir() / "mempool.dat.new", GetDataDir() / "mempool.dat");
@@ -5980,6 +6710,63 @@ bool ResyncSCDB(const CBlockIndex* pindex)
     return true;
 }
 
+void PublishChainSnapshot()
+{
+    AssertLockHeld(cs_main);
+
+    std::shared_ptr<ChainSnapshot> snapshot = std::make_shared<ChainSnapshot>();
+    snapshot->pindexTip = chainActive.Tip();
+    snapshot->scdb = scdb.GetSnapshot();
+
+    std::lock_guard<std::mutex> lock(g_chain_snapshot_mutex);
+    g_chain_snapshot = std::move(snapshot);
+    g_chain_snapshot_cv.notify_all();
+}
+
+std::shared_ptr<const ChainSnapshot> GetChainSnapshot()
+{
+    std::lock_guard<std::mutex> lock(g_chain_snapshot_mutex);
+    if (!g_chain_snapshot) {
+        std::shared_ptr<ChainSnapshot> snapshot = std::make_shared<ChainSnapshot>();
+        snapshot->pindexTip = nullptr;
+        snapshot->scdb = std::make_shared<SCDBSnapshot>();
+        g_chain_snapshot = std::move(snapshot);
+    }
+    return g_chain_snapshot;
+}
+
+std::shared_ptr<const ChainSnapshot> WaitForChainSnapshot(const std::shared_ptr<const ChainSnapshot>& snapshot, int64_t nTimeout)
+{
+    std::unique_lock<std::mutex> lock(g_chain_snapshot_mutex);
+    auto fWake = [&snapshot]{ return g_chain_snapshot != snapshot || g_chain_snapshot_interrupted; };
+    if (nTimeout > 0)
+        g_chain_snapshot_cv.wait_for(lock, std::chrono::milliseconds(nTimeout), fWake);
+    else
+        g_chain_snapshot_cv.wait(lock, fWake);
+    return g_chain_snapshot ? g_chain_snapshot : snapshot;
+}
+
+void InterruptChainSnapshotWaiters()
+{
+    std::lock_guard<std::mutex> lock(g_chain_snapshot_mutex);
+    g_chain_snapshot_interrupted = true;
+    g_chain_snapshot_cv.notify_all();
+}
+
+bool ResyncSCDBAfterDisconnect(const CBlockIndex* pindex)
+{
+    if (!pindex)
+        return true;
+
+    if (!ResyncSCDB(pindex))
+        return false;
+
+    // Revert mempool CTIP to match SCDB
+    mempool.UpdateCTIPFromBlock(scdb.GetCTIP(), true /* fDisconnect */);
+
+    return true;
+}
+
 double GetNetworkHashPerSecond(int nLookup, int nHeight)
 {
     CBlockIndex *pb = chainActive.Tip();
@@ -6030,3 +6817,242 @@ public:
         mapBlockIndex.clear();
     }
 } instance_of_cmaincleanup;
+
+void ComputeBlockStats(const CBlock& block, const CBlockUndo& blockundo, CBlockStats& stats)
+{
+    AssertLockHeld(cs_main);
+    assert(blockundo.vtxundo.size() + 1 == block.vtx.size());
+
+    stats.SetNull();
+    stats.nTx = block.vtx.size();
+
+    // WT^(s) are classified with the spends SCDB recorded when this block
+    // was connected. Matching spent coins against the current sidechain
+    // scripts would misclassify older blocks once the sidechains change.
+    std::set<uint256> setWTPrime;
+    for (const SidechainSpentWTPrime& spent : scdb.GetSpentWTPrimesForBlock(block.GetHash()))
+        setWTPrime.insert(spent.hashWTPrime);
+
+    // Feerate (sat / vbyte) and weight of every non-coinbase transaction
+    std::vector<std::pair<CAmount, int64_t>> vFeerateWeight;
+    vFeerateWeight.reserve(block.vtx.size());
+    int64_t nTotalWeight = 0;
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = *block.vtx[i];
+        int64_t nVSize = GetVirtualTransactionSize(tx);
+        stats.nVSize += nVSize;
+
+        if (tx.IsCoinBase())
+            continue;
+
+        // The undo data has the coins spent by this transaction, so we know
+        // the exact fee instead of estimating it from the coinbase value.
+        CAmount nValueIn = 0;
+        for (const Coin& coin : blockundo.vtxundo[i - 1].vprevout)
+            nValueIn += coin.out.nValue;
+
+        CAmount nFee = nValueIn - tx.GetValueOut();
+        stats.nTotalFee += nFee;
+
+        uint256 hashBlind;
+        if (!setWTPrime.empty() && tx.GetBWTHash(hashBlind) && setWTPrime.count(hashBlind))
+            stats.nWTPrimeFee += nFee;
+
+        int64_t nWeight = GetTransactionWeight(tx);
+        nTotalWeight += nWeight;
+        vFeerateWeight.emplace_back(nFee / nVSize, nWeight);
+    }
+
+    if (vFeerateWeight.empty())
+        return;
+
+    std::sort(vFeerateWeight.begin(), vFeerateWeight.end());
+
+    const double vPercentile[BLOCK_STATS_NUM_PERCENTILES] = {0.10, 0.25, 0.50, 0.75, 0.90};
+    int64_t nCumulativeWeight = 0;
+    size_t nPercentile = 0;
+    for (const std::pair<CAmount, int64_t>& p : vFeerateWeight) {
+        nCumulativeWeight += p.second;
+        while (nPercentile < BLOCK_STATS_NUM_PERCENTILES &&
+                nCumulativeWeight >= nTotalWeight * vPercentile[nPercentile]) {
+            stats.feeratePercentiles[nPercentile] = p.first;
+            nPercentile++;
+        }
+    }
+    // Handle any percentile left unset due to rounding
+    for (; nPercentile < BLOCK_STATS_NUM_PERCENTILES; nPercentile++)
+        stats.feeratePercentiles[nPercentile] = vFeerateWeight.back().first;
+}
+
+bool GetBlockStats(const CBlockIndex* pindex, CBlockStats& stats)
+{
+    if (!fBlockStatsIndex || !pindex)
+        return false;
+
+    return pblocktree->ReadBlockStats(pindex->GetBlockHash(), stats);
+}
+
+void BackfillBlockStatsIndex()
+{
+    const CChainParams& chainparams = Params();
+
+    // Blocks up to the one the last backfill got to have their entries, as
+    // long as that block is still in the active chain. Blocks connected
+    // while the index was disabled come after it or after the fork point.
+    int nHeightStart = 1;
+    uint256 hashBackfilled;
+    if (pblocktree->ReadBlockStatsBackfilled(hashBackfilled)) {
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(hashBackfilled);
+        if (mi != mapBlockIndex.end()) {
+            const CBlockIndex* pindexFork = chainActive.FindFork(mi->second);
+            if (pindexFork)
+                nHeightStart = std::max(pindexFork->nHeight + 1, 1);
+        }
+    }
+
+    LogPrintf("%s: Scanning active chain from height %d for blocks without block stats\n", __func__, nHeightStart);
+
+    // Entries are keyed by block hash, so it is harmless if the block we are
+    // working on is disconnected before we write the entry for it.
+    // hashBackfilled is the last block all blocks up to which are done, it
+    // stops moving at the first block that couldn't be read.
+    std::vector<std::pair<uint256, CBlockStats>> vStats;
+    int nWritten = 0;
+    bool fAdvance = true;
+    hashBackfilled.SetNull();
+    for (int nHeight = nHeightStart; !ShutdownRequested(); nHeight++) {
+        boost::this_thread::interruption_point();
+
+        const CBlockIndex* pindex = nullptr;
+        {
+            LOCK(cs_main);
+            pindex = chainActive[nHeight];
+            if (!pindex)
+                break;
+
+            // Skip pruned blocks
+            if (!(pindex->nStatus & BLOCK_HAVE_DATA) || !(pindex->nStatus & BLOCK_HAVE_UNDO)) {
+                if (fAdvance)
+                    hashBackfilled = pindex->GetBlockHash();
+                continue;
+            }
+        }
+
+        CBlockStats stats;
+        if (pblocktree->ReadBlockStats(pindex->GetBlockHash(), stats)) {
+            if (fAdvance)
+                hashBackfilled = pindex->GetBlockHash();
+            continue;
+        }
+
+        CBlock block;
+        CBlockUndo blockundo;
+        if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()) ||
+                !UndoReadFromDisk(blockundo, pindex)) {
+            LogPrintf("%s: Failed to read block: %s\n", __func__, pindex->GetBlockHash().ToString());
+            fAdvance = false;
+            continue;
+        }
+        if (blockundo.vtxundo.size() + 1 != block.vtx.size()) {
+            fAdvance = false;
+            continue;
+        }
+
+        {
+            LOCK(cs_main);
+            ComputeBlockStats(block, blockundo, stats);
+        }
+        vStats.push_back(std::make_pair(pindex->GetBlockHash(), stats));
+        if (fAdvance)
+            hashBackfilled = pindex->GetBlockHash();
+
+        if (vStats.size() >= 1000) {
+            if (!pblocktree->WriteBlockStats(vStats) ||
+                    (!hashBackfilled.IsNull() && !pblocktree->WriteBlockStatsBackfilled(hashBackfilled))) {
+                LogPrintf("%s: Failed to write block stats!\n", __func__);
+                return;
+            }
+            nWritten += vStats.size();
+            vStats.clear();
+        }
+    }
+
+    if ((!vStats.empty() && !pblocktree->WriteBlockStats(vStats)) ||
+            (!hashBackfilled.IsNull() && !pblocktree->WriteBlockStatsBackfilled(hashBackfilled))) {
+        LogPrintf("%s: Failed to write block stats!\n", __func__);
+        return;
+    }
+    nWritten += vStats.size();
+
+    LogPrintf("%s: Wrote block stats for %d blocks\n", __func__, nWritten);
+}
+
+bool GetBlockFilter(const CBlockIndex* pindex, BlockFilter& filter)
+{
+    if (!fBlockFilterIndex || !pindex)
+        return false;
+
+    return pblocktree->ReadBlockFilter(pindex->GetBlockHash(), filter);
+}
+
+void BackfillBlockFilterIndex()
+{
+    const CChainParams& chainparams = Params();
+
+    LogPrintf("%s: Scanning active chain for blocks without a block filter\n", __func__);
+
+    // As with the block stats, entries are keyed by block hash so a block
+    // being disconnected while we work on it does no harm.
+    std::vector<BlockFilter> vFilter;
+    int nWritten = 0;
+    for (int nHeight = 0; !ShutdownRequested(); nHeight++) {
+        boost::this_thread::interruption_point();
+
+        const CBlockIndex* pindex = nullptr;
+        {
+            LOCK(cs_main);
+            pindex = chainActive[nHeight];
+            if (!pindex)
+                break;
+
+            // Skip pruned blocks
+            if (!(pindex->nStatus & BLOCK_HAVE_DATA) || (nHeight > 0 && !(pindex->nStatus & BLOCK_HAVE_UNDO)))
+                continue;
+        }
+
+        BlockFilter filter;
+        if (pblocktree->ReadBlockFilter(pindex->GetBlockHash(), filter))
+            continue;
+
+        // The genesis block has no undo data
+        CBlock block;
+        CBlockUndo blockundo;
+        if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()) ||
+                (nHeight > 0 && !UndoReadFromDisk(blockundo, pindex))) {
+            LogPrintf("%s: Failed to read block: %s\n", __func__, pindex->GetBlockHash().ToString());
+            continue;
+        }
+        if (nHeight > 0 && blockundo.vtxundo.size() + 1 != block.vtx.size())
+            continue;
+
+        vFilter.emplace_back(block, blockundo);
+
+        if (vFilter.size() >= 1000) {
+            if (!pblocktree->WriteBlockFilters(vFilter)) {
+                LogPrintf("%s: Failed to write block filters!\n", __func__);
+                return;
+            }
+            nWritten += vFilter.size();
+            vFilter.clear();
+        }
+    }
+
+    if (!vFilter.empty() && !pblocktree->WriteBlockFilters(vFilter)) {
+        LogPrintf("%s: Failed to write block filters!\n", __func__);
+        return;
+    }
+    nWritten += vFilter.size();
+
+    LogPrintf("%s: Wrote block filters for %d blocks\n", __func__, nWritten);
+}
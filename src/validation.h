@@ -22,6 +22,7 @@
 #include <algorithm>
 #include <exception>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <string>
@@ -32,17 +33,22 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CBlockUndo;
 class CChainParams;
 class CCoinsViewDB;
 class CInv;
 class CConnman;
 class CScriptCheck;
 class CBlockPolicyEstimator;
+class CTaskPool;
 class CTxMemPool;
 class CValidationState;
 class SidechainDB;
 class SidechainWTPrimeState;
+struct SCDBSnapshot;
 class CSidechainTreeDB;
+struct CBlockStats;
+class BlockFilter;
 struct ChainTxData;
 
 struct PrecomputedTransactionData;
@@ -80,7 +86,7 @@ static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 
 /** Maximum number of script-checking threads allowed */
-static const int MAX_SCRIPTCHECK_THREADS = 16;
+static const int MAX_SCRIPTCHECK_THREADS = 64;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
 /** Number of blocks that can be requested at any given time from a single peer. */
@@ -133,6 +139,8 @@ static const int64_t MAX_FEE_ESTIMATION_TIP_AGE = 3 * 60 * 60;
 static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
 static const bool DEFAULT_TXINDEX = false;
+static const bool DEFAULT_BLOCKSTATSINDEX = false;
+static const bool DEFAULT_BLOCKFILTERINDEX = false;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 /** Default for -persistmempool */
 static const bool DEFAULT_PERSIST_MEMPOOL = true;
@@ -178,6 +186,8 @@ extern std::atomic_bool fImporting;
 extern std::atomic_bool fReindex;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+extern bool fBlockStatsIndex;
+extern bool fBlockFilterIndex;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
@@ -281,6 +291,8 @@ bool LoadChainTip(const CChainParams& chainparams);
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the Drivechain (M5 / M6) checking thread */
+void ThreadSidechainCheck();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
@@ -317,6 +329,10 @@ void PruneBlockFilesManual(int nManualPruneHeight);
 void GetSidechainValues(const CCoinsView& coins, const CTransaction& tx, CAmount& amtSidechainUTXO, CAmount& amtUserInput,
                         CAmount& amtReturning, CAmount& amtWithdrawn);
 
+/** Calculate the same values from the outputs spent by the transaction */
+void GetSidechainValues(const std::vector<CTxOut>& vSpent, const CTransaction& tx, CAmount& amtSidechainUTXO, CAmount& amtUserInput,
+                        CAmount& amtReturning, CAmount& amtWithdrawn);
+
 /** Compare the blinded hash (B-WT^) with the transaction provided */
 bool CheckBWTHash(const uint256& hashWTPrime, const CTransaction& tx);
 
@@ -326,6 +342,17 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                         bool* pfMissingInputs, std::list<CTransactionRef>* plTxnReplaced,
                         bool bypass_limits, const CAmount nAbsurdFee);
 
+/**
+ * Verify the input scripts of a batch of transactions without holding cs_main
+ * so that the signatures end up in the signature cache before the batch is
+ * passed to AcceptToMemoryPool. The coins spent are copied from the chain and
+ * the mempool first; inputs created by earlier transactions of the batch are
+ * also resolved, so vtx has to be in dependency order. Transactions with
+ * missing inputs are skipped, failures are left for AcceptToMemoryPool to
+ * report. The checks run on pool and the calling thread.
+ */
+void PreCheckTransactionScripts(const std::vector<CTransactionRef>& vtx, CTaskPool& pool);
+
 /** Convert CValidationState to a human-readable message for logging */
 std::string FormatStateMessage(const CValidationState &state);
 
@@ -413,6 +440,11 @@ void InitScriptExecutionCache();
 /** Functions for disk access for blocks */
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/** Read the serialized block (with witness and drivechain data) from disk without deserializing it */
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vch, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
+/** Same, checking that the bytes at pos start with the header of the block with the given hash */
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vch, const CDiskBlockPos& pos, const uint256& hash, const CMessageHeader::MessageStartChars& messageStart);
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vch, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -525,8 +557,12 @@ CBlockFileInfo* GetBlockFileInfo(size_t n);
 /** Dump the mempool to disk. */
 bool DumpMempool();
 
-/** Load the mempool from disk. */
-bool LoadMempool();
+/**
+ * Load the mempool from disk, checking the scripts of the transactions on
+ * pool. If pnFastPath is given it is set to the number of transactions that
+ * were added back without AcceptToMemoryPool.
+ */
+bool LoadMempool(CTaskPool& pool, int64_t* pnFastPath = nullptr);
 
 /** Load cache of user set WT^ votes for sidechains */
 bool LoadCustomVoteCache();
@@ -584,6 +620,59 @@ void DumpSCDBCache();
  * when a block is disconnected. */
 bool ResyncSCDB(const CBlockIndex* pindex);
 
+/** Resync SCDB to pindex and revert the mempool CTIP after one or more blocks
+ * have been disconnected down to pindex. */
+bool ResyncSCDBAfterDisconnect(const CBlockIndex* pindex);
+
+/**
+ * State of the active chain, published at every tip change for readers that
+ * should not wait for cs_main. Block index entries are never freed while
+ * running and their hash, height and ancestors never change, so the tip and
+ * its ancestors may be read without cs_main as well.
+ */
+struct ChainSnapshot
+{
+    const CBlockIndex* pindexTip;
+    std::shared_ptr<const SCDBSnapshot> scdb;
+};
+
+/** Publish a new snapshot of chainActive and scdb. Requires cs_main. */
+void PublishChainSnapshot();
+
+/** The last published chain snapshot. Never null, the tip is null before the
+ * block index has been loaded. */
+std::shared_ptr<const ChainSnapshot> GetChainSnapshot();
+
+/** Block until a snapshot other than snapshot (one returned earlier by
+ * GetChainSnapshot) is published, nTimeout milliseconds have passed (no limit
+ * if 0) or waiters are interrupted. Returns the last published snapshot. */
+std::shared_ptr<const ChainSnapshot> WaitForChainSnapshot(const std::shared_ptr<const ChainSnapshot>& snapshot, int64_t nTimeout);
+
+/** Wake up all threads in WaitForChainSnapshot and make further waits return
+ * right away. Used at shutdown. */
+void InterruptChainSnapshotWaiters();
+
 double GetNetworkHashPerSecond(int nLookup, int nHeight);
 
+/** Calculate fee statistics for a block from the coins it spent. WT^ fees
+ * use the WT^ spends SCDB recorded for the block when it was connected. */
+void ComputeBlockStats(const CBlock& block, const CBlockUndo& blockundo, CBlockStats& stats);
+
+/** Look up the block stats index entry of a block. Returns false if the index
+ * is disabled or does not have an entry for the block yet. */
+bool GetBlockStats(const CBlockIndex* pindex, CBlockStats& stats);
+
+/** Write block stats index entries for active chain blocks which connected
+ * before the index was enabled. Called from the import thread. */
+void BackfillBlockStatsIndex();
+
+/** Look up the basic block filter of a block. Returns false if the filter
+ * index is disabled or does not have an entry for the block yet. Safe to call
+ * without cs_main. */
+bool GetBlockFilter(const CBlockIndex* pindex, BlockFilter& filter);
+
+/** Write block filter index entries for active chain blocks which connected
+ * before the index was enabled. Called from the import thread. */
+void BackfillBlockFilterIndex();
+
 #endif // BITCOIN_VALIDATION_H
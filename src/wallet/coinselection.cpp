@@ -0,0 +1,110 @@
+// Copyright (c) 2026 The DriveNet developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <wallet/coinselection.h>
+
+#include <wallet/wallet.h>
+
+#include <algorithm>
+#include <assert.h>
+
+/**
+ * The search relies on the pool being ordered by effective value, which can
+ * differ from the order of the actual values the wallet lists coins in. Ties
+ * are broken by outpoint so the result doesn't depend on that order either.
+ */
+static bool CompareEffectiveValueDesc(const CInputCoin& a, const CInputCoin& b)
+{
+    if (a.effective_value != b.effective_value)
+        return a.effective_value > b.effective_value;
+    return a < b;
+}
+
+bool SelectCoinsBnB(std::vector<CInputCoin>& utxo_pool, const CAmount& target_value, const CAmount& cost_of_change,
+                    std::set<CInputCoin>& out_set, CAmount& value_ret, CAmount not_input_fees)
+{
+    out_set.clear();
+    value_ret = 0;
+
+    const CAmount actual_target = target_value + not_input_fees;
+    const CAmount upper_bound = actual_target + cost_of_change;
+
+    std::sort(utxo_pool.begin(), utxo_pool.end(), CompareEffectiveValueDesc);
+
+    // remaining_value[i] is the effective value of utxo_pool[i..], used to
+    // cut branches that can no longer reach the target
+    const size_t nPool = utxo_pool.size();
+    std::vector<CAmount> remaining_value(nPool + 1, 0);
+    for (size_t i = nPool; i > 0; i--) {
+        assert(utxo_pool[i - 1].effective_value > 0);
+        remaining_value[i - 1] = remaining_value[i] + utxo_pool[i - 1].effective_value;
+    }
+    if (remaining_value[0] < actual_target)
+        return false;
+
+    // First coin at or after begin whose effective value is below (fStrict)
+    // or at most nValue. The pool is sorted, so this is a binary search.
+    auto first_fitting = [&utxo_pool](size_t begin, CAmount nValue, bool fStrict) {
+        auto it = std::partition_point(utxo_pool.begin() + begin, utxo_pool.end(), [nValue, fStrict](const CInputCoin& utxo) {
+            return fStrict ? utxo.effective_value >= nValue : utxo.effective_value > nValue;
+        });
+        return (size_t)(it - utxo_pool.begin());
+    };
+
+    // Depth first search. Each step either includes the largest coin after
+    // the last decision that still fits below the upper bound, or backtracks
+    // by excluding the most recently included coin. Coins that were skipped
+    // for being too large stay excluded in the whole subtree.
+    std::vector<size_t> curr_selection;
+    CAmount curr_value = 0;
+    size_t next = 0;
+
+    std::vector<size_t> best_selection;
+    CAmount best_excess = MAX_MONEY;
+
+    for (size_t nTries = 0; nTries < BNB_TOTAL_TRIES; nTries++) {
+        bool fBacktrack = false;
+        if (curr_value >= actual_target) {
+            // Found a solution, adding more coins only increases the excess
+            const CAmount excess = curr_value - actual_target;
+            if (excess < best_excess) {
+                best_selection = curr_selection;
+                best_excess = excess;
+                if (best_excess == 0)
+                    break;
+            }
+            fBacktrack = true;
+        } else {
+            next = first_fitting(next, upper_bound - curr_value, false);
+            if (next == nPool || curr_value + remaining_value[next] < actual_target) {
+                fBacktrack = true;
+            } else {
+                curr_selection.push_back(next);
+                curr_value += utxo_pool[next].effective_value;
+                next++;
+            }
+        }
+
+        if (fBacktrack) {
+            if (curr_selection.empty())
+                break; // Searched everything
+
+            // Exclude the last included coin. Including a following coin of
+            // the same value instead would only repeat the same branch.
+            const size_t last = curr_selection.back();
+            curr_selection.pop_back();
+            curr_value -= utxo_pool[last].effective_value;
+            next = first_fitting(last + 1, utxo_pool[last].effective_value, true);
+        }
+    }
+
+    if (best_selection.empty())
+        return false;
+
+    for (size_t i : best_selection) {
+        out_set.insert(utxo_pool[i]);
+        value_ret += utxo_pool[i].txout.nValue;
+    }
+    return true;
+}
@@ -0,0 +1,42 @@
+// Copyright (c) 2026 The DriveNet developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_WALLET_COINSELECTION_H
+#define BITCOIN_WALLET_COINSELECTION_H
+
+#include <amount.h>
+
+#include <set>
+#include <stddef.h>
+#include <vector>
+
+class CInputCoin;
+
+/** Maximum number of branches SelectCoinsBnB explores before giving up */
+static const size_t BNB_TOTAL_TRIES = 100000;
+
+/**
+ * Branch and bound search for a set of coins that pays target_value plus
+ * not_input_fees without needing a change output.
+ *
+ * The effective value of every coin in utxo_pool (its value minus the fee
+ * for spending it) must already be set and positive. A selection is accepted
+ * when its total effective value lies between the target and the target plus
+ * cost_of_change, the excess being paid as fee instead of creating change.
+ * Of the selections found, the one with the smallest excess is returned.
+ *
+ * The search is depth first over the coins sorted by decreasing effective
+ * value. Coins too large for the current branch are skipped with a binary
+ * search, so large pools of small coins are cheap to search. It gives up
+ * after BNB_TOTAL_TRIES steps and may then fail even if a solution exists.
+ * utxo_pool is reordered.
+ *
+ * @param[out] out_set   The selected coins
+ * @param[out] value_ret Total value (not effective value) of out_set
+ * @return Whether a changeless selection was found
+ */
+bool SelectCoinsBnB(std::vector<CInputCoin>& utxo_pool, const CAmount& target_value, const CAmount& cost_of_change,
+                    std::set<CInputCoin>& out_set, CAmount& value_ret, CAmount not_input_fees);
+
+#endif // BITCOIN_WALLET_COINSELECTION_H
@@ -477,6 +477,110 @@ void CWalletDBWrapper::IncrementUpdateCounter()
     ++nUpdateCounter;
 }
 
+bool CDB::WriteRaw(const std::string& strKey, const std::string& strValue)
+{
+    if (!pdb)
+        return true;
+    if (fReadOnly)
+        assert(!"Write called on database in read-only mode");
+
+    Dbt datKey((void*)strKey.data(), strKey.size());
+    Dbt datValue((void*)strValue.data(), strValue.size());
+    int ret = pdb->put(activeTxn, &datKey, &datValue, 0);
+    return (ret == 0);
+}
+
+bool CDB::EraseRaw(const std::string& strKey)
+{
+    if (!pdb)
+        return false;
+    if (fReadOnly)
+        assert(!"Erase called on database in read-only mode");
+
+    Dbt datKey((void*)strKey.data(), strKey.size());
+    int ret = pdb->del(activeTxn, &datKey, 0);
+    return (ret == 0 || ret == DB_NOTFOUND);
+}
+
+void CWalletDBWrapper::QueueWrite(const CDataStream& ssKey, const CDataStream& ssValue)
+{
+    LOCK(cs_queue);
+    mapQueue[ssKey.str()] = QueuedWrite{false, ssValue.str()};
+    nQueueSeq++;
+}
+
+void CWalletDBWrapper::QueueErase(const CDataStream& ssKey)
+{
+    LOCK(cs_queue);
+    mapQueue[ssKey.str()] = QueuedWrite{true, std::string()};
+    nQueueSeq++;
+}
+
+bool CWalletDBWrapper::CommitQueue()
+{
+    if (IsDummy())
+        return true;
+
+    uint64_t nTarget;
+    {
+        LOCK(cs_queue);
+        nTarget = nQueueSeq;
+    }
+
+    LOCK(cs_commit);
+    if (nCommittedSeq >= nTarget)
+        return true; // Committed by another thread while we waited
+
+    std::map<std::string, QueuedWrite> mapCommit;
+    uint64_t nSeq;
+    {
+        LOCK(cs_queue);
+        mapCommit.swap(mapQueue);
+        nSeq = nQueueSeq;
+    }
+    if (mapCommit.empty()) {
+        nCommittedSeq = nSeq;
+        return true;
+    }
+
+    bool fSuccess = false;
+    try {
+        // Closing the batch checkpoints the environment, which is the only
+        // disk flush of the group.
+        CDB batch(*this, "r+", true);
+        if (batch.TxnBegin()) {
+            fSuccess = true;
+            for (const auto& entry : mapCommit) {
+                const QueuedWrite& write = entry.second;
+                if (!(write.fErase ? batch.EraseRaw(entry.first) : batch.WriteRaw(entry.first, write.strValue))) {
+                    fSuccess = false;
+                    break;
+                }
+            }
+            if (fSuccess) {
+                fSuccess = batch.TxnCommit();
+            } else {
+                batch.TxnAbort();
+            }
+        }
+    } catch (const std::runtime_error& e) {
+        // The database couldn't be opened, keep the records below
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+
+    if (!fSuccess) {
+        // Queue the records again, unless they were replaced in the meantime
+        LOCK(cs_queue);
+        for (auto& entry : mapCommit)
+            mapQueue.insert(std::move(entry));
+        LogPrintf("%s: Failed to commit %u queued writes to %s\n", __func__, mapCommit.size(), strFile);
+        return false;
+    }
+
+    nCommittedSeq = nSeq;
+    return true;
+}
+
 void CDB::Close()
 {
     if (!pdb)
@@ -683,6 +787,7 @@ bool CDB::PeriodicFlush(CWalletDBWrapper& dbw)
 
 bool CWalletDBWrapper::Rewrite(const char* pszSkip)
 {
+    CommitQueue();
     return CDB::Rewrite(*this, pszSkip);
 }
 
@@ -691,6 +796,9 @@ bool CWalletDBWrapper::Backup(const std::string& strDest)
     if (IsDummy()) {
         return false;
     }
+    if (!CommitQueue()) {
+        return false;
+    }
     while (true)
     {
         {
@@ -730,6 +838,7 @@ bool CWalletDBWrapper::Backup(const std::string& strDest)
 void CWalletDBWrapper::Flush(bool shutdown)
 {
     if (!IsDummy()) {
+        CommitQueue();
         env->Flush(shutdown);
     }
 }
@@ -95,13 +95,15 @@ class CWalletDBWrapper
     friend class CDB;
 public:
     /** Create dummy DB handle */
-    CWalletDBWrapper() : nUpdateCounter(0), nLastSeen(0), nLastFlushed(0), nLastWalletUpdate(0), env(nullptr)
+    CWalletDBWrapper() : nUpdateCounter(0), nLastSeen(0), nLastFlushed(0), nLastWalletUpdate(0), env(nullptr),
+        fGroupCommit(false), nQueueSeq(0), nCommittedSeq(0)
     {
     }
 
     /** Create DB handle to real database */
     CWalletDBWrapper(CDBEnv *env_in, const std::string &strFile_in) :
-        nUpdateCounter(0), nLastSeen(0), nLastFlushed(0), nLastWalletUpdate(0), env(env_in), strFile(strFile_in)
+        nUpdateCounter(0), nLastSeen(0), nLastFlushed(0), nLastWalletUpdate(0), env(env_in), strFile(strFile_in),
+        fGroupCommit(false), nQueueSeq(0), nCommittedSeq(0)
     {
     }
 
@@ -123,6 +125,24 @@ public:
 
     void IncrementUpdateCounter();
 
+    /** Whether CWalletDB queues writes of wallet transaction records for a
+     * group commit instead of writing them immediately */
+    bool IsGroupCommit() const { return fGroupCommit && !IsDummy(); }
+    void SetGroupCommit(bool fGroupCommitIn) { fGroupCommit = fGroupCommitIn; }
+
+    /** Queue a serialized record for the next group commit. A later write
+     * or erase of the same key replaces it. */
+    void QueueWrite(const CDataStream& ssKey, const CDataStream& ssValue);
+    void QueueErase(const CDataStream& ssKey);
+
+    /**
+     * Durability barrier: commit all records queued so far in a single
+     * database transaction and checkpoint, so they pay for one disk flush
+     * together. When another thread is already committing, this waits for it
+     * and then commits whatever that commit did not include.
+     */
+    bool CommitQueue();
+
     std::atomic<unsigned int> nUpdateCounter;
     unsigned int nLastSeen;
     unsigned int nLastFlushed;
@@ -137,7 +157,21 @@ private:
      * Only to be used at a low level, application should ideally not care
      * about this.
      */
-    bool IsDummy() { return env == nullptr; }
+    bool IsDummy() const { return env == nullptr; }
+
+    struct QueuedWrite {
+        bool fErase;
+        std::string strValue;
+    };
+
+    std::atomic<bool> fGroupCommit;
+
+    CCriticalSection cs_queue;
+    std::map<std::string, QueuedWrite> mapQueue; //!< Serialized key to pending write
+    uint64_t nQueueSeq; //!< Number of writes queued so far
+
+    CCriticalSection cs_commit; //!< Held for the whole commit
+    uint64_t nCommittedSeq; //!< nQueueSeq covered by the last commit
 };
 
 
@@ -236,6 +270,10 @@ public:
         return (ret == 0);
     }
 
+    /** Write an already serialized record, as queued by the group commit */
+    bool WriteRaw(const std::string& strKey, const std::string& strValue);
+    bool EraseRaw(const std::string& strKey);
+
     template <typename K>
     bool Erase(const K& key)
     {
@@ -26,6 +26,10 @@ std::string GetWalletHelpString(bool showDebug)
                                                               CURRENCY_UNIT, FormatMoney(DEFAULT_DISCARD_FEE)));
     strUsage += HelpMessageOpt("-fallbackfee=<amt>", strprintf(_("A fee rate (in %s/kB) that will be used when fee estimation has insufficient data (default: %s)"),
                                                                CURRENCY_UNIT, FormatMoney(DEFAULT_FALLBACK_FEE)));
+    strUsage += HelpMessageOpt("-bmmpoolamount=<amt>", strprintf(_("Value (in %s) of each output in the BMM funding pool (default: %s)"),
+                                                               CURRENCY_UNIT, FormatMoney(DEFAULT_BMM_POOL_AMOUNT)));
+    strUsage += HelpMessageOpt("-bmmpoolsize=<n>", strprintf(_("Keep <n> confirmed outputs for funding BMM requests without coin selection, 0 to disable (default: %u)"), DEFAULT_BMM_POOL_SIZE));
+    strUsage += HelpMessageOpt("-bmmreplace=<n>", strprintf(_("Replace our BMM requests with ones for the new chain tip when they expire, for up to <n> blocks, 0 to disable (default: %u)"), DEFAULT_BMM_REPLACE));
     strUsage += HelpMessageOpt("-keypool=<n>", strprintf(_("Set key pool size to <n> (default: %u)"), DEFAULT_KEYPOOL_SIZE));
     strUsage += HelpMessageOpt("-mintxfee=<amt>", strprintf(_("Fees (in %s/kB) smaller than this are considered zero fee for transaction creation (default: %s)"),
                                                             CURRENCY_UNIT, FormatMoney(DEFAULT_TRANSACTION_MINFEE)));
@@ -38,6 +42,7 @@ std::string GetWalletHelpString(bool showDebug)
     strUsage += HelpMessageOpt("-upgradewallet", _("Upgrade wallet to latest format on startup"));
     strUsage += HelpMessageOpt("-wallet=<file>", _("Specify wallet file (within data directory)") + " " + strprintf(_("(default: %s)"), DEFAULT_WALLET_DAT));
     strUsage += HelpMessageOpt("-walletbroadcast", _("Make the wallet broadcast transactions") + " " + strprintf(_("(default: %u)"), DEFAULT_WALLETBROADCAST));
+    strUsage += HelpMessageOpt("-walletcommitdelay=<n>", strprintf(_("Queue wallet transaction records and write them to disk together every <n> milliseconds instead of one at a time, 0 to disable. Transactions sent by the wallet are written before they are broadcast. Other changes, such as confirmations and incoming transactions, of the last <n> milliseconds may be lost on a crash unless the syncwallet RPC was called, and are found again by a rescan (default: %u)"), DEFAULT_WALLET_COMMIT_DELAY));
     strUsage += HelpMessageOpt("-walletdir=<dir>", _("Specify directory to hold wallets (default: <datadir>/wallets if it exists, otherwise <datadir>)"));
     strUsage += HelpMessageOpt("-walletnotify=<cmd>", _("Execute command when a wallet transaction changes (%s in cmd is replaced by TxID)"));
     strUsage += HelpMessageOpt("-walletrbf", strprintf(_("Send transactions with full-RBF opt-in enabled (RPC only, default: %u)"), DEFAULT_WALLET_RBF));
@@ -125,6 +130,16 @@ bool WalletParameterInteraction()
                         _("This is the minimum transaction fee you pay on every transaction."));
         CWallet::minTxFee = CFeeRate(n);
     }
+    if (gArgs.IsArgSet("-bmmpoolamount"))
+    {
+        CAmount n = 0;
+        if (!ParseMoney(gArgs.GetArg("-bmmpoolamount", ""), n) || n <= 0)
+            return InitError(AmountErrMsg("bmmpoolamount", gArgs.GetArg("-bmmpoolamount", "")));
+        CWallet::nBMMPoolAmount = n;
+    }
+    CWallet::nBMMPoolSize = std::max<int64_t>(0, gArgs.GetArg("-bmmpoolsize", DEFAULT_BMM_POOL_SIZE));
+    CWallet::nBMMReplace = std::max<int64_t>(0, gArgs.GetArg("-bmmreplace", DEFAULT_BMM_REPLACE));
+    CWallet::nCommitDelay = std::max<int64_t>(0, gArgs.GetArg("-walletcommitdelay", DEFAULT_WALLET_COMMIT_DELAY));
     if (gArgs.IsArgSet("-fallbackfee"))
     {
         CAmount nFeePerK = 0;
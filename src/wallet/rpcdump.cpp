@@ -417,6 +417,9 @@ UniValue importprunedfunds(const JSONRPCRequest& request)
 
     if (pwallet->IsMine(*wtx.tx)) {
         pwallet->AddToWallet(wtx, false);
+        if (!pwallet->CommitQueuedWrites()) {
+            throw JSONRPCError(RPC_WALLET_ERROR, "Error: Failed to write wallet changes to disk");
+        }
         return NullUniValue;
     }
 
@@ -457,6 +460,9 @@ UniValue removeprunedfunds(const JSONRPCRequest& request)
     if(vHashOut.empty()) {
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Transaction does not exist in wallet.");
     }
+    if (!pwallet->CommitQueuedWrites()) {
+        throw JSONRPCError(RPC_WALLET_ERROR, "Error: Failed to write wallet changes to disk");
+    }
 
     return NullUniValue;
 }
@@ -1845,6 +1845,17 @@ UniValue listtransactions(const JSONRPCRequest& request)
 
     std::reverse(arrTmp.begin(), arrTmp.end()); // Return oldest to newest
 
+    // Written after releasing the wallet, which a slow client would
+    // otherwise hold up
+    if (request.pResultWriter) {
+        JSONStreamWriter& writer = *request.pResultWriter;
+        writer.BeginArray();
+        for (const UniValue& entry : arrTmp)
+            writer.Value(entry);
+        writer.EndArray();
+        return NullUniValue;
+    }
+
     ret.clear();
     ret.setArray();
     ret.push_backV(arrTmp);
@@ -2219,10 +2230,23 @@ UniValue abandontransaction(const JSONRPCRequest& request)
     if (!pwallet->AbandonTransaction(hash)) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Transaction not eligible for abandonment");
     }
+    if (!pwallet->CommitQueuedWrites()) {
+        throw JSONRPCError(RPC_WALLET_ERROR, "Error: Failed to write wallet changes to disk");
+    }
 
     return NullUniValue;
 }
 
+static bool IsInAnyWallet(const uint256& txid)
+{
+    for (CWalletRef pwallet : ::vpwallets) {
+        LOCK(pwallet->cs_wallet);
+        if (pwallet->GetWalletTx(txid))
+            return true;
+    }
+    return false;
+}
+
 UniValue abandonbmm(const JSONRPCRequest& request)
 {
     CWallet * const pwallet = GetWalletForJSONRPCRequest(request);
@@ -2265,8 +2289,18 @@ UniValue abandonbmm(const JSONRPCRequest& request)
     std::set<uint256> setRemoved = scdb.GetRemovedBMM();
 
     // Make sure the results are valid at least up to the most recent block
-    // the user could have gotten from another RPC command prior to now
+    // the user could have gotten from another RPC command prior to now, and
+    // that the wallet knows the requests above have left the mempool
     pwallet->BlockUntilSyncedToCurrentChain();
+    SyncWithValidationInterfaceQueue();
+
+    // Requests no wallet knows about don't need to be tracked anymore. This
+    // is checked before locking our wallet so that wallet locks never nest.
+    std::set<uint256> setNotInAnyWallet;
+    for (const uint256& u : setRemoved) {
+        if (!IsInAnyWallet(u))
+            setNotInAnyWallet.insert(u);
+    }
 
     LOCK2(cs_main, pwallet->cs_wallet);
 
@@ -2275,6 +2309,10 @@ UniValue abandonbmm(const JSONRPCRequest& request)
         UniValue entry(UniValue::VOBJ);
 
         if (!pwallet->mapWallet.count(u)) {
+            // Someone else's request, stop tracking it unless another
+            // wallet may still want to abandon it
+            if (setNotInAnyWallet.count(u))
+                scdb.BMMAbandoned(u);
             entry.push_back(Pair("not-in-wallet", u.ToString()));
             results.push_back(entry);
             continue;
@@ -2387,6 +2425,31 @@ UniValue backupwallet(const JSONRPCRequest& request)
     return NullUniValue;
 }
 
+UniValue syncwallet(const JSONRPCRequest& request)
+{
+    CWallet * const pwallet = GetWalletForJSONRPCRequest(request);
+    if (!EnsureWalletIsAvailable(pwallet, request.fHelp)) {
+        return NullUniValue;
+    }
+
+    if (request.fHelp || request.params.size() != 0)
+        throw std::runtime_error(
+            "syncwallet\n"
+            "\nWaits until all changes made to the wallet so far have been written to disk.\n"
+            "This is only needed with -walletcommitdelay, otherwise changes are written immediately.\n"
+            "\nExamples:\n"
+            + HelpExampleCli("syncwallet", "")
+            + HelpExampleRpc("syncwallet", "")
+        );
+
+    // Deliberately not holding cs_wallet: the commit only needs the database
+    if (!pwallet->CommitQueuedWrites()) {
+        throw JSONRPCError(RPC_WALLET_ERROR, "Error: Failed to write wallet changes to disk");
+    }
+
+    return NullUniValue;
+}
+
 
 UniValue keypoolrefill(const JSONRPCRequest& request)
 {
@@ -3562,6 +3625,42 @@ UniValue generate(const JSONRPCRequest& request)
     return generateBlocks(coinbase_script, num_generate, max_tries, true);
 }
 
+/** Parse a sidechain deposit address of nSidechain into the destination
+ * the deposit pays to. Throws on invalid addresses. */
+static std::string ParseSidechainDepositAddress(const std::string& strDepositAddress, unsigned int nSidechain)
+{
+    if (strDepositAddress.empty()) {
+        std::string strError = "Invalid sidechain deposit address";
+        LogPrintf("%s: %s\n", __func__, strError);
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, strError);
+    }
+
+    // Get strDest from deposit address
+    std::string strDest = "";
+    unsigned int nSidechainFromAddress;
+    if (!ParseDepositAddress(strDepositAddress, strDest, nSidechainFromAddress)) {
+        std::string strError = "Invalid sidechain deposit address - failed to parse";
+        LogPrintf("%s: %s\n", __func__, strError);
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, strError);
+    }
+
+    // Double check sidechain number
+    if (nSidechainFromAddress != nSidechain) {
+        std::string strError = "Invalid sidechain deposit address - sidechain number mismatch";
+        LogPrintf("%s: %s\n", __func__, strError);
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, strError);
+    }
+
+    // Reject deposits to SIDECHAIN_WTPRIME_RETURN_DEST
+    if (strDest == SIDECHAIN_WTPRIME_RETURN_DEST) {
+        std::string strError = "Invalid sidechain address. Cannot be SIDECHAIN_WTPRIME_RETURN_DEST. Choose a different address and try again,";
+        LogPrintf("%s: %s\n", __func__, strError);
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, strError);
+    }
+
+    return strDest;
+}
+
 UniValue createsidechaindeposit(const JSONRPCRequest& request)
 {
     CWallet * const pwallet = GetWalletForJSONRPCRequest(request);
@@ -3603,46 +3702,122 @@ UniValue createsidechaindeposit(const JSONRPCRequest& request)
     LOCK2(cs_main, pwallet->cs_wallet);
 
     // strDepositAddress
-    std::string strDepositAddress = request.params[1].get_str();
-    if (strDepositAddress.empty()) {
-        std::string strError = "Invalid sidechain deposit address";
+    std::string strDest = ParseSidechainDepositAddress(request.params[1].get_str(), nSidechain);
+
+    // Amount
+    CAmount nAmount = AmountFromValue(request.params[2]);
+    if (nAmount <= 0) {
+        std::string strError = "Invalid amount for send";
         LogPrintf("%s: %s\n", __func__, strError);
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, strError);
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
     }
 
-    // Get strDest from deposit address
-    std::string strDest = "";
-    unsigned int nSidechainFromAddress;
-    if (!ParseDepositAddress(strDepositAddress, strDest, nSidechainFromAddress)) {
-        std::string strError = "Invalid sidechain deposit address - failed to parse";
+    // Fee
+    CAmount nFee = AmountFromValue(request.params[3]);
+    if (nFee <= 0) {
+        std::string strError = "Invalid fee amount";
         LogPrintf("%s: %s\n", __func__, strError);
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, strError);
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
     }
 
-    // Double check sidechain number
-    if (nSidechainFromAddress != nSidechain) {
-        std::string strError = "Invalid sidechain deposit address - sidechain number mismatch";
+    // Get sidechain script
+    CScript sidechainScriptPubKey;
+    if (!scdb.GetSidechainScript(nSidechain, sidechainScriptPubKey))
+    {
+        std::string strError = "Failed to lookup sidechain script";
         LogPrintf("%s: %s\n", __func__, strError);
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, strError);
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
     }
 
-    // Reject deposits to SIDECHAIN_WTPRIME_RETURN_DEST
-    if (strDest == SIDECHAIN_WTPRIME_RETURN_DEST) {
-        std::string strError = "Invalid sidechain address. Cannot be SIDECHAIN_WTPRIME_RETURN_DEST. Choose a different address and try again,";
-        LogPrintf("%s: %s\n", __func__, strError);
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, strError);
+    EnsureWalletIsUnlocked(pwallet);
+
+    CTransactionRef tx;
+    std::string strFail = "";
+    if (!pwallet->CreateSidechainDeposit(tx, strFail, sidechainScriptPubKey, nSidechain, nAmount, nFee, strDest))
+    {
+        LogPrintf("%s: %s\n", __func__, strFail);
+        throw JSONRPCError(RPC_MISC_ERROR, strFail);
     }
 
-    // Amount
-    CAmount nAmount = AmountFromValue(request.params[2]);
-    if (nAmount <= 0) {
-        std::string strError = "Invalid amount for send";
+    return tx->GetHash().GetHex();
+}
+
+UniValue createsidechaindeposits(const JSONRPCRequest& request)
+{
+    CWallet * const pwallet = GetWalletForJSONRPCRequest(request);
+    if (!EnsureWalletIsAvailable(pwallet, request.fHelp)) {
+        return NullUniValue;
+    }
+
+    if (request.fHelp || request.params.size() != 3)
+        throw std::runtime_error(
+            "createsidechaindeposits nsidechain [{\"address\":\"depositaddress\",\"amount\":x},...] fee\n"
+            "\nCreate a chain of sidechain deposits, one for each address and amount.\n"
+            "Each deposit spends the one before it, so they are accepted to the mempool\n"
+            "in order and without racing other deposits for the sidechain CTIP. If one\n"
+            "of them is rejected none of them are broadcast.\n"
+            + HelpRequiringPassphrase(pwallet) +
+            "\nArguments:\n"
+            "1. nsidechain             (numeric, required) The sidechain to send to.\n"
+            "2. deposits               (array, required) The deposits to create\n"
+            "     [\n"
+            "       {\n"
+            "         \"address\":\"depositaddress\", (string, required) The sidechain deposit address to send to.\n"
+            "         \"amount\":x                 (numeric or string, required) The amount in " + CURRENCY_UNIT + " to send. eg 0.1\n"
+            "       }\n"
+            "       ,...\n"
+            "     ]\n"
+            "3. fee                    (numeric or string, required) The fee in " + CURRENCY_UNIT + " of each deposit\n"
+            "\nResult:\n"
+            "[\n"
+            "  \"txid\"                 (string) The transaction id of each deposit, in order.\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("createsidechaindeposits", "0 \"[{\\\"address\\\":\\\"s0_1M72Sfpbz1BPpXFHz9m3CdqATR44Jvaydd_xxxxxx\\\",\\\"amount\\\":0.1}]\" 0.01")
+            + HelpExampleRpc("createsidechaindeposits", "0, [{\"address\":\"s0_1M72Sfpbz1BPpXFHz9m3CdqATR44Jvaydd_xxxxxx\",\"amount\":0.1}], 0.01")
+        );
+
+    ObserveSafeMode();
+
+    RPCTypeCheck(request.params, {UniValue::VNUM, UniValue::VARR});
+
+    // nSidechain
+    unsigned int nSidechain = request.params[0].get_int();
+    if (!scdb.IsSidechainActive(nSidechain)) {
+        std::string strError = "Invalid sidechain number";
         LogPrintf("%s: %s\n", __func__, strError);
         throw JSONRPCError(RPC_MISC_ERROR, strError);
     }
 
+    // Deposits
+    const UniValue& deposits = request.params[1].get_array();
+    if (deposits.empty()) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, deposits are empty");
+    }
+    std::vector<std::pair<std::string, CAmount>> vDeposit;
+    for (unsigned int idx = 0; idx < deposits.size(); idx++) {
+        const UniValue& deposit = deposits[idx].get_obj();
+        RPCTypeCheckObj(deposit,
+            {
+                {"address", UniValueType(UniValue::VSTR)},
+                {"amount", UniValueType()}, // will be checked by AmountFromValue() below
+            });
+
+        std::string strDest = ParseSidechainDepositAddress(find_value(deposit, "address").get_str(), nSidechain);
+
+        CAmount nAmount = AmountFromValue(find_value(deposit, "amount"));
+        if (nAmount <= 0) {
+            std::string strError = "Invalid amount for send";
+            LogPrintf("%s: %s\n", __func__, strError);
+            throw JSONRPCError(RPC_MISC_ERROR, strError);
+        }
+
+        vDeposit.push_back(std::make_pair(strDest, nAmount));
+    }
+
     // Fee
-    CAmount nFee = AmountFromValue(request.params[3]);
+    CAmount nFee = AmountFromValue(request.params[2]);
     if (nFee <= 0) {
         std::string strError = "Invalid fee amount";
         LogPrintf("%s: %s\n", __func__, strError);
@@ -3660,15 +3835,19 @@ UniValue createsidechaindeposit(const JSONRPCRequest& request)
 
     EnsureWalletIsUnlocked(pwallet);
 
-    CTransactionRef tx;
+    std::vector<CTransactionRef> vtx;
     std::string strFail = "";
-    if (!pwallet->CreateSidechainDeposit(tx, strFail, sidechainScriptPubKey, nSidechain, nAmount, nFee, strDest))
+    if (!pwallet->CreateSidechainDeposits(vtx, strFail, sidechainScriptPubKey, nSidechain, vDeposit, nFee))
     {
         LogPrintf("%s: %s\n", __func__, strFail);
         throw JSONRPCError(RPC_MISC_ERROR, strFail);
     }
 
-    return tx->GetHash().GetHex();
+    UniValue result(UniValue::VARR);
+    for (const CTransactionRef& tx : vtx)
+        result.push_back(tx->GetHash().GetHex());
+
+    return result;
 }
 
 UniValue createbmmcriticaldatatx(const JSONRPCRequest& request)
@@ -3785,22 +3964,50 @@ UniValue createbmmcriticaldatatx(const JSONRPCRequest& request)
     wtx.BindWallet(pwallet);
 
     CReserveKey reservekey(pwallet);
-    CAmount nFeeRequired;
-    int nChangePosRet = -1;
-    //TODO: set this as a real thing
-    CCoinControl cc;
-    cc.signalRbf = false;
-    if (!pwallet->CreateTransaction(vecSend, wtx, reservekey, nFeeRequired, nChangePosRet, strError, cc, true, 3, nHeight, criticalData)) {
-        if (nAmount + nFeeRequired > pwallet->GetBalance() || nAmount < nFeeRequired)
-            strError = strprintf("Error: This transaction requires a transaction fee of at least %s", FormatMoney(nFeeRequired));
-        LogPrintf("%s: %s\n", __func__, strError);
-        throw JSONRPCError(RPC_WALLET_ERROR, strError);
-    }
-    CValidationState state;
-    if (!pwallet->CommitTransaction(wtx, reservekey, g_connman.get(), state)) {
-        strError = strprintf("Error: The transaction was rejected! Reason given: %s", state.GetRejectReason());
-        LogPrintf("%s: %s\n", __func__, strError);
-        throw JSONRPCError(RPC_WALLET_ERROR, strError);
+
+    // With -bmmreplace our pending request for this sidechain is replaced,
+    // spending the same inputs, instead of leaving it to be abandoned
+    const CWalletTx* pwtxPending = CWallet::nBMMReplace ? pwallet->GetBMMRequest(nSidechain) : nullptr;
+    if (pwtxPending) {
+        const uint256 hashPending = pwtxPending->GetHash();
+        if (!pwallet->CreateBMMReplacement(*pwtxPending, nAmount, nHeight, criticalData, wtx, strError)) {
+            LogPrintf("%s: %s\n", __func__, strError);
+            throw JSONRPCError(RPC_WALLET_ERROR, strError);
+        }
+        wtx.mapValue["bmmreplace"] = "0";
+
+        CValidationState state;
+        if (!pwallet->CommitBMMReplacement(hashPending, wtx, g_connman.get(), state)) {
+            strError = strprintf("Error: The transaction was rejected! Reason given: %s", state.GetRejectReason());
+            LogPrintf("%s: %s\n", __func__, strError);
+            throw JSONRPCError(RPC_WALLET_ERROR, strError);
+        }
+    } else {
+        if (CWallet::nBMMReplace)
+            wtx.mapValue["bmmreplace"] = "0";
+
+        // Use the BMM pool if there is one, fall back to coin selection
+        if (!CWallet::nBMMPoolSize || !pwallet->CreateBMMRequest(nAmount, nHeight, criticalData, wtx, reservekey, strError)) {
+            CAmount nFeeRequired;
+            int nChangePosRet = -1;
+            //TODO: set this as a real thing
+            CCoinControl cc;
+            cc.signalRbf = CWallet::nBMMReplace > 0;
+            if (!pwallet->CreateTransaction(vecSend, wtx, reservekey, nFeeRequired, nChangePosRet, strError, cc, true, 3, nHeight, criticalData)) {
+                if (nAmount + nFeeRequired > pwallet->GetBalance() || nAmount < nFeeRequired)
+                    strError = strprintf("Error: This transaction requires a transaction fee of at least %s", FormatMoney(nFeeRequired));
+                LogPrintf("%s: %s\n", __func__, strError);
+                throw JSONRPCError(RPC_WALLET_ERROR, strError);
+            }
+        }
+        CValidationState state;
+        if (!pwallet->CommitTransaction(wtx, reservekey, g_connman.get(), state)) {
+            strError = strprintf("Error: The transaction was rejected! Reason given: %s", state.GetRejectReason());
+            LogPrintf("%s: %s\n", __func__, strError);
+            throw JSONRPCError(RPC_WALLET_ERROR, strError);
+        }
+        if (CWallet::nBMMReplace)
+            pwallet->TrackBMMRequest(*pwallet->GetWalletTx(wtx.GetHash()));
     }
 #endif
 
@@ -3962,6 +4169,7 @@ static const CRPCCommand commands[] =
     { "wallet",             "setaccount",               &setaccount,               {"address","account"} },
     { "wallet",             "settxfee",                 &settxfee,                 {"amount"} },
     { "wallet",             "signmessage",              &signmessage,              {"address","message"} },
+    { "wallet",             "syncwallet",               &syncwallet,               {} },
     { "wallet",             "walletlock",               &walletlock,               {} },
     { "wallet",             "walletpassphrasechange",   &walletpassphrasechange,   {"oldpassphrase","newpassphrase"} },
     { "wallet",             "walletpassphrase",         &walletpassphrase,         {"passphrase","timeout"} },
@@ -3971,6 +4179,7 @@ static const CRPCCommand commands[] =
     { "generating",         "generate",                 &generate,                 {"nblocks","maxtries"} },
 
     { "DriveChain",         "createsidechaindeposit",   &createsidechaindeposit,   {"nSidechain", "depositaddress", "amount", "fee"} },
+    { "DriveChain",         "createsidechaindeposits",  &createsidechaindeposits,  {"nsidechain", "deposits", "fee"} },
     { "DriveChain",         "createbmmcriticaldatatx",  &createbmmcriticaldatatx,  {"amount", "height", "criticalhash", "nsidechain", "ndag"}},
 };
 
@@ -0,0 +1,176 @@
+// Copyright (c) 2026 The DriveNet developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <wallet/coinselection.h>
+#include <wallet/wallet.h>
+
+#include <key.h>
+#include <policy/feerate.h>
+#include <script/standard.h>
+#include <test/test_drivenet.h>
+
+#include <memory>
+#include <set>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(coinselector_tests, BasicTestingSetup)
+
+typedef std::set<CInputCoin> CoinSet;
+
+static void add_coin(const CAmount& nValue, std::vector<CInputCoin>& vCoins, CAmount nFee = 0)
+{
+    static uint32_t nextIndex = 0;
+    CInputCoin coin(COutPoint(uint256(), nextIndex++), CTxOut(nValue, CScript()));
+    coin.effective_value = nValue - nFee;
+    vCoins.push_back(coin);
+}
+
+static CAmount sum_values(const CoinSet& setCoins)
+{
+    CAmount nTotal = 0;
+    for (const CInputCoin& coin : setCoins)
+        nTotal += coin.txout.nValue;
+    return nTotal;
+}
+
+// Pairs of coins where every pair only adds up to the target with the
+// first coin of each pair, but the second coins always look better when
+// searching from the largest coin down
+static CAmount make_hard_case(int nPairs, std::vector<CInputCoin>& vCoins)
+{
+    vCoins.clear();
+    CAmount nTarget = 0;
+    for (int i = 0; i < nPairs; i++) {
+        nTarget += (CAmount)1 << (nPairs + i);
+        add_coin((CAmount)1 << (nPairs + i), vCoins);
+        add_coin(((CAmount)1 << (nPairs + i)) + ((CAmount)1 << (nPairs - 1 - i)), vCoins);
+    }
+    return nTarget;
+}
+
+BOOST_AUTO_TEST_CASE(bnb_search_test)
+{
+    std::vector<CInputCoin> vCoins;
+    CoinSet setCoinsRet;
+    CAmount nValueRet = 0;
+
+    add_coin(1 * CENT, vCoins);
+    add_coin(2 * CENT, vCoins);
+    add_coin(3 * CENT, vCoins);
+    add_coin(4 * CENT, vCoins);
+
+    // Exact matches with one or more coins
+    BOOST_CHECK(SelectCoinsBnB(vCoins, 1 * CENT, 0, setCoinsRet, nValueRet, 0));
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 1U);
+    BOOST_CHECK_EQUAL(nValueRet, 1 * CENT);
+
+    BOOST_CHECK(SelectCoinsBnB(vCoins, 5 * CENT, 0, setCoinsRet, nValueRet, 0));
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 2U);
+    BOOST_CHECK_EQUAL(nValueRet, 5 * CENT);
+
+    BOOST_CHECK(SelectCoinsBnB(vCoins, 10 * CENT, 0, setCoinsRet, nValueRet, 0));
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 4U);
+    BOOST_CHECK_EQUAL(nValueRet, 10 * CENT);
+
+    // Not enough funds
+    BOOST_CHECK(!SelectCoinsBnB(vCoins, 11 * CENT, 0, setCoinsRet, nValueRet, 0));
+    BOOST_CHECK(setCoinsRet.empty());
+
+    // No exact match, but within the cost of change
+    BOOST_CHECK(!SelectCoinsBnB(vCoins, CENT / 2, 0, setCoinsRet, nValueRet, 0));
+    BOOST_CHECK(SelectCoinsBnB(vCoins, CENT / 2, CENT / 2, setCoinsRet, nValueRet, 0));
+    BOOST_CHECK_EQUAL(nValueRet, 1 * CENT);
+
+    // The smallest excess wins
+    BOOST_CHECK(SelectCoinsBnB(vCoins, 6 * CENT + CENT / 2, 2 * CENT, setCoinsRet, nValueRet, 0));
+    BOOST_CHECK_EQUAL(nValueRet, 7 * CENT);
+
+    // Fees that don't depend on the inputs are added to the target
+    BOOST_CHECK(SelectCoinsBnB(vCoins, 4 * CENT, 0, setCoinsRet, nValueRet, 3 * CENT));
+    BOOST_CHECK_EQUAL(nValueRet, 7 * CENT);
+
+    // Selection works on effective values but returns the actual value
+    vCoins.clear();
+    add_coin(1 * CENT, vCoins, 1000);
+    add_coin(2 * CENT, vCoins, 1000);
+    BOOST_CHECK(!SelectCoinsBnB(vCoins, 3 * CENT, 0, setCoinsRet, nValueRet, 0));
+    BOOST_CHECK(SelectCoinsBnB(vCoins, 3 * CENT - 2000, 0, setCoinsRet, nValueRet, 0));
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 2U);
+    BOOST_CHECK_EQUAL(nValueRet, 3 * CENT);
+    BOOST_CHECK_EQUAL(sum_values(setCoinsRet), 3 * CENT);
+
+    // The pool is searched by effective value even when the coins come in
+    // descending order of their actual value
+    vCoins.clear();
+    add_coin(5 * CENT, vCoins, 3 * CENT);
+    add_coin(4 * CENT, vCoins);
+    add_coin(1 * CENT, vCoins);
+    BOOST_CHECK(SelectCoinsBnB(vCoins, 3 * CENT, 0, setCoinsRet, nValueRet, 0));
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 2U);
+    BOOST_CHECK_EQUAL(nValueRet, 6 * CENT);
+
+    // The search gives up after BNB_TOTAL_TRIES
+    CAmount nTarget = make_hard_case(17, vCoins);
+    BOOST_CHECK(!SelectCoinsBnB(vCoins, nTarget, 0, setCoinsRet, nValueRet, 0));
+    nTarget = make_hard_case(14, vCoins);
+    BOOST_CHECK(SelectCoinsBnB(vCoins, nTarget, 0, setCoinsRet, nValueRet, 0));
+    BOOST_CHECK_EQUAL(nValueRet, nTarget);
+
+    // Coins of equal value are not tried in every combination
+    vCoins.clear();
+    for (int i = 0; i < 4; i++)
+        add_coin(7 * CENT, vCoins);
+    add_coin(2 * CENT, vCoins);
+    for (int i = 0; i < 50000; i++)
+        add_coin(5 * CENT, vCoins);
+    BOOST_CHECK(SelectCoinsBnB(vCoins, 30 * CENT, 5000, setCoinsRet, nValueRet, 0));
+    BOOST_CHECK_EQUAL(nValueRet, 30 * CENT);
+}
+
+BOOST_AUTO_TEST_CASE(bnb_select_coins_min_conf)
+{
+    CWallet wallet;
+    CKey key;
+    key.MakeNewKey(true);
+    BOOST_CHECK(wallet.CCryptoKeyStore::AddKeyPubKey(key, key.GetPubKey()));
+    const CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+    std::vector<std::unique_ptr<CWalletTx>> vWtx;
+    std::vector<COutput> vCoins;
+    for (CAmount nValue : {1 * CENT, 2 * CENT, 5 * CENT}) {
+        CMutableTransaction tx;
+        tx.nLockTime = vWtx.size();
+        tx.vout.emplace_back(nValue, scriptPubKey);
+        vWtx.emplace_back(new CWalletTx(&wallet, MakeTransactionRef(std::move(tx))));
+        vCoins.emplace_back(vWtx.back().get(), 0, 6 * 24, true /* spendable */, true /* solvable */, true /* safe */);
+    }
+
+    const int nInputSize = wallet.CalculateMaximumSignedInputSize(CTxOut(0, scriptPubKey));
+    BOOST_CHECK(nInputSize > 0);
+
+    CoinSelectionParams params;
+    params.effective_fee = CFeeRate(10000);
+    params.tx_noinputs_size = 50;
+    const CAmount nInputFee = params.effective_fee.GetFee(nInputSize);
+    const CAmount nNoInputsFee = params.effective_fee.GetFee(params.tx_noinputs_size);
+
+    // The 1 and 2 CENT coins pay for the target and the fees exactly
+    CoinSet setCoinsRet;
+    CAmount nValueRet;
+    bool bnb_used;
+    BOOST_CHECK(wallet.SelectCoinsMinConf(3 * CENT - 2 * nInputFee - nNoInputsFee, 1, 6, 0, vCoins, setCoinsRet, nValueRet, &params, &bnb_used));
+    BOOST_CHECK(bnb_used);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 2U);
+    BOOST_CHECK_EQUAL(nValueRet, 3 * CENT);
+
+    // Without room for the fees no changeless selection exists and the
+    // knapsack solver is used
+    BOOST_CHECK(wallet.SelectCoinsMinConf(3 * CENT, 1, 6, 0, vCoins, setCoinsRet, nValueRet, &params, &bnb_used));
+    BOOST_CHECK(!bnb_used);
+    BOOST_CHECK(nValueRet >= 3 * CENT);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
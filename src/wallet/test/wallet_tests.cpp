@@ -9,10 +9,19 @@
 #include <utility>
 #include <vector>
 
+#include <chainparams.h>
 #include <consensus/validation.h>
+#include <miner.h>
+#include <policy/policy.h>
+#include <pow.h>
+#include <random.h>
 #include <rpc/server.h>
+#include <sidechaindb.h>
 #include <test/test_drivenet.h>
+#include <txmempool.h>
 #include <validation.h>
+#include <utilstrencodings.h>
+#include <validationinterface.h>
 #include <wallet/coincontrol.h>
 #include <wallet/test/wallet_test_fixture.h>
 
@@ -22,6 +31,8 @@
 extern UniValue importmulti(const JSONRPCRequest& request);
 extern UniValue dumpwallet(const JSONRPCRequest& request);
 extern UniValue importwallet(const JSONRPCRequest& request);
+extern UniValue abandonbmm(const JSONRPCRequest& request);
+extern UniValue listtransactions(const JSONRPCRequest& request);
 
 // how many times to run all the tests to have a chance to catch errors that only show up with particular random shuffles
 #define RUN_TESTS 100
@@ -445,6 +456,96 @@ BOOST_FIXTURE_TEST_CASE(rescan, TestChain100Setup)
     }
 }
 
+// With the block filter index, rescans find watch-only and multisig outputs,
+// and wallets that received bare multisig outputs to their keys, which can't
+// be listed for the filters, read every block.
+BOOST_FIXTURE_TEST_CASE(rescan_block_filters, TestChain100Setup)
+{
+    fBlockFilterIndex = true;
+
+    CKey watchKey1, watchKey2, key1, key2;
+    watchKey1.MakeNewKey(true);
+    watchKey2.MakeNewKey(true);
+    key1.MakeNewKey(true);
+    key2.MakeNewKey(true);
+    const CScript watchScript = GetScriptForMultisig(1, {watchKey1.GetPubKey(), watchKey2.GetPubKey()});
+    const CScript multisigScript = GetScriptForMultisig(1, {key1.GetPubKey(), key2.GetPubKey()});
+    const CScript multisigScript2 = GetScriptForMultisig(2, {key1.GetPubKey(), key2.GetPubKey()});
+
+    const int nHeightFirst = chainActive.Height() + 1;
+    CreateAndProcessBlock({}, watchScript);
+    CreateAndProcessBlock({}, multisigScript);
+    CreateAndProcessBlock({}, multisigScript2);
+    CBlockIndex* const nullBlock = nullptr;
+    CBlockIndex *pindexFirst, *pindexMultisig;
+    {
+        LOCK(cs_main);
+        pindexFirst = chainActive[nHeightFirst];
+        pindexMultisig = chainActive[nHeightFirst + 1];
+    }
+
+    // Watch-only scripts are matched as they are
+    {
+        CWallet wallet;
+        {
+            LOCK(wallet.cs_wallet);
+            BOOST_CHECK(wallet.AddWatchOnly(watchScript, 0 /* nCreateTime */));
+        }
+        GCSFilter::ElementSet elements;
+        BOOST_CHECK(wallet.GetRescanFilterElements(elements));
+        BOOST_CHECK(elements.count(GCSFilter::Element(watchScript.begin(), watchScript.end())));
+
+        WalletRescanReserver reserver(&wallet);
+        reserver.reserve();
+        BOOST_CHECK_EQUAL(nullBlock, wallet.ScanForWalletTransactions(pindexFirst, nullptr, reserver));
+        LOCK(wallet.cs_wallet);
+        BOOST_CHECK_EQUAL(wallet.mapWallet.size(), 1U);
+    }
+
+    // Redeem scripts are matched bare as well
+    {
+        CWallet wallet;
+        AddKey(wallet, key1);
+        AddKey(wallet, key2);
+        {
+            LOCK(wallet.cs_wallet);
+            BOOST_CHECK(wallet.AddCScript(multisigScript));
+        }
+        WalletRescanReserver reserver(&wallet);
+        reserver.reserve();
+        BOOST_CHECK_EQUAL(nullBlock, wallet.ScanForWalletTransactions(pindexFirst, pindexMultisig, reserver));
+        LOCK(wallet.cs_wallet);
+        BOOST_CHECK_EQUAL(wallet.mapWallet.size(), 1U);
+    }
+
+    // Having received bare multisig that isn't listed, every block is read
+    {
+        CWallet wallet;
+        AddKey(wallet, key1);
+        AddKey(wallet, key2);
+        GCSFilter::ElementSet elements;
+        BOOST_CHECK(wallet.GetRescanFilterElements(elements));
+        BOOST_CHECK(!elements.count(GCSFilter::Element(multisigScript.begin(), multisigScript.end())));
+
+        fBlockFilterIndex = false;
+        {
+            WalletRescanReserver reserver(&wallet);
+            reserver.reserve();
+            BOOST_CHECK_EQUAL(nullBlock, wallet.ScanForWalletTransactions(pindexMultisig, pindexMultisig, reserver));
+        }
+        fBlockFilterIndex = true;
+        BOOST_CHECK(!wallet.GetRescanFilterElements(elements));
+
+        WalletRescanReserver reserver(&wallet);
+        reserver.reserve();
+        BOOST_CHECK_EQUAL(nullBlock, wallet.ScanForWalletTransactions(pindexFirst, nullptr, reserver));
+        LOCK(wallet.cs_wallet);
+        BOOST_CHECK_EQUAL(wallet.mapWallet.size(), 2U);
+    }
+
+    fBlockFilterIndex = false;
+}
+
 // Verify importwallet RPC starts rescan at earliest block with timestamp
 // greater or equal than key birthday. Previously there was a bug where
 // importwallet RPC would start the scan at the latest block with timestamp less
@@ -530,6 +631,56 @@ BOOST_FIXTURE_TEST_CASE(coin_mark_dirty_immature_credit, TestChain100Setup)
     BOOST_CHECK_EQUAL(wtx.GetImmatureCredit(), 50*COIN);
 }
 
+// Keys and watch-only scripts imported without a rescan make outputs already
+// in the wallet ours, coin selection has to see them.
+BOOST_FIXTURE_TEST_CASE(unspent_index_import_without_rescan, TestChain100Setup)
+{
+    const CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    // Mature the first coinbase for the wallet
+    CreateAndProcessBlock({}, scriptPubKey);
+
+    // Removing a watch-only script erases it from the database
+    ::bitdb.MakeMock();
+    std::unique_ptr<CWallet> pwallet(new CWallet(std::unique_ptr<CWalletDBWrapper>(new CWalletDBWrapper(&bitdb, "wallet_test.dat"))));
+    CWallet& wallet = *pwallet;
+    bool fFirstRun;
+    wallet.LoadWallet(fFirstRun);
+
+    {
+        LOCK2(cs_main, wallet.cs_wallet);
+        CWalletTx wtx(&wallet, MakeTransactionRef(coinbaseTxns[0]));
+        wtx.SetMerkleBranch(chainActive[1], 0);
+        wallet.AddToWallet(wtx);
+
+        std::vector<COutput> vCoins;
+        wallet.AvailableCoinsForSelection(vCoins);
+        BOOST_CHECK(vCoins.empty());
+
+        BOOST_CHECK(wallet.AddWatchOnly(scriptPubKey, 0 /* nCreateTime */));
+        wallet.AvailableCoinsForSelection(vCoins);
+        BOOST_CHECK_EQUAL(vCoins.size(), 1U);
+        BOOST_CHECK(!vCoins[0].fSpendable);
+
+        BOOST_CHECK(wallet.RemoveWatchOnly(scriptPubKey));
+        wallet.AvailableCoinsForSelection(vCoins);
+        BOOST_CHECK(vCoins.empty());
+
+        BOOST_CHECK(wallet.AddKeyPubKey(coinbaseKey, coinbaseKey.GetPubKey()));
+        wallet.AvailableCoinsForSelection(vCoins);
+        BOOST_CHECK_EQUAL(vCoins.size(), 1U);
+        BOOST_CHECK(vCoins[0].fSpendable);
+
+        // Listing all coins walks the wallet in its own order and agrees
+        std::vector<COutput> vCoinsAll;
+        wallet.AvailableCoins(vCoinsAll);
+        BOOST_CHECK_EQUAL(vCoinsAll.size(), 1U);
+    }
+
+    pwallet.reset();
+    ::bitdb.Flush(true);
+    ::bitdb.Reset();
+}
+
 static int64_t AddTx(CWallet& wallet, uint32_t lockTime, int64_t mockTime, int64_t blockTime)
 {
     CMutableTransaction tx;
@@ -702,4 +853,655 @@ BOOST_FIXTURE_TEST_CASE(ListCoins, ListCoinsTestingSetup)
     BOOST_CHECK_EQUAL(list.begin()->second.size(), 2);
 }
 
+class BMMPoolTestingSetup : public TestChain100Setup
+{
+public:
+    BMMPoolTestingSetup()
+    {
+        CreateAndProcessBlock({}, GetScriptForRawPubKey(coinbaseKey.GetPubKey()));
+        g_address_type = OUTPUT_TYPE_DEFAULT;
+        g_change_type = OUTPUT_TYPE_DEFAULT;
+        CWallet::nBMMPoolSize = 3;
+        CWallet::nBMMPoolAmount = COIN;
+        ::bitdb.MakeMock();
+        wallet.reset(new CWallet(std::unique_ptr<CWalletDBWrapper>(new CWalletDBWrapper(&bitdb, "wallet_test.dat"))));
+        bool firstRun;
+        wallet->LoadWallet(firstRun);
+        wallet->SetBroadcastTransactions(true);
+        AddKey(*wallet, coinbaseKey);
+        WalletRescanReserver reserver(wallet.get());
+        reserver.reserve();
+        wallet->ScanForWalletTransactions(chainActive.Genesis(), nullptr, reserver);
+        RegisterValidationInterface(wallet.get());
+        // Expired requests leaving the mempool have to reach the wallet
+        GetMainSignals().RegisterWithMempoolSignals(mempool);
+    }
+
+    ~BMMPoolTestingSetup()
+    {
+        GetMainSignals().UnregisterWithMempoolSignals(mempool);
+        SyncWithValidationInterfaceQueue();
+        UnregisterValidationInterface(wallet.get());
+        wallet.reset();
+        ::bitdb.Flush(true);
+        ::bitdb.Reset();
+        CWallet::nBMMPoolSize = DEFAULT_BMM_POOL_SIZE;
+        CWallet::nBMMPoolAmount = DEFAULT_BMM_POOL_AMOUNT;
+        CWallet::nBMMReplace = DEFAULT_BMM_REPLACE;
+    }
+
+    //! Mine a block from the mempool
+    void MineBlock()
+    {
+        CreateAndProcessBlock({}, GetScriptForRawPubKey(coinbaseKey.GetPubKey()), false);
+        SyncWithValidationInterfaceQueue();
+    }
+
+    //! Create a block on the current tip to be connected later, as if it was
+    //! found by a miner that hasn't seen our transactions yet
+    CBlock CreateBlock()
+    {
+        std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(Params()).CreateNewBlock(GetScriptForRawPubKey(coinbaseKey.GetPubKey()));
+        CBlock& block = pblocktemplate->block;
+        unsigned int extraNonce = 0;
+        {
+            LOCK(cs_main);
+            IncrementExtraNonce(&block, chainActive.Tip(), extraNonce);
+        }
+        while (!CheckProofOfWork(block.GetPoWHash(), block.nBits, Params().GetConsensus())) ++block.nNonce;
+        return block;
+    }
+
+    void ProcessBlock(const CBlock& block)
+    {
+        BOOST_CHECK(ProcessNewBlock(Params(), std::make_shared<const CBlock>(block), true, nullptr));
+        SyncWithValidationInterfaceQueue();
+    }
+
+    //! Refill the pool and confirm the refill
+    void FundPool()
+    {
+        std::string strFailReason;
+        BOOST_CHECK(wallet->RefillBMMPool(nullptr, strFailReason));
+        MineBlock();
+    }
+
+    void CheckPoolSize(size_t nAvailableExpected, size_t nPendingExpected)
+    {
+        LOCK(wallet->cs_wallet);
+        size_t nAvailable, nPending;
+        wallet->GetBMMPoolSize(nAvailable, nPending);
+        BOOST_CHECK_EQUAL(nAvailable, nAvailableExpected);
+        BOOST_CHECK_EQUAL(nPending, nPendingExpected);
+    }
+
+    //! Critical data that expires like a BMM request but isn't tied to a sidechain
+    static CCriticalData CriticalData()
+    {
+        CCriticalData criticalData;
+        criticalData.bytes = std::vector<unsigned char>{0x01, 0x02, 0x03};
+        criticalData.hashCritical = GetRandHash();
+        return criticalData;
+    }
+
+    //! A BMM request for sidechain 0 on top of the current tip
+    static CCriticalData BMMCriticalData(const uint256& hashCritical)
+    {
+        std::string strPrevBlock = chainActive.Tip()->GetBlockHash().ToString();
+        strPrevBlock = strPrevBlock.substr(strPrevBlock.size() - 4);
+
+        CScript bytes;
+        bytes.resize(3);
+        bytes[0] = 0x00;
+        bytes[1] = 0xbf;
+        bytes[2] = 0x00;
+        bytes << CScriptNum(0);
+        bytes << CScriptNum(0);
+        bytes << ToByteVector(HexStr(strPrevBlock));
+
+        CCriticalData criticalData;
+        criticalData.bytes = std::vector<unsigned char>(bytes.begin(), bytes.end());
+        criticalData.hashCritical = hashCritical;
+        return criticalData;
+    }
+
+    //! Create a BMM request for the current tip and add it to the mempool
+    uint256 CommitBMMRequest(const uint256& hashCritical, bool fReplace)
+    {
+        LOCK2(cs_main, wallet->cs_wallet);
+        CWalletTx wtx;
+        if (fReplace)
+            wtx.mapValue["bmmreplace"] = "0";
+        CReserveKey reservekey(wallet.get());
+        std::string strFailReason;
+        BOOST_CHECK(wallet->CreateBMMRequest(CENT, chainActive.Height(), BMMCriticalData(hashCritical), wtx, reservekey, strFailReason));
+        CValidationState state;
+        BOOST_CHECK(wallet->CommitTransaction(wtx, reservekey, nullptr, state));
+        BOOST_CHECK(mempool.exists(wtx.GetHash()));
+        if (fReplace)
+            wallet->TrackBMMRequest(*wallet->GetWalletTx(wtx.GetHash()));
+        return wtx.GetHash();
+    }
+
+    std::unique_ptr<CWallet> wallet;
+};
+
+BOOST_FIXTURE_TEST_CASE(bmm_pool_refill, BMMPoolTestingSetup)
+{
+    // Nothing to spend before the pool has been refilled
+    {
+        LOCK2(cs_main, wallet->cs_wallet);
+        CWalletTx wtx;
+        CReserveKey reservekey(wallet.get());
+        std::string strFailReason;
+        BOOST_CHECK(!wallet->CreateBMMRequest(CENT, chainActive.Height(), CriticalData(), wtx, reservekey, strFailReason));
+        BOOST_CHECK_EQUAL(strFailReason, "BMM pool is empty");
+    }
+
+    // The refill outputs are pending until the refill confirms, and a second
+    // refill doesn't create more of them
+    std::string strFailReason;
+    BOOST_CHECK(wallet->RefillBMMPool(nullptr, strFailReason));
+    CheckPoolSize(0, 3);
+    BOOST_CHECK(wallet->RefillBMMPool(nullptr, strFailReason));
+    CheckPoolSize(0, 3);
+    BOOST_CHECK_EQUAL(mempool.size(), 1U);
+
+    // Every refill output pays to a key of its own
+    {
+        LOCK(mempool.cs);
+        std::set<CScript> setScript;
+        for (const CTxOut& txout : mempool.mapTx.begin()->GetTx().vout) {
+            if (txout.nValue == COIN)
+                setScript.insert(txout.scriptPubKey);
+        }
+        BOOST_CHECK_EQUAL(setScript.size(), 3U);
+    }
+
+    MineBlock();
+    CheckPoolSize(3, 0);
+    BOOST_CHECK_EQUAL(mempool.size(), 0U);
+
+    // Pool outputs aren't used for regular spends
+    {
+        LOCK2(cs_main, wallet->cs_wallet);
+        std::vector<COutput> vCoins;
+        wallet->AvailableCoins(vCoins);
+        for (const COutput& out : vCoins)
+            BOOST_CHECK(out.tx->tx->vout[out.i].nValue != COIN);
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(bmm_pool_refill_unfunded, BMMPoolTestingSetup)
+{
+    // The key the keypool hands out next
+    CPubKey pubkeyNext;
+    {
+        CReserveKey reservekey(wallet.get());
+        BOOST_CHECK(reservekey.GetReservedKey(pubkeyNext));
+    }
+    size_t nAddressBook;
+    {
+        LOCK(wallet->cs_wallet);
+        nAddressBook = wallet->mapAddressBook.size();
+    }
+
+    // A refill the wallet can't pay for gives its keys back and leaves the
+    // address book alone
+    CWallet::nBMMPoolAmount = 1000 * COIN;
+    std::string strFailReason;
+    BOOST_CHECK(!wallet->RefillBMMPool(nullptr, strFailReason));
+    CheckPoolSize(0, 0);
+
+    CPubKey pubkey;
+    CReserveKey reservekey(wallet.get());
+    BOOST_CHECK(reservekey.GetReservedKey(pubkey));
+    BOOST_CHECK(pubkey == pubkeyNext);
+    LOCK(wallet->cs_wallet);
+    BOOST_CHECK_EQUAL(wallet->mapAddressBook.size(), nAddressBook);
+}
+
+BOOST_FIXTURE_TEST_CASE(bmm_pool_consume, BMMPoolTestingSetup)
+{
+    FundPool();
+
+    LOCK2(cs_main, wallet->cs_wallet);
+    std::set<COutPoint> setSpent;
+    for (size_t i = 0; i < 3; i++) {
+        CWalletTx wtx;
+        CReserveKey reservekey(wallet.get());
+        std::string strFailReason;
+        BOOST_CHECK(wallet->CreateBMMRequest(CENT, chainActive.Height(), CriticalData(), wtx, reservekey, strFailReason));
+        BOOST_CHECK_EQUAL(wtx.tx->nVersion, 3);
+        BOOST_CHECK_EQUAL(wtx.tx->nLockTime, (uint32_t)chainActive.Height());
+        BOOST_CHECK_EQUAL(wtx.tx->vin.size(), 1U);
+        BOOST_CHECK(setSpent.insert(wtx.tx->vin[0].prevout).second);
+        BOOST_CHECK_EQUAL(wtx.tx->vout.size(), 2U);
+        BOOST_CHECK_EQUAL(wtx.tx->vout[0].nValue, CENT);
+        BOOST_CHECK(wtx.tx->vout[0].scriptPubKey == CScript() << OP_TRUE);
+        BOOST_CHECK(wallet->IsChange(wtx.tx->vout[1]));
+        BOOST_CHECK_EQUAL(wtx.mapValue["bmm"], "request");
+        reservekey.KeepKey();
+
+        size_t nAvailable, nPending;
+        wallet->GetBMMPoolSize(nAvailable, nPending);
+        BOOST_CHECK_EQUAL(nAvailable, 2 - i);
+    }
+
+    CWalletTx wtx;
+    CReserveKey reservekey(wallet.get());
+    std::string strFailReason;
+    BOOST_CHECK(!wallet->CreateBMMRequest(CENT, chainActive.Height(), CriticalData(), wtx, reservekey, strFailReason));
+    BOOST_CHECK_EQUAL(strFailReason, "BMM pool is empty");
+}
+
+BOOST_FIXTURE_TEST_CASE(bmm_pool_request_failure, BMMPoolTestingSetup)
+{
+    FundPool();
+
+    SecureString strPassphrase;
+    strPassphrase.assign("passphrase");
+    BOOST_CHECK(wallet->EncryptWallet(strPassphrase));
+    BOOST_CHECK(wallet->Unlock(strPassphrase));
+
+    LOCK2(cs_main, wallet->cs_wallet);
+    const unsigned int nKeyPoolSize = wallet->GetKeyPoolSize();
+    std::string strFailReason;
+    size_t nAvailable, nPending;
+
+    // A bid larger than the pool outputs leaves both the output and the
+    // change key where they were
+    {
+        CWalletTx wtx;
+        CReserveKey reservekey(wallet.get());
+        BOOST_CHECK(!wallet->CreateBMMRequest(2 * COIN, chainActive.Height(), CriticalData(), wtx, reservekey, strFailReason));
+        BOOST_CHECK_EQUAL(strFailReason, "BMM pool outputs are too small for this amount");
+        BOOST_CHECK_EQUAL(wallet->GetKeyPoolSize(), nKeyPoolSize);
+        wallet->GetBMMPoolSize(nAvailable, nPending);
+        BOOST_CHECK_EQUAL(nAvailable, 3U);
+    }
+
+    // So does failing to sign with a locked wallet
+    BOOST_CHECK(wallet->Lock());
+    {
+        CWalletTx wtx;
+        CReserveKey reservekey(wallet.get());
+        BOOST_CHECK(!wallet->CreateBMMRequest(CENT, chainActive.Height(), CriticalData(), wtx, reservekey, strFailReason));
+        BOOST_CHECK_EQUAL(strFailReason, "Signing transaction failed");
+        BOOST_CHECK_EQUAL(wallet->GetKeyPoolSize(), nKeyPoolSize);
+        wallet->GetBMMPoolSize(nAvailable, nPending);
+        BOOST_CHECK_EQUAL(nAvailable, 3U);
+    }
+
+    // Every output can still be used afterwards
+    BOOST_CHECK(wallet->Unlock(strPassphrase));
+    for (size_t i = 0; i < 3; i++) {
+        CWalletTx wtx;
+        CReserveKey reservekey(wallet.get());
+        BOOST_CHECK(wallet->CreateBMMRequest(CENT, chainActive.Height(), CriticalData(), wtx, reservekey, strFailReason));
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(bmm_pool_expired_request, BMMPoolTestingSetup)
+{
+    FundPool();
+
+    const CBlock block = CreateBlock();
+    COutPoint outpoint;
+    {
+        LOCK2(cs_main, wallet->cs_wallet);
+        CWalletTx wtx;
+        CReserveKey reservekey(wallet.get());
+        std::string strFailReason;
+        BOOST_CHECK(wallet->CreateBMMRequest(CENT, chainActive.Height(), CriticalData(), wtx, reservekey, strFailReason));
+        outpoint = wtx.tx->vin[0].prevout;
+        CValidationState state;
+        BOOST_CHECK(wallet->CommitTransaction(wtx, reservekey, nullptr, state));
+        BOOST_CHECK(mempool.exists(wtx.GetHash()));
+    }
+    CheckPoolSize(2, 0);
+
+    // The request could only be included in this block. It stays in the
+    // mempool until the next block template is created.
+    ProcessBlock(block);
+    BOOST_CHECK_EQUAL(mempool.size(), 1U);
+    CheckPoolSize(2, 0);
+
+    // Once it has been dropped from the mempool its input goes back to the
+    // front of the pool
+    MineBlock();
+    BOOST_CHECK_EQUAL(mempool.size(), 0U);
+    CheckPoolSize(3, 0);
+
+    LOCK2(cs_main, wallet->cs_wallet);
+    CWalletTx wtx;
+    CReserveKey reservekey(wallet.get());
+    std::string strFailReason;
+    BOOST_CHECK(wallet->CreateBMMRequest(CENT, chainActive.Height(), CriticalData(), wtx, reservekey, strFailReason));
+    BOOST_CHECK(wtx.tx->vin[0].prevout == outpoint);
+}
+
+BOOST_FIXTURE_TEST_CASE(bmm_pool_reorg, BMMPoolTestingSetup)
+{
+    FundPool();
+    CheckPoolSize(3, 0);
+
+    // Disconnecting the refill moves its outputs back to pending
+    CBlockIndex* pindex;
+    CValidationState state;
+    {
+        LOCK(cs_main);
+        pindex = chainActive.Tip();
+        BOOST_CHECK(InvalidateBlock(state, Params(), pindex));
+    }
+    SyncWithValidationInterfaceQueue();
+    BOOST_CHECK_EQUAL(mempool.size(), 1U);
+    {
+        LOCK2(cs_main, wallet->cs_wallet);
+        CWalletTx wtx;
+        CReserveKey reservekey(wallet.get());
+        std::string strFailReason;
+        BOOST_CHECK(!wallet->CreateBMMRequest(CENT, chainActive.Height(), CriticalData(), wtx, reservekey, strFailReason));
+        BOOST_CHECK_EQUAL(strFailReason, "BMM pool is empty");
+    }
+    CheckPoolSize(0, 3);
+
+    // And reconnecting it makes them available again
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(ResetBlockFailureFlags(pindex));
+    }
+    BOOST_CHECK(ActivateBestChain(state, Params()));
+    SyncWithValidationInterfaceQueue();
+    CheckPoolSize(3, 0);
+}
+
+BOOST_FIXTURE_TEST_CASE(bmm_request_replacement, BMMPoolTestingSetup)
+{
+    CWallet::nBMMReplace = 1;
+    FundPool();
+
+    const uint256 hashCritical = GetRandHash();
+    const CBlock block = CreateBlock();
+    const uint256 hashOld = CommitBMMRequest(hashCritical, true);
+    {
+        LOCK2(cs_main, wallet->cs_wallet);
+        BOOST_CHECK(wallet->GetBMMRequest(0)->GetHash() == hashOld);
+    }
+
+    // A block without our request replaces the expired request in the mempool
+    // with one for the new tip, spending the same input
+    ProcessBlock(block);
+    uint256 hashNew;
+    {
+        LOCK2(cs_main, wallet->cs_wallet);
+        const CWalletTx* pwtx = wallet->GetBMMRequest(0);
+        BOOST_CHECK(pwtx);
+        hashNew = pwtx->GetHash();
+        BOOST_CHECK(hashNew != hashOld);
+        BOOST_CHECK(!wallet->GetWalletTx(hashOld));
+        BOOST_CHECK(!mempool.exists(hashOld));
+        BOOST_CHECK(mempool.exists(hashNew));
+        BOOST_CHECK_EQUAL(pwtx->tx->nLockTime, (uint32_t)chainActive.Height());
+        BOOST_CHECK(pwtx->tx->criticalData.hashCritical == hashCritical);
+        BOOST_CHECK_EQUAL(pwtx->mapValue.at("bmmreplace"), "1");
+    }
+    CheckPoolSize(2, 0);
+
+    // A replacement that isn't accepted isn't kept in the wallet
+    {
+        LOCK2(cs_main, wallet->cs_wallet);
+        const CWalletTx* pwtx = wallet->GetBMMRequest(0);
+        CCriticalData criticalData = pwtx->tx->criticalData;
+        // Prev bytes that don't match the tip
+        criticalData.bytes.back() ^= 1;
+        CWalletTx wtx;
+        std::string strFailReason;
+        BOOST_CHECK(wallet->CreateBMMReplacement(*pwtx, CENT, chainActive.Height(), criticalData, wtx, strFailReason));
+        CValidationState state;
+        BOOST_CHECK(!wallet->CommitBMMReplacement(hashNew, wtx, nullptr, state));
+        BOOST_CHECK_EQUAL(state.GetRejectReason(), "bmm-invalid-prev-bytes");
+        BOOST_CHECK(!wallet->GetWalletTx(wtx.GetHash()));
+        BOOST_CHECK(wallet->GetBMMRequest(0)->GetHash() == hashNew);
+        BOOST_CHECK(mempool.exists(hashNew));
+    }
+
+    // Replacing it again for the same tip has to pay for the request it replaces
+    {
+        LOCK2(cs_main, wallet->cs_wallet);
+        const CWalletTx* pwtx = wallet->GetBMMRequest(0);
+        const CAmount nOldFee = wallet->GetDebit(*pwtx->tx, ISMINE_ALL) - pwtx->tx->GetValueOut();
+        CWalletTx wtx;
+        std::string strFailReason;
+        BOOST_CHECK(wallet->CreateBMMReplacement(*pwtx, 2 * CENT, chainActive.Height(), pwtx->tx->criticalData, wtx, strFailReason));
+        BOOST_CHECK_GT(wallet->GetDebit(*wtx.tx, ISMINE_ALL) - wtx.tx->GetValueOut(), nOldFee);
+        CValidationState state;
+        BOOST_CHECK(wallet->CommitBMMReplacement(hashNew, wtx, nullptr, state));
+        BOOST_CHECK(!wallet->GetWalletTx(hashNew));
+        BOOST_CHECK(!mempool.exists(hashNew));
+        BOOST_CHECK(mempool.exists(wtx.GetHash()));
+        BOOST_CHECK(wallet->GetBMMRequest(0)->GetHash() == wtx.GetHash());
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(bmm_abandon, BMMPoolTestingSetup)
+{
+    std::unique_ptr<CWallet> other(new CWallet(std::unique_ptr<CWalletDBWrapper>(new CWalletDBWrapper(&bitdb, "wallet_test_other.dat"))));
+    bool firstRun;
+    other->LoadWallet(firstRun);
+    RegisterValidationInterface(other.get());
+
+    FundPool();
+
+    const CBlock block = CreateBlock();
+    const uint256 hash = CommitBMMRequest(GetRandHash(), false);
+    ProcessBlock(block);
+    CheckPoolSize(2, 0);
+
+    vpwallets.insert(vpwallets.begin(), wallet.get());
+    vpwallets.insert(vpwallets.begin(), other.get());
+
+    auto find = [](const UniValue& results, const std::string& strKey) {
+        for (const UniValue& entry : results.getValues()) {
+            if (entry.exists(strKey))
+                return entry[strKey].get_str();
+        }
+        return std::string();
+    };
+
+    // Another wallet leaves the request to us
+    JSONRPCRequest request;
+    request.params.setArray();
+    request.URI = "/wallet/wallet_test_other.dat";
+    UniValue results = abandonbmm(request);
+    BOOST_CHECK_EQUAL(find(results, "not-in-wallet"), hash.ToString());
+    BOOST_CHECK(!mempool.exists(hash));
+    BOOST_CHECK(scdb.GetRemovedBMM().count(hash));
+
+    request.URI = "/wallet/wallet_test.dat";
+    results = abandonbmm(request);
+    BOOST_CHECK_EQUAL(find(results, "abandoned"), hash.ToString());
+    BOOST_CHECK(!scdb.GetRemovedBMM().count(hash));
+    {
+        LOCK2(cs_main, wallet->cs_wallet);
+        BOOST_CHECK(wallet->GetWalletTx(hash)->isAbandoned());
+    }
+
+    vpwallets.erase(vpwallets.begin(), vpwallets.begin() + 2);
+    UnregisterValidationInterface(other.get());
+
+    // The input goes back into the pool with the next block
+    MineBlock();
+    CheckPoolSize(3, 0);
+}
+
+BOOST_FIXTURE_TEST_CASE(listtransactions_stream, BMMPoolTestingSetup)
+{
+    // A transaction with several entries, sent and received
+    FundPool();
+    vpwallets.insert(vpwallets.begin(), wallet.get());
+
+    // The written result matches the returned one for every window
+    for (const auto& window : std::vector<std::pair<int, int>>{{10, 0}, {3, 2}, {4, 9}, {1000, 0}, {5, 1000}, {0, 0}}) {
+        JSONRPCRequest request;
+        request.params.setArray();
+        request.params.push_back("*");
+        request.params.push_back(window.first);
+        request.params.push_back(window.second);
+        UniValue result = listtransactions(request);
+
+        std::string strStreamed;
+        JSONStreamWriter writer([&](const std::string& strChunk) {
+            strStreamed += strChunk;
+        }, 16);
+        request.pResultWriter = &writer;
+        BOOST_CHECK(listtransactions(request).isNull());
+        strStreamed += writer.ReleaseBuffer();
+        BOOST_CHECK_EQUAL(strStreamed, result.write());
+    }
+
+    vpwallets.erase(vpwallets.begin());
+}
+
+class SidechainDepositTestingSetup : public BMMPoolTestingSetup
+{
+public:
+    SidechainDepositTestingSetup()
+    {
+        // Let the wallet see a block so it can wait for the chain tip
+        MineBlock();
+        vpwallets.push_back(wallet.get());
+
+        Sidechain proposal;
+        proposal.nSidechain = 0;
+        proposal.title = "Test";
+        proposal.description = "Deposits";
+        BOOST_CHECK(ActivateSidechain(scdb, proposal, chainActive.Height(), true));
+        BOOST_CHECK(scdb.GetSidechain(0, sidechain));
+    }
+
+    ~SidechainDepositTestingSetup()
+    {
+        vpwallets.clear();
+        mempool.clear();
+        mempool.UpdateCTIPFromMempool({});
+        gArgs.ForceSetArg("-limitdescendantcount", std::to_string(DEFAULT_DESCENDANT_LIMIT));
+    }
+
+    bool CreateDeposits(std::vector<CTransactionRef>& vtx, std::string& strFail, size_t nDeposit)
+    {
+        std::vector<std::pair<std::string, CAmount>> vDeposit;
+        for (size_t i = 0; i < nDeposit; i++)
+            vDeposit.emplace_back("s0_deposit_" + std::to_string(i), COIN);
+        return wallet->CreateSidechainDeposits(vtx, strFail, sidechain.scriptPubKey, 0, vDeposit, CENT);
+    }
+
+    Sidechain sidechain;
+};
+
+BOOST_FIXTURE_TEST_CASE(sidechain_deposit_chain, SidechainDepositTestingSetup)
+{
+    std::vector<CTransactionRef> vtx;
+    std::string strFail;
+    BOOST_CHECK(CreateDeposits(vtx, strFail, 3));
+    BOOST_REQUIRE_EQUAL(vtx.size(), 3U);
+
+    LOCK2(cs_main, wallet->cs_wallet);
+    const CScript& scriptChange = vtx.front()->vout[0].scriptPubKey;
+    BOOST_CHECK(wallet->IsMine(vtx.front()->vout[0]));
+    for (size_t i = 0; i < vtx.size(); i++) {
+        const CTransaction& tx = *vtx[i];
+        BOOST_CHECK(mempool.exists(tx.GetHash()));
+        BOOST_CHECK(wallet->GetWalletTx(tx.GetHash())->InMempool());
+
+        // Change on output 0, the sidechain CTIP on the last output
+        BOOST_REQUIRE_EQUAL(tx.vout.size(), 3U);
+        BOOST_CHECK(tx.vout[0].scriptPubKey == scriptChange);
+        BOOST_CHECK(tx.vout[1].scriptPubKey.IsUnspendable());
+        BOOST_CHECK(tx.vout[2].scriptPubKey == sidechain.scriptPubKey);
+        BOOST_CHECK_EQUAL(tx.vout[2].nValue, (CAmount)(i + 1) * COIN);
+
+        if (i == 0)
+            continue;
+
+        // Every later deposit spends the change and the CTIP of the one
+        // before it, and nothing else
+        const CTransaction& txPrev = *vtx[i - 1];
+        BOOST_REQUIRE_EQUAL(tx.vin.size(), 2U);
+        BOOST_CHECK(tx.vin[0].prevout == COutPoint(txPrev.GetHash(), 0));
+        BOOST_CHECK(tx.vin[1].prevout == COutPoint(txPrev.GetHash(), 2));
+        BOOST_CHECK_EQUAL(txPrev.vout[0].nValue - tx.vout[0].nValue, COIN + CENT);
+    }
+
+    SidechainCTIP ctip;
+    BOOST_CHECK(mempool.GetMemPoolCTIP(0, ctip));
+    BOOST_CHECK(ctip.out == COutPoint(vtx.back()->GetHash(), 2));
+    BOOST_CHECK_EQUAL(ctip.amount, 3 * COIN);
+}
+
+BOOST_FIXTURE_TEST_CASE(sidechain_deposit_chain_rollback, SidechainDepositTestingSetup)
+{
+    const CAmount nBalance = wallet->GetBalance();
+
+    // The third deposit is rejected after the first two were accepted
+    gArgs.ForceSetArg("-limitdescendantcount", "2");
+    std::vector<CTransactionRef> vtx;
+    std::string strFail;
+    BOOST_CHECK(!CreateDeposits(vtx, strFail, 3));
+    BOOST_CHECK(vtx.empty());
+    BOOST_CHECK(strFail.find("too-long-mempool-chain") != std::string::npos);
+
+    // None of them are left in the mempool, and their coins can be spent again
+    SidechainCTIP ctip;
+    BOOST_CHECK_EQUAL(mempool.size(), 0U);
+    BOOST_CHECK(!mempool.GetMemPoolCTIP(0, ctip));
+    {
+        LOCK2(cs_main, wallet->cs_wallet);
+        int nAbandoned = 0;
+        for (const auto& entry : wallet->mapWallet) {
+            const CWalletTx& wtx = entry.second;
+            if (wtx.IsCoinBase())
+                continue;
+            BOOST_CHECK(wtx.isAbandoned());
+            BOOST_CHECK(!wtx.InMempool());
+            nAbandoned++;
+        }
+        BOOST_CHECK_EQUAL(nAbandoned, 3);
+    }
+    BOOST_CHECK_EQUAL(wallet->GetBalance(), nBalance);
+
+    // A new chain can be created on the old CTIP
+    gArgs.ForceSetArg("-limitdescendantcount", std::to_string(DEFAULT_DESCENDANT_LIMIT));
+    BOOST_CHECK(CreateDeposits(vtx, strFail, 2));
+    BOOST_CHECK_EQUAL(vtx.size(), 2U);
+    BOOST_CHECK_EQUAL(mempool.size(), 2U);
+}
+
+// The fee check counts the signature of the CTIP input
+BOOST_FIXTURE_TEST_CASE(sidechain_deposit_ctip_fee, SidechainDepositTestingSetup)
+{
+    // The second deposit of a chain spends the change and the CTIP of the
+    // first one, measure its size
+    std::vector<CTransactionRef> vtx;
+    std::string strFail;
+    BOOST_REQUIRE(CreateDeposits(vtx, strFail, 2));
+    const int64_t nSize = GetVirtualTransactionSize(*vtx[1]);
+
+    mempool.removeRecursive(*vtx.front());
+    mempool.UpdateCTIPFromMempool({});
+    SyncWithValidationInterfaceQueue();
+    for (const CTransactionRef& tx : vtx)
+        BOOST_CHECK(wallet->AbandonTransaction(tx->GetHash()));
+
+    // A fee rate at which the deposit fee only covers the second deposit
+    // without the signature of its CTIP input
+    payTxFee = CFeeRate(CENT * 1000 / (nSize - 30));
+    BOOST_CHECK(!CreateDeposits(vtx, strFail, 2));
+    BOOST_CHECK_EQUAL(strFail, "The fee you have set is too small!");
+
+    // A single deposit without a CTIP is smaller and still pays enough
+    BOOST_CHECK(CreateDeposits(vtx, strFail, 1));
+    payTxFee = CFeeRate(0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
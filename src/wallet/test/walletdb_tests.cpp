@@ -0,0 +1,151 @@
+// Copyright (c) 2026 The DriveNet developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <wallet/walletdb.h>
+
+#include <random.h>
+#include <wallet/test/wallet_test_fixture.h>
+#include <wallet/wallet.h>
+
+#include <thread>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(walletdb_tests, WalletTestingSetup)
+
+/** A wallet transaction that passes the checks done when loading it */
+static CWalletTx MakeWalletTx(const CWallet* pwallet, int64_t nOrderPos)
+{
+    CMutableTransaction mtx;
+    mtx.vin.emplace_back(COutPoint(GetRandHash(), 0));
+    mtx.vout.emplace_back(COIN, CScript() << OP_TRUE);
+    CWalletTx wtx(pwallet, MakeTransactionRef(std::move(mtx)));
+    wtx.nOrderPos = nOrderPos;
+    return wtx;
+}
+
+static bool HasTx(CWalletDBWrapper& dbw, const uint256& hash)
+{
+    CDB batch(dbw, "r");
+    return batch.Exists(std::make_pair(std::string("tx"), hash));
+}
+
+BOOST_AUTO_TEST_CASE(group_commit_coalesce)
+{
+    CWalletDBWrapper& dbw = pwalletMain->GetDBHandle();
+    const CWalletTx wtxA = MakeWalletTx(pwalletMain.get(), 0);
+    const CWalletTx wtxB = MakeWalletTx(pwalletMain.get(), 1);
+    const CWalletTx wtxC = MakeWalletTx(pwalletMain.get(), 2);
+
+    BOOST_CHECK(CWalletDB(dbw).WriteTx(wtxC));
+    BOOST_CHECK(HasTx(dbw, wtxC.GetHash()));
+
+    // Only the last queued change of a record is committed
+    dbw.SetGroupCommit(true);
+    {
+        CWalletDB walletdb(dbw);
+        BOOST_CHECK(walletdb.WriteTx(wtxA));
+        BOOST_CHECK(walletdb.EraseTx(wtxA.GetHash()));
+        BOOST_CHECK(walletdb.EraseTx(wtxB.GetHash()));
+        BOOST_CHECK(walletdb.WriteTx(wtxB));
+        BOOST_CHECK(walletdb.EraseTx(wtxC.GetHash()));
+    }
+    BOOST_CHECK(!HasTx(dbw, wtxA.GetHash()));
+    BOOST_CHECK(!HasTx(dbw, wtxB.GetHash()));
+    BOOST_CHECK(HasTx(dbw, wtxC.GetHash()));
+
+    BOOST_CHECK(dbw.CommitQueue());
+    BOOST_CHECK(!HasTx(dbw, wtxA.GetHash()));
+    BOOST_CHECK(HasTx(dbw, wtxB.GetHash()));
+    BOOST_CHECK(!HasTx(dbw, wtxC.GetHash()));
+}
+
+BOOST_AUTO_TEST_CASE(group_commit_read_barrier)
+{
+    CWalletDBWrapper& dbw = pwalletMain->GetDBHandle();
+    dbw.SetGroupCommit(true);
+
+    // Reading the records back commits the queue first
+    const CWalletTx wtx = MakeWalletTx(pwalletMain.get(), 0);
+    BOOST_CHECK(CWalletDB(dbw).WriteTx(wtx));
+    BOOST_CHECK(!HasTx(dbw, wtx.GetHash()));
+
+    std::vector<uint256> vTxHash;
+    std::vector<CWalletTx> vWtx;
+    BOOST_CHECK(CWalletDB(dbw).FindWalletTx(vTxHash, vWtx) == DB_LOAD_OK);
+    BOOST_CHECK_EQUAL(vTxHash.size(), 1U);
+    BOOST_CHECK(vTxHash[0] == wtx.GetHash());
+    BOOST_CHECK(HasTx(dbw, wtx.GetHash()));
+}
+
+BOOST_AUTO_TEST_CASE(group_commit_best_block)
+{
+    CWalletDBWrapper& dbw = pwalletMain->GetDBHandle();
+    dbw.SetGroupCommit(true);
+
+    // The locator is never written ahead of the records it covers
+    const CWalletTx wtx = MakeWalletTx(pwalletMain.get(), 0);
+    CWalletDB walletdb(dbw);
+    BOOST_CHECK(walletdb.WriteTx(wtx));
+    BOOST_CHECK(!HasTx(dbw, wtx.GetHash()));
+    BOOST_CHECK(walletdb.WriteBestBlock(CBlockLocator()));
+    BOOST_CHECK(HasTx(dbw, wtx.GetHash()));
+}
+
+BOOST_AUTO_TEST_CASE(group_commit_failure)
+{
+    // Commits fail until the database exists
+    CWalletDBWrapper dbw(&bitdb, "wallet_test_missing.dat");
+    dbw.SetGroupCommit(true);
+
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << std::string("counter");
+    auto queue = [&](int n) {
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        ssValue << n;
+        dbw.QueueWrite(ssKey, ssValue);
+    };
+
+    queue(0);
+    BOOST_CHECK(!dbw.CommitQueue());
+
+    // A failed commit queues its records again, but doesn't replace newer
+    // writes of the same key queued while it was running
+    const int nWrites = 1000;
+    std::thread writer([&] {
+        for (int i = 1; i <= nWrites; i++)
+            queue(i);
+    });
+    for (int i = 0; i < 100; i++)
+        BOOST_CHECK(!dbw.CommitQueue());
+    writer.join();
+
+    {
+        CDB batch(dbw, "cr+");
+    }
+    BOOST_CHECK(dbw.CommitQueue());
+
+    CDB batch(dbw, "r");
+    int n = -1;
+    BOOST_CHECK(batch.Read(std::string("counter"), n));
+    BOOST_CHECK_EQUAL(n, nWrites);
+}
+
+BOOST_AUTO_TEST_CASE(load_wallet_order_pos_next)
+{
+    // A counter that lags behind the transactions, as left by a crash before
+    // a group commit
+    {
+        CWalletDB walletdb(pwalletMain->GetDBHandle());
+        BOOST_CHECK(walletdb.WriteTx(MakeWalletTx(pwalletMain.get(), 5)));
+        BOOST_CHECK(walletdb.WriteOrderPosNext(2));
+    }
+
+    CWallet wallet(std::unique_ptr<CWalletDBWrapper>(new CWalletDBWrapper(&bitdb, "wallet_test.dat")));
+    bool fFirstRun;
+    BOOST_CHECK(wallet.LoadWallet(fFirstRun) == DB_LOAD_OK);
+    BOOST_CHECK_EQUAL(wallet.nOrderPosNext, 6);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
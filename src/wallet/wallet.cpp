@@ -9,8 +9,10 @@
 #include <checkpoints.h>
 #include <chain.h>
 #include <wallet/coincontrol.h>
+#include <wallet/coinselection.h>
 #include <consensus/consensus.h>
 #include <consensus/validation.h>
+#include <crypto/sha256.h>
 #include <coins.h>
 #include <dbwrapper.h>
 #include <fs.h>
@@ -24,8 +26,10 @@
 #include <policy/rbf.h>
 #include <primitives/block.h>
 #include <primitives/transaction.h>
+#include <rpc/server.h>
 #include <script/script.h>
 #include <scheduler.h>
+#include <taskpool.h>
 #include <timedata.h>
 #include <txmempool.h>
 #include <util.h>
@@ -66,6 +70,10 @@ CFeeRate CWallet::minTxFee = CFeeRate(DEFAULT_TRANSACTION_MINFEE);
 CFeeRate CWallet::fallbackFee = CFeeRate(DEFAULT_FALLBACK_FEE);
 
 CFeeRate CWallet::m_discard_rate = CFeeRate(DEFAULT_DISCARD_FEE);
+unsigned int CWallet::nBMMPoolSize = DEFAULT_BMM_POOL_SIZE;
+CAmount CWallet::nBMMPoolAmount = DEFAULT_BMM_POOL_AMOUNT;
+unsigned int CWallet::nBMMReplace = DEFAULT_BMM_REPLACE;
+int64_t CWallet::nCommitDelay = DEFAULT_WALLET_COMMIT_DELAY;
 
 const uint256 CMerkleTx::ABANDON_HASH(uint256S("0000000000000000000000000000000000000000000000000000000000000001"));
 
@@ -245,6 +253,7 @@ bool CWallet::AddKeyPubKeyWithDB(CWalletDB &walletdb, const CKey& secret, const
         return false;
     }
     if (needsDB) pwalletdbEncryption = nullptr;
+    MarkIsMineDirty();
 
     // check if we need to remove from watch-only
     CScript script;
@@ -276,6 +285,7 @@ bool CWallet::AddCryptedKey(const CPubKey &vchPubKey,
 {
     if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
         return false;
+    MarkIsMineDirty();
     {
         LOCK(cs_wallet);
         if (pwalletdbEncryption)
@@ -330,6 +340,7 @@ bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    MarkIsMineDirty();
     return CWalletDB(*dbw).WriteCScript(Hash160(redeemScript), redeemScript);
 }
 
@@ -353,6 +364,7 @@ bool CWallet::AddWatchOnly(const CScript& dest)
 {
     if (!CCryptoKeyStore::AddWatchOnly(dest))
         return false;
+    MarkIsMineDirty();
     const CKeyMetadata& meta = m_script_metadata[CScriptID(dest)];
     UpdateTimeFirstKey(meta.nCreateTime);
     NotifyWatchonlyChanged(true);
@@ -370,6 +382,7 @@ bool CWallet::RemoveWatchOnly(const CScript &dest)
     AssertLockHeld(cs_wallet);
     if (!CCryptoKeyStore::RemoveWatchOnly(dest))
         return false;
+    MarkIsMineDirty();
     if (!HaveWatchOnly())
         NotifyWatchonlyChanged(false);
     if (!CWalletDB(*dbw).EraseWatchOnly(dest))
@@ -612,6 +625,51 @@ void CWallet::AddToSpends(const uint256& wtxid)
         AddToSpends(txin.prevout, wtxid);
 }
 
+void CWallet::UpdateUnspentIndex(const COutPoint& outpoint)
+{
+    auto it = mapWallet.find(outpoint.hash);
+    if (it == mapWallet.end() || outpoint.n >= it->second.tx->vout.size())
+        return;
+    const CTxOut& txout = it->second.tx->vout[outpoint.n];
+
+    bool fUnspent = IsMine(txout) != ISMINE_NO;
+    std::pair<TxSpends::const_iterator, TxSpends::const_iterator> range = mapTxSpends.equal_range(outpoint);
+    for (TxSpends::const_iterator spend = range.first; fUnspent && spend != range.second; ++spend) {
+        auto mit = mapWallet.find(spend->second);
+        // Abandoned and conflicted transactions have nIndex -1 and hashBlock
+        // set. This does not need cs_main, unlike IsSpent().
+        if (mit != mapWallet.end() && !(mit->second.nIndex == -1 && !mit->second.hashBlock.IsNull()))
+            fUnspent = false;
+    }
+
+    if (fUnspent)
+        setUnspentByValue.emplace(txout.nValue, outpoint);
+    else
+        setUnspentByValue.erase(std::make_pair(txout.nValue, outpoint));
+}
+
+void CWallet::UpdateUnspentIndex(const CWalletTx& wtx)
+{
+    for (unsigned int i = 0; i < wtx.tx->vout.size(); i++)
+        UpdateUnspentIndex(COutPoint(wtx.GetHash(), i));
+
+    if (!wtx.IsCoinBase()) {
+        for (const CTxIn& txin : wtx.tx->vin)
+            UpdateUnspentIndex(txin.prevout);
+    }
+}
+
+void CWallet::RebuildUnspentIndex()
+{
+    AssertLockHeld(cs_wallet);
+
+    setUnspentByValue.clear();
+    for (const auto& item : mapWallet) {
+        for (unsigned int i = 0; i < item.second.tx->vout.size(); i++)
+            UpdateUnspentIndex(COutPoint(item.first, i));
+    }
+}
+
 bool CWallet::EncryptWallet(const SecureString& strWalletPassphrase)
 {
     if (IsCrypted())
@@ -872,6 +930,7 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         for (std::pair<const uint256, CWalletTx>& item : mapWallet)
             item.second.MarkDirty();
+        MarkIsMineDirty();
     }
 }
 
@@ -924,6 +983,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
         wtxOrdered.insert(std::make_pair(wtx.nOrderPos, TxPair(&wtx, nullptr)));
         wtx.nTimeSmart = ComputeTimeSmart(wtx);
         AddToSpends(hash);
+        TrackBMMPoolTx(wtx);
     }
 
     bool fUpdated = false;
@@ -970,6 +1030,10 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
     //// debug print
     LogPrintf("AddToWallet %s  %s%s\n", wtxIn.GetHash().ToString(), (fInsertedNew ? "new" : ""), (fUpdated ? "update" : ""));
 
+    // Even without changes to wtx, its outputs may have become ours through
+    // a key import followed by a rescan
+    UpdateUnspentIndex(wtx);
+
     // Write to disk
     if (fInsertedNew || fUpdated)
         if (!walletdb.WriteTx(wtx))
@@ -1000,6 +1064,9 @@ bool CWallet::LoadToWallet(const CWalletTx& wtxIn)
     wtx.BindWallet(this);
     wtxOrdered.insert(std::make_pair(wtx.nOrderPos, TxPair(&wtx, nullptr)));
     AddToSpends(hash);
+    UpdateUnspentIndex(wtx);
+    TrackBMMPoolTx(wtx);
+    TrackBMMRequest(wtx);
     for (const CTxIn& txin : wtx.tx->vin) {
         auto it = mapWallet.find(txin.prevout.hash);
         if (it != mapWallet.end()) {
@@ -1136,6 +1203,7 @@ bool CWallet::AbandonTransaction(const uint256& hashTx, std::string* pstrReason)
             wtx.setAbandoned();
             wtx.MarkDirty();
             walletdb.WriteTx(wtx);
+            UpdateUnspentIndex(wtx);
             NotifyTransactionChanged(this, wtx.GetHash(), CT_UPDATED);
             // Iterate over all its outputs, and mark transactions in the wallet that spend them abandoned too
             TxSpends::const_iterator iter = mapTxSpends.lower_bound(COutPoint(hashTx, 0));
@@ -1201,6 +1269,7 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
             wtx.hashBlock = hashBlock;
             wtx.MarkDirty();
             walletdb.WriteTx(wtx);
+            UpdateUnspentIndex(wtx);
             // Iterate over all its outputs, and mark transactions in the wallet that spend them conflicted too
             TxSpends::const_iterator iter = mapTxSpends.lower_bound(COutPoint(now, 0));
             while (iter != mapTxSpends.end() && iter->first.hash == now) {
@@ -1275,9 +1344,16 @@ void CWallet::BlockConnected(const std::shared_ptr<const CBlock>& pblock, const
         TransactionRemovedFromMempool(pblock->vtx[i]);
     }
 
+    UpdateBMMPool(pindex->nHeight);
+
     m_last_block_processed = pindex;
 }
 
+void CWallet::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) {
+    if (nBMMReplace && !fInitialDownload)
+        ReplaceStaleBMMRequests(g_connman.get());
+}
+
 void CWallet::BlockDisconnected(const std::shared_ptr<const CBlock>& pblock) {
     LOCK2(cs_main, cs_wallet);
 
@@ -1607,6 +1683,44 @@ int64_t CWallet::RescanFromTime(int64_t startTime, const WalletRescanReserver& r
     return startTime;
 }
 
+/**
+ * Match the block filters of vIndex against elements on g_rpc_task_pool.
+ * Blocks without a filter in the index count as a match.
+ */
+static std::vector<char> MatchBlockFilters(const std::vector<CBlockIndex*>& vIndex, const GCSFilter::ElementSet& elements)
+{
+    std::vector<char> vMatch(vIndex.size(), true);
+    std::vector<CTaskPool::Task> vTask;
+    for (size_t nBegin = 0; nBegin < vIndex.size(); nBegin += RESCAN_FILTERS_PER_TASK) {
+        const size_t nEnd = std::min<size_t>(nBegin + RESCAN_FILTERS_PER_TASK, vIndex.size());
+        vTask.emplace_back([&vIndex, &elements, &vMatch, nBegin, nEnd] {
+            for (size_t i = nBegin; i < nEnd; i++) {
+                BlockFilter filter;
+                if (GetBlockFilter(vIndex[i], filter))
+                    vMatch[i] = filter.GetFilter().MatchAny(elements);
+            }
+        });
+    }
+    g_rpc_task_pool.Run(vTask);
+    return vMatch;
+}
+
+/** Read the blocks of vIndex on g_rpc_task_pool, null where a read failed */
+static std::vector<std::shared_ptr<const CBlock>> ReadBlocks(const std::vector<const CBlockIndex*>& vIndex, const Consensus::Params& consensusParams)
+{
+    std::vector<std::shared_ptr<const CBlock>> vBlock(vIndex.size());
+    std::vector<CTaskPool::Task> vTask;
+    for (size_t i = 0; i < vIndex.size(); i++) {
+        vTask.emplace_back([&vIndex, &vBlock, &consensusParams, i] {
+            std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
+            if (ReadBlockFromDisk(*pblockRead, vIndex[i], consensusParams))
+                vBlock[i] = pblockRead;
+        });
+    }
+    g_rpc_task_pool.Run(vTask);
+    return vBlock;
+}
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
@@ -1619,6 +1733,11 @@ int64_t CWallet::RescanFromTime(int64_t startTime, const WalletRescanReserver& r
  * If pindexStop is not a nullptr, the scan will stop at the block-index
  * defined by pindexStop
  *
+ * With -blockfilterindex, blocks whose filter matches none of the scripts
+ * from GetRescanFilterElements are skipped without reading them, and the
+ * blocks that do match are read several at a time on the task pool. Wallets
+ * owning scripts that can't be listed read every block.
+ *
  * Caller needs to make sure pindexStop (and the optional pindexStart) are on
  * the main chain after to the addition of any new keys you want to detect
  * transactions for.
@@ -1633,6 +1752,18 @@ CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, CBlock
         assert(pindexStop->nHeight >= pindexStart->nHeight);
     }
 
+    // With the block filter index only blocks whose filter matches one of
+    // our scripts are read. vBatch holds the next blocks to scan and vMatch
+    // whether their filter matched, vPrefetch the matching blocks that were
+    // read ahead of time.
+    const bool fUseFilters = fBlockFilterIndex;
+    std::vector<CBlockIndex*> vBatch;
+    std::vector<char> vMatch;
+    size_t nBatchPos = 0;
+    size_t nPrefetchPos = 0;
+    std::deque<std::shared_ptr<const CBlock>> vPrefetch;
+    bool fLoggedFullScan = false;
+
     CBlockIndex* pindex = pindexStart;
     CBlockIndex* ret = nullptr;
     {
@@ -1663,8 +1794,62 @@ CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, CBlock
                 LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, GuessVerificationProgress(chainParams.TxData(), pindex));
             }
 
-            CBlock block;
-            if (ReadBlockFromDisk(block, pindex, Params().GetConsensus())) {
+            std::shared_ptr<const CBlock> pblock;
+            bool fSkip = false;
+            if (fUseFilters) {
+                if (nBatchPos == vBatch.size() || vBatch[nBatchPos] != pindex) {
+                    // Drop reads of a batch that became stale in a reorg
+                    vPrefetch.clear();
+                    vBatch.clear();
+                    {
+                        LOCK(cs_main);
+                        for (CBlockIndex* pindexBatch = pindex; pindexBatch && vBatch.size() < RESCAN_FILTER_BATCH_SIZE; pindexBatch = chainActive.Next(pindexBatch)) {
+                            vBatch.push_back(pindexBatch);
+                            if (pindexBatch == pindexStop)
+                                break;
+                        }
+                    }
+                    // Keys may have been added by the previous batch topping
+                    // up the keypool, so collect the scripts every time.
+                    GCSFilter::ElementSet elements;
+                    if (GetRescanFilterElements(elements)) {
+                        vMatch = MatchBlockFilters(vBatch, elements);
+                    } else {
+                        if (!fLoggedFullScan)
+                            LogPrintf("%s: Wallet owns scripts the block filters can't be matched against, reading every block\n", __func__);
+                        fLoggedFullScan = true;
+                        vMatch.assign(vBatch.size(), true);
+                    }
+                    nBatchPos = 0;
+                    nPrefetchPos = 0;
+                }
+
+                if (vMatch[nBatchPos] && vPrefetch.empty()) {
+                    std::vector<const CBlockIndex*> vRead;
+                    for (; vRead.size() < RESCAN_PREFETCH_BLOCKS && nPrefetchPos < vBatch.size(); nPrefetchPos++) {
+                        if (vMatch[nPrefetchPos])
+                            vRead.push_back(vBatch[nPrefetchPos]);
+                    }
+                    for (std::shared_ptr<const CBlock>& pblockRead : ReadBlocks(vRead, chainParams.GetConsensus()))
+                        vPrefetch.push_back(std::move(pblockRead));
+                }
+
+                if (vMatch[nBatchPos]) {
+                    pblock = vPrefetch.front();
+                    vPrefetch.pop_front();
+                } else {
+                    fSkip = true;
+                }
+                nBatchPos++;
+            } else {
+                std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
+                if (ReadBlockFromDisk(*pblockRead, pindex, chainParams.GetConsensus()))
+                    pblock = pblockRead;
+            }
+
+            if (fSkip) {
+                // The block doesn't involve any of our scripts
+            } else if (pblock) {
                 LOCK2(cs_main, cs_wallet);
                 if (pindex && !chainActive.Contains(pindex)) {
                     // Abort scan if current block is no longer active, to prevent
@@ -1672,8 +1857,8 @@ CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, CBlock
                     ret = pindex;
                     break;
                 }
-                for (size_t posInBlock = 0; posInBlock < block.vtx.size(); ++posInBlock) {
-                    AddToWalletIfInvolvingMe(block.vtx[posInBlock], pindex, posInBlock, fUpdate);
+                for (size_t posInBlock = 0; posInBlock < pblock->vtx.size(); ++posInBlock) {
+                    AddToWalletIfInvolvingMe(pblock->vtx[posInBlock], pindex, posInBlock, fUpdate);
                 }
             } else {
                 ret = pindex;
@@ -1683,6 +1868,12 @@ CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, CBlock
             }
             {
                 LOCK(cs_main);
+                if (fSkip && !chainActive.Contains(pindex)) {
+                    // Skipped blocks aren't checked above, but the blocks
+                    // after this one would be from the wrong chain as well.
+                    ret = pindex;
+                    break;
+                }
                 pindex = chainActive.Next(pindex);
                 if (tip != chainActive.Tip()) {
                     tip = chainActive.Tip();
@@ -1699,6 +1890,99 @@ CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, CBlock
     return ret;
 }
 
+bool CWallet::GetRescanFilterElements(GCSFilter::ElementSet& elements)
+{
+    elements.clear();
+
+    LOCK2(cs_main, cs_wallet);
+
+    std::vector<CScript> vSidechainScript;
+    for (const Sidechain& sidechain : scdb.GetActiveSidechains())
+        vSidechainScript.push_back(sidechain.scriptPubKey);
+    if (vSidechainScript != vRescanSidechainScript)
+        fRescanElementsDirty = true;
+
+    // A smaller nOrderPosNext means the transactions were reloaded
+    if (fRescanElementsDirty.exchange(false) || nOrderPosNext < nRescanElementsOrderPos) {
+        setRescanElements.clear();
+        fRescanElementsComplete = true;
+        nRescanElementsOrderPos = std::numeric_limits<int64_t>::min();
+        vRescanSidechainScript = vSidechainScript;
+
+        // Candidate scripts, of which only the ones IsMine accepts are kept
+        std::set<CScript> setCandidate;
+        auto addPubKey = [&setCandidate](const CPubKey& pubkey) {
+            const CKeyID keyid = pubkey.GetID();
+            setCandidate.insert(GetScriptForRawPubKey(pubkey));
+            setCandidate.insert(GetScriptForDestination(keyid));
+            if (pubkey.IsCompressed()) {
+                const CScript witprog = GetScriptForDestination(WitnessV0KeyHash(keyid));
+                setCandidate.insert(witprog);
+                setCandidate.insert(GetScriptForDestination(CScriptID(witprog)));
+            }
+        };
+        for (const CKeyID& keyid : GetKeys()) {
+            CPubKey pubkey;
+            if (GetPubKey(keyid, pubkey))
+                addPubKey(pubkey);
+        }
+        for (const CScriptID& scriptid : GetCScripts()) {
+            CScript script;
+            if (!GetCScript(scriptid, script))
+                continue;
+            WitnessV0ScriptHash witnesshash;
+            CSHA256().Write(script.data(), script.size()).Finalize(witnesshash.begin());
+            setCandidate.insert(script);
+            setCandidate.insert(GetScriptForDestination(scriptid));
+            setCandidate.insert(GetScriptForDestination(witnesshash));
+        }
+        {
+            LOCK(cs_KeyStore);
+            for (const CScript& script : setWatchOnly) {
+                setCandidate.insert(script);
+                // Watched pubkeys make the other standard scripts of the key
+                // solvable as well
+                txnouttype whichType;
+                std::vector<std::vector<unsigned char>> vSolutions;
+                if (Solver(script, whichType, vSolutions) && whichType == TX_PUBKEY)
+                    addPubKey(CPubKey(vSolutions[0]));
+            }
+        }
+        setCandidate.insert(vSidechainScript.begin(), vSidechainScript.end());
+
+        for (const CScript& script : setCandidate) {
+            if (::IsMine(*this, script) != ISMINE_NO)
+                setRescanElements.emplace(script.begin(), script.end());
+        }
+        for (const LoadedCoin& coin : vLoadedCoinCache)
+            setRescanElements.emplace(coin.coin.out.scriptPubKey.begin(), coin.coin.out.scriptPubKey.end());
+    }
+
+    // IsMine also accepts scripts that can't be listed from the keys, such
+    // as bare multisig of our keys. If the wallet already received any of
+    // those it may receive more, which only a full scan finds. Only the
+    // transactions added since the last call need checking.
+    for (auto it = wtxOrdered.lower_bound(nRescanElementsOrderPos); it != wtxOrdered.end() && fRescanElementsComplete; ++it) {
+        const CWalletTx* pwtx = it->second.first;
+        if (!pwtx)
+            continue;
+        for (const CTxOut& txout : pwtx->tx->vout) {
+            if (IsMine(txout) == ISMINE_NO)
+                continue;
+            if (!setRescanElements.count(GCSFilter::Element(txout.scriptPubKey.begin(), txout.scriptPubKey.end()))) {
+                fRescanElementsComplete = false;
+                break;
+            }
+        }
+    }
+    nRescanElementsOrderPos = nOrderPosNext;
+
+    if (!fRescanElementsComplete)
+        return false;
+    elements = setRescanElements;
+    return true;
+}
+
 void CWallet::ReacceptWalletTransactions()
 {
     // If transactions aren't being broadcasted, don't let them into local mempool either
@@ -2190,6 +2474,94 @@ CAmount CWallet::GetAvailableBalance(const CCoinControl* coinControl) const
     return balance;
 }
 
+bool CWallet::GetAvailableDepth(const CWalletTx& wtx, bool fOnlySafe, int nMinDepth, int nMaxDepth, int& nDepth, bool& fSafe) const
+{
+    if (!CheckFinalTx(*wtx.tx))
+        return false;
+
+    if (wtx.IsCoinBase() && wtx.GetBlocksToMaturity() > 0)
+        return false;
+
+    if (wtx.IsCriticalData() && wtx.GetBlocksToMaturity() > 0)
+        return false;
+
+    nDepth = wtx.GetDepthInMainChain();
+    if (nDepth < 0)
+        return false;
+
+    // We should not consider coins which aren't at least in our mempool
+    // It's possible for these to be conflicted via ancestors which we may never be able to detect
+    if (nDepth == 0 && !wtx.InMempool())
+        return false;
+
+    fSafe = wtx.IsTrusted();
+
+    // We should not consider coins from transactions that are replacing
+    // other transactions.
+    //
+    // Example: There is a transaction A which is replaced by bumpfee
+    // transaction B. In this case, we want to prevent creation of
+    // a transaction B' which spends an output of B.
+    //
+    // Reason: If transaction A were initially confirmed, transactions B
+    // and B' would no longer be valid, so the user would have to create
+    // a new transaction C to replace B'. However, in the case of a
+    // one-block reorg, transactions B' and C might BOTH be accepted,
+    // when the user only wanted one of them. Specifically, there could
+    // be a 1-block reorg away from the chain where transactions A and C
+    // were accepted to another chain where B, B', and C were all
+    // accepted.
+    if (nDepth == 0 && wtx.mapValue.count("replaces_txid")) {
+        fSafe = false;
+    }
+
+    // Similarly, we should not consider coins from transactions that
+    // have been replaced. In the example above, we would want to prevent
+    // creation of a transaction A' spending an output of A, because if
+    // transaction B were initially confirmed, conflicting with A and
+    // A', we wouldn't want to the user to create a transaction D
+    // intending to replace A', but potentially resulting in a scenario
+    // where A, A', and D could all be accepted (instead of just B and
+    // D, or just A and A' like the user would want).
+    if (nDepth == 0 && wtx.mapValue.count("replaced_by_txid")) {
+        fSafe = false;
+    }
+
+    if (fOnlySafe && !fSafe) {
+        return false;
+    }
+
+    if (nDepth < nMinDepth || nDepth > nMaxDepth)
+        return false;
+    return true;
+}
+
+bool CWallet::IsAvailableCoin(const CWalletTx& wtx, const COutPoint& outpoint, const CCoinControl* coinControl, bool& fSpendable, bool& fSolvable) const
+{
+    if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs && !coinControl->IsSelected(outpoint))
+        return false;
+
+    if (IsLockedCoin(outpoint.hash, outpoint.n))
+        return false;
+
+    // Reserved for BMM requests
+    if (nBMMPoolSize && (setBMMPool.count(outpoint) || (setBMMPoolPending.count(outpoint.hash) && !IsChange(wtx.tx->vout[outpoint.n]))))
+        return false;
+
+    if (IsSpent(outpoint.hash, outpoint.n))
+        return false;
+
+    isminetype mine = IsMine(wtx.tx->vout[outpoint.n]);
+
+    if (mine == ISMINE_NO) {
+        return false;
+    }
+
+    fSpendable = ((mine & ISMINE_SPENDABLE) != ISMINE_NO) || (coinControl && coinControl->fAllowWatchOnly && (mine & ISMINE_WATCH_SOLVABLE) != ISMINE_NO);
+    fSolvable = (mine & (ISMINE_SPENDABLE | ISMINE_WATCH_SOLVABLE)) != ISMINE_NO;
+    return true;
+}
+
 void CWallet::AvailableCoins(std::vector<COutput> &vCoins, bool fOnlySafe, const CCoinControl *coinControl, const CAmount &nMinimumAmount, const CAmount &nMaximumAmount, const CAmount &nMinimumSumAmount, const uint64_t nMaximumCount, const int nMinDepth, const int nMaxDepth) const
 {
     AssertLockHeld(cs_main);
@@ -2203,85 +2575,18 @@ void CWallet::AvailableCoins(std::vector<COutput> &vCoins, bool fOnlySafe, const
         const uint256& wtxid = entry.first;
         const CWalletTx* pcoin = &entry.second;
 
-        if (!CheckFinalTx(*pcoin->tx))
-            continue;
-
-        if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
-            continue;
-
-        if (pcoin->IsCriticalData() && pcoin->GetBlocksToMaturity() > 0)
-            continue;
-
-        int nDepth = pcoin->GetDepthInMainChain();
-        if (nDepth < 0)
-            continue;
-
-        // We should not consider coins which aren't at least in our mempool
-        // It's possible for these to be conflicted via ancestors which we may never be able to detect
-        if (nDepth == 0 && !pcoin->InMempool())
-            continue;
-
-        bool safeTx = pcoin->IsTrusted();
-
-        // We should not consider coins from transactions that are replacing
-        // other transactions.
-        //
-        // Example: There is a transaction A which is replaced by bumpfee
-        // transaction B. In this case, we want to prevent creation of
-        // a transaction B' which spends an output of B.
-        //
-        // Reason: If transaction A were initially confirmed, transactions B
-        // and B' would no longer be valid, so the user would have to create
-        // a new transaction C to replace B'. However, in the case of a
-        // one-block reorg, transactions B' and C might BOTH be accepted,
-        // when the user only wanted one of them. Specifically, there could
-        // be a 1-block reorg away from the chain where transactions A and C
-        // were accepted to another chain where B, B', and C were all
-        // accepted.
-        if (nDepth == 0 && pcoin->mapValue.count("replaces_txid")) {
-            safeTx = false;
-        }
-
-        // Similarly, we should not consider coins from transactions that
-        // have been replaced. In the example above, we would want to prevent
-        // creation of a transaction A' spending an output of A, because if
-        // transaction B were initially confirmed, conflicting with A and
-        // A', we wouldn't want to the user to create a transaction D
-        // intending to replace A', but potentially resulting in a scenario
-        // where A, A', and D could all be accepted (instead of just B and
-        // D, or just A and A' like the user would want).
-        if (nDepth == 0 && pcoin->mapValue.count("replaced_by_txid")) {
-            safeTx = false;
-        }
-
-        if (fOnlySafe && !safeTx) {
-            continue;
-        }
-
-        if (nDepth < nMinDepth || nDepth > nMaxDepth)
+        int nDepth;
+        bool safeTx;
+        if (!GetAvailableDepth(*pcoin, fOnlySafe, nMinDepth, nMaxDepth, nDepth, safeTx))
             continue;
 
         for (unsigned int i = 0; i < pcoin->tx->vout.size(); i++) {
             if (pcoin->tx->vout[i].nValue < nMinimumAmount || pcoin->tx->vout[i].nValue > nMaximumAmount)
                 continue;
 
-            if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs && !coinControl->IsSelected(COutPoint(entry.first, i)))
-                continue;
-
-            if (IsLockedCoin(entry.first, i))
-                continue;
-
-            if (IsSpent(wtxid, i))
-                continue;
-
-            isminetype mine = IsMine(pcoin->tx->vout[i]);
-
-            if (mine == ISMINE_NO) {
+            bool fSpendableIn, fSolvableIn;
+            if (!IsAvailableCoin(*pcoin, COutPoint(wtxid, i), coinControl, fSpendableIn, fSolvableIn))
                 continue;
-            }
-
-            bool fSpendableIn = ((mine & ISMINE_SPENDABLE) != ISMINE_NO) || (coinControl && coinControl->fAllowWatchOnly && (mine & ISMINE_WATCH_SOLVABLE) != ISMINE_NO);
-            bool fSolvableIn = (mine & (ISMINE_SPENDABLE | ISMINE_WATCH_SOLVABLE)) != ISMINE_NO;
 
             vCoins.push_back(COutput(pcoin, i, nDepth, fSpendableIn, fSolvableIn, safeTx));
 
@@ -2302,6 +2607,40 @@ void CWallet::AvailableCoins(std::vector<COutput> &vCoins, bool fOnlySafe, const
     }
 }
 
+void CWallet::AvailableCoinsForSelection(std::vector<COutput>& vCoins, bool fOnlySafe, const CCoinControl* coinControl)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    if (fUnspentIndexDirty.exchange(false))
+        RebuildUnspentIndex();
+
+    vCoins.clear();
+
+    // Only outputs in the unspent index can be available, so the spent
+    // history of the wallet isn't walked. Skip the zero value outputs like
+    // AvailableCoins does by default.
+    auto itIndex = setUnspentByValue.lower_bound(std::make_pair(CAmount(1), COutPoint(uint256(), 0)));
+    for (; itIndex != setUnspentByValue.end(); ++itIndex)
+    {
+        const COutPoint& outpoint = itIndex->second;
+        auto mi = mapWallet.find(outpoint.hash);
+        assert(mi != mapWallet.end());
+        const CWalletTx* pcoin = &mi->second;
+
+        int nDepth;
+        bool safeTx;
+        if (!GetAvailableDepth(*pcoin, fOnlySafe, 0, 9999999, nDepth, safeTx))
+            continue;
+
+        bool fSpendableIn, fSolvableIn;
+        if (!IsAvailableCoin(*pcoin, outpoint, coinControl, fSpendableIn, fSolvableIn))
+            continue;
+
+        vCoins.push_back(COutput(pcoin, outpoint.n, nDepth, fSpendableIn, fSolvableIn, safeTx));
+    }
+}
+
 std::map<CTxDestination, std::vector<COutput>> CWallet::ListCoins() const
 {
     // TODO: Add AssertLockHeld(cs_wallet) here.
@@ -2411,11 +2750,72 @@ static void ApproximateBestSubset(const std::vector<CInputCoin>& vValue, const C
     }
 }
 
+int CWallet::CalculateMaximumSignedInputSize(const CTxOut& txout) const
+{
+    CMutableTransaction txn;
+    txn.vin.push_back(CTxIn(COutPoint()));
+    const int nEmptySize = GetVirtualTransactionSize(CTransaction(CMutableTransaction()));
+
+    std::vector<CInputCoin> vCoin{CInputCoin(COutPoint(), txout)};
+    if (!DummySignTx(txn, vCoin))
+        return -1;
+    return GetVirtualTransactionSize(txn) - nEmptySize;
+}
+
 bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, const int nConfMine, const int nConfTheirs, const uint64_t nMaxAncestors, std::vector<COutput> vCoins,
-                                 std::set<CInputCoin>& setCoinsRet, CAmount& nValueRet) const
+                                 std::set<CInputCoin>& setCoinsRet, CAmount& nValueRet, const CoinSelectionParams* coin_selection_params, bool* bnb_used) const
 {
     setCoinsRet.clear();
     nValueRet = 0;
+    if (bnb_used)
+        *bnb_used = false;
+
+    auto eligible = [&](const COutput& output) {
+        if (!output.fSpendable)
+            return false;
+        if (output.nDepth < (output.tx->IsFromMe(ISMINE_ALL) ? nConfMine : nConfTheirs))
+            return false;
+        return mempool.TransactionWithinChainLimit(output.tx->GetHash(), nMaxAncestors);
+    };
+
+    if (coin_selection_params) {
+        // Look for a selection that pays the target and the fees without a
+        // change output first
+        const CFeeRate& effective_fee = coin_selection_params->effective_fee;
+        const CAmount not_input_fees = effective_fee.GetFee(coin_selection_params->tx_noinputs_size);
+        const CAmount cost_of_change = GetDiscardRate(::feeEstimator).GetFee(coin_selection_params->change_spend_size) +
+            effective_fee.GetFee(coin_selection_params->change_output_size);
+        const CAmount nMaxEffectiveValue = nTargetValue + not_input_fees + cost_of_change;
+
+        // Wallets tend to reuse a few script types, so avoid dummy signing
+        // the same script over and over
+        std::map<CScript, int> mapInputSize;
+        std::vector<CInputCoin> vUTXO;
+        for (const COutput& output : vCoins) {
+            if (!eligible(output))
+                continue;
+
+            CInputCoin coin(output.tx, output.i);
+            auto it = mapInputSize.find(coin.txout.scriptPubKey);
+            if (it == mapInputSize.end())
+                it = mapInputSize.emplace(coin.txout.scriptPubKey, CalculateMaximumSignedInputSize(coin.txout)).first;
+            if (it->second < 0)
+                continue;
+
+            coin.effective_value = coin.txout.nValue - effective_fee.GetFee(it->second);
+            // Coins that cost more to spend than they are worth or that
+            // overshoot the target on their own cannot be part of a solution
+            if (coin.effective_value <= 0 || coin.effective_value > nMaxEffectiveValue)
+                continue;
+            vUTXO.push_back(coin);
+        }
+
+        if (SelectCoinsBnB(vUTXO, nTargetValue, cost_of_change, setCoinsRet, nValueRet, not_input_fees)) {
+            if (bnb_used)
+                *bnb_used = true;
+            return true;
+        }
+    }
 
     // List of values less than target
     boost::optional<CInputCoin> coinLowestLarger;
@@ -2426,17 +2826,10 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, const int nConfMin
 
     for (const COutput &output : vCoins)
     {
-        if (!output.fSpendable)
+        if (!eligible(output))
             continue;
 
         const CWalletTx *pcoin = output.tx;
-
-        if (output.nDepth < (pcoin->IsFromMe(ISMINE_ALL) ? nConfMine : nConfTheirs))
-            continue;
-
-        if (!mempool.TransactionWithinChainLimit(pcoin->GetHash(), nMaxAncestors))
-            continue;
-
         int i = output.i;
 
         CInputCoin coin = CInputCoin(pcoin, i);
@@ -2517,8 +2910,12 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, const int nConfMin
     return true;
 }
 
-bool CWallet::SelectCoins(const std::vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, std::set<CInputCoin>& setCoinsRet, CAmount& nValueRet, const CCoinControl* coinControl) const
+bool CWallet::SelectCoins(const std::vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, std::set<CInputCoin>& setCoinsRet, CAmount& nValueRet, const CCoinControl* coinControl,
+                          const CoinSelectionParams* coin_selection_params, bool* bnb_used) const
 {
+    if (bnb_used)
+        *bnb_used = false;
+
     std::vector<COutput> vCoins(vAvailableCoins);
     std::vector<LoadedCoin> vLoadedCoin;
     vLoadedCoin = GetMyLoadedCoins();
@@ -2565,6 +2962,10 @@ bool CWallet::SelectCoins(const std::vector<COutput>& vAvailableCoins, const CAm
             return false; // TODO: Allow non-wallet inputs
     }
 
+    // The fees used for changeless selection don't account for preset inputs
+    if (!vPresetInputs.empty())
+        coin_selection_params = nullptr;
+
     // remove preset inputs from vCoins
     for (std::vector<COutput>::iterator it = vCoins.begin(); it != vCoins.end() && coinControl && coinControl->HasSelected();)
     {
@@ -2578,13 +2979,13 @@ bool CWallet::SelectCoins(const std::vector<COutput>& vAvailableCoins, const CAm
     bool fRejectLongChains = gArgs.GetBoolArg("-walletrejectlongchains", DEFAULT_WALLET_REJECT_LONG_CHAINS);
 
     bool res = nTargetValue <= nValueFromPresetInputs ||
-        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 6, 0, vCoins, setCoinsRet, nValueRet) ||
-        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 1, 0, vCoins, setCoinsRet, nValueRet) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, 2, vCoins, setCoinsRet, nValueRet)) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, std::min((size_t)4, nMaxChainLength/3), vCoins, setCoinsRet, nValueRet)) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, nMaxChainLength/2, vCoins, setCoinsRet, nValueRet)) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, nMaxChainLength, vCoins, setCoinsRet, nValueRet)) ||
-        (bSpendZeroConfChange && !fRejectLongChains && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, std::numeric_limits<uint64_t>::max(), vCoins, setCoinsRet, nValueRet));
+        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 6, 0, vCoins, setCoinsRet, nValueRet, coin_selection_params, bnb_used) ||
+        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 1, 0, vCoins, setCoinsRet, nValueRet, coin_selection_params, bnb_used) ||
+        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, 2, vCoins, setCoinsRet, nValueRet, coin_selection_params, bnb_used)) ||
+        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, std::min((size_t)4, nMaxChainLength/3), vCoins, setCoinsRet, nValueRet, coin_selection_params, bnb_used)) ||
+        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, nMaxChainLength/2, vCoins, setCoinsRet, nValueRet, coin_selection_params, bnb_used)) ||
+        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, nMaxChainLength, vCoins, setCoinsRet, nValueRet, coin_selection_params, bnb_used)) ||
+        (bSpendZeroConfChange && !fRejectLongChains && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, std::numeric_limits<uint64_t>::max(), vCoins, setCoinsRet, nValueRet, coin_selection_params, bnb_used));
 
     // because SelectCoinsMinConf clears the setCoinsRet, we now add the possible inputs to the coinset
     setCoinsRet.insert(setPresetCoins.begin(), setPresetCoins.end());
@@ -2775,7 +3176,7 @@ bool CWallet::CreateTransaction(const std::vector<CRecipient>& vecSend, CWalletT
         LOCK2(cs_main, cs_wallet);
         {
             std::vector<COutput> vAvailableCoins;
-            AvailableCoins(vAvailableCoins, true, &coin_control);
+            AvailableCoinsForSelection(vAvailableCoins, true, &coin_control);
 
             // Create change script that will be used if we need change
             // TODO: pass in scriptChange instead of reservekey so
@@ -2812,6 +3213,17 @@ bool CWallet::CreateTransaction(const std::vector<CRecipient>& vecSend, CWalletT
             size_t change_prototype_size = GetSerializeSize(change_prototype_txout, SER_DISK, 0);
 
             CFeeRate discard_rate = GetDiscardRate(::feeEstimator);
+
+            // A changeless selection is only searched for on the first pass,
+            // when the fee is still to be paid from the inputs
+            CoinSelectionParams coin_selection_params;
+            bool use_bnb = nSubtractFeeFromAmount == 0;
+            coin_selection_params.change_output_size = change_prototype_size;
+            const int change_spend_size = CalculateMaximumSignedInputSize(change_prototype_txout);
+            // Change to a script we cannot sign for, assume a P2PKH spend
+            coin_selection_params.change_spend_size = change_spend_size < 0 ? 148 : change_spend_size;
+            coin_selection_params.effective_fee = CFeeRate(GetMinimumFee(1000, coin_control, ::mempool, ::feeEstimator, nullptr), 1000);
+
             nFeeRet = 0;
             bool pick_new_inputs = true;
             CAmount nValueIn = 0;
@@ -2862,19 +3274,30 @@ bool CWallet::CreateTransaction(const std::vector<CRecipient>& vecSend, CWalletT
                 }
 
                 // Choose coins to use
+                bool bnb_used = false;
                 if (pick_new_inputs) {
                     nValueIn = 0;
                     setCoins.clear();
-                    if (!SelectCoins(vAvailableCoins, nValueToSelect, setCoins, nValueIn, &coin_control))
+                    coin_selection_params.tx_noinputs_size = GetVirtualTransactionSize(txNew);
+                    if (!SelectCoins(vAvailableCoins, nValueToSelect, setCoins, nValueIn, &coin_control, use_bnb ? &coin_selection_params : nullptr, &bnb_used))
                     {
                         strFailReason = _("Insufficient funds");
                         return false;
                     }
+                    use_bnb = false;
                 }
 
                 const CAmount nChange = nValueIn - nValueToSelect;
 
-                if (nChange > 0)
+                if (bnb_used)
+                {
+                    // The selection already covers the fee, the excess it
+                    // was allowed to have is cheaper to pay as fee than a
+                    // change output
+                    nChangePosInOut = -1;
+                    nFeeRet += nChange;
+                }
+                else if (nChange > 0)
                 {
                     // Fill a vout to ourself
                     CTxOut newTxOut(nChange, scriptChange);
@@ -3070,198 +3493,864 @@ bool CWallet::CreateTransaction(const std::vector<CRecipient>& vecSend, CWalletT
     return true;
 }
 
-bool CWallet::CreateSidechainDeposit(CTransactionRef& tx, std::string& strFail, const CScript& sidechainScriptPubKey, const uint8_t nSidechain, const CAmount& nAmount, const CAmount& nFee, const std::string& strDest)
+void CWallet::TrackBMMPoolTx(const CWalletTx& wtx)
 {
-    strFail = "Unknown error!";
-
-    if (!scdb.IsSidechainActive(nSidechain)) {
-        strFail = "Invalid Sidechain number!\n";
-        return false;
-    }
+    auto it = wtx.mapValue.find("bmm");
+    if (it == wtx.mapValue.end())
+        return;
+    if (it->second == "pool")
+        setBMMPoolPending.insert(wtx.GetHash());
+    else if (it->second == "request")
+        setBMMRequestPending.insert(wtx.GetHash());
+}
 
-    if (vpwallets.empty()) {
-        strFail = "No active wallet!\n";
-        return false;
-    }
+void CWallet::AddToBMMPool(const COutPoint& outpoint, bool fFront)
+{
+    if (!setBMMPool.insert(outpoint).second)
+        return;
+    if (fFront)
+        vBMMPool.push_front(outpoint);
+    else
+        vBMMPool.push_back(outpoint);
+}
 
-    // User deposit data script
-    CScript dataScript = CScript() << OP_RETURN << ParseHex(HexStr(strDest));
+void CWallet::UpdateBMMPool(int nHeight)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
 
-    if (dataScript.size() > MAX_DEPOSIT_DESTINATION_BYTES) {
-        strFail = "Invalid sidechain deposit script - destination too large!";
-        return false;
+    for (auto it = setBMMPoolPending.begin(); it != setBMMPoolPending.end(); ) {
+        auto mi = mapWallet.find(*it);
+        if (mi == mapWallet.end()) {
+            it = setBMMPoolPending.erase(it);
+            continue;
+        }
+        const CWalletTx& wtx = mi->second;
+        const int nDepth = wtx.GetDepthInMainChain();
+        if (nDepth == 0 && !wtx.isAbandoned()) {
+            ++it;
+            continue;
+        }
+        if (nDepth > 0) {
+            for (unsigned int i = 0; i < wtx.tx->vout.size(); i++) {
+                const CTxOut& txout = wtx.tx->vout[i];
+                if ((IsMine(txout) & ISMINE_SPENDABLE) && !IsChange(txout) && !IsSpent(wtx.GetHash(), i))
+                    AddToBMMPool(COutPoint(wtx.GetHash(), i), false);
+            }
+        }
+        it = setBMMPoolPending.erase(it);
     }
 
-    std::vector<unsigned char> vch(ParseHex(HexStr(sidechainScriptPubKey)));
-    CScript sidechainScript = CScript(vch.begin(), vch.end());
-    if (sidechainScript.empty()) {
-        strFail = "Invalid sidechain deposit script!";
-        return false;
+    for (auto it = setBMMRequestPending.begin(); it != setBMMRequestPending.end(); ) {
+        auto mi = mapWallet.find(*it);
+        if (mi == mapWallet.end()) {
+            it = setBMMRequestPending.erase(it);
+            continue;
+        }
+        const CWalletTx& wtx = mi->second;
+        if (wtx.GetDepthInMainChain() != 0) {
+            it = setBMMRequestPending.erase(it);
+            continue;
+        }
+        // Requests that are replaced for new tips keep their input
+        uint8_t nSidechain;
+        uint16_t nPrevBlockRef;
+        std::string strPrevBlock;
+        if (wtx.tx->criticalData.IsBMMRequest(nSidechain, nPrevBlockRef, strPrevBlock)) {
+            auto itRequest = mapBMMRequest.find(nSidechain);
+            if (itRequest != mapBMMRequest.end() && itRequest->second == wtx.GetHash()) {
+                ++it;
+                continue;
+            }
+        }
+        if (!wtx.isAbandoned()) {
+            // A BMM request can only be included in the block following
+            // nLockTime. Once that block is connected without it, the request
+            // can't confirm anymore and its input goes back into the pool as
+            // soon as it has left the mempool.
+            if ((int)wtx.tx->nLockTime >= nHeight || !TransactionCanBeAbandoned(wtx.GetHash()) || !AbandonTransaction(wtx.GetHash())) {
+                ++it;
+                continue;
+            }
+        }
+        for (const CTxIn& txin : wtx.tx->vin)
+            AddToBMMPool(txin.prevout, true);
+        it = setBMMRequestPending.erase(it);
     }
+}
 
-    // The deposit transaction
-    CMutableTransaction mtx;
+void CWallet::GetBMMPoolSize(size_t& nAvailable, size_t& nPending) const
+{
+    AssertLockHeld(cs_wallet);
 
-    BlockUntilSyncedToCurrentChain();
+    nAvailable = vBMMPool.size();
+    nPending = 0;
+    for (const uint256& hash : setBMMPoolPending) {
+        auto mi = mapWallet.find(hash);
+        if (mi == mapWallet.end())
+            continue;
+        for (const CTxOut& txout : mi->second.tx->vout) {
+            if ((IsMine(txout) & ISMINE_SPENDABLE) && !IsChange(txout))
+                nPending++;
+        }
+    }
+}
 
-    LOCK2(cs_main, vpwallets[0]->cs_wallet);
+bool CWallet::CreateBMMRequest(const CAmount& nAmount, uint32_t nLockTime, const CCriticalData& criticalData, CWalletTx& wtxNew, CReserveKey& reservekey, std::string& strFailReason)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
 
-    // Select coins to cover sidechain deposit
-    std::vector<COutput> vCoins;
-    AvailableCoins(vCoins, true /* fOnlySafe */);
-    std::set<CInputCoin> setCoins;
-    CAmount nAmountRet = CAmount(0);
-    if (!SelectCoins(vCoins, nAmount + nFee, setCoins, nAmountRet)) {
-        strFail = "Could not collect enough coins to cover deposit + fee!\n";
-        return false;
-    }
+    while (!vBMMPool.empty()) {
+        const COutPoint outpoint = vBMMPool.front();
+        vBMMPool.pop_front();
+        setBMMPool.erase(outpoint);
 
-    // Handle change if there is any
-    const CAmount nChange = nAmountRet - (nAmount + nFee);
-    CReserveKey reserveKey(vpwallets[0]);
-    if (nChange > 0) {
-        CScript scriptChange;
+        auto mi = mapWallet.find(outpoint.hash);
+        if (mi == mapWallet.end() || outpoint.n >= mi->second.tx->vout.size())
+            continue;
+        const CWalletTx& wtxPrev = mi->second;
+        const int nDepth = wtxPrev.GetDepthInMainChain();
+        if (nDepth == 0 && !wtxPrev.isAbandoned()) {
+            // Disconnected by a reorg, wait for it to confirm again
+            setBMMPoolPending.insert(outpoint.hash);
+            continue;
+        }
+        if (nDepth < 1 || IsSpent(outpoint.hash, outpoint.n) || IsLockedCoin(outpoint.hash, outpoint.n))
+            continue;
+        const CTxOut& txoutPrev = wtxPrev.tx->vout[outpoint.n];
+        if (!(IsMine(txoutPrev) & ISMINE_SPENDABLE))
+            continue;
 
-        // Reserve a new key pair from key pool
-        CPubKey vchPubKey;
-        if (!reserveKey.GetReservedKey(vchPubKey))
-        {
-            strFail = "Keypool ran out, please call keypoolrefill first!\n";
+        CMutableTransaction txNew;
+        // Critical data is only serialized for version 3 transactions
+        txNew.nVersion = 3;
+        txNew.nLockTime = nLockTime;
+        txNew.criticalData = criticalData;
+        txNew.vin.push_back(CTxIn(outpoint, CScript(), nBMMReplace ? MAX_BIP125_RBF_SEQUENCE : CTxIn::SEQUENCE_FINAL - 1));
+        txNew.vout.push_back(CTxOut(nAmount, CScript() << OP_TRUE));
+
+        // Put the output back at the front of the pool if the request can't
+        // be created
+        auto fail = [&](const std::string& strReason) {
+            AddToBMMPool(outpoint, true);
+            reservekey.ReturnKey();
+            strFailReason = strReason;
             return false;
-        }
-        scriptChange = GetScriptForDestination(vchPubKey.GetID());
+        };
 
-        CTxOut out(nChange, scriptChange);
-        if (!IsDust(out, ::dustRelayFee))
-            mtx.vout.push_back(out);
+        CPubKey vchPubKey;
+        if (!reservekey.GetReservedKey(vchPubKey, true))
+            return fail(_("Keypool ran out, please call keypoolrefill first"));
+        CCoinControl coin_control;
+        const OutputType change_type = TransactionChangeType(coin_control.change_type, std::vector<CRecipient>());
+        LearnRelatedScripts(vchPubKey, change_type);
+        txNew.vout.push_back(CTxOut(0, GetScriptForDestination(GetDestinationForKey(vchPubKey, change_type))));
+
+        const std::vector<CInputCoin> vCoins{CInputCoin(outpoint, txoutPrev)};
+        if (!DummySignTx(txNew, vCoins))
+            return fail(_("Signing transaction failed"));
+        const unsigned int nBytes = GetVirtualTransactionSize(txNew);
+        txNew.vin[0].scriptSig = CScript();
+        txNew.vin[0].scriptWitness.SetNull();
+
+        const CAmount nFee = GetMinimumFee(nBytes, coin_control, ::mempool, ::feeEstimator, nullptr);
+        const CAmount nChange = txoutPrev.nValue - nAmount - nFee;
+        if (nChange < 0) {
+            // Leave the output for a smaller bid
+            return fail(_("BMM pool outputs are too small for this amount"));
+        }
+        txNew.vout[1].nValue = nChange;
+        if (IsDust(txNew.vout[1], ::dustRelayFee)) {
+            // Give the dust to the miner instead
+            txNew.vout.pop_back();
+            reservekey.ReturnKey();
+        }
+
+        CTransaction txNewConst(txNew);
+        SignatureData sigdata;
+        if (!ProduceSignature(TransactionSignatureCreator(this, &txNewConst, 0, txoutPrev.nValue, SIGHASH_ALL), txoutPrev.scriptPubKey, sigdata))
+            return fail(_("Signing transaction failed"));
+        UpdateTransaction(txNew, 0, sigdata);
+
+        wtxNew.fTimeReceivedIsTxTime = true;
+        wtxNew.fFromMe = true;
+        wtxNew.BindWallet(this);
+        wtxNew.mapValue["bmm"] = "request";
+        wtxNew.SetTx(MakeTransactionRef(std::move(txNew)));
+        return true;
     }
 
-    // Add deposit inputs
-    for (const auto& coin : setCoins) {
-        mtx.vin.push_back(CTxIn(coin.outpoint.hash, coin.outpoint.n, CScript()));
-    }
+    strFailReason = _("BMM pool is empty");
+    return false;
+}
 
-    // Add data output
-    mtx.vout.push_back(CTxOut(CAmount(0), dataScript));
+/** Critical data of a BMM request for h* on top of the block ending in strPrevBlock */
+static CCriticalData BMMCriticalData(uint8_t nSidechain, uint16_t nPrevBlockRef, const std::string& strPrevBlock, const uint256& hashCritical)
+{
+    CScript bytes;
+    bytes.resize(3);
+    bytes[0] = 0x00;
+    bytes[1] = 0xbf;
+    bytes[2] = 0x00;
+
+    bytes << CScriptNum(nSidechain);
+    bytes << CScriptNum(nPrevBlockRef);
+    bytes << ToByteVector(HexStr(strPrevBlock));
+
+    CCriticalData criticalData;
+    criticalData.bytes = std::vector<unsigned char>(bytes.begin(), bytes.end());
+    criticalData.hashCritical = hashCritical;
+    return criticalData;
+}
+
+void CWallet::TrackBMMRequest(const CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet);
+
+    if (!wtx.mapValue.count("bmmreplace"))
+        return;
+    uint8_t nSidechain;
+    uint16_t nPrevBlockRef;
+    std::string strPrevBlock;
+    if (!wtx.tx->criticalData.IsBMMRequest(nSidechain, nPrevBlockRef, strPrevBlock))
+        return;
+
+    // Keep the most recent request if there are several for a sidechain
+    auto it = mapBMMRequest.find(nSidechain);
+    if (it != mapBMMRequest.end()) {
+        auto mi = mapWallet.find(it->second);
+        if (mi != mapWallet.end() && mi->second.nOrderPos > wtx.nOrderPos)
+            return;
+    }
+    mapBMMRequest[nSidechain] = wtx.GetHash();
+}
+
+const CWalletTx* CWallet::GetBMMRequest(uint8_t nSidechain) const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
 
-    // Add deposit output
-    mtx.vout.push_back(CTxOut(nAmount, sidechainScript));
+    auto it = mapBMMRequest.find(nSidechain);
+    if (it == mapBMMRequest.end())
+        return nullptr;
+    const CWalletTx* pwtx = GetWalletTx(it->second);
+    if (!pwtx || pwtx->GetDepthInMainChain() != 0 || pwtx->isAbandoned())
+        return nullptr;
+    return pwtx;
+}
+
+bool CWallet::CreateBMMReplacement(const CWalletTx& wtxOld, const CAmount& nAmount, uint32_t nLockTime, const CCriticalData& criticalData, CWalletTx& wtxNew, std::string& strFailReason)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    CMutableTransaction txNew;
+    // Critical data is only serialized for version 3 transactions
+    txNew.nVersion = 3;
+    txNew.nLockTime = nLockTime;
+    txNew.criticalData = criticalData;
+
+    std::vector<CInputCoin> vCoins;
+    CAmount nValueIn = 0;
+    for (const CTxIn& txin : wtxOld.tx->vin) {
+        auto mi = mapWallet.find(txin.prevout.hash);
+        if (mi == mapWallet.end() || txin.prevout.n >= mi->second.tx->vout.size()) {
+            strFailReason = _("BMM request spends coins that aren't in the wallet");
+            return false;
+        }
+        const CTxOut& txoutPrev = mi->second.tx->vout[txin.prevout.n];
+        if (!(IsMine(txoutPrev) & ISMINE_SPENDABLE)) {
+            strFailReason = _("BMM request spends coins that aren't spendable");
+            return false;
+        }
+        vCoins.emplace_back(txin.prevout, txoutPrev);
+        nValueIn += txoutPrev.nValue;
+        txNew.vin.push_back(CTxIn(txin.prevout, CScript(), MAX_BIP125_RBF_SEQUENCE));
+    }
+    txNew.vout.push_back(CTxOut(nAmount, CScript() << OP_TRUE));
+
+    // Reuse the change destination of the request being replaced
+    CScript scriptChange;
+    for (const CTxOut& txout : wtxOld.tx->vout) {
+        if (IsChange(txout)) {
+            scriptChange = txout.scriptPubKey;
+            break;
+        }
+    }
+    if (scriptChange.empty()) {
+        CPubKey vchPubKey;
+        if (!GetKeyFromPool(vchPubKey, true)) {
+            strFailReason = _("Keypool ran out, please call keypoolrefill first");
+            return false;
+        }
+        CCoinControl coin_control;
+        const OutputType change_type = TransactionChangeType(coin_control.change_type, std::vector<CRecipient>());
+        LearnRelatedScripts(vchPubKey, change_type);
+        scriptChange = GetScriptForDestination(GetDestinationForKey(vchPubKey, change_type));
+    }
+    txNew.vout.push_back(CTxOut(0, scriptChange));
 
-    // Handle existing sidechain utxo. We will look at our local mempool, and
-    // create a deposit based on the latest CTIP for the sidechain.
-    // Note: It will be rejected if other nodes have seen a newer CTIP.
-    SidechainCTIP ctip;
-    CAmount returnAmount = CAmount(0);
-    if (::mempool.GetMemPoolCTIP(nSidechain, ctip)) {
-        returnAmount = ctip.amount;
-        // Amount returning to sidechain
-        mtx.vout.back().nValue += returnAmount;
-        // Spend the existing CTIP
-        mtx.vin.push_back(CTxIn(ctip.out));
+    if (!DummySignTx(txNew, vCoins)) {
+        strFailReason = _("Signing transaction failed");
+        return false;
+    }
+    const unsigned int nBytes = GetVirtualTransactionSize(txNew);
+    for (CTxIn& txin : txNew.vin) {
+        txin.scriptSig = CScript();
+        txin.scriptWitness.SetNull();
     }
 
-    // Dummy sign the transaction to calculate fee
-    std::set<CInputCoin> setCoinsTemp = setCoins;
-    // TODO also dummy sign the sidechain UTXO input
-    if (!DummySignTx(mtx, setCoinsTemp)) {
-        strFail = "Dummy signing transaction for required fee calculation failed!";
+    CCoinControl coin_control;
+    CAmount nFee = GetMinimumFee(nBytes, coin_control, ::mempool, ::feeEstimator, nullptr);
+    if ((int64_t)wtxOld.tx->nLockTime == chainActive.Height()) {
+        // The old request can still be mined, pay for it and for our own relay
+        const CAmount nOldFee = nValueIn - wtxOld.tx->GetValueOut();
+        nFee = std::max(nFee, nOldFee + ::incrementalRelayFee.GetFee(nBytes));
+    }
+    const CAmount nChange = nValueIn - nAmount - nFee;
+    if (nChange < 0) {
+        strFailReason = _("Insufficient funds");
         return false;
     }
+    txNew.vout[1].nValue = nChange;
+    if (IsDust(txNew.vout[1], ::dustRelayFee)) {
+        // Give the dust to the miner instead
+        txNew.vout.pop_back();
+    }
 
-    // Get transaction size with dummy signatures
-    unsigned int nBytes = GetVirtualTransactionSize(mtx);
+    CTransaction txNewConst(txNew);
+    for (unsigned int i = 0; i < vCoins.size(); i++) {
+        SignatureData sigdata;
+        if (!ProduceSignature(TransactionSignatureCreator(this, &txNewConst, i, vCoins[i].txout.nValue, SIGHASH_ALL), vCoins[i].txout.scriptPubKey, sigdata)) {
+            strFailReason = _("Signing transaction failed");
+            return false;
+        }
+        UpdateTransaction(txNew, i, sigdata);
+    }
 
-    // Calculate fee
-    CCoinControl coinControl;
-    FeeCalculation feeCalc;
-    CAmount nFeeNeeded = GetMinimumFee(nBytes, coinControl, ::mempool, ::feeEstimator, &feeCalc);
+    wtxNew.fTimeReceivedIsTxTime = true;
+    wtxNew.fFromMe = true;
+    wtxNew.BindWallet(this);
+    wtxNew.mapValue = wtxOld.mapValue;
+    wtxNew.SetTx(MakeTransactionRef(std::move(txNew)));
+    return true;
+}
+
+bool CWallet::CommitBMMReplacement(const uint256& hashOld, CWalletTx& wtxNew, CConnman* connman, CValidationState& state, bool fCommitWrites)
+{
+    LOCK2(cs_main, cs_wallet);
 
-    // Check that the fee is valid for relay
-    if (nFeeNeeded < ::minRelayTxFee.GetFee(nBytes)) {
-        strFail = "Transaction too large for fee policy";
+    // Nothing is reserved, change goes to an existing destination
+    CReserveKey reservekey(this);
+    if (!CommitTransaction(wtxNew, reservekey, connman, state, true /* fRemoveIfFail */, fCommitWrites)) {
+        // Don't keep an abandoned copy of a request nobody has seen
+        EraseBMMRequest(wtxNew.GetHash());
         return false;
     }
 
-    // Check the user set fee
-    if (nFee < nFeeNeeded) {
-        strFail = "The fee you have set is too small!";
+    EraseBMMRequest(hashOld);
+    // The replaced request will never need to be abandoned
+    scdb.BMMAbandoned(hashOld);
+
+    TrackBMMRequest(mapWallet.at(wtxNew.GetHash()));
+    return true;
+}
+
+void CWallet::EraseBMMRequest(const uint256& hash)
+{
+    AssertLockHeld(cs_wallet);
+
+    auto mi = mapWallet.find(hash);
+    if (mi == mapWallet.end())
+        return;
+    const CWalletTx& wtx = mi->second;
+
+    for (const CTxIn& txin : wtx.tx->vin) {
+        auto range = mapTxSpends.equal_range(txin.prevout);
+        for (auto it = range.first; it != range.second; ) {
+            if (it->second == hash)
+                it = mapTxSpends.erase(it);
+            else
+                ++it;
+        }
+    }
+    auto range = wtxOrdered.equal_range(wtx.nOrderPos);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second.first == &wtx) {
+            wtxOrdered.erase(it);
+            break;
+        }
+    }
+
+    if (!CWalletDB(*dbw).EraseTx(hash))
+        LogPrintf("%s: Failed to erase %s from the wallet database\n", __func__, hash.ToString());
+    const CTransactionRef tx = wtx.tx;
+    mapWallet.erase(mi);
+    for (unsigned int i = 0; i < tx->vout.size(); i++)
+        setUnspentByValue.erase(std::make_pair(tx->vout[i].nValue, COutPoint(hash, i)));
+    for (const CTxIn& txin : tx->vin)
+        UpdateUnspentIndex(txin.prevout);
+    NotifyTransactionChanged(this, hash, CT_DELETED);
+}
+
+void CWallet::ReplaceStaleBMMRequests(CConnman* connman)
+{
+    LOCK2(cs_main, cs_wallet);
+
+    const CBlockIndex* pindexTip = chainActive.Tip();
+    if (!pindexTip || IsLocked())
+        return;
+    std::string strPrevBlock = pindexTip->GetBlockHash().ToString();
+    strPrevBlock = strPrevBlock.substr(strPrevBlock.size() - 4);
+
+    std::vector<uint256> vReplaced;
+    for (auto it = mapBMMRequest.begin(); it != mapBMMRequest.end(); ) {
+        const CWalletTx* pwtxOld = GetBMMRequest(it->first);
+        if (!pwtxOld) {
+            // Mined, conflicted or given up on
+            it = mapBMMRequest.erase(it);
+            continue;
+        }
+        if ((int)pwtxOld->tx->nLockTime >= pindexTip->nHeight) {
+            ++it;
+            continue;
+        }
+
+        const uint256 hashOld = pwtxOld->GetHash();
+        const unsigned int nReplaced = atoi(pwtxOld->mapValue.at("bmmreplace"));
+        if (nReplaced >= nBMMReplace) {
+            // Leave it to abandonbmm
+            LogPrintf("%s: Not replacing BMM request %s again after %u blocks\n", __func__, hashOld.ToString(), nReplaced);
+            it = mapBMMRequest.erase(it);
+            continue;
+        }
+
+        uint8_t nSidechain;
+        uint16_t nPrevBlockRef;
+        std::string strOldPrevBlock;
+        pwtxOld->tx->criticalData.IsBMMRequest(nSidechain, nPrevBlockRef, strOldPrevBlock);
+        const CCriticalData criticalData = BMMCriticalData(nSidechain, nPrevBlockRef, strPrevBlock, pwtxOld->tx->criticalData.hashCritical);
+
+        CAmount nAmount = 0;
+        for (const CTxOut& txout : pwtxOld->tx->vout) {
+            if (txout.scriptPubKey == CScript() << OP_TRUE)
+                nAmount += txout.nValue;
+        }
+
+        CWalletTx wtxNew;
+        std::string strFailReason;
+        if (!CreateBMMReplacement(*pwtxOld, nAmount, pindexTip->nHeight, criticalData, wtxNew, strFailReason)) {
+            LogPrintf("%s: Failed to replace BMM request %s: %s\n", __func__, hashOld.ToString(), strFailReason);
+            ++it;
+            continue;
+        }
+        wtxNew.mapValue["bmmreplace"] = std::to_string(nReplaced + 1);
+
+        CValidationState state;
+        if (!CommitBMMReplacement(hashOld, wtxNew, connman, state, false /* fCommitWrites */)) {
+            LogPrintf("%s: Replacement for BMM request %s rejected: %s\n", __func__, hashOld.ToString(), FormatStateMessage(state));
+            ++it;
+            continue;
+        }
+        LogPrintf("%s: Replaced BMM request %s with %s for block %s\n", __func__, hashOld.ToString(), wtxNew.GetHash().ToString(), pindexTip->GetBlockHash().ToString());
+        vReplaced.push_back(wtxNew.GetHash());
+        ++it;
+    }
+
+    // Write all of the replacements to the wallet database in one go before
+    // any of them is announced
+    if (vReplaced.empty())
+        return;
+    if (!CommitQueuedWrites())
+        LogPrintf("%s: Failed to write BMM replacements to the wallet database\n", __func__);
+    if (!fBroadcastTransactions)
+        return;
+    for (const uint256& hash : vReplaced) {
+        auto mi = mapWallet.find(hash);
+        if (mi != mapWallet.end() && mi->second.InMempool())
+            mi->second.RelayWalletTransaction(connman);
+    }
+}
+
+bool CWallet::RefillBMMPool(CConnman* connman, std::string& strFailReason)
+{
+    if (!nBMMPoolSize)
+        return true;
+
+    // Create, sign and commit under the same locks, so the selected coins
+    // can't be picked by another transaction before this one is committed
+    LOCK2(cs_main, cs_wallet);
+
+    size_t nAvailable, nPending;
+    GetBMMPoolSize(nAvailable, nPending);
+    if (nAvailable + nPending >= nBMMPoolSize)
+        return true;
+    const unsigned int nOutputs = std::min<size_t>(nBMMPoolSize - nAvailable - nPending, MAX_BMM_POOL_REFILL);
+
+    // Every output pays to a new key, so the BMM requests spending them
+    // can't be linked to each other. The keys are only reserved, they go
+    // back to the keypool unless the transaction is committed.
+    std::vector<std::unique_ptr<CReserveKey>> vReserveKey;
+    std::vector<CTxDestination> vDest;
+    std::vector<CRecipient> vecSend;
+    for (unsigned int i = 0; i < nOutputs; i++) {
+        vReserveKey.emplace_back(new CReserveKey(this));
+        CPubKey newKey;
+        if (!vReserveKey.back()->GetReservedKey(newKey)) {
+            strFailReason = _("Keypool ran out, please call keypoolrefill first");
+            return false;
+        }
+        LearnRelatedScripts(newKey, g_address_type);
+        vDest.push_back(GetDestinationForKey(newKey, g_address_type));
+        vecSend.push_back(CRecipient{GetScriptForDestination(vDest.back()), nBMMPoolAmount, false});
+    }
+
+    CWalletTx wtx;
+    wtx.mapValue["bmm"] = "pool";
+    CReserveKey reservekey(this);
+    CAmount nFeeRequired;
+    int nChangePosRet = -1;
+    CCoinControl coin_control;
+    if (!CreateTransaction(vecSend, wtx, reservekey, nFeeRequired, nChangePosRet, strFailReason, coin_control))
+        return false;
+
+    CValidationState state;
+    if (!CommitTransaction(wtx, reservekey, connman, state)) {
+        strFailReason = state.GetRejectReason();
         return false;
     }
 
-    // Remove dummy signatures
-    for (auto& vin : mtx.vin) {
-        vin.scriptSig = CScript();
-        vin.scriptWitness.SetNull();
+    // The outputs are added to the address book so they aren't mistaken
+    // for change
+    for (size_t i = 0; i < vReserveKey.size(); i++) {
+        vReserveKey[i]->KeepKey();
+        SetAddressBook(vDest[i], "bmmpool", "receive");
     }
+    auto mi = mapWallet.find(wtx.GetHash());
+    if (mi != mapWallet.end())
+        mi->second.MarkDirty();
 
-    Sidechain sidechain;
-    if (!scdb.GetSidechain(nSidechain, sidechain))
+    LogPrintf("%s: Created %u BMM pool outputs in %s\n", __func__, vecSend.size(), wtx.GetHash().ToString());
+    return true;
+}
+
+bool CWallet::CreateSidechainDeposit(CTransactionRef& tx, std::string& strFail, const CScript& sidechainScriptPubKey, const uint8_t nSidechain, const CAmount& nAmount, const CAmount& nFee, const std::string& strDest)
+{
+    std::vector<CTransactionRef> vtx;
+    if (!CreateSidechainDeposits(vtx, strFail, sidechainScriptPubKey, nSidechain, {std::make_pair(strDest, nAmount)}, nFee))
+        return false;
+
+    tx = vtx.front();
+    return true;
+}
+
+/** Add the private key of a sidechain, which its CTIP is paid to, to keystore */
+static bool AddSidechainKey(CBasicKeyStore& keystore, const Sidechain& sidechain, std::string& strFail)
+{
+    CBitcoinSecret vchSecret;
+    bool fGood = vchSecret.SetString(sidechain.strPrivKey);
+    if (!fGood) {
+        strFail = "Invalid sidechain private key encoding!\n";
+        return false;
+    }
+    CKey privKey = vchSecret.GetKey();
+    if (!privKey.IsValid()) {
+        strFail = "Sidechain private key invalid!\n";
+        return false;
+    }
+
+    keystore.AddKey(privKey);
+    return true;
+}
+
+/** Sign the CTIP input of a sidechain deposit, which is always the last input */
+static bool SignSidechainCTIP(CMutableTransaction& mtx, const CKeyStore& keystore, const CScript& sidechainScript, const CAmount& returnAmount, std::string& strFail)
+{
+    const CTransaction& txToSign = mtx;
+
+    TransactionSignatureCreator creator(&keystore, &txToSign, mtx.vin.size() - 1, returnAmount);
+
+    SignatureData sigdata;
+    bool sigCreated = ProduceSignature(creator, sidechainScript, sigdata);
+    if (!sigCreated) {
+        strFail = "Failed to sign sidechain inputs!\n";
+        return false;
+    }
+
+    mtx.vin.back().scriptSig = sigdata.scriptSig;
+    return true;
+}
+
+bool CWallet::CreateSidechainDeposits(std::vector<CTransactionRef>& vtx, std::string& strFail, const CScript& sidechainScriptPubKey, const uint8_t nSidechain, const std::vector<std::pair<std::string, CAmount>>& vDeposit, const CAmount& nFee)
+{
+    strFail = "Unknown error!";
+    vtx.clear();
+
+    if (!scdb.IsSidechainActive(nSidechain)) {
+        strFail = "Invalid Sidechain number!\n";
+        return false;
+    }
+
+    if (vpwallets.empty()) {
+        strFail = "No active wallet!\n";
+        return false;
+    }
+
+    if (vDeposit.empty()) {
+        strFail = "No deposits to create!\n";
+        return false;
+    }
+
+    // Every deposit of the chain is an ancestor of the ones after it
+    if (vDeposit.size() > (size_t)gArgs.GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT)) {
+        strFail = "Too many deposits for the mempool ancestor limit!\n";
         return false;
+    }
+
+    // User deposit data scripts
+    std::vector<CScript> vDataScript;
+    CAmount nTotal = CAmount(0);
+    for (const auto& deposit : vDeposit) {
+        CScript dataScript = CScript() << OP_RETURN << ParseHex(HexStr(deposit.first));
 
-    // Sign the sidechain utxo if we need to
-    if (returnAmount > CAmount(0)) {
-        CBitcoinSecret vchSecret;
-        bool fGood = vchSecret.SetString(sidechain.strPrivKey);
-        if (!fGood) {
-            strFail = "Invalid sidechain private key encoding!\n";
+        if (dataScript.size() > MAX_DEPOSIT_DESTINATION_BYTES) {
+            strFail = "Invalid sidechain deposit script - destination too large!";
             return false;
         }
-        CKey privKey = vchSecret.GetKey();
-        if (!privKey.IsValid()) {
-            strFail = "Sidechain private key invalid!\n";
+        vDataScript.push_back(dataScript);
+
+        nTotal += deposit.second + nFee;
+        if (!MoneyRange(deposit.second) || !MoneyRange(nTotal)) {
+            strFail = "Invalid deposit amount!";
             return false;
         }
+    }
 
-        CBasicKeyStore tempKeystore;
-        tempKeystore.AddKey(privKey);
+    std::vector<unsigned char> vch(ParseHex(HexStr(sidechainScriptPubKey)));
+    CScript sidechainScript = CScript(vch.begin(), vch.end());
+    if (sidechainScript.empty()) {
+        strFail = "Invalid sidechain deposit script!";
+        return false;
+    }
 
-        const CKeyStore& keystoreConst = tempKeystore;
-        const CTransaction& txToSign = mtx;
+    Sidechain sidechain;
+    if (!scdb.GetSidechain(nSidechain, sidechain))
+        return false;
 
-        TransactionSignatureCreator creator(&keystoreConst, &txToSign, mtx.vin.size() - 1, returnAmount);
+    BlockUntilSyncedToCurrentChain();
 
-        SignatureData sigdata;
-        bool sigCreated = ProduceSignature(creator, sidechainScript, sigdata);
-        if (!sigCreated) {
-            strFail = "Failed to sign sidechain inputs!\n";
+    // Deposits that were accepted before one after them was rejected
+    std::vector<uint256> vAbandon;
+    {
+        LOCK2(cs_main, cs_wallet);
+
+        // Select coins to cover all of the deposits + fees. They are all spent by
+        // the first deposit, whose change then funds the next one and so on.
+        std::vector<COutput> vCoins;
+        AvailableCoinsForSelection(vCoins, true /* fOnlySafe */);
+        std::set<CInputCoin> setCoins;
+        CAmount nAmountRet = CAmount(0);
+        if (!SelectCoins(vCoins, nTotal, setCoins, nAmountRet)) {
+            strFail = "Could not collect enough coins to cover deposit + fee!\n";
             return false;
         }
 
-        mtx.vin.back().scriptSig = sigdata.scriptSig;
-    }
+        // The whole chain shares one change key pair
+        CReserveKey reserveKey(this);
+        CScript scriptChange;
+        if (nAmountRet > nTotal || vDeposit.size() > 1) {
+            // Reserve a new key pair from key pool
+            CPubKey vchPubKey;
+            if (!reserveKey.GetReservedKey(vchPubKey))
+            {
+                strFail = "Keypool ran out, please call keypoolrefill first!\n";
+                return false;
+            }
+            scriptChange = GetScriptForDestination(vchPubKey.GetID());
+        }
 
-    // Sign the non sidechain inputs
-    const CTransaction txToSign = mtx;
-    int nIn = 0;
-    for (const auto& coin : setCoins) {
-        const CScript& scriptPubKey = coin.txout.scriptPubKey;
-        SignatureData sigdata;
+        // Handle existing sidechain utxo. We will look at our local mempool, and
+        // create the first deposit based on the latest CTIP for the sidechain.
+        // Note: It will be rejected if other nodes have seen a newer CTIP.
+        SidechainCTIP ctip;
+        bool fCTIP = ::mempool.GetMemPoolCTIP(nSidechain, ctip);
 
-        if (!ProduceSignature(TransactionSignatureCreator(this, &txToSign, nIn, coin.txout.nValue, SIGHASH_ALL), scriptPubKey, sigdata))
-        {
-            strFail = "Signing non-sidechain inputs failed!\n";
+        // Every deposit after the first spends the CTIP, the first one does
+        // if there is one already
+        CBasicKeyStore sidechainKeystore;
+        if ((fCTIP || vDeposit.size() > 1) && !AddSidechainKey(sidechainKeystore, sidechain, strFail))
             return false;
-        } else {
-            UpdateTransaction(mtx, nIn, sigdata);
-        }
 
-        nIn++;
-    }
+        CAmount nInputs = nAmountRet;
+        for (size_t i = 0; i < vDeposit.size(); i++) {
+            const CAmount& nAmount = vDeposit[i].second;
+            const bool fLast = (i == vDeposit.size() - 1);
+
+            // The deposit transaction
+            CMutableTransaction mtx;
+
+            // Handle change if there is any. Change that funds the rest of the
+            // chain is always kept, it is output 0.
+            const CAmount nChange = nInputs - (nAmount + nFee);
+            if (nChange > 0) {
+                CTxOut out(nChange, scriptChange);
+                if (!fLast || !IsDust(out, ::dustRelayFee))
+                    mtx.vout.push_back(out);
+            }
 
-    // Broadcast transaction
-    CWalletTx wtxNew;
-    wtxNew.fTimeReceivedIsTxTime = true;
-    wtxNew.fFromMe = true;
-    wtxNew.BindWallet(this);
+            // Add deposit inputs
+            for (const auto& coin : setCoins) {
+                mtx.vin.push_back(CTxIn(coin.outpoint.hash, coin.outpoint.n, CScript()));
+            }
 
-    wtxNew.SetTx(MakeTransactionRef(std::move(mtx)));
+            // Add data output
+            mtx.vout.push_back(CTxOut(CAmount(0), vDataScript[i]));
 
-    CValidationState state;
-    if (!CommitTransaction(wtxNew, reserveKey, g_connman.get(), state, true /* fRemoveIfFail */)) {
-        strFail = "Failed to commit sidechain deposit! Reject reason: " + FormatStateMessage(state) + "\n";
+            // Add deposit output
+            mtx.vout.push_back(CTxOut(nAmount, sidechainScript));
+
+            CAmount returnAmount = CAmount(0);
+            if (fCTIP) {
+                returnAmount = ctip.amount;
+                // Amount returning to sidechain
+                mtx.vout.back().nValue += returnAmount;
+                // Spend the existing CTIP
+                mtx.vin.push_back(CTxIn(ctip.out));
+            }
+
+            // Dummy sign the transaction to calculate fee
+            std::set<CInputCoin> setCoinsTemp = setCoins;
+            if (!DummySignTx(mtx, setCoinsTemp)) {
+                strFail = "Dummy signing transaction for required fee calculation failed!";
+                return false;
+            }
+            if (fCTIP) {
+                SignatureData sigdata;
+                if (!ProduceSignature(DummySignatureCreator(&sidechainKeystore), sidechainScript, sigdata)) {
+                    strFail = "Dummy signing sidechain input for required fee calculation failed!";
+                    return false;
+                }
+                mtx.vin.back().scriptSig = sigdata.scriptSig;
+            }
+
+            // Get transaction size with dummy signatures
+            unsigned int nBytes = GetVirtualTransactionSize(mtx);
+
+            // Calculate fee
+            CCoinControl coinControl;
+            FeeCalculation feeCalc;
+            CAmount nFeeNeeded = GetMinimumFee(nBytes, coinControl, ::mempool, ::feeEstimator, &feeCalc);
+
+            // Check that the fee is valid for relay
+            if (nFeeNeeded < ::minRelayTxFee.GetFee(nBytes)) {
+                strFail = "Transaction too large for fee policy";
+                return false;
+            }
+
+            // Check the user set fee
+            if (nFee < nFeeNeeded) {
+                strFail = "The fee you have set is too small!";
+                return false;
+            }
+
+            // Remove dummy signatures
+            for (auto& vin : mtx.vin) {
+                vin.scriptSig = CScript();
+                vin.scriptWitness.SetNull();
+            }
+
+            // Sign the sidechain utxo if we need to
+            if (returnAmount > CAmount(0)) {
+                if (!SignSidechainCTIP(mtx, sidechainKeystore, sidechainScript, returnAmount, strFail))
+                    return false;
+            }
+
+            // Sign the non sidechain inputs
+            const CTransaction txToSign = mtx;
+            int nIn = 0;
+            for (const auto& coin : setCoins) {
+                const CScript& scriptPubKey = coin.txout.scriptPubKey;
+                SignatureData sigdata;
+
+                if (!ProduceSignature(TransactionSignatureCreator(this, &txToSign, nIn, coin.txout.nValue, SIGHASH_ALL), scriptPubKey, sigdata))
+                {
+                    strFail = "Signing non-sidechain inputs failed!\n";
+                    return false;
+                } else {
+                    UpdateTransaction(mtx, nIn, sigdata);
+                }
+
+                nIn++;
+            }
+
+            CTransactionRef tx = MakeTransactionRef(std::move(mtx));
+            vtx.push_back(tx);
+
+            // The next deposit spends this deposit's burn output as its CTIP and
+            // this deposit's change as its only other input
+            ctip.out = COutPoint(tx->GetHash(), tx->vout.size() - 1);
+            ctip.amount = tx->vout.back().nValue;
+            fCTIP = true;
+
+            setCoins.clear();
+            if (!fLast)
+                setCoins.insert(CInputCoin(COutPoint(tx->GetHash(), 0), tx->vout[0]));
+            nInputs = nChange;
+        }
+
+        // Accept the whole chain to the mempool before relaying any of it. We
+        // still hold cs_main, so nothing else can have changed the mempool CTIP
+        // since we looked it up.
+        const std::map<uint8_t, SidechainCTIP> mapCTIPPrev = ::mempool.mapLastSidechainDeposit;
+        for (size_t i = 0; i < vtx.size(); i++) {
+            CWalletTx wtxNew;
+            wtxNew.fTimeReceivedIsTxTime = true;
+            wtxNew.fFromMe = true;
+            wtxNew.BindWallet(this);
+
+            wtxNew.SetTx(vtx[i]);
+
+            CValidationState state;
+            if (!CommitTransaction(wtxNew, reserveKey, nullptr /* connman */, state, true /* fRemoveIfFail */, false /* fCommitWrites */)) {
+                strFail = "Failed to commit sidechain deposit! Reject reason: " + FormatStateMessage(state) + "\n";
+
+                // Take the deposits that made it into the mempool back out, they
+                // were only valid as part of the whole chain
+                if (i > 0) {
+                    ::mempool.removeRecursive(*vtx.front());
+                    ::mempool.UpdateCTIPFromMempool(mapCTIPPrev);
+                    for (size_t j = 0; j < i; j++)
+                        vAbandon.push_back(vtx[j]->GetHash());
+                }
+                vtx.clear();
+                break;
+            }
+        }
+
+        // Every deposit was accepted. Write them all to the wallet database
+        // in one go, then announce them to our peers.
+        if (!vtx.empty() && !CommitQueuedWrites())
+            LogPrintf("%s: Failed to write deposits to the wallet database\n", __func__);
+        if (!vtx.empty() && fBroadcastTransactions) {
+            for (const CTransactionRef& tx : vtx)
+                mapWallet[tx->GetHash()].RelayWalletTransaction(g_connman.get());
+        }
+    }
+
+    if (vtx.empty()) {
+        // The wallet is told about the deposits entering and leaving the
+        // mempool asynchronously, and being told that one entered clears its
+        // abandoned state. Wait for that before abandoning them.
+        if (!vAbandon.empty())
+            SyncWithValidationInterfaceQueue();
+        for (const uint256& hash : vAbandon) {
+            if (!AbandonTransaction(hash)) {
+                LogPrintf("%s: Failed to abandon deposit %s!\n", __func__, hash.ToString());
+            }
+        }
         return false;
     }
-    tx = wtxNew.tx;
 
     return true;
 }
@@ -3269,7 +4358,7 @@ bool CWallet::CreateSidechainDeposit(CTransactionRef& tx, std::string& strFail,
 /**
  * Call after CreateTransaction unless you want to abort
  */
-bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey, CConnman* connman, CValidationState& state, bool fRemoveIfFail)
+bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey, CConnman* connman, CValidationState& state, bool fRemoveIfFail, bool fCommitWrites)
 {
     {
         LOCK2(cs_main, cs_wallet);
@@ -3298,6 +4387,13 @@ bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey, CCon
             }
         }
 
+        // With -walletcommitdelay the record was only queued. Write it before
+        // the transaction is broadcast or returned to the caller, so a crash
+        // can't lose a transaction that may already be on the network.
+        // Callers committing a batch do this once for the whole batch.
+        if (fCommitWrites && !CommitQueuedWrites())
+            LogPrintf("%s: Failed to write transaction %s to the wallet database\n", __func__, wtxNew.GetHash().ToString());
+
         // Get the inserted-CWalletTx from mapWallet so that the
         // fInMempool flag is cached properly
         CWalletTx& wtx = mapWallet[wtxNew.GetHash()];
@@ -3314,7 +4410,7 @@ bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey, CCon
                     }
                     return false;
                 }
-            } else {
+            } else if (fCommitWrites) {
                 wtx.RelayWalletTransaction(connman);
             }
         }
@@ -3354,6 +4450,7 @@ void CWallet::AddLoadedCoins(const std::vector<LoadedCoin>& vLoadedCoin)
     for (const LoadedCoin& c : vLoadedCoin) {
         vLoadedCoinCache.push_back(c);
     }
+    fRescanElementsDirty = true;
 }
 
 std::vector<LoadedCoin> CWallet::GetMyLoadedCoins() const
@@ -3395,8 +4492,17 @@ DBErrors CWallet::ZapSelectTx(std::vector<uint256>& vHashIn, std::vector<uint256
 {
     AssertLockHeld(cs_wallet); // mapWallet
     DBErrors nZapSelectTxRet = CWalletDB(*dbw,"cr+").ZapSelectTx(vHashIn, vHashOut);
-    for (uint256 hash : vHashOut)
-        mapWallet.erase(hash);
+    for (uint256 hash : vHashOut) {
+        const auto it = mapWallet.find(hash);
+        if (it == mapWallet.end())
+            continue;
+        const CTransactionRef tx = it->second.tx;
+        mapWallet.erase(it);
+        for (unsigned int i = 0; i < tx->vout.size(); i++)
+            setUnspentByValue.erase(std::make_pair(tx->vout[i].nValue, COutPoint(hash, i)));
+        for (const CTxIn& txin : tx->vin)
+            UpdateUnspentIndex(txin.prevout);
+    }
 
     if (nZapSelectTxRet == DB_NEED_REWRITE)
     {
@@ -4165,6 +5271,7 @@ CWallet* CWallet::CreateWalletFromFile(const std::string walletFile)
     int64_t nStart = GetTimeMillis();
     bool fFirstRun = true;
     std::unique_ptr<CWalletDBWrapper> dbw(new CWalletDBWrapper(&bitdb, walletFile));
+    dbw->SetGroupCommit(nCommitDelay > 0);
     CWallet *walletInstance = new CWallet(std::move(dbw));
     DBErrors nLoadWalletRet = walletInstance->LoadWallet(fFirstRun);
     if (nLoadWalletRet != DB_LOAD_OK)
@@ -4343,6 +5450,21 @@ CWallet* CWallet::CreateWalletFromFile(const std::string walletFile)
 }
 
 std::atomic<bool> CWallet::fFlushScheduled(false);
+std::atomic<bool> CWallet::fBMMPoolRefillScheduled(false);
+std::atomic<bool> CWallet::fCommitScheduled(false);
+
+static void MaybeRefillBMMPools()
+{
+    if (IsInitialBlockDownload())
+        return;
+    for (CWalletRef pwallet : vpwallets) {
+        if (pwallet->IsLocked())
+            continue;
+        std::string strFailReason;
+        if (!pwallet->RefillBMMPool(g_connman.get(), strFailReason))
+            LogPrintf("%s: %s: %s\n", __func__, pwallet->GetName(), strFailReason);
+    }
+}
 
 void CWallet::postInitProcess(CScheduler& scheduler)
 {
@@ -4354,6 +5476,19 @@ void CWallet::postInitProcess(CScheduler& scheduler)
     if (!CWallet::fFlushScheduled.exchange(true)) {
         scheduler.scheduleEvery(MaybeCompactWalletDB, 500);
     }
+
+    {
+        LOCK2(cs_main, cs_wallet);
+        UpdateBMMPool(chainActive.Height());
+    }
+    if (nBMMPoolSize && !CWallet::fBMMPoolRefillScheduled.exchange(true)) {
+        scheduler.scheduleEvery(MaybeRefillBMMPools, BMM_POOL_REFILL_INTERVAL);
+    }
+
+    // Commit queued wallet writes at the end of every commit window
+    if (nCommitDelay > 0 && !CWallet::fCommitScheduled.exchange(true)) {
+        scheduler.scheduleEvery(CommitQueuedWalletWrites, nCommitDelay);
+    }
 }
 
 bool CWallet::BackupWallet(const std::string& strDest)
@@ -4361,6 +5496,11 @@ bool CWallet::BackupWallet(const std::string& strDest)
     return dbw->Backup(strDest);
 }
 
+bool CWallet::CommitQueuedWrites()
+{
+    return dbw->CommitQueue();
+}
+
 CKeyPool::CKeyPool()
 {
     nTime = GetTime();
@@ -7,6 +7,7 @@
 #define BITCOIN_WALLET_WALLET_H
 
 #include <amount.h>
+#include <blockfilter.h>
 #include <policy/feerate.h>
 #include <streams.h>
 #include <tinyformat.h>
@@ -21,6 +22,7 @@
 
 #include <algorithm>
 #include <atomic>
+#include <deque>
 #include <map>
 #include <set>
 #include <stdexcept>
@@ -64,6 +66,24 @@ static const unsigned int DEFAULT_TX_CONFIRM_TARGET = 6;
 //! -walletrbf default
 static const bool DEFAULT_WALLET_RBF = false;
 static const bool DEFAULT_WALLETBROADCAST = true;
+//! -bmmpoolsize default, 0 disables the BMM funding pool
+static const unsigned int DEFAULT_BMM_POOL_SIZE = 0;
+//! -bmmpoolamount default
+static const CAmount DEFAULT_BMM_POOL_AMOUNT = COIN / 10;
+//! Largest number of BMM pool outputs created by a single transaction
+static const unsigned int MAX_BMM_POOL_REFILL = 100;
+//! Milliseconds between checks whether the BMM pool needs to be refilled
+static const int64_t BMM_POOL_REFILL_INTERVAL = 10 * 1000;
+//! -bmmreplace default, 0 disables replacing BMM requests for a new tip
+static const unsigned int DEFAULT_BMM_REPLACE = 0;
+//! -walletcommitdelay default in milliseconds, 0 disables the group commit
+static const int64_t DEFAULT_WALLET_COMMIT_DELAY = 0;
+//! Number of blocks whose filters are matched at once by a rescan
+static const unsigned int RESCAN_FILTER_BATCH_SIZE = 1000;
+//! Number of block filters a rescan matches per task pool task
+static const unsigned int RESCAN_FILTERS_PER_TASK = 50;
+//! Number of matching blocks a rescan reads at once on the task pool
+static const unsigned int RESCAN_PREFETCH_BLOCKS = 8;
 static const bool DEFAULT_DISABLE_WALLET = false;
 
 extern const char * DEFAULT_WALLET_DAT;
@@ -525,16 +545,20 @@ public:
 
         outpoint = COutPoint(walletTx->GetHash(), i);
         txout = walletTx->tx->vout[i];
+        effective_value = txout.nValue;
     }
 
     CInputCoin(const COutPoint& outpointIn, const CTxOut& txoutIn)
     {
         outpoint = outpointIn;
         txout = txoutIn;
+        effective_value = txout.nValue;
     }
 
     COutPoint outpoint;
     CTxOut txout;
+    //! Value minus the fee for spending this coin, set by coin selection
+    CAmount effective_value;
 
     bool operator<(const CInputCoin& rhs) const {
         return outpoint < rhs.outpoint;
@@ -549,6 +573,19 @@ public:
     }
 };
 
+/** Parameters for the branch and bound coin selection in SelectCoinsMinConf */
+struct CoinSelectionParams
+{
+    //! Fee rate the inputs are paid at
+    CFeeRate effective_fee;
+    //! Size of the change output that a changeless selection avoids
+    size_t change_output_size = 0;
+    //! Size of the input that would later spend that change output
+    size_t change_spend_size = 0;
+    //! Size of the transaction without any inputs
+    size_t tx_noinputs_size = 0;
+};
+
 class COutput
 {
 public:
@@ -698,6 +735,8 @@ class CWallet final : public CCryptoKeyStore, public CValidationInterface
 {
 private:
     static std::atomic<bool> fFlushScheduled;
+    static std::atomic<bool> fBMMPoolRefillScheduled;
+    static std::atomic<bool> fCommitScheduled;
     std::atomic<bool> fAbortRescan;
     std::atomic<bool> fScanningWallet; //controlled by WalletRescanReserver
     std::mutex mutexScanning;
@@ -707,9 +746,12 @@ private:
     /**
      * Select a set of coins such that nValueRet >= nTargetValue and at least
      * all coins from coinControl are selected; Never select unconfirmed coins
-     * if they are not ours
+     * if they are not ours. If coin_selection_params is set and there are no
+     * preset inputs a changeless selection is tried first, bnb_used tells
+     * whether one was found.
      */
-    bool SelectCoins(const std::vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, std::set<CInputCoin>& setCoinsRet, CAmount& nValueRet, const CCoinControl *coinControl = nullptr) const;
+    bool SelectCoins(const std::vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, std::set<CInputCoin>& setCoinsRet, CAmount& nValueRet, const CCoinControl *coinControl = nullptr,
+                     const CoinSelectionParams* coin_selection_params = nullptr, bool* bnb_used = nullptr) const;
 
     CWalletDB *pwalletdbEncryption;
 
@@ -733,6 +775,50 @@ private:
     void AddToSpends(const COutPoint& outpoint, const uint256& wtxid);
     void AddToSpends(const uint256& wtxid);
 
+    /**
+     * Outputs of wallet transactions that are ours and not spent by a wallet
+     * transaction which is neither abandoned nor conflicted, ordered by
+     * value. AvailableCoinsForSelection only looks at these instead of all
+     * of mapWallet. This is a superset of the spendable outputs: depth,
+     * maturity, locks and IsSpent are still checked when the outputs are
+     * listed.
+     */
+    std::set<std::pair<CAmount, COutPoint>> setUnspentByValue;
+    void UpdateUnspentIndex(const COutPoint& outpoint);
+    void UpdateUnspentIndex(const CWalletTx& wtx);
+
+    /**
+     * Set when keys, scripts or watch-only scripts change what IsMine
+     * returns for outputs already in mapWallet (imports without rescan,
+     * watch-only records loaded after the transactions). The index is
+     * rebuilt on the next coin selection.
+     */
+    std::atomic<bool> fUnspentIndexDirty{true};
+    void RebuildUnspentIndex();
+
+    /**
+     * Result of GetRescanFilterElements, kept between calls as listing the
+     * scripts runs IsMine on every key. Rebuilt when fRescanElementsDirty
+     * is set, which happens along with fUnspentIndexDirty (so also when
+     * keypool top-ups add keys), or when the active sidechains change.
+     * fRescanElementsComplete is false once a wallet transaction was found
+     * paying us a script not in the set; transactions before
+     * nRescanElementsOrderPos have been checked.
+     */
+    std::atomic<bool> fRescanElementsDirty{true};
+    GCSFilter::ElementSet setRescanElements;
+    std::vector<CScript> vRescanSidechainScript;
+    bool fRescanElementsComplete = true;
+    int64_t nRescanElementsOrderPos = std::numeric_limits<int64_t>::min();
+
+    /** IsMine may have changed for some scripts, rebuild what depends on it */
+    void MarkIsMineDirty() { fUnspentIndexDirty = true; fRescanElementsDirty = true; }
+
+    /** Checks of AvailableCoins on the transaction of an output, sets its depth and whether it is safe */
+    bool GetAvailableDepth(const CWalletTx& wtx, bool fOnlySafe, int nMinDepth, int nMaxDepth, int& nDepth, bool& fSafe) const;
+    /** Checks of AvailableCoins on a single output, sets whether it is spendable and solvable */
+    bool IsAvailableCoin(const CWalletTx& wtx, const COutPoint& outpoint, const CCoinControl* coinControl, bool& fSpendable, bool& fSolvable) const;
+
     /* Mark a transaction (and its in-wallet descendants) as conflicting with a particular block. */
     void MarkConflicted(const uint256& hashBlock, const uint256& hashTx);
 
@@ -785,6 +871,39 @@ private:
     // Cache of loaded coins owned by this wallet
     std::vector<LoadedCoin> vLoadedCoinCache;
 
+    /**
+     * BMM funding pool. Transactions that create pool outputs are marked
+     * with mapValue["bmm"] = "pool" and BMM requests paid from the pool with
+     * mapValue["bmm"] = "request", so the pool can be rebuilt on startup.
+     * Outputs are only handed out once they are confirmed, which keeps BMM
+     * requests from chaining on each other's change. Entries are checked
+     * again when they are taken from the pool.
+     */
+    std::deque<COutPoint> vBMMPool;
+    std::set<COutPoint> setBMMPool;
+    //! Pool funding transactions waiting for a confirmation
+    std::set<uint256> setBMMPoolPending;
+    //! BMM requests paid from the pool that have neither confirmed nor expired
+    std::set<uint256> setBMMRequestPending;
+
+    void TrackBMMPoolTx(const CWalletTx& wtx);
+    void AddToBMMPool(const COutPoint& outpoint, bool fFront);
+    /** Move confirmed funding outputs into the pool and return the outputs of expired requests */
+    void UpdateBMMPool(int nHeight);
+
+    /**
+     * Our in-flight BMM request for each sidechain, if it was created with
+     * -bmmreplace set. Such requests are tagged with mapValue["bmmreplace"],
+     * the number of times they have been replaced for a new chain tip.
+     * Replaced requests are erased from the wallet.
+     */
+    std::map<uint8_t, uint256> mapBMMRequest;
+
+    /** Replace requests the chain tip has moved past with ones for the new tip */
+    void ReplaceStaleBMMRequests(CConnman* connman);
+    /** Remove a BMM request that was replaced or rejected from the wallet */
+    void EraseBMMRequest(const uint256& hash);
+
 public:
     /*
      * Main wallet lock.
@@ -883,6 +1002,12 @@ public:
      */
     void AvailableCoins(std::vector<COutput>& vCoins, bool fOnlySafe=true, const CCoinControl *coinControl = nullptr, const CAmount& nMinimumAmount = 1, const CAmount& nMaximumAmount = MAX_MONEY, const CAmount& nMinimumSumAmount = MAX_MONEY, const uint64_t nMaximumCount = 0, const int nMinDepth = 0, const int nMaxDepth = 9999999) const;
 
+    /**
+     * Same outputs as AvailableCoins without filters, for coin selection
+     * where the order doesn't matter. Only walks the unspent index.
+     */
+    void AvailableCoinsForSelection(std::vector<COutput>& vCoins, bool fOnlySafe=true, const CCoinControl *coinControl = nullptr);
+
     /**
      * Return list of available coins and locked coins grouped by non-change output address.
      */
@@ -897,9 +1022,18 @@ public:
      * Shuffle and select coins until nTargetValue is reached while avoiding
      * small change; This method is stochastic for some inputs and upon
      * completion the coin set and corresponding actual target value is
-     * assembled
+     * assembled. With coin_selection_params, a selection that needs no
+     * change output (SelectCoinsBnB) is searched for first; nTargetValue
+     * then excludes the fees, which are derived from the params.
+     */
+    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, uint64_t nMaxAncestors, std::vector<COutput> vCoins, std::set<CInputCoin>& setCoinsRet, CAmount& nValueRet,
+                            const CoinSelectionParams* coin_selection_params = nullptr, bool* bnb_used = nullptr) const;
+
+    /**
+     * Virtual size of an input spending txout once signed, or -1 if the
+     * wallet cannot produce a signature for it.
      */
-    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, uint64_t nMaxAncestors, std::vector<COutput> vCoins, std::set<CInputCoin>& setCoinsRet, CAmount& nValueRet) const;
+    int CalculateMaximumSignedInputSize(const CTxOut& txout) const;
 
     bool IsSpent(const uint256& hash, unsigned int n) const;
 
@@ -981,10 +1115,20 @@ public:
     bool LoadToWallet(const CWalletTx& wtxIn);
     void TransactionAddedToMempool(const CTransactionRef& tx) override;
     void BlockConnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex *pindex, const std::vector<CTransactionRef>& vtxConflicted) override;
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override;
     void BlockDisconnected(const std::shared_ptr<const CBlock>& pblock) override;
     bool AddToWalletIfInvolvingMe(const CTransactionRef& tx, const CBlockIndex* pIndex, int posInBlock, bool fUpdate);
     int64_t RescanFromTime(int64_t startTime, const WalletRescanReserver& reserver, bool update);
     CBlockIndex* ScanForWalletTransactions(CBlockIndex* pindexStart, CBlockIndex* pindexStop, const WalletRescanReserver& reserver, bool fUpdate = false);
+    /**
+     * Scripts a block filter must match for a block to be relevant to a
+     * rescan: the standard scripts of all keys, watched pubkeys and redeem
+     * scripts that IsMine accepts, watch-only scripts, the scripts of our
+     * loaded coins and sidechain deposit scripts we can spend. Returns false
+     * if the wallet has received outputs to scripts not in that list, such
+     * as bare multisig of our keys, in which case every block must be read.
+     */
+    bool GetRescanFilterElements(GCSFilter::ElementSet& elements);
     void TransactionRemovedFromMempool(const CTransactionRef &ptx) override;
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(int64_t nBestBlockTime, CConnman* connman) override;
@@ -1014,9 +1158,48 @@ public:
      * @note passing nChangePosInOut as -1 will result in setting a random position
      */
     bool CreateTransaction(const std::vector<CRecipient>& vecSend, CWalletTx& wtxNew, CReserveKey& reservekey, CAmount& nFeeRet, int& nChangePosInOut, std::string& strFailReason, const CCoinControl& coin_control, bool sign = true, uint32_t nVersionOverride = CTransaction::CURRENT_VERSION, uint32_t nLockTimeOverride = 0, CCriticalData criticalData = {});
+    /**
+     * Create a BMM request paying nAmount to the miner, funded by the oldest
+     * confirmed output of the BMM pool instead of running coin selection.
+     * Returns false if the pool has no usable output large enough, in which
+     * case CreateTransaction() can be used instead.
+     */
+    bool CreateBMMRequest(const CAmount& nAmount, uint32_t nLockTime, const CCriticalData& criticalData, CWalletTx& wtxNew, CReserveKey& reservekey, std::string& strFailReason);
+    /** Fund new BMM pool outputs until there are -bmmpoolsize confirmed or pending ones */
+    bool RefillBMMPool(CConnman* connman, std::string& strFailReason);
+    /** Number of outputs in the BMM pool and outputs of funding transactions waiting to confirm */
+    void GetBMMPoolSize(size_t& nAvailable, size_t& nPending) const;
+    /** Start replacing wtx for new chain tips if it is a BMM request tagged for it */
+    void TrackBMMRequest(const CWalletTx& wtx);
+    /** Our in-flight BMM request for nSidechain or nullptr */
+    const CWalletTx* GetBMMRequest(uint8_t nSidechain) const;
+    /**
+     * Create a BMM request spending the same inputs as wtxOld so that it
+     * replaces it in the mempool. Change goes back to the change output of
+     * wtxOld. If wtxOld can still be mined the new request pays the BIP 125
+     * fee bump, otherwise only its own fee.
+     */
+    bool CreateBMMReplacement(const CWalletTx& wtxOld, const CAmount& nAmount, uint32_t nLockTime, const CCriticalData& criticalData, CWalletTx& wtxNew, std::string& strFailReason);
+    /** Broadcast a replacement BMM request and erase the request it replaced */
+    bool CommitBMMReplacement(const uint256& hashOld, CWalletTx& wtxNew, CConnman* connman, CValidationState& state, bool fCommitWrites = true);
     /** Create a transaction with special format for sidechains */
     bool CreateSidechainDeposit(CTransactionRef& tx, std::string& strFail, const CScript& sidechainScriptPubKey, const uint8_t nSidechain, const CAmount& nAmount, const CAmount& nFee, const std::string& strDest);
-    bool CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey, CConnman* connman, CValidationState& state, bool fRemoveIfFail = false);
+    /**
+     * Create and broadcast a chain of sidechain deposits, one for each
+     * (destination, amount) pair and each paying nFee. The first deposit
+     * spends the mempool CTIP and every following one spends the deposit
+     * output and change of the one before it, all built under one lock so no
+     * other deposit can take the CTIP in between. If one of them is rejected,
+     * the ones already broadcast are removed from the mempool again.
+     */
+    bool CreateSidechainDeposits(std::vector<CTransactionRef>& vtx, std::string& strFail, const CScript& sidechainScriptPubKey, const uint8_t nSidechain, const std::vector<std::pair<std::string, CAmount>>& vDeposit, const CAmount& nFee);
+    /**
+     * Add a transaction to the wallet, write it to the wallet database and
+     * broadcast it. Without fCommitWrites the transaction is only accepted to
+     * the mempool: the caller commits a batch of them with
+     * CommitQueuedWrites() and then relays them itself.
+     */
+    bool CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey, CConnman* connman, CValidationState& state, bool fRemoveIfFail = false, bool fCommitWrites = true);
 
     void ListAccountCreditDebit(const std::string& strAccount, std::list<CAccountingEntry>& entries);
     bool AddAccountingEntry(const CAccountingEntry&);
@@ -1030,6 +1213,10 @@ public:
     static CFeeRate minTxFee;
     static CFeeRate fallbackFee;
     static CFeeRate m_discard_rate;
+    static unsigned int nBMMPoolSize;
+    static CAmount nBMMPoolAmount;
+    static unsigned int nBMMReplace;
+    static int64_t nCommitDelay;
 
     bool NewKeyPool();
     size_t KeypoolCountExternalKeys();
@@ -1153,6 +1340,13 @@ public:
 
     bool BackupWallet(const std::string& strDest);
 
+    /**
+     * Durability barrier for -walletcommitdelay: returns once all wallet
+     * changes made so far are committed to disk. Callers that don't hold
+     * cs_wallet share a single commit when they arrive together.
+     */
+    bool CommitQueuedWrites();
+
     /* Set the HD chain model (chain child index counters) */
     bool SetHDChain(const CHDChain& chain, bool memonly);
     const CHDChain& GetHDChain() const { return hdChain; }
@@ -49,12 +49,12 @@ bool CWalletDB::ErasePurpose(const std::string& strAddress)
 
 bool CWalletDB::WriteTx(const CWalletTx& wtx)
 {
-    return WriteIC(std::make_pair(std::string("tx"), wtx.GetHash()), wtx);
+    return WriteQueuedIC(std::make_pair(std::string("tx"), wtx.GetHash()), wtx);
 }
 
 bool CWalletDB::EraseTx(uint256 hash)
 {
-    return EraseIC(std::make_pair(std::string("tx"), hash));
+    return EraseQueuedIC(std::make_pair(std::string("tx"), hash));
 }
 
 bool CWalletDB::WriteKey(const CPubKey& vchPubKey, const CPrivKey& vchPrivKey, const CKeyMetadata& keyMeta)
@@ -116,6 +116,12 @@ bool CWalletDB::EraseWatchOnly(const CScript &dest)
 
 bool CWalletDB::WriteBestBlock(const CBlockLocator& locator)
 {
+    // The transactions of the blocks up to locator must not be lost once
+    // the locator is on disk, so commit them first. The database log is
+    // written in order, so the locator can't reach the disk before them.
+    if (!m_dbw.CommitQueue()) {
+        return false;
+    }
     WriteIC(std::string("bestblock"), CBlockLocator()); // Write empty block locator so versions that require a merkle branch automatically rescan
     return WriteIC(std::string("bestblock_nomerkle"), locator);
 }
@@ -128,7 +134,7 @@ bool CWalletDB::ReadBestBlock(CBlockLocator& locator)
 
 bool CWalletDB::WriteOrderPosNext(int64_t nOrderPosNext)
 {
-    return WriteIC(std::string("orderposnext"), nOrderPosNext);
+    return WriteQueuedIC(std::string("orderposnext"), nOrderPosNext);
 }
 
 bool CWalletDB::ReadPool(int64_t nPool, CKeyPool& keypool)
@@ -526,6 +532,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
     DBErrors result = DB_LOAD_OK;
 
     LOCK(pwallet->cs_wallet);
+    m_dbw.CommitQueue();
     try {
         int nMinVersion = 0;
         if (batch.Read((std::string)"minversion", nMinVersion))
@@ -622,6 +629,11 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
         pwallet->wtxOrdered.insert(make_pair(entry.nOrderPos, CWallet::TxPair(nullptr, &entry)));
     }
 
+    // The counter is written with the group commit while accounting entries
+    // are written immediately, so it may lag behind them after a crash.
+    if (!pwallet->wtxOrdered.empty())
+        pwallet->nOrderPosNext = std::max(pwallet->nOrderPosNext, pwallet->wtxOrdered.rbegin()->first + 1);
+
     return result;
 }
 
@@ -629,6 +641,9 @@ DBErrors CWalletDB::FindWalletTx(std::vector<uint256>& vTxHash, std::vector<CWal
 {
     DBErrors result = DB_LOAD_OK;
 
+    if (!m_dbw.CommitQueue())
+        return DB_CORRUPT;
+
     try {
         int nMinVersion = 0;
         if (batch.Read((std::string)"minversion", nMinVersion))
@@ -769,6 +784,13 @@ void MaybeCompactWalletDB()
     fOneThread = false;
 }
 
+void CommitQueuedWalletWrites()
+{
+    for (CWalletRef pwallet : vpwallets) {
+        pwallet->GetDBHandle().CommitQueue();
+    }
+}
+
 //
 // Try to (very carefully!) recover wallet file if there is a problem.
 //
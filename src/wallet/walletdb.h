@@ -138,6 +138,11 @@ public:
  * This should really be named CWalletDBBatch, as it represents a single transaction at the
  * database. It will be committed when the object goes out of scope.
  * Optionally (on by default) it will flush to disk as well.
+ *
+ * With -walletcommitdelay, transaction records and the order position
+ * counter are not written immediately but queued on the CWalletDBWrapper and
+ * committed together, see CWalletDBWrapper::CommitQueue. Everything that
+ * reads these records back commits the queue first.
  */
 class CWalletDB
 {
@@ -162,6 +167,36 @@ private:
         return true;
     }
 
+    //! Like WriteIC, but queued for the next group commit if it is enabled
+    template <typename K, typename T>
+    bool WriteQueuedIC(const K& key, const T& value)
+    {
+        if (!m_dbw.IsGroupCommit()) {
+            return WriteIC(key, value);
+        }
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey << key;
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        ssValue << value;
+        m_dbw.QueueWrite(ssKey, ssValue);
+        m_dbw.IncrementUpdateCounter();
+        return true;
+    }
+
+    //! Like EraseIC, but queued for the next group commit if it is enabled
+    template <typename K>
+    bool EraseQueuedIC(const K& key)
+    {
+        if (!m_dbw.IsGroupCommit()) {
+            return EraseIC(key);
+        }
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey << key;
+        m_dbw.QueueErase(ssKey);
+        m_dbw.IncrementUpdateCounter();
+        return true;
+    }
+
 public:
     explicit CWalletDB(CWalletDBWrapper& dbw, const char* pszMode = "r+", bool _fFlushOnClose = true) :
         batch(dbw, pszMode, _fFlushOnClose),
@@ -252,4 +287,7 @@ private:
 //! Compacts BDB state so that wallet.dat is self-contained (if there are changes)
 void MaybeCompactWalletDB();
 
+//! Commits the queued writes of all wallets, run at the end of every -walletcommitdelay window
+void CommitQueuedWalletWrites();
+
 #endif // BITCOIN_WALLET_WALLETDB_H
@@ -322,5 +322,26 @@ class RESTTest (BitcoinTestFramework):
         json_obj = json.loads(json_string)
         assert_equal(json_obj['bestblockhash'], bb_hash)
 
+        #test rest sidechain bmm over the last 5 blocks
+        height = self.nodes[0].getblockcount()
+        start_hash = self.nodes[0].getblockhash(height - 4)
+        json_string = http_get_call(url.hostname, url.port, '/rest/sidechain/bmm/10/'+start_hash+self.FORMAT_SEPARATOR+'json')
+        json_obj = json.loads(json_string)
+        assert_equal(len(json_obj), 5)
+        assert_equal(json_obj[0]['hashblock'], start_hash)
+        assert_equal(json_obj[-1]['hashblock'], bb_hash)
+        assert_equal(json_obj[-1]['height'], height)
+
+        response = http_get_call(url.hostname, url.port, '/rest/sidechain/bmm/0/'+start_hash+self.FORMAT_SEPARATOR+'json', True)
+        assert_equal(response.status, 400)
+
+        #no sidechain is active on a fresh chain
+        response = http_get_call(url.hostname, url.port, '/rest/sidechain/deposits/0'+self.FORMAT_SEPARATOR+'json', True)
+        assert_equal(response.status, 404)
+        response = http_get_call(url.hostname, url.port, '/rest/sidechain/ctip/0'+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 404)
+        response = http_get_call(url.hostname, url.port, '/rest/sidechain/wtprimestatus/256'+self.FORMAT_SEPARATOR+'json', True)
+        assert_equal(response.status, 400)
+
 if __name__ == '__main__':
     RESTTest ().main ()
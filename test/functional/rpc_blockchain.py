@@ -150,6 +150,21 @@ class BlockchainTest(BitcoinTestFramework):
         assert size < 64000
         assert_equal(len(res['bestblock']), 64)
         assert_equal(len(res['hash_serialized_2']), 64)
+        assert 'muhash' not in res
+        assert_equal(res['loaded_txouts'], 0)
+        assert_equal(res['sidechain_escrow'], [])
+
+        res_muhash = node.gettxoutsetinfo("muhash")
+        assert_equal(res_muhash['txouts'], res['txouts'])
+        assert_equal(res_muhash['total_amount'], res['total_amount'])
+        assert_equal(len(res_muhash['muhash']), 64)
+        assert 'hash_serialized_2' not in res_muhash
+
+        res_none = node.gettxoutsetinfo("none")
+        assert_equal(res_none['txouts'], res['txouts'])
+        assert 'hash_serialized_2' not in res_none
+        assert 'muhash' not in res_none
+        assert_raises_rpc_error(-8, "foo is not a valid hash_type", node.gettxoutsetinfo, "foo")
 
         self.log.info("Test that gettxoutsetinfo() works for blockchain with just the genesis block")
         b1hash = node.getblockhash(1)
@@ -163,6 +178,7 @@ class BlockchainTest(BitcoinTestFramework):
         assert_equal(res2['bogosize'], 0),
         assert_equal(res2['bestblock'], node.getblockhash(0))
         assert_equal(len(res2['hash_serialized_2']), 64)
+        assert_equal(len(node.gettxoutsetinfo("muhash")['muhash']), 64)
 
         self.log.info("Test that gettxoutsetinfo() returns the same result after invalidate/reconsider block")
         node.reconsiderblock(b1hash)
@@ -175,6 +191,7 @@ class BlockchainTest(BitcoinTestFramework):
         assert_equal(res['bogosize'], res3['bogosize'])
         assert_equal(res['bestblock'], res3['bestblock'])
         assert_equal(res['hash_serialized_2'], res3['hash_serialized_2'])
+        assert_equal(res_muhash['muhash'], node.gettxoutsetinfo("muhash")['muhash'])
 
     def _test_getblockheader(self):
         node = self.nodes[0]
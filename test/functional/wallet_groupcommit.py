@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+# Copyright (c) 2026 The DriveNet developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test wallet durability with -walletcommitdelay.
+
+Wallet transaction records are queued and written together at the end of
+every commit window. Transactions the wallet sends are written before the
+RPC returns, so they survive the node being killed. Other changes, such as
+incoming transactions, are written by syncwallet or a clean shutdown."""
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, connect_nodes_bi, sync_mempools
+
+class WalletGroupCommitTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+        # Long enough that the timer doesn't commit anything during the test
+        self.extra_args = [['-walletcommitdelay=600000'], []]
+
+    def kill_node(self, i):
+        node = self.nodes[i]
+        node.process.kill()
+        node.process.wait()
+        node.running = False
+        node.process = None
+        node.rpc_connected = False
+        node.rpc = None
+
+    def run_test(self):
+        node = self.nodes[0]
+        node.generate(101)
+        self.sync_all()
+        self.nodes[1].generate(101)
+        self.sync_all()
+
+        self.log.info("Sent transactions are kept after a crash")
+        txid = node.sendtoaddress(node.getnewaddress(), 1)
+        self.kill_node(0)
+        self.start_node(0)
+        assert_equal(node.gettransaction(txid)['txid'], txid)
+
+        self.log.info("Incoming transactions are kept after a crash once syncwallet returns")
+        connect_nodes_bi(self.nodes, 0, 1)
+        txid = self.nodes[1].sendtoaddress(node.getnewaddress(), 1)
+        sync_mempools(self.nodes)
+        assert_equal(node.syncwallet(), None)
+        self.kill_node(0)
+        self.start_node(0)
+        assert_equal(node.gettransaction(txid)['txid'], txid)
+
+        self.log.info("A clean shutdown writes the queued transactions")
+        connect_nodes_bi(self.nodes, 0, 1)
+        txid = self.nodes[1].sendtoaddress(node.getnewaddress(), 1)
+        sync_mempools(self.nodes)
+        self.restart_node(0)
+        assert_equal(node.gettransaction(txid)['txid'], txid)
+
+if __name__ == '__main__':
+    WalletGroupCommitTest().main()